@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * run a set of independent jobs on worker threads.
+ *
+ * Jobs are taken in order by the first idle worker, using an atomic
+ * counter, so long jobs don't delay short ones. The calling thread
+ * works as well, and returns once all jobs are done. Jobs must not
+ * share data, except pools and the log which are made thread-safe
+ * during the run (see pool_mt and log_mt).
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "pool.h"
+#include "batch.h"
+
+struct batch {
+	void (*func)(void *);	/* function to call */
+	void **args;		/* its argument, one per job */
+	unsigned njobs;		/* number of jobs */
+	unsigned next;		/* next job to start */
+};
+
+unsigned batch_debug = 0;
+
+/*
+ * worker main loop: run jobs until there are no more left
+ */
+void *
+batch_worker(void *arg)
+{
+	struct batch *b = arg;
+	unsigned i;
+
+	for (;;) {
+		i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+		if (i >= b->njobs)
+			break;
+		b->func(b->args[i]);
+	}
+	pool_magflush();
+	log_flush();
+	return NULL;
+}
+
+/*
+ * return the number of threads to use for the given number of jobs
+ */
+unsigned
+batch_nthreads(unsigned njobs)
+{
+	long ncpu;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		ncpu = 1;
+	if (ncpu > BATCH_MAXTHREADS)
+		ncpu = BATCH_MAXTHREADS;
+	return njobs < ncpu ? njobs : ncpu;
+}
+
+/*
+ * call func() for each of the given arguments and wait for all calls
+ * to complete
+ */
+void
+batch_run(void (*func)(void *), void **args, unsigned njobs)
+{
+	struct batch b;
+	struct timespec ts0, ts1;
+	pthread_t tids[BATCH_MAXTHREADS];
+	unsigned i, n, nthreads;
+	int err;
+
+	nthreads = batch_nthreads(njobs);
+	if (nthreads <= 1) {
+		for (i = 0; i < njobs; i++)
+			func(args[i]);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	log_flush();
+	b.func = func;
+	b.args = args;
+	b.njobs = njobs;
+	b.next = 0;
+	pool_mt = 1;
+	log_mt = 1;
+	for (n = 0; n < nthreads - 1; n++) {
+		err = pthread_create(&tids[n], NULL, batch_worker, &b);
+		if (err) {
+			log_puts("batch_run: ");
+			log_puts(strerror(err));
+			log_puts("\n");
+			break;
+		}
+	}
+	batch_worker(&b);
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+	pool_mt = 0;
+	log_mt = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	if (batch_debug) {
+		log_puts("batch_run: ");
+		log_putu(njobs);
+		log_puts(" jobs, ");
+		log_putu(n + 1);
+		log_puts(" threads, ");
+		log_putu((ts1.tv_sec - ts0.tv_sec) * 1000000 +
+		    (ts1.tv_nsec - ts0.tv_nsec) / 1000);
+		log_puts("us\n");
+	}
+}
@@ -14,6 +14,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "utils.h"
 #include "defs.h"
 #include "node.h"
@@ -33,6 +35,9 @@
 #include "builtin.h"
 #include "version.h"
 #include "undo.h"
+#include "rt.h"
+#include "pool.h"
+#include "batch.h"
 
 unsigned
 blt_info(struct exec *o, struct data **r)
@@ -89,7 +94,7 @@ blt_proclist(struct exec *o, struct data **r)
 	struct data *d, *n;
 
 	d = data_newlist(NULL);
-	PROC_FOREACH(i, o->procs) {
+	PROC_FOREACH(i, o->procs.first) {
 		if (i->code->vmt == &node_vmt_slist) {
 			n = data_newref(i->name.str);
 			data_listadd(d, n);
@@ -106,7 +111,7 @@ blt_builtinlist(struct exec *o, struct data **r)
 	struct data *d, *n;
 
 	d = data_newlist(NULL);
-	PROC_FOREACH(i, o->procs) {
+	PROC_FOREACH(i, o->procs.first) {
 		if (i->code->vmt == &node_vmt_builtin) {
 			n = data_newref(i->name.str);
 			data_listadd(d, n);
@@ -134,9 +139,9 @@ blt_panic(struct exec *o, struct data **r)
 unsigned
 blt_debug(struct exec *o, struct data **r)
 {
-	extern unsigned filt_debug, mididev_debug, mux_debug, mixout_debug,
-	    norm_debug, pool_debug, song_debug,
-	    timo_debug;
+	extern unsigned batch_debug, data_debug, filt_debug, mididev_debug, mux_debug, mixout_debug,
+	    norm_debug, pool_debug, rt_debug, song_debug,
+	    timo_debug, vm_debug;
 	char *flag;
 	long value;
 
@@ -144,7 +149,11 @@ blt_debug(struct exec *o, struct data **r)
 	    !exec_lookuplong(o, "value", &value)) {
 		return 0;
 	}
-	if (str_eq(flag, "filt")) {
+	if (str_eq(flag, "batch")) {
+		batch_debug = value;
+	} else if (str_eq(flag, "data")) {
+		data_debug = value;
+	} else if (str_eq(flag, "filt")) {
 		filt_debug = value;
 	} else if (str_eq(flag, "mididev")) {
 		mididev_debug = value;
@@ -156,10 +165,14 @@ blt_debug(struct exec *o, struct data **r)
 		norm_debug = value;
 	} else if (str_eq(flag, "pool")) {
 		pool_debug = value;
+	} else if (str_eq(flag, "rt")) {
+		rt_debug = value;
 	} else if (str_eq(flag, "song")) {
 		song_debug = value;
 	} else if (str_eq(flag, "timo")) {
 		timo_debug = value;
+	} else if (str_eq(flag, "vm")) {
+		vm_debug = value;
 	} else {
 		cons_errs(o->procname, "unknuwn debug-flag");
 		return 0;
@@ -1625,8 +1638,15 @@ unsigned
 blt_undolist(struct exec *o, struct data **r)
 {
 	struct undo *u;
+	unsigned long packed, unpacked, ratio;
 
+	packed = unpacked = 0;
 	for (u = usong->undo; u != NULL; u = u->next) {
+		if (u->type == UNDO_TRACK) {
+			packed += u->u.track.data.setlen;
+			unpacked += u->u.track.data.nset *
+			    sizeof(struct seqev_data);
+		}
 		if (u->func == NULL)
 			continue;
 		textout_putstr(tout, u->func);
@@ -1639,6 +1659,25 @@ blt_undolist(struct exec *o, struct data **r)
 		}
 		textout_putstr(tout, "\n");
 	}
+
+	/*
+	 * report memory usage, and how much packing the saved
+	 * events of tracks saved
+	 */
+	textout_putstr(tout, "# ");
+	textout_putlong(tout, usong->undo_size);
+	textout_putstr(tout, " of ");
+	textout_putlong(tout, UNDO_MAXSIZE);
+	textout_putstr(tout, " bytes used");
+	if (packed > 0) {
+		ratio = (10 * unpacked + packed / 2) / packed;
+		textout_putstr(tout, ", events packed ");
+		textout_putlong(tout, ratio / 10);
+		textout_putstr(tout, ".");
+		textout_putlong(tout, ratio % 10);
+		textout_putstr(tout, ":1");
+	}
+	textout_putstr(tout, "\n");
 	return 1;
 }
 
@@ -1715,7 +1754,7 @@ blt_tren(struct exec *o, struct data **r)
 		    "name already used by another track");
 		return 0;
 	}
-	undo_setstr(usong, o->procname, &t->name.str, name);
+	undo_rename(usong, o->procname, &usong->trklist, &t->name, name);
 	return 1;
 }
 
@@ -1773,6 +1812,156 @@ blt_taddev(struct exec *o, struct data **r)
 	return 1;
 }
 
+/*
+ * an event to insert with taddevs, 'idx' is the position in the
+ * list, so events of the same tick keep their order once sorted
+ */
+struct tevent {
+	unsigned tic, idx;
+	struct ev ev;
+};
+
+int
+tevent_cmp(const void *p1, const void *p2)
+{
+	const struct tevent *e1 = p1, *e2 = p2;
+
+	if (e1->tic != e2->tic)
+		return e1->tic < e2->tic ? -1 : 1;
+	return e1->idx < e2->idx ? -1 : (e1->idx > e2->idx);
+}
+
+/*
+ * return the events of the current selection as a list
+ * of {tick event} pairs, ticks are relative to the start of
+ * the selection
+ */
+unsigned
+blt_tgetevs(struct exec *o, struct data **r)
+{
+	struct songtrk *t;
+	struct track sel;
+	struct seqev *se;
+	struct data *e, **tail;
+	unsigned tic, len;
+
+	song_getcurtrk(usong, &t);
+	if (t == NULL) {
+		cons_errs(o->procname, "no current track");
+		return 0;
+	}
+	tic = track_findmeasure(&usong->meta, usong->curpos);
+	len = track_findmeasure(&usong->meta, usong->curpos + usong->curlen) - tic;
+	track_init(&sel);
+	track_move(&t->track, tic, len, &usong->curev, &sel, 1, 0);
+	*r = data_newlist(NULL);
+	tail = &(*r)->val.list;
+	tic = 0;
+	for (se = sel.first; se != &sel.eot; se = se->next) {
+		tic += se->delta;
+		e = data_newlist(data_newlong(tic));
+		e->val.list->next = data_newev(&se->ev);
+		*tail = e;
+		tail = &e->next;
+	}
+	track_done(&sel);
+	return 1;
+}
+
+/*
+ * put a list of {tick event} pairs on the current track, ticks are
+ * relative to the start of the selection. The list is sorted, then
+ * the events are inserted in a single pass with a single undo
+ * record, as if taddev was called for each event
+ */
+unsigned
+blt_taddevs(struct exec *o, struct data **r)
+{
+	struct songtrk *t;
+	struct seqev *se;
+	struct var *arg;
+	struct data *d, *e;
+	struct tevent *tab;
+	unsigned i, n, pos, tic, dst, delta, sorted;
+
+	song_getcurtrk(usong, &t);
+	if (t == NULL) {
+		cons_errs(o->procname, "no current track");
+		return 0;
+	}
+	if (!song_try_trk(usong, t)) {
+		return 0;
+	}
+	arg = exec_varlookup(o, "evlist");
+	if (!arg) {
+		log_puts("blt_taddevs: evlist: no such param\n");
+		return 0;
+	}
+	if (arg->data->type != DATA_LIST) {
+		cons_errs(o->procname, "list of {tick event} pairs expected");
+		return 0;
+	}
+	n = 0;
+	for (d = arg->data->val.list; d != NULL; d = d->next)
+		n++;
+	if (n == 0)
+		return 1;
+	tab = xmalloc(n * sizeof(struct tevent), "tevent");
+
+	/*
+	 * check all events first, so the track is not modified on
+	 * errors
+	 */
+	sorted = 1;
+	for (d = arg->data->val.list, i = 0; d != NULL; d = d->next, i++) {
+		e = d->type == DATA_LIST ? d->val.list : NULL;
+		if (e == NULL || e->type != DATA_LONG || e->val.num < 0 ||
+		    e->next == NULL || e->next->next != NULL) {
+			cons_errs(o->procname, "bad {tick event} pair");
+			xfree(tab);
+			return 0;
+		}
+		if (!data_getev(e->next, &tab[i].ev, 0)) {
+			xfree(tab);
+			return 0;
+		}
+		tab[i].tic = e->val.num;
+		tab[i].idx = i;
+		if (i > 0 && tab[i].tic < tab[i - 1].tic)
+			sorted = 0;
+	}
+	if (!sorted)
+		qsort(tab, n, sizeof(struct tevent), tevent_cmp);
+
+	/*
+	 * walk the track once, without a seqptr: we don't need the
+	 * states of the frames, and updating them would be slow on
+	 * tracks with many overlapping frames. As with taddev, events
+	 * are put before the events of the track at the same tick
+	 */
+	undo_track_save(usong, &t->track, o->procname, t->name.str);
+	pos = track_findmeasure(&usong->meta, usong->curpos);
+	se = t->track.first;
+	tic = delta = 0;
+	for (i = 0; i < n; i++) {
+		dst = pos + tab[i].tic;
+		while (se->ev.cmd != EV_NULL && tic + se->delta - delta < dst) {
+			tic += se->delta - delta;
+			delta = 0;
+			se = se->next;
+		}
+		if (tic + se->delta - delta < dst)
+			track_setdelta(&t->track, se, delta + dst - tic);
+		delta += dst - tic;
+		tic = dst;
+		track_evput(&t->track, se, delta, &tab[i].ev);
+		delta = 0;
+	}
+	undo_track_diff(usong);
+	xfree(tab);
+	return 1;
+}
+
 unsigned
 blt_tsetf(struct exec *o, struct data **r)
 {
@@ -1825,10 +2014,129 @@ blt_tgetf(struct exec *o, struct data **r)
 	return 1;
 }
 
+/*
+ * track transform, built by one of the track builtins and run either
+ * immediately or, within tbatch, on a worker thread once the
+ * transforms of all tracks are built
+ */
+struct tjob {
+	struct songtrk *trk;	/* track to transform */
+	struct undo *undo;	/* its undo data, if batched */
+#define TJOB_QUANTA	0
+#define TJOB_QUANTF	1
+#define TJOB_TRANSP	2
+#define TJOB_VMAP	3
+#define TJOB_EVMAP	4
+#define TJOB_CHECK	5
+#define TJOB_REWRITE	6
+	unsigned op;		/* one of above */
+	unsigned tic, len;	/* selection */
+	unsigned offset, quant;	/* quantization parameters */
+	long arg;		/* quantization rate or halftones */
+	struct evspec es;	/* selected events */
+	struct evspec from, to;	/* for evmap */
+	unsigned char map[EV_MAXCOARSE + 1];	/* velocity map */
+};
+
+struct tjob **tbatch_jobs = NULL;	/* if set, queue jobs here */
+unsigned tbatch_njobs;
+
+void
+tjob_run(struct tjob *j)
+{
+	struct track *t = &j->trk->track;
+
+	switch (j->op) {
+	case TJOB_QUANTA:
+		track_quantize(t, &j->es, j->tic, j->len,
+		    j->offset, j->quant, j->arg);
+		break;
+	case TJOB_QUANTF:
+		track_quantize_frame(t, &j->es, j->tic, j->len,
+		    j->offset, j->quant, j->arg);
+		break;
+	case TJOB_TRANSP:
+		track_transpose(t, j->tic, j->len, &j->es, j->arg);
+		break;
+	case TJOB_VMAP:
+		track_vmap(t, j->tic, j->len, &j->es, j->map);
+		break;
+	case TJOB_EVMAP:
+		track_evmap(t, j->tic, j->len, &j->es, &j->from, &j->to);
+		break;
+	case TJOB_CHECK:
+		track_check(t);
+		break;
+	case TJOB_REWRITE:
+		track_rewrite(t);
+		break;
+	}
+}
+
+/*
+ * run a batched job on a worker thread, and save undo data
+ */
+void
+tjob_batch(void *arg)
+{
+	struct tjob *j = arg;
+	struct undo *u = j->undo;
+
+	u->size = track_undosave(u->u.track.track, &u->u.track.data);
+	tjob_run(j);
+	u->size = track_undodiff(u->u.track.track, &u->u.track.data);
+}
+
+/*
+ * run the given track transform, or queue it if within tbatch
+ */
+unsigned
+tjob_do(struct exec *o, struct tjob *j)
+{
+	struct songtrk *t = j->trk;
+
+	if (tbatch_jobs) {
+		tbatch_jobs[tbatch_njobs] = xmalloc(sizeof(struct tjob), "tjob");
+		*tbatch_jobs[tbatch_njobs++] = *j;
+		return 1;
+	}
+	undo_track_save(usong, &t->track, o->procname, t->name.str);
+	tjob_run(j);
+	undo_track_diff(usong);
+	return 1;
+}
+
+/*
+ * set the job selection from the current selection
+ */
+void
+tjob_setsel(struct tjob *j, unsigned op, struct songtrk *t)
+{
+	unsigned qstep;
+
+	j->op = op;
+	j->trk = t;
+	j->es = usong->curev;
+	j->tic = track_findmeasure(&usong->meta, usong->curpos);
+	j->len = track_findmeasure(&usong->meta,
+	    usong->curpos + usong->curlen) - j->tic;
+	qstep = usong->curquant / 2;
+	if (j->tic > qstep) {
+		j->tic -= qstep;
+		j->offset = qstep;
+	} else {
+		j->offset = 0;
+		if (j->tic + j->len > qstep)
+			j->len -= qstep;
+	}
+	j->quant = 2 * qstep;
+}
+
 unsigned
 blt_tcheck(struct exec *o, struct data **r)
 {
 	struct songtrk *t;
+	struct tjob j;
 
 	song_getcurtrk(usong, &t);
 	if (t == NULL) {
@@ -1838,16 +2146,16 @@ blt_tcheck(struct exec *o, struct data **r)
 	if (!song_try_trk(usong, t)) {
 		return 0;
 	}
-	undo_track_save(usong, &t->track, o->procname, t->name.str);
-	track_check(&t->track);
-	undo_track_diff(usong);
-	return 1;
+	j.op = TJOB_CHECK;
+	j.trk = t;
+	return tjob_do(o, &j);
 }
 
 unsigned
 blt_trewrite(struct exec *o, struct data **r)
 {
 	struct songtrk *t;
+	struct tjob j;
 
 	song_getcurtrk(usong, &t);
 	if (t == NULL) {
@@ -1857,10 +2165,9 @@ blt_trewrite(struct exec *o, struct data **r)
 	if (!song_try_trk(usong, t)) {
 		return 0;
 	}
-	undo_track_save(usong, &t->track, o->procname, t->name.str);
-	track_rewrite(&t->track);
-	undo_track_diff(usong);
-	return 1;
+	j.op = TJOB_REWRITE;
+	j.trk = t;
+	return tjob_do(o, &j);
 }
 
 unsigned
@@ -1974,7 +2281,7 @@ blt_tpaste(struct exec *o, struct data **r)
 	track_init(&copy);
 	track_move(&usong->clip, tic, ~0U, &usong->curev, &copy, 1, 0);
 	if (!track_isempty(&copy)) {
-		copy.first->delta += tic2;
+		track_shift(&copy, tic2);
 		undo_track_save(usong, &t->track, o->procname, t->name.str);
 		track_merge(&t->track, &copy);
 		undo_track_diff(usong);
@@ -2026,10 +2333,10 @@ blt_tmerge(struct exec *o, struct data **r)
 		cons_errs(o->procname, "no current track");
 		return 0;
 	}
-	if (!song_try_trk(usong, dst)) {
+	if (!song_try_trk(usong, src)) {
 		return 0;
 	}
-	undo_track_save(usong, &dst->track, o->procname, dst->name.str);
+	undo_track_save(usong, &src->track, o->procname, src->name.str);
 	track_merge(&src->track, &dst->track);
 	undo_track_diff(usong);
 	return 1;
@@ -2039,7 +2346,7 @@ unsigned
 blt_tquant_common(struct exec *o, struct data **r, int all)
 {
 	struct songtrk *t;
-	unsigned tic, len, qstep, offset;
+	struct tjob j;
 	long rate;
 
 	song_getcurtrk(usong, &t);
@@ -2057,27 +2364,9 @@ blt_tquant_common(struct exec *o, struct data **r, int all)
 	if (!song_try_trk(usong, t)) {
 		return 0;
 	}
-	tic = track_findmeasure(&usong->meta, usong->curpos);
-	len = track_findmeasure(&usong->meta, usong->curpos + usong->curlen) - tic;
-	qstep = usong->curquant / 2;
-	if (tic > qstep) {
-		tic -= qstep;
-		offset = qstep;
-	} else {
-		offset = 0;
-		if (tic + len > qstep)
-			len -= qstep;
-	}
-	undo_track_save(usong, &t->track, o->procname, t->name.str);
-	if (all) {
-		track_quantize(&t->track, &usong->curev,
-		    tic, len, offset, 2 * qstep, rate);
-	} else {
-		track_quantize_frame(&t->track, &usong->curev,
-		    tic, len, offset, 2 * qstep, rate);
-	}
-	undo_track_diff(usong);
-	return 1;
+	tjob_setsel(&j, all ? TJOB_QUANTA : TJOB_QUANTF, t);
+	j.arg = rate;
+	return tjob_do(o, &j);
 }
 
 unsigned
@@ -2103,8 +2392,8 @@ unsigned
 blt_ttransp(struct exec *o, struct data **r)
 {
 	struct songtrk *t;
+	struct tjob j;
 	long halftones;
-	unsigned tic, len, qstep;
 
 	song_getcurtrk(usong, &t);
 	if (t == NULL) {
@@ -2121,25 +2410,16 @@ blt_ttransp(struct exec *o, struct data **r)
 	if (!song_try_trk(usong, t)) {
 		return 0;
 	}
-	tic = track_findmeasure(&usong->meta, usong->curpos);
-	len = track_findmeasure(&usong->meta, usong->curpos + usong->curlen) - tic;
-	qstep = usong->curquant / 2;
-	if (tic > qstep) {
-		tic -= qstep;
-	} else if (tic + len > qstep) {
-		len -= qstep;
-	}
-	undo_track_save(usong, &t->track, o->procname, t->name.str);
-	track_transpose(&t->track, tic, len, &usong->curev, halftones);
-	undo_track_diff(usong);
-	return 1;
+	tjob_setsel(&j, TJOB_TRANSP, t);
+	j.arg = halftones;
+	return tjob_do(o, &j);
 }
 
 unsigned
 blt_tvcurve(struct exec *o, struct data **r)
 {
 	struct songtrk *t;
-	unsigned tic, len, qstep;
+	struct tjob j;
 	long weight;
 
 	song_getcurtrk(usong, &t);
@@ -2156,51 +2436,184 @@ blt_tvcurve(struct exec *o, struct data **r)
 	if (!song_try_trk(usong, t)) {
 		return 0;
 	}
-	tic = track_findmeasure(&usong->meta, usong->curpos);
-	len = track_findmeasure(&usong->meta, usong->curpos + usong->curlen) - tic;
-	qstep = usong->curquant / 2;
-	if (tic > qstep) {
-		tic -= qstep;
-	} else if (tic + len > qstep) {
-		len -= qstep;
+	tjob_setsel(&j, TJOB_VMAP, t);
+	/* put weight from -63:63 to 1:127 range */
+	memcpy(j.map, vcurve_lut((64 - weight) & 0x7f), sizeof(j.map));
+	return tjob_do(o, &j);
+}
+
+unsigned
+blt_tvmap(struct exec *o, struct data **r)
+{
+	struct songtrk *t;
+	struct tjob j;
+
+	song_getcurtrk(usong, &t);
+	if (t == NULL) {
+		cons_errs(o->procname, "no current track");
+		return 0;
 	}
-	undo_track_save(usong, &t->track, o->procname, t->name.str);
-	track_vcurve(&t->track, tic, len, &usong->curev, weight);
-	undo_track_diff(usong);
-	return 1;
+	if (!exec_lookupvmap(o, "map", j.map))
+		return 0;
+	if (!song_try_trk(usong, t)) {
+		return 0;
+	}
+	tjob_setsel(&j, TJOB_VMAP, t);
+	return tjob_do(o, &j);
 }
 
 unsigned
 blt_tevmap(struct exec *o, struct data **r)
 {
 	struct songtrk *t;
-	struct evspec from, to;
-	unsigned tic, len, qstep;
+	struct tjob j;
 
 	song_getcurtrk(usong, &t);
 	if (t == NULL) {
 		cons_errs(o->procname, "no current track");
 		return 0;
 	}
-	if (!exec_lookupevspec(o, "from", &from, 0) ||
-	    !exec_lookupevspec(o, "to", &to, 0)) {
+	if (!exec_lookupevspec(o, "from", &j.from, 0) ||
+	    !exec_lookupevspec(o, "to", &j.to, 0)) {
 		return 0;
 	}
 	if (!song_try_trk(usong, t)) {
 		return 0;
 	}
-	tic = track_findmeasure(&usong->meta, usong->curpos);
-	len = track_findmeasure(&usong->meta, usong->curpos + usong->curlen) - tic;
-	qstep = usong->curquant / 2;
-	if (tic > qstep) {
-		tic -= qstep;
-	} else if (tic + len > qstep) {
-		len -= qstep;
+	tjob_setsel(&j, TJOB_EVMAP, t);
+	return tjob_do(o, &j);
+}
+
+unsigned
+blt_tbatch(struct exec *o, struct data **r)
+{
+	unsigned (*func)(struct exec *, struct data **);
+	unsigned (**f)(struct exec *, struct data **);
+	unsigned (*funcs[])(struct exec *, struct data **) = {
+		blt_tquanta, blt_tquantf, blt_ttransp, blt_tvcurve,
+		blt_tvmap, blt_tevmap, blt_tcheck, blt_trewrite, NULL
+	};
+	struct songtrk *t, *curtrk, **trks;
+	struct data *list, *a, *d, *res;
+	struct namelist locals, *oldlocals;
+	struct name *argn;
+	struct tjob **jobs;
+	struct proc *p;
+	struct var *arg;
+	char *name, *procname_save;
+	unsigned i, k, n, ok;
+
+	if (!exec_lookuplist(o, "tracklist", &list) ||
+	    !exec_lookupname(o, "func", &name)) {
+		return 0;
 	}
-	undo_track_save(usong, &t->track, o->procname, t->name.str);
-	track_evmap(&t->track, tic, len, &usong->curev, &from, &to);
-	undo_track_diff(usong);
-	return 1;
+	arg = exec_varlookup(o, "...");
+	if (!arg) {
+		log_puts("blt_tbatch: no variable argument list\n");
+		return 0;
+	}
+	p = exec_proclookup(o, name);
+	func = NULL;
+	if (p != NULL && p->code->vmt == &node_vmt_builtin) {
+		for (f = funcs; *f != NULL; f++) {
+			if (*f == (unsigned (*)(struct exec *, struct data **))
+			    p->code->data->val.user)
+				func = *f;
+		}
+	}
+	if (func == NULL) {
+		cons_errs(name, "not a track transform");
+		return 0;
+	}
+
+	n = 0;
+	for (d = list; d != NULL; d = d->next)
+		n++;
+	if (n == 0)
+		return 1;
+	trks = xmalloc(n * sizeof(struct songtrk *), "tbatch");
+	for (d = list, i = 0; d != NULL; d = d->next, i++) {
+		if (d->type != DATA_REF ||
+		    (t = song_trklookup(usong, d->val.ref)) == NULL) {
+			cons_errs(o->procname, "bad track name");
+			xfree(trks);
+			return 0;
+		}
+		for (k = 0; k < i; k++) {
+			if (trks[k] == t) {
+				cons_errs(t->name.str, "track used twice");
+				xfree(trks);
+				return 0;
+			}
+		}
+		trks[i] = t;
+	}
+
+	/*
+	 * call the builtin on each track with tbatch_jobs set, so it
+	 * only checks arguments and queues the transform
+	 */
+	jobs = xmalloc(n * sizeof(struct tjob *), "tbatch");
+	tbatch_jobs = jobs;
+	tbatch_njobs = 0;
+	curtrk = usong->curtrk;
+	ok = 1;
+	for (i = 0; i < n; i++) {
+		usong->curtrk = trks[i];
+		namelist_init(&locals, 0);
+		a = arg->data->val.list;
+		for (argn = p->args; argn != NULL; argn = argn->next) {
+			if (a == NULL)
+				break;
+			d = data_newnil();
+			data_assign(d, a);
+			var_new(&locals, argn->str, d);
+			a = a->next;
+		}
+		if (argn != NULL || a != NULL) {
+			cons_errs(name, "bad number of arguments");
+			var_empty(&locals);
+			ok = 0;
+			break;
+		}
+		oldlocals = o->locals;
+		o->locals = &locals;
+		procname_save = o->procname;
+		o->procname = p->name.str;
+		res = NULL;
+		ok = func(o, &res);
+		o->locals = oldlocals;
+		o->procname = procname_save;
+		if (res)
+			data_delete(res);
+		var_empty(&locals);
+		if (!ok)
+			break;
+	}
+	usong->curtrk = curtrk;
+	tbatch_jobs = NULL;
+
+	/*
+	 * run all jobs in parallel. Undo entries are pushed in track
+	 * order, only the first one has a name, so they are all
+	 * undone at once
+	 */
+	if (ok) {
+		for (i = 0; i < tbatch_njobs; i++) {
+			t = jobs[i]->trk;
+			jobs[i]->undo = undo_new(usong, UNDO_TRACK,
+			    i == 0 ? o->procname : NULL, t->name.str);
+			jobs[i]->undo->u.track.track = &t->track;
+		}
+		batch_run(tjob_batch, (void **)jobs, tbatch_njobs);
+		for (i = 0; i < tbatch_njobs; i++)
+			undo_push(usong, jobs[i]->undo);
+	}
+	for (i = 0; i < tbatch_njobs; i++)
+		xfree(jobs[i]);
+	xfree(jobs);
+	xfree(trks);
+	return ok;
 }
 
 unsigned
@@ -2580,9 +2993,11 @@ blt_cren(struct exec *o, struct data **r, int input)
 		cons_errss(o->procname, name, "filt name already in use");
 		return 0;
 	}
-	undo_setstr(usong, o->procname, &c->name.str, name);
-	if (c->filt)
-		undo_setstr(usong, NULL, &c->filt->name.str, name);
+	undo_rename(usong, o->procname, &usong->chanlist, &c->name, name);
+	if (c->filt) {
+		undo_rename(usong, NULL,
+		    &usong->filtlist, &c->filt->name, name);
+	}
 	return 1;
 }
 
@@ -2894,7 +3309,7 @@ blt_fren(struct exec *o, struct data **r)
 			return 0;
 		}
 	}
-	undo_setstr(usong, o->procname, &f->name.str, name);
+	undo_rename(usong, o->procname, &usong->filtlist, &f->name, name);
 	return 1;
 }
 
@@ -3052,6 +3467,33 @@ blt_fvcurve(struct exec *o, struct data **r)
 	return 1;
 }
 
+unsigned
+blt_fvmap(struct exec *o, struct data **r)
+{
+	struct songfilt *f;
+	struct evspec es;
+	unsigned char map[EV_MAXCOARSE + 1];
+
+	song_getcurfilt(usong, &f);
+	if (f == NULL) {
+		cons_errs(o->procname, "no current filt");
+		return 0;
+	}
+	if (!exec_lookupevspec(o, "evspec", &es, 0) ||
+	    !exec_lookupvmap(o, "map", map)) {
+		return 0;
+	}
+	if (es.cmd != EVSPEC_ANY && es.cmd != EVSPEC_NOTE) {
+		cons_errs(o->procname, "set must contain notes");
+		return 0;
+	}
+	if (mux_isopen)
+		norm_shut();
+	undo_filt_save(usong, &f->filt, o->procname, f->name.str);
+	filt_vmap(&f->filt, &es, map);
+	return 1;
+}
+
 unsigned
 blt_fchgxxx(struct exec *o, struct data **r, int input, int swap)
 {
@@ -3193,7 +3635,7 @@ blt_xren(struct exec *o, struct data **r)
 	if (!song_try_sx(usong, c)) {
 		return 0;
 	}
-	undo_setstr(usong, o->procname, &c->name.str, name);
+	undo_rename(usong, o->procname, &usong->sxlist, &c->name, name);
 	return 1;
 }
 
@@ -3732,6 +4174,29 @@ blt_dinfo(struct exec *o, struct data **r)
 	textout_putlong(tout, mididev_byunit[unit]->ticrate);
 	textout_putstr(tout, "\n");
 
+	textout_putstr(tout, "flush ");
+	if (dev->oflush == MIDIDEV_FLUSH_MSG) {
+		textout_putstr(tout, "msg");
+	} else if (dev->oflush == MIDIDEV_FLUSH_TICK) {
+		textout_putstr(tout, "tick");
+	} else {
+		textout_putstr(tout, "{");
+		textout_putlong(tout, dev->oflush_bytes);
+		textout_putstr(tout, " ");
+		textout_putlong(tout, dev->oflush_usec);
+		textout_putstr(tout, "}");
+	}
+	textout_putstr(tout, "\n");
+
+	textout_putstr(tout, "writes ");
+	textout_putlong(tout, dev->onwrites);
+	textout_putstr(tout, "\t\t# ");
+	textout_putlong(tout, dev->onbytes);
+	textout_putstr(tout, " bytes, ");
+	textout_putlong(tout, dev->onwrites > 0 ?
+	    dev->onbytes / dev->onwrites : 0);
+	textout_putstr(tout, " per write\n");
+
 	textout_shiftleft(tout);
 	textout_putstr(tout, "}\n");
 	return 1;
@@ -3836,3 +4301,208 @@ blt_doev(struct exec *o, struct data **r)
 	mididev_byunit[unit]->oevset = flags;
 	return 1;
 }
+
+unsigned
+blt_dflush(struct exec *o, struct data **r)
+{
+	struct data *d;
+	long unit;
+	unsigned mode, bytes, usec;
+
+	if (!song_try_mode(usong, 0)) {
+		return 0;
+	}
+	if (!exec_lookuplong(o, "devnum", &unit)) {
+		return 0;
+	}
+	if (unit < 0 || unit >= DEFAULT_MAXNDEVS || !mididev_byunit[unit]) {
+		cons_errs(o->procname, "bad device number");
+		return 0;
+	}
+	d = exec_varlookup(o, "policy")->data;
+	bytes = MIDIDEV_BUFLEN;
+	usec = 0;
+	if (d->type == DATA_REF && str_eq(d->val.ref, "msg")) {
+		mode = MIDIDEV_FLUSH_MSG;
+	} else if (d->type == DATA_REF && str_eq(d->val.ref, "tick")) {
+		mode = MIDIDEV_FLUSH_TICK;
+	} else if (d->type == DATA_LIST &&
+	    d->val.list != NULL && d->val.list->type == DATA_LONG &&
+	    d->val.list->next != NULL &&
+	    d->val.list->next->type == DATA_LONG &&
+	    d->val.list->next->next == NULL) {
+		d = d->val.list;
+		if (d->val.num < 1 || d->val.num > MIDIDEV_BUFLEN) {
+			cons_errs(o->procname, "bytes limit out of range");
+			return 0;
+		}
+		if (d->next->val.num < 0 ||
+		    d->next->val.num > MIDIDEV_FLUSH_MAXUSEC) {
+			cons_errs(o->procname, "usec limit out of range");
+			return 0;
+		}
+		mode = MIDIDEV_FLUSH_BUF;
+		bytes = d->val.num;
+		usec = d->next->val.num;
+	} else {
+		cons_errs(o->procname,
+		    "policy must be 'msg', 'tick' or {bytes usec}");
+		return 0;
+	}
+	mididev_setflush(mididev_byunit[unit], mode, bytes, usec);
+	return 1;
+}
+
+unsigned
+blt_timer(struct exec *o, struct data **r)
+{
+	char *mstr;
+	unsigned mode;
+
+	if (!song_try_mode(usong, 0)) {
+		return 0;
+	}
+	if (!exec_lookupname(o, "mode", &mstr)) {
+		return 0;
+	}
+	if (str_eq(mstr, "deadline")) {
+		mode = MUX_TIMER_DEADLINE;
+	} else if (str_eq(mstr, "itimer")) {
+		mode = MUX_TIMER_ITIMER;
+	} else {
+		cons_errs(o->procname,
+		    "mode must be 'deadline' or 'itimer'");
+		return 0;
+	}
+	mux_timermode = mode;
+	return 1;
+}
+
+unsigned
+blt_timerinfo(struct exec *o, struct data **r)
+{
+	struct rtstat rtst;
+	unsigned long msec;
+
+	textout_putstr(tout, "{\n");
+	textout_shiftright(tout);
+
+	textout_putstr(tout, "mode ");
+	textout_putstr(tout, mux_stat.mode == MUX_TIMER_DEADLINE ?
+	    "deadline" : "itimer");
+	textout_putstr(tout, "\n");
+
+	msec = mux_stat.elapsed / 1000000;
+	textout_putstr(tout, "elapsed ");
+	textout_putlong(tout, msec);
+	textout_putstr(tout, "\t\t# milliseconds\n");
+
+	textout_putstr(tout, "wakeups ");
+	textout_putlong(tout, mux_stat.nwakeups);
+	textout_putstr(tout, "\t\t# ");
+	textout_putlong(tout, msec > 0 ? 1000ULL * mux_stat.nwakeups / msec : 0);
+	textout_putstr(tout, " per second\n");
+
+	textout_putstr(tout, "timeouts ");
+	textout_putlong(tout, timo_nfired);
+	textout_putstr(tout, "\t\t# fired, including active sensing\n");
+
+	textout_putstr(tout, "deadlines ");
+	textout_putlong(tout, mux_stat.ndeadlines);
+	textout_putstr(tout, "\n");
+
+	textout_putstr(tout, "jitter ");
+	textout_putlong(tout, mux_stat.ndeadlines > 0 ?
+	    mux_stat.jitter_sum / mux_stat.ndeadlines / 1000 : 0);
+	textout_putstr(tout, " ");
+	textout_putlong(tout, mux_stat.jitter_max / 1000);
+	textout_putstr(tout, "\t\t# average and max, in microseconds\n");
+
+	textout_putstr(tout, "lookahead ");
+	textout_putlong(tout, mux_lookahead);
+	textout_putstr(tout, "\t\t# milliseconds, when playing\n");
+
+	rt_getstat(&rtst);
+	if (rtst.nmsg > 0 || rt_running) {
+		textout_putstr(tout, "rtout ");
+		textout_putlong(tout, rtst.nmsg);
+		textout_putstr(tout, rtst.fifo ?
+		    "\t\t# messages, SCHED_FIFO\n" :
+		    "\t\t# messages, normal priority\n");
+
+		textout_putstr(tout, "rtjitter ");
+		textout_putlong(tout, rtst.nmsg > 0 ?
+		    rtst.late_sum / rtst.nmsg / 1000 : 0);
+		textout_putstr(tout, " ");
+		textout_putlong(tout, rtst.late_max / 1000);
+		textout_putstr(tout, "\t\t# average and max, in microseconds\n");
+	}
+
+	textout_shiftleft(tout);
+	textout_putstr(tout, "}\n");
+	return 1;
+}
+
+unsigned
+blt_poolinfo(struct exec *o, struct data **r)
+{
+	struct pool *p;
+
+	textout_putstr(tout, "{\n");
+	textout_shiftright(tout);
+	for (p = pool_list; p != NULL; p = p->next) {
+		textout_putstr(tout, p->name);
+		textout_putstr(tout, " ");
+		textout_putlong(tout, p->used);
+		textout_putstr(tout, " ");
+		textout_putlong(tout, p->maxused);
+		textout_putstr(tout, " ");
+		textout_putlong(tout,
+		    (1023 + p->nslab * p->slabnum * p->itemsize) / 1024);
+		textout_putstr(tout, "\t\t# used, max used, kB\n");
+	}
+	textout_shiftleft(tout);
+	textout_putstr(tout, "}\n");
+	return 1;
+}
+
+unsigned
+blt_rtout(struct exec *o, struct data **r)
+{
+	char *mstr;
+
+	if (!song_try_mode(usong, 0)) {
+		return 0;
+	}
+	if (!exec_lookupname(o, "onoff", &mstr)) {
+		return 0;
+	}
+	if (str_eq(mstr, "on")) {
+		rt_enabled = 1;
+	} else if (str_eq(mstr, "off")) {
+		rt_enabled = 0;
+	} else {
+		cons_errs(o->procname, "mode must be 'on' or 'off'");
+		return 0;
+	}
+	return 1;
+}
+
+unsigned
+blt_lookahead(struct exec *o, struct data **r)
+{
+	long msec;
+
+	if (!song_try_mode(usong, 0)) {
+		return 0;
+	}
+	if (!exec_lookuplong(o, "msec", &msec)) {
+		return 0;
+	}
+	if (msec < 0 || msec > LOOKAHEAD_MAX) {
+		cons_errs(o->procname, "look-ahead out of range");
+		return 0;
+	}
+	mux_lookahead = msec;
+	return 1;
+}
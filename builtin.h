@@ -96,6 +96,8 @@ unsigned blt_tdel(struct exec *, struct data **);
 unsigned blt_tren(struct exec *, struct data **);
 unsigned blt_texists(struct exec *, struct data **);
 unsigned blt_taddev(struct exec *, struct data **);
+unsigned blt_tgetevs(struct exec *, struct data **);
+unsigned blt_taddevs(struct exec *, struct data **);
 unsigned blt_tsetf(struct exec *, struct data **);
 unsigned blt_tgetf(struct exec *, struct data **);
 unsigned blt_tcheck(struct exec *, struct data **);
@@ -111,7 +113,9 @@ unsigned blt_tquanta(struct exec *, struct data **);
 unsigned blt_tquantf(struct exec *, struct data **);
 unsigned blt_ttransp(struct exec *, struct data **);
 unsigned blt_tvcurve(struct exec *, struct data **);
+unsigned blt_tvmap(struct exec *, struct data **);
 unsigned blt_tevmap(struct exec *, struct data **);
+unsigned blt_tbatch(struct exec *, struct data **);
 unsigned blt_tclist(struct exec *, struct data **);
 unsigned blt_tinfo(struct exec *, struct data **);
 unsigned blt_tdump(struct exec *, struct data **);
@@ -151,6 +155,7 @@ unsigned blt_fmap(struct exec *, struct data **);
 unsigned blt_funmap(struct exec *, struct data **);
 unsigned blt_ftransp(struct exec *, struct data **);
 unsigned blt_fvcurve(struct exec *, struct data **);
+unsigned blt_fvmap(struct exec *, struct data **);
 unsigned blt_fchgin(struct exec *, struct data **);
 unsigned blt_fchgout(struct exec *, struct data **);
 unsigned blt_fswapin(struct exec *, struct data **);
@@ -181,5 +186,11 @@ unsigned blt_dixctl(struct exec *, struct data **);
 unsigned blt_doxctl(struct exec *, struct data **);
 unsigned blt_diev(struct exec *, struct data **);
 unsigned blt_doev(struct exec *, struct data **);
+unsigned blt_dflush(struct exec *, struct data **);
+unsigned blt_timer(struct exec *, struct data **);
+unsigned blt_timerinfo(struct exec *, struct data **);
+unsigned blt_poolinfo(struct exec *, struct data **);
+unsigned blt_rtout(struct exec *, struct data **);
+unsigned blt_lookahead(struct exec *, struct data **);
 
 #endif /* MIDISH_BUILTIN_H */
@@ -49,6 +49,11 @@ struct data {
 	struct data *next;
 };
 
+extern unsigned data_debug;
+extern unsigned long data_nnew;
+
+void	     data_pool_init(unsigned);
+void	     data_pool_done(void);
 struct data *data_newnil(void);
 struct data *data_newlong(long);
 struct data *data_newstring(char *);
@@ -57,6 +62,7 @@ struct data *data_newlist(struct data *);
 struct data *data_newuser(void *);
 struct data *data_newrange(unsigned, unsigned);
 void	     data_delete(struct data *);
+void	     data_clear(struct data *);
 void	     data_setfield(struct data *, char *);
 void	     data_log(struct data *);
 void	     data_listadd(struct data *, struct data *);
@@ -56,6 +56,11 @@
 #define TIMESIG_BEATS_MAX	100
 #define TPU_MAX			(96 * 40)
 
+/*
+ * maximum output look-ahead, in milliseconds
+ */
+#define LOOKAHEAD_MAX		1000
+
 /*
  * maximum number of midi devices supported by midish
  */
@@ -67,30 +72,15 @@
 #define DEFAULT_MAXNCHANS	(DEFAULT_MAXNDEVS * 16)
 
 /*
- * maximum number of events
- */
-#define DEFAULT_MAXNSEQEVS	400000
-
-/*
- * maximum number of tracks
- */
-#define DEFAULT_MAXNSEQPTRS	200
-
-/*
- * maximum number of filter states (roughly maximum number of
- * simultaneous notes
+ * number of entries allocated at once by pools, they grow by this
+ * amount as needed (see pool.c)
  */
-#define DEFAULT_MAXNSTATES	10000
-
-/*
- * maximum number of system exclusive messages
- */
-#define DEFAULT_MAXNSYSEXS	2000
-
-/*
- * maximum number of chunks (each sysex is a set of chunks)
- */
-#define DEFAULT_MAXNCHUNKS	(DEFAULT_MAXNSYSEXS * 2)
+#define DEFAULT_NSEQEVS		4096	/* events */
+#define DEFAULT_NSEQPTRS	64	/* track pointers */
+#define DEFAULT_NSTATES		1024	/* filter and track states */
+#define DEFAULT_NSYSEXS		64	/* system exclusive messages */
+#define DEFAULT_NCHUNKS		64	/* sysex chunks of 256 bytes */
+#define DEFAULT_NDATAS		1024	/* interpreter values */
 
 /*
  * default number of tics per beat
@@ -159,6 +149,11 @@
  */
 #define UNDO_MAXSIZE		(4 * 1024 * 1024)
 
+/*
+ * min number of logged track changes worth compacting
+ */
+#define UNDO_MINCOMPACT		256
+
 /*
  * output source prioriries
  */
@@ -162,7 +162,8 @@ ev_str2cmd(struct ev *ev, char *str)
 	unsigned i;
 
 	for (i = 0; i < EV_NUMCMD; i++) {
-		if (evinfo[i].ev && str_eq(evinfo[i].ev, str)) {
+		if (evinfo[i].ev && evinfo[i].ev[0] == str[0] &&
+		    str_eq(evinfo[i].ev, str)) {
 			ev->cmd = i;
 			return 1;
 		}
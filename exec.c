@@ -33,6 +33,7 @@
 #include "exec.h"
 #include "data.h"
 #include "node.h"
+#include "vm.h"
 
 #include "cons.h"	/* for cons_errxxx */
 
@@ -43,13 +44,13 @@
  * and insert it on the given variable list
  */
 struct var *
-var_new(struct name **list, char *name, struct data *data)
+var_new(struct namelist *list, char *name, struct data *data)
 {
 	struct var *o;
 	o = (struct var *)xmalloc(sizeof(struct var), "var");
 	o->data = data;
 	name_init(&o->name, name);
-	name_insert(list, (struct name *)o);
+	namelist_insert(list, (struct name *)o);
 	return o;
 }
 
@@ -57,9 +58,9 @@ var_new(struct name **list, char *name, struct data *data)
  * delete the given variable from the given list
  */
 void
-var_delete(struct name **list, struct var *o)
+var_delete(struct namelist *list, struct var *o)
 {
-	name_remove(list, (struct name *)o);
+	namelist_remove(list, (struct name *)o);
 	if (o->data != NULL) {
 		data_delete(o->data);
 	}
@@ -85,10 +86,10 @@ var_log(struct var *o)
  * delete all variables and clear the given list
  */
 void
-var_empty(struct name **list)
+var_empty(struct namelist *list)
 {
-	while (*list != NULL) {
-		var_delete(list, (struct var *)*list);
+	while (list->first != NULL) {
+		var_delete(list, (struct var *)list->first);
 	}
 }
 
@@ -103,6 +104,8 @@ proc_new(char *name)
 	name_init(&o->name, name);
 	o->args = NULL;
 	o->code = NULL;
+	o->vm = NULL;
+	o->novm = 0;
 	return o;
 }
 
@@ -112,6 +115,8 @@ proc_new(char *name)
 void
 proc_delete(struct proc *o)
 {
+	if (o->vm)
+		vm_release(o->vm);
 	node_delete(o->code);
 	name_empty(&o->args);
 	name_done(&o->name);
@@ -122,15 +127,14 @@ proc_delete(struct proc *o)
  * free all procedures and clear the given list
  */
 void
-proc_empty(struct name **first)
+proc_empty(struct namelist *list)
 {
 	struct name *i;
-	while (*first) {
-		i = *first;
-		name_remove(first, i);
+	while (list->first) {
+		i = list->first;
+		namelist_remove(list, i);
 		proc_delete((struct proc *)i);
 	}
-	*first = NULL;
 }
 
 /*
@@ -167,12 +171,13 @@ exec_new(void)
 {
 	struct exec *o;
 	o = (struct exec *)xmalloc(sizeof(struct exec), "exec");
-	o->procs = NULL;
-	o->globals = NULL;
+	namelist_init(&o->procs, 1);
+	namelist_init(&o->globals, 1);
 	o->locals = &o->globals;
 	o->procname = "top-level";
 	o->depth = 0;
 	o->result = RESULT_OK;
+	o->gen = 0;
 	return o;
 }
 
@@ -189,6 +194,8 @@ exec_delete(struct exec *o)
 	}
 	var_empty(&o->globals);
 	proc_empty(&o->procs);
+	namelist_done(&o->globals);
+	namelist_done(&o->procs);
 	xfree(o);
 }
 
@@ -203,12 +210,12 @@ exec_varlookup(struct exec *o, char *name)
 {
 	struct name *var;
 
-	var = name_lookup(o->locals, name);
+	var = namelist_lookup(o->locals, name);
 	if (var != NULL) {
 		return (struct var *)var;
 	}
 	if (o->locals != &o->globals) {
-		var = name_lookup(&o->globals, name);
+		var = namelist_lookup(&o->globals, name);
 		if (var != NULL) {
 			return (struct var *)var;
 		}
@@ -222,7 +229,7 @@ exec_varlookup(struct exec *o, char *name)
 struct proc *
 exec_proclookup(struct exec *o, char *name)
 {
-	return (struct proc *)name_lookup(&o->procs, name);
+	return (struct proc *)namelist_lookup(&o->procs, name);
 }
 
 /*
@@ -236,7 +243,8 @@ exec_newbuiltin(struct exec *o, char *name,
 	newp = proc_new(name);
 	newp->args = args;
 	newp->code = node_new(&node_vmt_builtin, data_newuser((void *)func));
-	name_add(&o->procs, (struct name *)newp);
+	namelist_add(&o->procs, (struct name *)newp);
+	o->gen++;
 }
 
 /*
@@ -260,7 +268,7 @@ exec_dumpprocs(struct exec *o)
 	struct proc *p;
 	struct name *n;
 
-	PROC_FOREACH(p, o->procs) {
+	PROC_FOREACH(p, o->procs.first) {
 		log_puts(p->name.str);
 		log_puts("(");
 		for (n = p->args; n != NULL; n = n->next) {
@@ -283,7 +291,7 @@ void
 exec_dumpvars(struct exec *o)
 {
 	struct var *v;
-	VAR_FOREACH(v, o->globals) {
+	VAR_FOREACH(v, o->globals.first) {
 		log_puts(v->name.str);
 		log_puts(" = ");
 		data_log(v->data);
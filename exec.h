@@ -30,6 +30,7 @@ struct proc;
 struct node;
 struct tree;
 struct exec;
+struct vmcode;
 
 /*
  * a variable is a (identifier, value) pair
@@ -53,6 +54,8 @@ struct proc {
 	struct name name;
 	struct name *args;
 	struct node *code;
+	struct vmcode *vm;	/* compiled code, see vm.c */
+	unsigned novm;		/* failed to compile, interpreted */
 };
 
 #define PROC_FOREACH(i,list)			\
@@ -65,19 +68,20 @@ struct proc {
  */
 
 struct exec {
-	struct name *globals;	/* list of global variables */
-	struct name **locals;	/* pointer to list of local variables */
-	struct name *procs;	/* list of user and built-in procs */
+	struct namelist globals; /* list of global variables */
+	struct namelist *locals; /* pointer to list of local variables */
+	struct namelist procs;	/* list of user and built-in procs */
 	char *procname;		/* current proc name, for err messages */
 #define EXEC_MAXDEPTH	40
 	unsigned depth;		/* max depth of nested proc calls */
 	unsigned result;	/* result of last operation */
+	unsigned gen;		/* incremented when procs change */
 };
 
-struct var *var_new(struct name **, char *, struct data *);
-void        var_delete(struct name **, struct var *);
+struct var *var_new(struct namelist *, char *, struct data *);
+void        var_delete(struct namelist *, struct var *);
 void	    var_log(struct var *);
-void	    var_empty(struct name **);
+void	    var_empty(struct namelist *);
 
 struct exec *exec_new(void);
 void	     exec_delete(struct exec *);
@@ -96,7 +100,7 @@ unsigned exec_lookupbool(struct exec *, char *, long *);
 
 struct proc *proc_new(char *);
 void 	     proc_delete(struct proc *);
-void	     proc_empty(struct name **);
+void	     proc_empty(struct namelist *);
 void 	     proc_log(struct proc *);
 
 #endif /* MIDISH_EXEC_H */
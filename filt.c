@@ -20,8 +20,16 @@
  * a simple midi filter. Rewrites input events according a set
  * of user-configurable rules.
  *
+ * Rules are stored as lists of sources, each with a list of
+ * destinations; the first source matching the input event is used.
+ * Scanning the lists for each event is slow with many rules, so for
+ * voice events the sources that may match events of a given dev,
+ * ch and cmd are "compiled" into a per-device table. Entries are
+ * computed on first use and are invalidated by incrementing the
+ * 'gen' counter of the filter whenever rules change.
  */
 
+#include <string.h>
 #include "utils.h"
 #include "ev.h"
 #include "filt.h"
@@ -31,6 +39,13 @@
 
 unsigned filt_debug = 0;
 
+/*
+ * velocity maps of vcurve() for each weight, computed on first use
+ */
+unsigned char vcurve_tab[EV_MAXCOARSE + 1][EV_MAXCOARSE + 1];
+unsigned char vcurve_valid[EV_MAXCOARSE + 1];
+struct vmaptab *vmap_list;
+
 void
 rule_log(struct evspec *from, struct  evspec *to)
 {
@@ -161,9 +176,14 @@ filtnode_mkdst(struct filtnode *s, struct evspec *to)
 void
 filt_init(struct filt *o)
 {
+	unsigned i;
+
 	o->map = NULL;
 	o->vcurve = NULL;
 	o->transp = NULL;
+	o->gen = 1;
+	for (i = 0; i < DEFAULT_MAXNDEVS; i++)
+		o->comp[i] = NULL;
 }
 
 /*
@@ -172,6 +192,15 @@ filt_init(struct filt *o)
 void
 filt_reset(struct filt *o)
 {
+	unsigned i;
+
+	for (i = 0; i < DEFAULT_MAXNDEVS; i++) {
+		if (o->comp[i]) {
+			xfree(o->comp[i]);
+			o->comp[i] = NULL;
+		}
+	}
+	o->gen++;
 	while (o->map)
 		filtnode_del(&o->map);
 	while (o->transp)
@@ -213,12 +242,73 @@ vcurve(unsigned nweight, unsigned x)
 	}
 }
 
+/*
+ * return the table mapping each velocity to the velocity adjusted by
+ * the curve with the given weight (same range as for vcurve())
+ */
+unsigned char *
+vcurve_lut(unsigned nweight)
+{
+	unsigned char *lut = vcurve_tab[nweight];
+	unsigned x;
+
+	if (!vcurve_valid[nweight]) {
+		for (x = 0; x <= EV_MAXCOARSE; x++)
+			lut[x] = vcurve(nweight, x);
+		vcurve_valid[nweight] = 1;
+	}
+	return lut;
+}
+
+/*
+ * return a shared table with the same contents as the given
+ * velocity map, create it if there's none
+ */
+unsigned char *
+vmap_lut(unsigned char *map)
+{
+	struct vmaptab *t;
+
+	for (t = vmap_list; t != NULL; t = t->next) {
+		if (memcmp(t->map, map, EV_MAXCOARSE + 1) == 0)
+			return t->map;
+	}
+	t = xmalloc(sizeof(struct vmaptab), "vmaptab");
+	memcpy(t->map, map, EV_MAXCOARSE + 1);
+	t->next = vmap_list;
+	vmap_list = t;
+	return t->map;
+}
+
+/*
+ * apply vcurve and transp rules to the given note event
+ */
+void
+filt_notescan(struct filt *o, struct ev *ev)
+{
+	struct filtnode *d;
+
+	for (d = o->vcurve; d != NULL; d = d->next) {
+		if (!evspec_matchev(&d->es, ev))
+			continue;
+		ev->note_vel = d->u.vel.map[ev->note_vel];
+		break;
+	}
+	for (d = o->transp; d != NULL; d = d->next) {
+		if (!evspec_matchev(&d->es, ev))
+			continue;
+		ev->note_num += d->u.transp.plus;
+		ev->note_num &= 0x7f;
+		break;
+	}
+}
+
 /*
  * match event against all sources and for each source
  * generate output events
  */
 unsigned
-filt_do(struct filt *o, struct ev *in, struct ev *out)
+filt_scan(struct filt *o, struct ev *in, struct ev *out)
 {
 	struct ev *ev;
 	struct filtnode *s;
@@ -255,21 +345,194 @@ filt_do(struct filt *o, struct ev *in, struct ev *out)
 	}
 	if (!EV_ISNOTE(in))
 		return nev;
-	for (i = 0, ev = out; i < nev; i++, ev++) {
-		for (d = o->vcurve; d != NULL; d = d->next) {
-			if (!evspec_matchev(&d->es, ev))
-				continue;
-			ev->note_vel = vcurve(d->u.vel.nweight, ev->note_vel);
+	for (i = 0, ev = out; i < nev; i++, ev++)
+		filt_notescan(o, ev);
+	return nev;
+}
+
+/*
+ * return 1 if the given spec matches some events with the cmd, dev
+ * and ch of the given event, ie if it matches the event for some
+ * values of v0 and v1
+ */
+unsigned
+filt_chanmatch(struct evspec *es, struct ev *ev)
+{
+	if (es->cmd == EVSPEC_EMPTY)
+		return 0;
+	if (es->cmd == EVSPEC_NOTE) {
+		if (!EV_ISNOTE(ev))
+			return 0;
+	} else if (es->cmd != EVSPEC_ANY && es->cmd != ev->cmd)
+		return 0;
+	if (ev->dev < es->dev_min || ev->dev > es->dev_max)
+		return 0;
+	if (ev->ch < es->ch_min || ev->ch > es->ch_max)
+		return 0;
+	return 1;
+}
+
+/*
+ * return 1 if the given spec matches all events with the cmd, dev and
+ * ch of the given event. The spec must pass filt_chanmatch()
+ */
+unsigned
+filt_allmatch(struct evspec *es, struct ev *ev)
+{
+	struct evinfo *ei = &evinfo[ev->cmd];
+	unsigned nparams;
+
+	nparams = evinfo[es->cmd].nparams;
+	if (nparams > ei->nparams)
+		nparams = ei->nparams;
+	if (nparams > 0 &&
+	    (es->v0_min > ei->v0_min || es->v0_max < ei->v0_max))
+		return 0;
+	if (nparams > 1 &&
+	    (es->v1_min > ei->v1_min || es->v1_max < ei->v1_max))
+		return 0;
+	return 1;
+}
+
+/*
+ * return the compiled rules for the given device, allocate them
+ * if needed
+ */
+struct filtdev *
+filt_getdev(struct filt *o, unsigned dev)
+{
+	struct filtdev *fd;
+	unsigned ch, i;
+
+	fd = o->comp[dev];
+	if (fd == NULL) {
+		fd = xmalloc(sizeof(struct filtdev), "filtdev");
+		for (ch = 0; ch <= EV_MAXCH; ch++) {
+			for (i = 0; i < FILT_NVOICE; i++)
+				fd->slot[ch][i].gen = 0;
+			fd->note[ch].gen = 0;
+		}
+		o->comp[dev] = fd;
+	}
+	return fd;
+}
+
+/*
+ * return the map sources that may match the given voice event,
+ * compute them if needed
+ */
+struct filtslot *
+filt_getslot(struct filt *o, struct ev *ev)
+{
+	struct filtslot *slot;
+	struct filtnode *s;
+
+	slot = &filt_getdev(o, ev->dev)->slot[ev->ch][ev->cmd - EV_NRPN];
+	if (slot->gen == o->gen)
+		return slot;
+	slot->gen = o->gen;
+	slot->nsrc = 0;
+	slot->always = 0;
+	for (s = o->map; s != NULL; s = s->next) {
+		if (!filt_chanmatch(&s->es, ev))
+			continue;
+		if (slot->nsrc == FILT_NSRC) {
+			slot->nsrc = FILT_SLOW;
 			break;
 		}
-		for (d = o->transp; d != NULL; d = d->next) {
-			if (!evspec_matchev(&d->es, ev))
-				continue;
-			ev->note_num += d->u.transp.plus;
-			ev->note_num &= 0x7f;
+		slot->src[slot->nsrc++] = s;
+		if (filt_allmatch(&s->es, ev)) {
+			slot->always = 1;
+			break;
+		}
+	}
+	return slot;
+}
+
+/*
+ * return the first rule of the given list that may match the given
+ * note, and set 'slow' if it doesn't match all notes
+ */
+struct filtnode *
+filt_getrule(struct filtnode *list, struct ev *ev, unsigned *slow)
+{
+	struct filtnode *d;
+
+	for (d = list; d != NULL; d = d->next) {
+		if (!filt_chanmatch(&d->es, ev))
+			continue;
+		if (!filt_allmatch(&d->es, ev))
+			*slow = 1;
+		return d;
+	}
+	return NULL;
+}
+
+/*
+ * return the vcurve and transp rules for the given note event,
+ * compute them if needed
+ */
+struct filtnote *
+filt_getnote(struct filt *o, struct ev *ev)
+{
+	struct filtnote *note;
+
+	note = &filt_getdev(o, ev->dev)->note[ev->ch];
+	if (note->gen == o->gen)
+		return note;
+	note->gen = o->gen;
+	note->slow = 0;
+	note->vcurve = filt_getrule(o->vcurve, ev, &note->slow);
+	note->transp = filt_getrule(o->transp, ev, &note->slow);
+	return note;
+}
+
+/*
+ * same as filt_scan(), but use compiled rules if possible
+ */
+unsigned
+filt_do(struct filt *o, struct ev *in, struct ev *out)
+{
+	struct filtslot *slot;
+	struct filtnote *note;
+	struct filtnode *s, *d;
+	struct ev *ev;
+	unsigned nev, i;
+
+	if (filt_debug || !EV_ISVOICE(in))
+		return filt_scan(o, in, out);
+	slot = filt_getslot(o, in);
+	if (slot->nsrc == FILT_SLOW)
+		return filt_scan(o, in, out);
+	nev = 0;
+	for (i = 0; i < slot->nsrc; i++) {
+		s = slot->src[i];
+		if ((slot->always && i == slot->nsrc - 1) ||
+		    evspec_matchev(&s->es, in)) {
+			for (d = s->dstlist; d != NULL; d = d->next) {
+				if (d->es.cmd == EVSPEC_EMPTY)
+					continue;
+				ev_map(in, &s->es, &d->es, &out[nev]);
+				nev++;
+			}
 			break;
 		}
 	}
+	if (!EV_ISNOTE(in))
+		return nev;
+	for (i = 0, ev = out; i < nev; i++, ev++) {
+		note = filt_getnote(o, ev);
+		if (note->slow) {
+			filt_notescan(o, ev);
+			continue;
+		}
+		if (note->vcurve)
+			ev->note_vel = note->vcurve->u.vel.map[ev->note_vel];
+		if (note->transp) {
+			ev->note_num += note->transp->u.transp.plus;
+			ev->note_num &= 0x7f;
+		}
+	}
 	return nev;
 }
 
@@ -282,6 +545,7 @@ filt_mapdel(struct filt *f, struct evspec *from, struct evspec *to)
 	struct filtnode *s, **ps;
 	struct filtnode *d, **pd;
 
+	f->gen++;
 	for (ps = &f->map; (s = *ps) != NULL;) {
 		if (evspec_in(&s->es, from)) {
 			for (pd = &s->dstlist; (d = *pd) != NULL;) {
@@ -330,6 +594,7 @@ filt_mapnew(struct filt *f, struct evspec *from, struct evspec *to)
 	if (to->cmd != EVSPEC_EMPTY && !evspec_isamap(from, to))
 		return;
 
+	f->gen++;
 	s = filtnode_mksrc(&f->map, from);
 	filtnode_mkdst(s, to);
 }
@@ -339,6 +604,7 @@ filt_detach(struct filt *o)
 {
 	struct filtnode *list, *s;
 
+	o->gen++;
 	for (list = NULL; (s = o->map) != NULL;) {
 		o->map = s->next;
 		s->next = list;
@@ -424,6 +690,7 @@ filt_transp(struct filt *f, struct evspec *from, int plus)
 		return;
 	}
 
+	f->gen++;
 	s = filtnode_mksrc(&f->transp, from);
 	s->u.transp.plus = plus & 0x7f;
 }
@@ -437,8 +704,28 @@ filt_vcurve(struct filt *f, struct evspec *from, int weight)
 		log_puts("filt_vcurve: set must contain notes\n");
 		return;
 	}
+	f->gen++;
 	s = filtnode_mksrc(&f->vcurve, from);
 	s->u.vel.nweight = (64 - weight) & 0x7f;
+	s->u.vel.map = vcurve_lut(s->u.vel.nweight);
+}
+
+/*
+ * same as filt_vcurve(), but use the given velocity map
+ */
+void
+filt_vmap(struct filt *f, struct evspec *from, unsigned char *map)
+{
+	struct filtnode *s;
+
+	if (from->cmd != EVSPEC_ANY && from->cmd != EVSPEC_NOTE) {
+		log_puts("filt_vmap: set must contain notes\n");
+		return;
+	}
+	f->gen++;
+	s = filtnode_mksrc(&f->vcurve, from);
+	s->u.vel.nweight = 0;
+	s->u.vel.map = vmap_lut(map);
 }
 
 unsigned
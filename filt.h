@@ -28,7 +28,8 @@ struct filtnode {
 	struct filtnode *next;		/* next source in the list */
 	union {
 		struct {
-			unsigned nweight;
+			unsigned nweight;	/* curve weight, 0 if vmap */
+			unsigned char *map;	/* shared table, not freed */
 		} vel;
 		struct {
 			int plus;
@@ -36,26 +37,78 @@ struct filtnode {
 	} u;
 };
 
+/*
+ * velocity map used by vmap rules. Maps are shared: rules with the
+ * same map point to the same table, which is never freed
+ */
+struct vmaptab {
+	struct vmaptab *next;
+	unsigned char map[EV_MAXCOARSE + 1];
+};
+
 #define FILT_MAXNRULES 32
 
+/*
+ * compiled map rules for voice events of a given dev, ch and cmd:
+ * the sources that may match such events, in the same order as in
+ * the map list. If the last one matches any such event, 'always'
+ * is set. If there are more than FILT_NSRC sources, 'nsrc' is set
+ * to FILT_SLOW and the map list is scanned
+ */
+#define FILT_NSRC	4
+#define FILT_SLOW	(FILT_NSRC + 1)
+#define FILT_NVOICE	(EV_BEND - EV_NRPN + 1)
+
+struct filtslot {
+	unsigned gen;			/* filt 'gen' this is valid for */
+	unsigned nsrc;			/* number of sources */
+	unsigned always;		/* last source always matches */
+	struct filtnode *src[FILT_NSRC];
+};
+
+/*
+ * compiled vcurve and transp rules for notes of a given dev and ch,
+ * 'slow' is set if they depend on the note or the velocity
+ */
+struct filtnote {
+	unsigned gen;			/* filt 'gen' this is valid for */
+	unsigned slow;			/* scan the rule lists */
+	struct filtnode *vcurve;	/* vcurve rule to use or NULL */
+	struct filtnode *transp;	/* transp rule to use or NULL */
+};
+
+/*
+ * compiled rules of a given device, allocated on first use
+ */
+struct filtdev {
+	struct filtslot slot[EV_MAXCH + 1][FILT_NVOICE];
+	struct filtnote note[EV_MAXCH + 1];
+};
+
 struct filt {
 	struct filtnode *map;		/* root of map rules */
 	struct filtnode *vcurve;	/* root of vcurve rules */
 	struct filtnode *transp;	/* root of transp rules */
+	unsigned gen;			/* incremented when rules change */
+	struct filtdev *comp[DEFAULT_MAXNDEVS]; /* compiled rules */
 };
 
 unsigned vcurve(unsigned, unsigned);
+unsigned char *vcurve_lut(unsigned);
+unsigned char *vmap_lut(unsigned char *);
 
 void filt_init(struct filt *);
 void filt_done(struct filt *);
 void filt_reset(struct filt *);
 unsigned filt_do(struct filt *, struct ev *, struct ev *);
+unsigned filt_scan(struct filt *, struct ev *, struct ev *);
 void filt_mapnew(struct filt *, struct evspec *, struct  evspec *);
 void filt_mapdel(struct filt *, struct evspec *, struct  evspec *);
 void filt_chgin(struct filt *, struct evspec *, struct evspec *, int);
 void filt_chgout(struct filt *, struct evspec *, struct evspec *, int);
 void filt_transp(struct filt *, struct evspec *, int);
 void filt_vcurve(struct filt *, struct evspec *, int);
+void filt_vmap(struct filt *, struct evspec *, unsigned char *);
 unsigned filt_evcnt(struct filt *, unsigned);
 
 struct filtnode *filtnode_new(struct evspec *, struct filtnode **);
@@ -180,7 +180,9 @@ seqptr_new(struct track *t)
 
 	sp = (struct seqptr *)pool_new(&seqptr_pool);
 	statelist_init(&sp->statelist);
+	statelist_hash(&sp->statelist);
 	sp->link = NULL;
+	sp->track = t;
 	sp->pos = t->first;
 	sp->delta = 0;
 	sp->tic = 0;
@@ -266,16 +268,29 @@ seqptr_evdel(struct seqptr *sp, struct statelist *slist)
 	else
 		st = NULL;
 	next = sp->pos->next;
-	next->delta += sp->pos->delta;
-	/* unlink and delete sp->pos */
-	*(sp->pos->prev) = next;
-	next->prev = sp->pos->prev;
-	seqev_del(sp->pos);
+	track_evrm(sp->track, sp->pos);
 	/* fix current position */
 	sp->pos = next;
 	return st;
 }
 
+/*
+ * same as seqptr_evdel() followed by seqptr_evput() of the same event,
+ * but the track is not modified
+ */
+struct state *
+seqptr_evkeep(struct seqptr *sp, struct statelist *slist)
+{
+	struct state *st;
+
+	if (sp->delta != sp->pos->delta || sp->pos->ev.cmd == EV_NULL) {
+		return NULL;
+	}
+	st = statelist_update(slist, &sp->pos->ev);
+	(void)seqptr_evget(sp);
+	return st;
+}
+
 /*
  * insert an event and put the cursor just after it, the state list is
  * updated and the state of the new event is returned.
@@ -286,16 +301,7 @@ seqptr_evput(struct seqptr *sp, struct ev *ev)
 	struct seqptr *link;
 	struct seqev *se;
 
-	se = seqev_new();
-	se->ev = *ev;
-	se->delta = sp->delta;
-	sp->pos->delta -= sp->delta;
-
-	/* link to the list */
-	se->next = sp->pos;
-	se->prev = sp->pos->prev;
-	*se->prev = se;
-	sp->pos->prev = &se->next;
+	se = track_evput(sp->track, sp->pos, sp->delta, ev);
 
 	/* if there's a reader update its pointer */
 	link = sp->link;
@@ -343,7 +349,7 @@ seqptr_ticdel(struct seqptr *sp, unsigned max, struct statelist *slist)
 	if (ntics > max) {
 		ntics = max;
 	}
-	sp->pos->delta -= ntics;
+	track_setdelta(sp->track, sp->pos, sp->pos->delta - ntics);
 	if (slist != NULL && max > 0) {
 		statelist_outdate(slist);
 	}
@@ -369,7 +375,7 @@ seqptr_ticput(struct seqptr *sp, unsigned ntics)
 	if (ntics == 0)
 		return;
 
-	sp->pos->delta += ntics;
+	track_setdelta(sp->track, sp->pos, sp->pos->delta + ntics);
 	sp->delta += ntics;
 	sp->tic += ntics;
 	statelist_outdate(&sp->statelist);
@@ -458,8 +464,7 @@ seqptr_framerm(struct seqptr *sp, struct track *f)
 	/* move event to frame track */
 	se = spos;
 	spos = se->next;
-	seqev_rm(se);
-	seqev_ins(fpos, se);
+	track_evmove(sp->track, se, fpos);
 
 	for (;;) {
 		if (phase & EV_PHASE_LAST)
@@ -484,8 +489,7 @@ seqptr_framerm(struct seqptr *sp, struct track *f)
 			/* move event to frame track */
 			se = spos;
 			spos = se->next;
-			seqev_rm(se);
-			seqev_ins(fpos, se);
+			track_evmove(sp->track, se, fpos);
 		} else {
 			/* skip event */
 			spos = spos->next;
@@ -493,6 +497,9 @@ seqptr_framerm(struct seqptr *sp, struct track *f)
 		}
 	}
 
+	sp->track->gen++;
+	f->gen++;
+
 	/*
 	 * restore position.
 	 */
@@ -543,7 +550,8 @@ seqptr_frameadd(struct seqptr *sp, struct track *f)
 
 			/* if reached the end, append space */
 			if (spos->ev.cmd == EV_NULL) {
-				spos->delta += offs;
+				track_setdelta(sp->track, spos,
+				    spos->delta + offs);
 				sdelta += offs;
 				offs = 0;
 				break;
@@ -560,15 +568,13 @@ seqptr_frameadd(struct seqptr *sp, struct track *f)
 		}
 
 		se->delta = sdelta;
-		spos->delta -= sdelta;
 		sdelta = 0;
-		/* link to the list */
-		se->next = spos;
-		se->prev = spos->prev;
-		*se->prev = se;
-		spos->prev = &se->next;
+		track_evins(sp->track, spos, se);
 	}
 
+	sp->track->gen++;
+	f->gen++;
+
 	/*
 	 * Restore current position.
 	 */
@@ -654,13 +660,10 @@ seqptr_rmlast(struct seqptr *sp, struct state **pst)
 	 * (but not the blank space)
 	 */
 	next = cur->next;
-	next->delta += cur->delta;
 	if (next == sp->pos) {
 		sp->delta += cur->delta;
 	}
-	next->prev = cur->prev;
-	*(cur->prev) = next;
-	seqev_del(cur);
+	track_evrm(sp->track, cur);
 
 	/*
 	 * update the state; if we deleted the first event of the
@@ -704,13 +707,10 @@ seqptr_rmprev(struct seqptr *sp, struct state **pst)
 			 * (but not the blank space)
 			 */
 			next = i->next;
-			next->delta += i->delta;
 			if (next == sp->pos) {
 				sp->delta += i->delta;
 			}
-			next->prev = i->prev;
-			*(i->prev) = next;
-			seqev_del(i);
+			track_evrm(sp->track, i);
 			i = next;
 		} else {
 			i = i->next;
@@ -898,7 +898,7 @@ track_merge(struct track *dst, struct track *src)
  *
  * if the 'copy' flag is set, then the selection is copied in
  * track 'dst'. If 'blank' flag is set, then the selection is
- * cleanly removed from the 'src' track
+ * cleanly removed from the 'src' track, else 'src' is not modified
  */
 void
 track_move(struct track *src, unsigned start, unsigned len,
@@ -950,7 +950,8 @@ track_move(struct track *src, unsigned start, unsigned len,
 	 *
 	 */
 	for (;;) {
-		st = seqptr_evdel(sp, &slist);
+		st = blank ? seqptr_evdel(sp, &slist) :
+		    seqptr_evkeep(sp, &slist);
 		if (st == NULL)
 			break;
 		if ((st->phase & EV_PHASE_FIRST) ||
@@ -964,7 +965,7 @@ track_move(struct track *src, unsigned start, unsigned len,
 		}
 		if (copy && (st->tag & TAG_COPY))
 			seqptr_evput(dp, &st->ev);
-		if (!blank || (st->tag & TAG_KEEP)) {
+		if (blank && (st->tag & TAG_KEEP)) {
 			seqptr_evput(sp, &st->ev);
 		}
 	}
@@ -994,7 +995,8 @@ track_move(struct track *src, unsigned start, unsigned len,
 		len -= delta;
 		if (len == 0)
 			break;
-		st = seqptr_evdel(sp, &slist);
+		st = blank ? seqptr_evdel(sp, &slist) :
+		    seqptr_evkeep(sp, &slist);
 		if (st == NULL)
 			break;
 		if (st->phase & EV_PHASE_FIRST) {
@@ -1003,7 +1005,7 @@ track_move(struct track *src, unsigned start, unsigned len,
 		if (copy && (st->tag & TAG_COPY)) {
 			seqptr_evput(dp, &st->ev);
 		}
-		if (!blank || (st->tag & TAG_KEEP)) {
+		if (blank && (st->tag & TAG_KEEP)) {
 			seqptr_evput(sp, &st->ev);
 		}
 	}
@@ -1027,7 +1029,8 @@ track_move(struct track *src, unsigned start, unsigned len,
 	 * avoid being restored
 	 */
 	for (;;) {
-		st = seqptr_evdel(sp, &slist);
+		st = blank ? seqptr_evdel(sp, &slist) :
+		    seqptr_evkeep(sp, &slist);
 		if (st == NULL)
 			break;
 		if ((st->phase & EV_PHASE_FIRST) ||
@@ -1039,7 +1042,7 @@ track_move(struct track *src, unsigned start, unsigned len,
 		if (copy && (st->tag & TAG_COPY)) {
 			seqptr_evput(dp, &st->ev);
 		}
-		if (!blank || (st->tag & TAG_KEEP)) {
+		if (blank && (st->tag & TAG_KEEP)) {
 			seqptr_evput(sp, &st->ev);
 		}
 
@@ -1048,9 +1051,11 @@ track_move(struct track *src, unsigned start, unsigned len,
 	/*
 	 * retore/tag frames that are not tagged.
 	 */
-	for (st = slist.first; st != NULL; st = st->next) {
-		if (!(st->tag & TAG_KEEP) && seqptr_restore(sp, st)) {
-			st->tag |= TAG_KEEP;
+	if (blank) {
+		for (st = slist.first; st != NULL; st = st->next) {
+			if (!(st->tag & TAG_KEEP) && seqptr_restore(sp, st)) {
+				st->tag |= TAG_KEEP;
+			}
 		}
 	}
 
@@ -1063,7 +1068,8 @@ track_move(struct track *src, unsigned start, unsigned len,
 		if (copy)
 			seqptr_ticput(dp, delta);
 		seqptr_ticput(sp, delta);
-		st = seqptr_evdel(sp, &slist);
+		st = blank ? seqptr_evdel(sp, &slist) :
+		    seqptr_evkeep(sp, &slist);
 		if (st == NULL)
 			break;
 		if (st->phase & EV_PHASE_FIRST) {
@@ -1073,7 +1079,7 @@ track_move(struct track *src, unsigned start, unsigned len,
 		if (copy && (st->tag & TAG_COPY)) {
 			seqptr_evput(dp, &st->ev);
 		}
-		if (!blank || (st->tag & TAG_KEEP)) {
+		if (blank && (st->tag & TAG_KEEP)) {
 			seqptr_evput(sp, &st->ev);
 		}
 	}
@@ -1359,6 +1365,7 @@ track_prescale(struct track *t, unsigned oldunit, unsigned newunit)
 	err = 0;
 	sp = seqptr_new(t);
 	statelist_init(&slist);
+	statelist_hash(&slist);
 	for (;;) {
 		delta = seqptr_ticdel(sp, ~0U, &slist) + err;
 		err = delta % round;
@@ -1391,28 +1398,17 @@ track_prescale(struct track *t, unsigned oldunit, unsigned newunit)
 
 /*
  * Finalize time-scaling the given track in such a way that 'oldunit'
- * ticks will correspond to 'newunit'.
+ * ticks will correspond to 'newunit'. Events are changed in place,
+ * so that pointers to them kept in undo logs remain valid.
  */
 void
 track_scale(struct track *t, unsigned oldunit, unsigned newunit)
 {
-	struct seqptr *sp;
-	struct statelist slist;
-	struct state *st;
-	unsigned delta;
+	struct seqev *se;
 
-	sp = seqptr_new(t);
-	statelist_init(&slist);
-	for (;;) {
-		delta = newunit * seqptr_ticdel(sp, ~0U, &slist);
-		seqptr_ticput(sp, delta / oldunit);
-		st = seqptr_evdel(sp, &slist);
-		if (st == NULL)
-			break;
-		seqptr_evput(sp, &st->ev);
-	}
-	statelist_done(&slist);
-	seqptr_del(sp);
+	for (se = t->first; se != NULL; se = se->next)
+		se->delta = newunit * se->delta / oldunit;
+	t->gen++;
 }
 
 /*
@@ -1508,6 +1504,17 @@ track_transpose(struct track *src, unsigned start, unsigned len,
 void
 track_vcurve(struct track *src, unsigned start, unsigned len,
     struct evspec *es, int weight)
+{
+	/* put weight from -63:63 to 1:127 range */
+	track_vmap(src, start, len, es, vcurve_lut((64 - weight) & 0x7f));
+}
+
+/*
+ * change velocities of notes of given track using the given map
+ */
+void
+track_vmap(struct track *src, unsigned start, unsigned len,
+    struct evspec *es, unsigned char *map)
 {
 	unsigned delta, tic;
 	struct seqptr *sp;
@@ -1515,9 +1522,6 @@ track_vcurve(struct track *src, unsigned start, unsigned len,
 	struct statelist slist;
 	struct ev ev;
 
-	/* put weight from -63:63 to 1:127 range */
-	weight = (64 - weight) & 0x7f;
-
 	sp = seqptr_new(src);
 	statelist_dup(&slist, &sp->statelist);
 	tic = 0;
@@ -1536,7 +1540,7 @@ track_vcurve(struct track *src, unsigned start, unsigned len,
 		    tic >= start && tic < start + len &&
 		    EV_ISNOTE(&st->ev) && state_inspec(st, es)) {
 			ev = st->ev;
-			ev.note_vel = vcurve(weight, ev.note_vel);
+			ev.note_vel = map[ev.note_vel];
 			seqptr_evput(sp, &ev);
 		} else {
 			seqptr_evput(sp, &st->ev);
@@ -1587,7 +1591,7 @@ track_rewrite(struct track *src)
 	statelist_done(&slist);
 	seqptr_del(sp);
 
-	track_swap(src, &dst);
+	track_replace(src, &dst);
 	track_done(&dst);
 }
 
@@ -1604,6 +1608,7 @@ track_check(struct track *src)
 
 	sp = seqptr_new(src);
 	statelist_init(&slist);
+	statelist_hash(&slist);
 
 	/*
 	 * reconstruct the track skipping bogus events,
@@ -1728,6 +1733,45 @@ seqptr_skipmeasure(struct seqptr *sp, unsigned meas)
 	return 0;
 }
 
+/*
+ * save the position and the state list of the seqptr, so that
+ * seqptr_ckptload() can restore it later, provided the track
+ * isn't modified in the meantime
+ */
+void
+seqptr_ckptsave(struct seqptr *sp, struct seqckpt *ck)
+{
+	ck->pos = sp->pos;
+	ck->delta = sp->delta;
+	ck->tic = sp->tic;
+	statelist_copy(&ck->statelist, &sp->statelist);
+}
+
+/*
+ * move the seqptr to the given checkpoint, the result is the same
+ * as if the seqptr had moved there with seqptr_skip()
+ */
+void
+seqptr_ckptload(struct seqptr *sp, struct seqckpt *ck)
+{
+	statelist_empty(&sp->statelist);
+	statelist_done(&sp->statelist);
+	statelist_copy(&sp->statelist, &ck->statelist);
+	sp->pos = ck->pos;
+	sp->delta = ck->delta;
+	sp->tic = ck->tic;
+}
+
+/*
+ * free the state list of the checkpoint
+ */
+void
+seqckpt_done(struct seqckpt *ck)
+{
+	statelist_empty(&ck->statelist);
+	statelist_done(&ck->statelist);
+}
+
 /*
  * convert a measure number to a tic number using
  * meta-events from the given track
@@ -1735,13 +1779,9 @@ seqptr_skipmeasure(struct seqptr *sp, unsigned meas)
 unsigned
 track_findmeasure(struct track *t, unsigned m)
 {
-	struct seqptr *sp;
 	unsigned tic;
 
-	sp = seqptr_new(t);
-	tic  = seqptr_skipmeasure(sp, m);
-	tic += sp->tic;
-	seqptr_del(sp);
+	tic = track_idxmeas(t, m, NULL, NULL);
 
 #ifdef FRAME_DEBUG
 	log_puts("track_findmeasure: ");
@@ -1762,26 +1802,15 @@ void
 track_timeinfo(struct track *t, unsigned meas, unsigned *abs,
     unsigned long *usec24, unsigned *bpm, unsigned *tpb)
 {
-	struct seqptr *sp;
 	unsigned tic;
 
-	sp = seqptr_new(t);
-	tic  = seqptr_skipmeasure(sp, meas);
-	tic += sp->tic;
-
-	/*
-	 * move to the last event, so all meta events enter the
-	 * state list
-	 */
-	while (seqptr_evget(sp)) {
-		/* nothing */
-	}
+	tic = track_idxmeas(t, meas, bpm, tpb);
 	if (abs) {
 		*abs = tic;
 	}
-	seqptr_getsign(sp, bpm, tpb);
-	seqptr_gettempo(sp, usec24);
-	seqptr_del(sp);
+	if (usec24) {
+		*usec24 = track_idxtempo(t, tic);
+	}
 }
 
 /*
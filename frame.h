@@ -22,11 +22,24 @@
 struct seqptr {
 	struct statelist statelist;
 	struct seqptr *link;		/* opposite direction seqptr */
+	struct track *track;		/* track we're on */
 	struct seqev *pos;		/* next event (current position) */
 	unsigned delta;			/* tics until the next event */
 	unsigned tic;			/* absolute tic of the current pos */
 };
 
+/*
+ * saved position and state of a seqptr, valid as long as the track
+ * is not modified
+ */
+struct seqckpt {
+	struct seqckpt *next;		/* for the caller's use */
+	struct statelist statelist;
+	struct seqev *pos;
+	unsigned delta;
+	unsigned tic;
+};
+
 struct track;
 struct evspec;
 
@@ -38,6 +51,7 @@ void	      seqptr_link(struct seqptr *, struct seqptr *);
 int	      seqptr_eot(struct seqptr *);
 struct state *seqptr_evget(struct seqptr *);
 struct state *seqptr_evdel(struct seqptr *, struct statelist *);
+struct state *seqptr_evkeep(struct seqptr *, struct statelist *);
 struct state *seqptr_evput(struct seqptr *, struct ev *);
 unsigned      seqptr_ticskip(struct seqptr *, unsigned);
 unsigned      seqptr_ticdel(struct seqptr *, unsigned,
@@ -48,6 +62,9 @@ void	      seqptr_seek(struct seqptr *, unsigned);
 struct state *seqptr_getsign(struct seqptr *, unsigned *, unsigned *);
 struct state *seqptr_gettempo(struct seqptr *, unsigned long *);
 unsigned      seqptr_skipmeasure(struct seqptr *, unsigned);
+void	      seqptr_ckptsave(struct seqptr *, struct seqckpt *);
+void	      seqptr_ckptload(struct seqptr *, struct seqckpt *);
+void	      seqckpt_done(struct seqckpt *);
 struct state *seqptr_evmerge1(struct seqptr *, struct state *);
 unsigned      seqptr_evmerge2(struct seqptr *,
     struct statelist *, struct ev *, struct ev *);
@@ -74,6 +91,8 @@ void	 track_evmap(struct track *, unsigned, unsigned,
 	 struct evspec *, struct evspec *, struct evspec *);
 void	 track_vcurve(struct track *, unsigned, unsigned,
 	 struct evspec *, int);
+void	 track_vmap(struct track *, unsigned, unsigned,
+	 struct evspec *, unsigned char *);
 void	 track_check(struct track *);
 void	 track_rewrite(struct track *);
 void     track_confev(struct track *, struct ev *);
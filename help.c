@@ -47,6 +47,18 @@ struct help help_list[] = {
 	"taddev measure beat tic event\n"
 	"\n"
 	"Put the given event at the give position of the current track."},
+
+	{"tgetevs",
+	"tgetevs\n"
+	"\n"
+	"Return the events of the current selection as a list of\n"
+	"{tic event} pairs, tics are relative to the selection start."},
+
+	{"taddevs",
+	"taddevs evlist\n"
+	"\n"
+	"Put the given list of {tic event} pairs on the current track,\n"
+	"tics are relative to the selection start."},
   
 	{"tsetf",
 	"tsetf filtname\n"
@@ -140,6 +152,15 @@ struct help help_list[] = {
 	"the -63..63 range. Applies only to note events of current "
 	"selection of the current track (see ev command)."},
 
+	{"tvmap",
+	"tvmap map\n"
+	"\n"
+	"Change velocity of note events of current selection of the "
+	"current track, using the given list of 128 velocities: a note "
+	"with velocity v gets the v-th velocity of the list (starting "
+	"from 0). Only events matching the current event selection are "
+	"changed (see ev command)."},
+
 	{"tevmap",
 	"tevmap source dest\n"
 	"\n"
@@ -148,6 +169,15 @@ struct help help_list[] = {
 	"Both event sets must have the same number of devices, "
 	"channels, notes, controllers etc.."},
 
+	{"tbatch",
+	"tbatch tracklist func arg1 arg2 ...\n"
+	"\n"
+	"Run the given track transform on each track of the list, in the "
+	"current selection. Tracks are processed in parallel, and the "
+	"whole batch is undone with a single undo. The transform is one of "
+	"tquanta, tquantf, ttransp, tvcurve, tvmap, tevmap, tcheck and "
+	"trewrite, followed by its arguments."},
+
 	{"mute",
 	"mute trackname\n"
 	"\n"
@@ -394,6 +424,14 @@ struct help help_list[] = {
 	"negative then sensitivity is decreased. If it's positive then "
 	"sensitivity is increased. If it's zero the velocity is unchanged."},
 
+	{"fvmap",
+	"fvmap evspec map\n"
+	"\n"
+	"Change velocity of the given note events, using the given list "
+	"of 128 velocities: a note with velocity v gets the v-th velocity "
+	"of the list (starting from 0). Like fvcurve, but allows any "
+	"response curve."},
+
 	{"xnew",
 	"xnew sysexname\n"
 	"\n"
@@ -841,6 +879,63 @@ struct help help_list[] = {
 	"\n"
 	"Same as the diev functino, but for output messages."},
 
+	{"dflush",
+	"dflush devnum policy\n"
+	"\n"
+	"Set when output to the given device is written. If policy is "
+	"'msg', each message is written as soon as it's generated. If "
+	"it's 'tick' (the default), all messages generated during a "
+	"clock tick are written at once. If it's a list of the form "
+	"{bytes usec}, messages are written when 'bytes' bytes are "
+	"buffered or the oldest buffered message is 'usec' microseconds "
+	"old. The dinfo function reports the average number of bytes "
+	"per write."},
+
+	{"timer",
+	"timer mode\n"
+	"\n"
+	"Select how the sequencer waits for the next clock tick or "
+	"timeout. If mode is 'deadline' (the default), midish sleeps "
+	"exactly until the next scheduled event and doesn't wake up if "
+	"nothing is scheduled. If mode is 'itimer', midish wakes up every "
+	"millisecond; use it if the deadline mode doesn't work on your "
+	"system. The new mode is used next time the sequencer is started."},
+
+	{"timerinfo",
+	"timerinfo\n"
+	"\n"
+	"Print the timer mode in use, the number of wakeups per second, "
+	"the number of timeouts fired and the average and maximum timer jitter, as measured during "
+	"the current (or last) play, record or idle session."},
+
+	{"poolinfo",
+	"poolinfo\n"
+	"\n"
+	"Display memory pools usage: for each pool (events, states, "
+	"sysex messages, ...) the number of entries in use, the "
+	"maximum number of entries ever used and the memory "
+	"allocated, in kilobytes. Pools grow as needed and unused "
+	"memory is given back to the system."},
+
+	{"rtout",
+	"rtout onoff\n"
+	"\n"
+	"If onoff is 'on', MIDI output is time-stamped and written to the "
+	"devices by a separate thread, running with real-time priority "
+	"if permitted. If it's 'off' (the default), output is written "
+	"as soon as it's produced. The new mode is used next time the "
+	"sequencer is started."},
+
+	{"lookahead",
+	"lookahead msec\n"
+	"\n"
+	"Send MIDI output produced while playing the given number of "
+	"milliseconds later, so that short delays in the processing "
+	"don't cause audible jitter. Messages are time-stamped and "
+	"written by the output thread (see rtout). When idle or "
+	"recording, output is sent immediately to keep the latency "
+	"of the monitored input minimal. Default is 0."},
+
 	{"ctlconf",
 	"ctlconf name number defval\n"
 	"\n"
@@ -954,6 +1049,7 @@ struct help help_list[] = {
 	"    mixout - show conflicts in the output MIDI merger\n"
 	"    norm - show events in the input normalizer\n"
 	"    pool - show pool usage on exit\n"
+	"    rt - show output thread errors\n"
 	"    song - show start/stop events\n"
 	"    timo - show timer internal errors\n"
 	"    mem - show memory usage"},
@@ -15,6 +15,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "utils.h"
@@ -31,18 +32,36 @@
 #include "defs.h"
 #include "sysex.h"
 #include "textio.h"
+#include "pool.h"
 
 int
 main(int argc, char **argv)
 {
 	int ch;
-	unsigned exitcode;
+	unsigned exitcode, jflag = 0;
+	char *end;
 
-	while ((ch = getopt(argc, argv, "bv")) != -1) {
+	while ((ch = getopt(argc, argv, "bf:j:m:v")) != -1) {
 		switch (ch) {
 		case 'b':
 			user_flag_batch = 1;
 			break;
+		case 'f':
+			user_batch_script = optarg;
+			user_flag_batch = 1;
+			break;
+		case 'j':
+			user_batch_njobs = strtoul(optarg, &end, 10);
+			if (*end != '\0' || user_batch_njobs == 0)
+				goto err;
+			jflag = 1;
+			break;
+		case 'm':
+			pool_maxmem = strtoul(optarg, &end, 10);
+			if (*end != '\0' || pool_maxmem == 0)
+				goto err;
+			pool_maxmem *= 1024 * 1024;
+			break;
 		case 'v':
 			user_flag_verb = 1;
 			break;
@@ -52,11 +71,14 @@ main(int argc, char **argv)
 	}
 	argc -= optind;
 	argv += optind;
-	if (argc >= 1) {
+	if ((argc >= 1 || jflag) && user_batch_script == NULL) {
 	err:
-		fputs("usage: midish [-bv]\n", stderr);
-		return 0;
+		fputs("usage: midish [-bv] [-m megabytes] "
+		    "[-f script [-j jobs] [file ...]]\n", stderr);
+		return 1;
 	}
+	user_batch_files = argv;
+	user_batch_nfiles = argc;
 
 	exitcode = user_mainloop();
 
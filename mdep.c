@@ -22,6 +22,10 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#endif
 #include <dirent.h>
 #ifdef __APPLE__
 #include <mach/mach_time.h>
@@ -40,6 +44,7 @@
 #include "defs.h"
 #include "mux.h"
 #include "mididev.h"
+#include "timo.h"
 #include "cons.h"
 #include "user.h"
 #include "exec.h"
@@ -57,10 +62,37 @@
 #endif
 
 #define MIDI_BUFSIZE	1024
-#define MAXFDS		(DEFAULT_MAXNDEVS + 1)
+#define MAXFDS		(DEFAULT_MAXNDEVS + 2)
 
 volatile sig_atomic_t cons_quit = 0, resize_flag = 0, cont_flag = 0;
-struct timespec ts, ts_last;
+struct timespec ts, ts_last, ts_open;
+
+/*
+ * timer mode to use next time the mux is opened, and timer
+ * statistics of the current (or last) session
+ */
+unsigned mux_timermode = MUX_TIMER_DEADLINE;
+struct muxstat mux_stat;
+
+#ifdef __linux__
+int timer_fd = -1;
+
+/*
+ * epoll(7) instance: input devices are added to it once when they
+ * are opened, the timer and the console when they are used. Events
+ * carry the mididev pointer, so only ready devices are processed. If
+ * it can't be created, poll(2) is used
+ */
+int mdep_epfd = -1;
+char mdep_eptag[2];
+#define MDEP_EPCONS	((void *)&mdep_eptag[0])
+#define MDEP_EPTIMER	((void *)&mdep_eptag[1])
+#define EPCONS_NONE	0		/* console not in the set */
+#define EPCONS_ADDED	1		/* console in the set */
+#define EPCONS_FILE	2		/* regular file, always readable */
+unsigned mdep_epcons_state = EPCONS_NONE;
+int mdep_epcons_fd = -1;		/* console fd, if EPCONS_ADDED */
+#endif
 
 int cons_eof, cons_isatty;
 
@@ -105,6 +137,13 @@ mdep_sigcont(int s)
 
 /*
  * start the mux, must be called just after devices are opened
+ *
+ * In MUX_TIMER_DEADLINE mode, nothing is armed here: before each
+ * poll() the time of the next scheduled event is calculated and
+ * poll() is woken up exactly at that time (using timerfd(2) where
+ * available), so no wakeups occur if nothing is scheduled. In
+ * MUX_TIMER_ITIMER mode, a periodic SIGALRM interrupts poll() every
+ * millisecond. If the former can't be setup, fall back to the latter.
  */
 void
 mux_mdep_open(void)
@@ -112,6 +151,9 @@ mux_mdep_open(void)
 	static struct sigaction sa;
 	struct itimerval it;
 	sigset_t set;
+#ifdef __linux__
+	struct epoll_event ev;
+#endif
 
 	sigemptyset(&set);
 	sigaddset(&set, SIGPIPE);
@@ -123,6 +165,29 @@ mux_mdep_open(void)
 		log_perror("mux_mdep_open: clock_gettime");
 		exit(1);
 	}
+	ts_open = ts_last;
+	memset(&mux_stat, 0, sizeof(struct muxstat));
+	mux_stat.mode = mux_timermode;
+#ifdef __linux__
+	if (mux_stat.mode == MUX_TIMER_DEADLINE) {
+		timer_fd = timerfd_create(CLOCK_MONOTONIC,
+		    TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timer_fd < 0) {
+			log_perror("mux_mdep_open: timerfd_create");
+			mux_stat.mode = MUX_TIMER_ITIMER;
+		} else if (mdep_epfd >= 0) {
+			ev.events = EPOLLIN;
+			ev.data.ptr = MDEP_EPTIMER;
+			if (epoll_ctl(mdep_epfd, EPOLL_CTL_ADD,
+				timer_fd, &ev) < 0) {
+				log_perror("mux_mdep_open: epoll_ctl");
+				exit(1);
+			}
+		}
+	}
+#endif
+	if (mux_stat.mode != MUX_TIMER_ITIMER)
+		return;
         sa.sa_flags = SA_RESTART;
         sa.sa_handler = mdep_sigalrm;
         sigfillset(&sa.sa_mask);
@@ -148,6 +213,13 @@ mux_mdep_close(void)
 {
 	struct itimerval it;
 
+	if (mux_stat.mode != MUX_TIMER_ITIMER) {
+#ifdef __linux__
+		(void)close(timer_fd);
+		timer_fd = -1;
+#endif
+		return;
+	}
 	it.it_value.tv_sec = 0;
 	it.it_value.tv_usec = 0;
 	it.it_interval.tv_sec = 0;
@@ -158,6 +230,204 @@ mux_mdep_close(void)
 	}
 }
 
+/*
+ * calculate the absolute time at which the next scheduled event
+ * is due, return 0 if nothing is scheduled
+ */
+int
+mdep_deadline(struct timespec *deadline)
+{
+	unsigned long delta;
+	unsigned long long nsec;
+
+	if (!mux_nextdelta(&delta))
+		return 0;
+
+	/*
+	 * round up, so that once the deadline is reached, the number
+	 * of 24-th of microseconds passed to mux_timercb() is at
+	 * least 'delta' and we don't wake up twice
+	 */
+	nsec = (1000ULL * delta + 23) / 24;
+	deadline->tv_sec = ts_last.tv_sec + nsec / 1000000000;
+	deadline->tv_nsec = ts_last.tv_nsec + nsec % 1000000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+	return 1;
+}
+
+/*
+ * setup the timer to wake up poll() at the given deadline, or disarm
+ * it if there's no deadline. Return the timeout to pass to poll()
+ */
+int
+mdep_settimer(struct timespec *deadline)
+{
+#ifdef __linux__
+	struct itimerspec it;
+
+	it.it_interval.tv_sec = 0;
+	it.it_interval.tv_nsec = 0;
+	if (deadline)
+		it.it_value = *deadline;
+	else {
+		it.it_value.tv_sec = 0;
+		it.it_value.tv_nsec = 0;
+	}
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &it, NULL) < 0) {
+		log_perror("mdep_settimer: timerfd_settime");
+		panic();
+	}
+	return -1;
+#else
+	struct timespec now;
+	long long delta_nsec;
+
+	if (deadline == NULL)
+		return -1;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+		log_perror("mdep_settimer: clock_gettime");
+		panic();
+	}
+	delta_nsec = 1000000000LL * (deadline->tv_sec - now.tv_sec);
+	delta_nsec += deadline->tv_nsec - now.tv_nsec;
+	if (delta_nsec <= 0)
+		return 0;
+	return (delta_nsec + 999999) / 1000000;
+#endif
+}
+
+/*
+ * return the time (in nanoseconds) of the last clock update, ie the
+ * time the mux_timercb() argument is relative to
+ */
+unsigned long long
+mux_mdep_clock(void)
+{
+	return 1000000000ULL * ts_last.tv_sec + ts_last.tv_nsec;
+}
+
+/*
+ * read and process input of the given device, 'pfd' is the array
+ * of pollfd structures as returned by poll(). Read until there's no
+ * more input, so the device doesn't need to be polled again
+ */
+void
+mdep_devinput(struct mididev *dev, struct pollfd *pfd)
+{
+	int revents;
+	unsigned res;
+	unsigned char midibuf[MIDI_BUFSIZE];
+
+	revents = dev->ops->revents(dev, pfd);
+	if (revents & POLLIN) {
+		do {
+			res = dev->ops->read(dev, midibuf, MIDI_BUFSIZE);
+			if (dev->eof) {
+				mux_mdep_unregister(dev);
+				mux_errorcb(dev->unit);
+				return;
+			}
+			if (dev->isensto.set) {
+				timo_del(&dev->isensto);
+				timo_add(&dev->isensto, MIDIDEV_ISENSTO);
+			}
+			mididev_inputcb(dev, midibuf, res);
+		} while (res == MIDI_BUFSIZE);
+	}
+	if (revents & POLLHUP) {
+		dev->eof = 1;
+		mux_mdep_unregister(dev);
+		mux_errorcb(dev->unit);
+	}
+}
+
+#ifdef __linux__
+/*
+ * add or remove the console to or from the epoll set
+ */
+void
+mdep_epcons(int docons, struct pollfd *pfd)
+{
+	struct epoll_event ev;
+
+	if (docons && mdep_epcons_state == EPCONS_NONE) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = MDEP_EPCONS;
+		if (epoll_ctl(mdep_epfd, EPOLL_CTL_ADD, pfd->fd, &ev) == 0) {
+			mdep_epcons_state = EPCONS_ADDED;
+			mdep_epcons_fd = pfd->fd;
+		} else if (errno == EPERM) {
+			/*
+			 * regular file, always readable
+			 */
+			mdep_epcons_state = EPCONS_FILE;
+		} else {
+			log_perror("mdep_epcons: epoll_ctl");
+			panic();
+		}
+	} else if (!docons && mdep_epcons_state != EPCONS_NONE) {
+		/*
+		 * 'pfd' is NULL here, use the fd that was added
+		 */
+		if (mdep_epcons_state == EPCONS_ADDED) {
+			(void)epoll_ctl(mdep_epfd, EPOLL_CTL_DEL,
+			    mdep_epcons_fd, NULL);
+			mdep_epcons_fd = -1;
+		}
+		mdep_epcons_state = EPCONS_NONE;
+	}
+}
+#endif
+
+/*
+ * register input descriptors of the given device, so the mux_mdep_wait()
+ * doesn't need to poll them one by one. Called once the device is opened
+ */
+void
+mux_mdep_register(struct mididev *dev)
+{
+#ifdef __linux__
+	struct pollfd pfds[MAXFDS];
+	struct epoll_event ev;
+	unsigned i, n;
+
+	if (mdep_epfd < 0 || !(dev->mode & MIDIDEV_MODE_IN) || dev->eof)
+		return;
+	n = dev->ops->pollfd(dev, pfds, POLLIN);
+	for (i = 0; i < n; i++) {
+		ev.events = pfds[i].events;
+		ev.data.ptr = dev;
+		if (epoll_ctl(mdep_epfd, EPOLL_CTL_ADD, pfds[i].fd, &ev) < 0) {
+			log_perror("mux_mdep_register: epoll_ctl");
+			dev->eof = 1;
+			return;
+		}
+	}
+#endif
+}
+
+/*
+ * unregister input descriptors of the given device, called before
+ * the device is closed. It's OK to call it twice
+ */
+void
+mux_mdep_unregister(struct mididev *dev)
+{
+#ifdef __linux__
+	struct pollfd pfds[MAXFDS];
+	unsigned i, n;
+
+	if (mdep_epfd < 0 || !(dev->mode & MIDIDEV_MODE_IN))
+		return;
+	n = dev->ops->pollfd(dev, pfds, POLLIN);
+	for (i = 0; i < n; i++)
+		(void)epoll_ctl(mdep_epfd, EPOLL_CTL_DEL, pfds[i].fd, NULL);
+#endif
+}
+
 /*
  * wait until an input device becomes readable or
  * until the next clock tick. Then process all events.
@@ -166,12 +436,20 @@ mux_mdep_close(void)
 int
 mux_mdep_wait(int docons)
 {
-	int i, res, revents;
+	int i, res, revents, timeout, has_deadline;
 	nfds_t nfds;
 	struct pollfd *pfd, *tty_pfds, pfds[MAXFDS];
 	struct mididev *dev;
+	struct timespec deadline;
 	unsigned char midibuf[MIDI_BUFSIZE];
 	long long delta_nsec;
+#ifdef __linux__
+	struct pollfd *timer_pfd, cons_pfd, dev_pfds[MAXFDS];
+	struct epoll_event evs[MAXFDS];
+	unsigned long long nexp;
+	int nevs;
+	unsigned n;
+#endif
 
 	nfds = 0;
 	if (docons && !cons_eof) {
@@ -185,6 +463,20 @@ mux_mdep_wait(int docons)
 		}
 	} else
 		tty_pfds = NULL;
+#ifdef __linux__
+	if (mdep_epfd >= 0) {
+		/*
+		 * devices are already in the epoll set, add the
+		 * console only
+		 */
+		if (tty_pfds) {
+			cons_pfd = *tty_pfds;
+			tty_pfds = &cons_pfd;
+		}
+		mdep_epcons(tty_pfds != NULL, tty_pfds);
+		nfds = 0;
+	} else
+#endif
 	for (dev = mididev_list; dev != NULL; dev = dev->next) {
 		if (!(dev->mode & MIDIDEV_MODE_IN) || dev->eof) {
 			dev->pfd = NULL;
@@ -194,6 +486,20 @@ mux_mdep_wait(int docons)
 		nfds += dev->ops->pollfd(dev, pfd, POLLIN);
 		dev->pfd = pfd;
 	}
+	has_deadline = mux_isopen ? mdep_deadline(&deadline) : 0;
+	timeout = -1;
+#ifdef __linux__
+	timer_pfd = NULL;
+#endif
+	if (mux_isopen && mux_stat.mode == MUX_TIMER_DEADLINE) {
+		timeout = mdep_settimer(has_deadline ? &deadline : NULL);
+#ifdef __linux__
+		timer_pfd = &pfds[nfds++];
+		timer_pfd->fd = timer_fd;
+		timer_pfd->events = POLLIN;
+		timer_pfd->revents = 0;
+#endif
+	}
 	if (cons_quit) {
 		fprintf(stderr, "\n--interrupt--\n");
 		cons_quit = 0;
@@ -211,32 +517,66 @@ mux_mdep_wait(int docons)
 		if (cons_isatty)
 			tty_reset();
 	}
-	res = poll(pfds, nfds, -1);
-	if (res < 0 && errno != EINTR) {
-		log_perror("mux_mdep_wait: poll");
-		exit(1);
-	}
-	if (res > 0) {
-		for (dev = mididev_list; dev != NULL; dev = dev->next) {
-			pfd = dev->pfd;
-			if (pfd == NULL)
+#ifdef __linux__
+	if (mdep_epfd >= 0) {
+		if (tty_pfds) {
+			tty_pfds->revents = 0;
+			if (mdep_epcons_state == EPCONS_FILE) {
+				tty_pfds->revents = POLLIN;
+				timeout = 0;
+			}
+		}
+		nevs = epoll_wait(mdep_epfd, evs, MAXFDS, timeout);
+		if (nevs < 0 && errno != EINTR) {
+			log_perror("mux_mdep_wait: epoll_wait");
+			exit(1);
+		}
+		for (i = 0; i < nevs; i++) {
+			if (evs[i].data.ptr == MDEP_EPTIMER) {
+				timer_pfd->revents = POLLIN;
 				continue;
-			revents = dev->ops->revents(dev, pfd);
-			if (revents & POLLIN) {
-				res = dev->ops->read(dev, midibuf, MIDI_BUFSIZE);
-				if (dev->eof) {
-					mux_errorcb(dev->unit);
-					continue;
-				}
-				if (dev->isensto > 0) {
-					dev->isensto = MIDIDEV_ISENSTO;
-				}
-				mididev_inputcb(dev, midibuf, res);
 			}
-			if (revents & POLLHUP) {
-				dev->eof = 1;
-				mux_errorcb(dev->unit);
+			if (evs[i].data.ptr == MDEP_EPCONS) {
+				tty_pfds->revents = evs[i].events;
+				continue;
 			}
+
+			/*
+			 * the event doesn't tell which descriptor is
+			 * ready, so flag them all, the device
+			 * will read only what's available
+			 */
+			dev = evs[i].data.ptr;
+			if (dev->eof)
+				continue;
+			n = dev->ops->pollfd(dev, dev_pfds, POLLIN);
+			while (n > 0)
+				dev_pfds[--n].revents = evs[i].events;
+			mdep_devinput(dev, dev_pfds);
+		}
+		res = 0;
+	} else
+#endif
+	{
+		res = poll(pfds, nfds, timeout);
+		if (res < 0 && errno != EINTR) {
+			log_perror("mux_mdep_wait: poll");
+			exit(1);
+		}
+	}
+#ifdef __linux__
+	if (timer_pfd && (timer_pfd->revents & POLLIN)) {
+		if (read(timer_fd, &nexp, sizeof(nexp)) < 0 &&
+		    errno != EAGAIN) {
+			log_perror("mux_mdep_wait: read timer");
+			panic();
+		}
+	}
+#endif
+	if (res > 0) {
+		for (dev = mididev_list; dev != NULL; dev = dev->next) {
+			if (dev->pfd != NULL)
+				mdep_devinput(dev, dev->pfd);
 		}
 	}
 	if (mux_isopen) {
@@ -244,6 +584,20 @@ mux_mdep_wait(int docons)
 			log_perror("mux_mdep_wait: clock_gettime");
 			panic();
 		}
+		mux_stat.nwakeups++;
+		mux_stat.elapsed = 1000000000ULL * (ts.tv_sec - ts_open.tv_sec) +
+		    ts.tv_nsec - ts_open.tv_nsec;
+		if (has_deadline) {
+			delta_nsec = 1000000000LL *
+			    (ts.tv_sec - deadline.tv_sec);
+			delta_nsec += ts.tv_nsec - deadline.tv_nsec;
+			if (delta_nsec >= 0) {
+				mux_stat.ndeadlines++;
+				mux_stat.jitter_sum += delta_nsec;
+				if (mux_stat.jitter_max < delta_nsec)
+					mux_stat.jitter_max = delta_nsec;
+			}
+		}
 
 		/*
 		 * number of micro-seconds between now and the last
@@ -276,7 +630,7 @@ mux_mdep_wait(int docons)
 			if (revents & POLLHUP)
 				cons_eof = 1;
 		} else {
-			if (tty_pfds->revents & POLLIN) {
+			if (tty_pfds->revents & (POLLIN | POLLHUP)) {
 				res = read(STDIN_FILENO, midibuf, MIDI_BUFSIZE);
 				if (res < 0) {
 					cons_eof = 1;
@@ -335,6 +689,15 @@ mux_sleep(unsigned millisecs)
 			exit(1);
 		}
 	}
+
+	/*
+	 * don't pass the time spent sleeping to mux_timercb(), as
+	 * it's not part of the song
+	 */
+	if (clock_gettime(CLOCK_MONOTONIC, &ts_last) < 0) {
+		log_perror("mux_sleep: clock_gettime");
+		exit(1);
+	}
 }
 
 void
@@ -352,6 +715,12 @@ cons_init(struct el_ops *el_ops, void *el_arg)
 
 	cons_eof = 0;
 	cons_quit = 0;
+#ifdef __linux__
+	mdep_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (mdep_epfd < 0)
+		log_perror("cons_init: epoll_create1");
+	mdep_epcons_state = EPCONS_NONE;
+#endif
 
 	sigfillset(&sa.sa_mask);
 	sa.sa_flags = SA_RESTART;
@@ -388,6 +757,12 @@ cons_done(void)
 		el_done();
 		tty_done();
 	}
+#ifdef __linux__
+	if (mdep_epfd >= 0) {
+		(void)close(mdep_epfd);
+		mdep_epfd = -1;
+	}
+#endif
 	sigfillset(&sa.sa_mask);
 	sa.sa_flags = SA_RESTART;
 	sa.sa_handler = SIG_DFL;
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
 #include <alsa/asoundlib.h>
 #include "utils.h"
 #include "mididev.h"
@@ -41,6 +42,7 @@ struct alsa {
 void	 alsa_open(struct mididev *);
 unsigned alsa_read(struct mididev *, unsigned char *, unsigned);
 unsigned alsa_write(struct mididev *, unsigned char *, unsigned);
+int	 alsa_rtwrite(struct mididev *, unsigned char *, unsigned);
 unsigned alsa_nfds(struct mididev *);
 unsigned alsa_pollfd(struct mididev *, struct pollfd *, int);
 int	 alsa_revents(struct mididev *, struct pollfd *);
@@ -51,6 +53,7 @@ struct devops alsa_ops = {
 	alsa_open,
 	alsa_read,
 	alsa_write,
+	alsa_rtwrite,
 	alsa_nfds,
 	alsa_pollfd,
 	alsa_revents,
@@ -249,26 +252,33 @@ alsa_read(struct mididev *addr, unsigned char *buf, unsigned count)
 	return count - todo;
 }
 
-unsigned
-alsa_write(struct mididev *addr, unsigned char *buf, unsigned count)
+/*
+ * encode the given bytes and send them to the sequencer, return -1
+ * and set errno on error. Only the output parser and the output buffer
+ * of the sequencer are used, so it's safe to call this from the output
+ * thread while the main thread reads events
+ */
+int
+alsa_rtwrite(struct mididev *addr, unsigned char *buf, unsigned count)
 {
 	struct alsa *dev = (struct alsa *)addr;
 	unsigned todo = count;
 	snd_seq_event_t ev;
 	long len;
+	int err;
 
-	if (!dev->seq_handle || !dev->oparser)
-		return 0;
-
+	if (!dev->seq_handle || !dev->oparser) {
+		errno = EBADF;
+		return -1;
+	}
 	while (todo > 0) {
 		/*
 		 * encode to sequencer commands
 		 */
 		len = snd_midi_event_encode(dev->oparser, buf, todo, &ev);
 		if (len < 0) {
-			log_puts("alsa_write: failed to encode buf\n");
-			dev->mididev.eof = 1;
-			return 0;
+			errno = -len;
+			return -1;
 		}
 		buf += len;
 		todo -= len;
@@ -277,14 +287,39 @@ alsa_write(struct mididev *addr, unsigned char *buf, unsigned count)
 		snd_seq_ev_set_direct(&ev);
 		snd_seq_ev_set_dest(&ev, SND_SEQ_ADDRESS_SUBSCRIBERS, 255);
 		snd_seq_ev_set_source(&ev, dev->port);
-		if (snd_seq_event_output_direct(dev->seq_handle, &ev) < 0) {
-			dev->mididev.eof = 1;
-			return 0;
+		err = snd_seq_event_output(dev->seq_handle, &ev);
+		if (err < 0) {
+			errno = -err;
+			return -1;
 		}
 	}
+
+	/*
+	 * events are accumulated in the output buffer of the
+	 * sequencer, send them all at once
+	 */
+	err = snd_seq_drain_output(dev->seq_handle);
+	if (err < 0) {
+		errno = -err;
+		return -1;
+	}
 	return count;
 }
 
+unsigned
+alsa_write(struct mididev *addr, unsigned char *buf, unsigned count)
+{
+	int res;
+
+	res = alsa_rtwrite(addr, buf, count);
+	if (res < 0) {
+		log_perror("alsa_write");
+		addr->eof = 1;
+		return 0;
+	}
+	return res;
+}
+
 unsigned
 alsa_nfds(struct mididev *addr)
 {
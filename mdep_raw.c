@@ -16,6 +16,7 @@
 #ifdef USE_RAW
 #include <sys/types.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
@@ -33,6 +34,7 @@ struct raw {
 void	 raw_open(struct mididev *);
 unsigned raw_read(struct mididev *, unsigned char *, unsigned);
 unsigned raw_write(struct mididev *, unsigned char *, unsigned);
+int	 raw_rtwrite(struct mididev *, unsigned char *, unsigned);
 unsigned raw_nfds(struct mididev *);
 unsigned raw_pollfd(struct mididev *, struct pollfd *, int);
 int	 raw_revents(struct mididev *, struct pollfd *);
@@ -43,6 +45,7 @@ struct devops raw_ops = {
 	raw_open,
 	raw_read,
 	raw_write,
+	raw_rtwrite,
 	raw_nfds,
 	raw_pollfd,
 	raw_revents,
@@ -98,6 +101,18 @@ raw_open(struct mididev *addr)
 		dev->mididev.eof = 1;
 		return;
 	}
+
+	/*
+	 * use non-blocking i/o, so the device can be read until
+	 * it's drained without the risk of blocking
+	 */
+	if (fcntl(dev->fd, F_SETFL, O_NONBLOCK) < 0) {
+		log_perror(dev->path);
+		(void)close(dev->fd);
+		dev->fd = -1;
+		dev->mididev.eof = 1;
+		return;
+	}
 }
 
 void
@@ -119,6 +134,8 @@ raw_read(struct mididev *addr, unsigned char *buf, unsigned count)
 
 	res = read(dev->fd, buf, count);
 	if (res < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
 		log_perror(dev->path);
 		dev->mididev.eof = 1;
 		return 0;
@@ -126,13 +143,41 @@ raw_read(struct mididev *addr, unsigned char *buf, unsigned count)
 	return res;
 }
 
+int
+raw_rtwrite(struct mididev *addr, unsigned char *buf, unsigned count)
+{
+	struct raw *dev = (struct raw *)addr;
+	struct pollfd pfd;
+	ssize_t res;
+
+	for (;;) {
+		res = write(dev->fd, buf, count);
+		if (res >= 0)
+			break;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			break;
+
+		/*
+		 * device not ready, block until it is, as if
+		 * non-blocking i/o was not used
+		 */
+		pfd.fd = dev->fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			break;
+	}
+	return res;
+}
+
 unsigned
 raw_write(struct mididev *addr, unsigned char *buf, unsigned count)
 {
 	struct raw *dev = (struct raw *)addr;
-	ssize_t res;
+	int res;
 
-	res = write(dev->fd, buf, count);
+	res = raw_rtwrite(addr, buf, count);
 	if (res < 0) {
 		log_perror(dev->path);
 		dev->mididev.eof = 1;
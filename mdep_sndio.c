@@ -14,6 +14,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 #ifdef USE_SNDIO
+#include <errno.h>
 #include <sndio.h>
 #include <stdio.h>
 #include "utils.h"
@@ -30,6 +31,7 @@ struct sndio {
 void	 sndio_open(struct mididev *);
 unsigned sndio_read(struct mididev *, unsigned char *, unsigned);
 unsigned sndio_write(struct mididev *, unsigned char *, unsigned);
+int	 sndio_rtwrite(struct mididev *, unsigned char *, unsigned);
 unsigned sndio_nfds(struct mididev *);
 unsigned sndio_pollfd(struct mididev *, struct pollfd *, int);
 int	 sndio_revents(struct mididev *, struct pollfd *);
@@ -40,6 +42,7 @@ struct devops sndio_ops = {
 	sndio_open,
 	sndio_read,
 	sndio_write,
+	sndio_rtwrite,
 	sndio_nfds,
 	sndio_pollfd,
 	sndio_revents,
@@ -120,6 +123,18 @@ sndio_read(struct mididev *addr, unsigned char *buf, unsigned count)
 	return res;
 }
 
+int
+sndio_rtwrite(struct mididev *addr, unsigned char *buf, unsigned count)
+{
+	struct sndio *dev = (struct sndio *)addr;
+
+	if (mio_write(dev->hdl, buf, count) < count) {
+		errno = EIO;
+		return -1;
+	}
+	return count;
+}
+
 unsigned
 sndio_write(struct mididev *addr, unsigned char *buf, unsigned count)
 {
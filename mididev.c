@@ -54,6 +54,7 @@
 #include "mux.h"
 #include "timo.h"
 #include "conv.h"
+#include "rt.h"
 
 #define MIDI_SYSEXSTART	0xf0
 #define MIDI_QFRAME	0xf1
@@ -87,7 +88,7 @@ mtc_init(struct mtc *mtc)
 	mtc->qfr = 0;
 	mtc->pos = 0xdeadbeef;
 	mtc->state = MTC_STOP;
-	mtc->timo = 0;
+	timo_set(&mtc->timo, mtc_timo, mtc);
 };
 
 /*
@@ -122,8 +123,10 @@ mtc_setfps(struct mtc *mtc, unsigned id)
  * called when timeout expires, ie MTC stopped
  */
 void
-mtc_timo(struct mtc *mtc)
+mtc_timo(void *addr)
 {
+	struct mtc *mtc = (struct mtc *)addr;
+
 	if (mididev_debug)
 		log_puts("mtc_timo: stopped\n");
 	mtc->state = MTC_STOP;
@@ -158,7 +161,8 @@ mtc_tick(struct mtc *mtc, unsigned data)
 	mtc->nibble[mtc->qfr++] = data & 0xf;
 	if (mtc->qfr < 8)
 		return;
-	mtc->timo = 24000000 / 4;
+	timo_del(&mtc->timo);
+	timo_add(&mtc->timo, 24000000 / 4);
 	pos = mtc->tps * 4 * (mtc->nibble[0] +  (mtc->nibble[1]      << 4)) +
 	    MTC_SEC *        (mtc->nibble[2] +  (mtc->nibble[3]      << 4)) +
 	    MTC_SEC * 60 *   (mtc->nibble[4] +  (mtc->nibble[5]      << 4)) +
@@ -249,7 +253,9 @@ mididev_init(struct mididev *o, struct devops *ops, unsigned mode)
 	o->istatus = o->ostatus = 0;
 	o->isysex = NULL;
 	o->runst = 1;
-	o->sync = 0;
+	o->oflush = MIDIDEV_FLUSH_TICK;
+	o->oflush_bytes = MIDIDEV_BUFLEN;
+	o->oflush_usec = 1000;
 }
 
 /*
@@ -263,6 +269,39 @@ mididev_done(struct mididev *o)
 		mididev_close(o);
 }
 
+/*
+ * called when no input was received during MIDIDEV_ISENSTO
+ */
+void
+mididev_isenstocb(void *addr)
+{
+	struct mididev *o = (struct mididev *)addr;
+
+	cons_erru(o->unit, "sensing timeout, disabled");
+}
+
+/*
+ * called when nothing was sent during MIDIDEV_OSENSTO, send an
+ * active-sensing message; flushing it restarts the timeout
+ */
+void
+mididev_osenstocb(void *addr)
+{
+	struct mididev *o = (struct mididev *)addr;
+
+	mididev_putack(o);
+	mididev_flush(o);
+}
+
+/*
+ * called when data was buffered for oflush_usec
+ */
+void
+mididev_oflushcb(void *addr)
+{
+	mididev_flush((struct mididev *)addr);
+}
+
 /*
  * open the device and initialize the parser
  */
@@ -271,10 +310,18 @@ mididev_open(struct mididev *o)
 {
 	o->eof = 0;
 	o->oused = 0;
+	o->otime = 0;
+	o->obuftime = 0;
+	o->onwrites = o->onbytes = 0;
 	o->istatus = o->ostatus = 0;
 	o->isysex = NULL;
 	mtc_init(&o->imtc);
+	timo_set(&o->isensto, mididev_isenstocb, o);
+	timo_set(&o->osensto, mididev_osenstocb, o);
+	timo_set(&o->oflushto, mididev_oflushcb, o);
+	timo_add(&o->osensto, MIDIDEV_OSENSTO);
 	o->ops->open(o);
+	mux_mdep_register(o);
 }
 
 /*
@@ -284,6 +331,11 @@ void
 mididev_close(struct mididev *o)
 {
 	mididev_flush(o);
+	timo_del(&o->imtc.timo);
+	timo_del(&o->isensto);
+	timo_del(&o->osensto);
+	timo_del(&o->oflushto);
+	mux_mdep_unregister(o);
 	o->ops->close(o);
 	o->eof = 1;
 }
@@ -296,8 +348,11 @@ mididev_flush(struct mididev *o)
 {
 	unsigned count, todo;
 	unsigned char *buf;
+	unsigned long long time;
 	unsigned i;
 
+	if (rt_running)
+		rt_poll(o);
 	if (!o->eof) {
 		if (mididev_debug && o->oused > 0) {
 			log_puts("mididev_flush: ");
@@ -311,19 +366,142 @@ mididev_flush(struct mididev *o)
 			}
 			log_puts("\n");
 		}
-		todo = o->oused;
-		buf = o->obuf;
-		while (todo > 0) {
-			count = o->ops->write(o, buf, todo);
-			if (o->eof)
-				break;
-			todo -= count;
-			buf += count;
+		time = 0;
+		if (rt_running && o->oused > 0) {
+			/*
+			 * never send data before data already queued,
+			 * this may happen when the look-ahead changes
+			 */
+			time = o->obuftime ? o->obuftime : mux_outtime();
+			if (time < o->otime)
+				time = o->otime;
+			o->otime = time;
+		}
+		if (rt_running && o->oused > 0 && o->ops->rtwrite) {
+			/*
+			 * the output thread will write it
+			 */
+			rt_put(o, o->obuf, o->oused, time);
+		} else {
+			todo = o->oused;
+			buf = o->obuf;
+			while (todo > 0) {
+				count = o->ops->write(o, buf, todo);
+				if (o->eof)
+					break;
+				o->onwrites++;
+				o->onbytes += count;
+				todo -= count;
+				buf += count;
+			}
+		}
+		if (o->oused) {
+			timo_del(&o->osensto);
+			timo_add(&o->osensto, MIDIDEV_OSENSTO);
+			timo_del(&o->oflushto);
 		}
-		if (o->oused)
-			o->osensto = MIDIDEV_OSENSTO;
 	}
 	o->oused = 0;
+	o->obuftime = 0;
+}
+
+/*
+ * called by the mux at the end of each tick, flush the device unless
+ * its policy is to wait for the bytes or usec limit
+ */
+void
+mididev_tickflush(struct mididev *o)
+{
+	if (o->oflush != MIDIDEV_FLUSH_BUF)
+		mididev_flush(o);
+}
+
+/*
+ * called after each message is queued, flush the output buffer if
+ * required by the device policy. With MIDIDEV_FLUSH_BUF, the first
+ * message arms a timeout to flush the buffer after oflush_usec; its
+ * time is used as the time the buffer is due
+ */
+void
+mididev_endmsg(struct mididev *o)
+{
+	switch (o->oflush) {
+	case MIDIDEV_FLUSH_MSG:
+		mididev_flush(o);
+		break;
+	case MIDIDEV_FLUSH_BUF:
+		if (o->oused >= o->oflush_bytes) {
+			mididev_flush(o);
+		} else if (o->oused > 0 && !o->oflushto.set) {
+			if (rt_running)
+				o->obuftime = mux_outtime();
+			timo_add(&o->oflushto, 24 * o->oflush_usec);
+		}
+		break;
+	}
+}
+
+/*
+ * set the flush policy, bytes and usec are used only by
+ * MIDIDEV_FLUSH_BUF
+ */
+void
+mididev_setflush(struct mididev *o, unsigned mode,
+    unsigned bytes, unsigned usec)
+{
+	mididev_flush(o);
+	o->oflush = mode;
+	o->oflush_bytes = bytes;
+	o->oflush_usec = usec;
+}
+
+/*
+ * decode a run of complete voice messages using the current running
+ * status, and return the number of bytes processed. This is the
+ * common case for dense streams (e.g. controllers sent by faders),
+ * so data bytes are decoded here in a tight loop rather than one by
+ * one by the generic parser of mididev_inputcb()
+ */
+unsigned
+mididev_inrun(struct mididev *o, unsigned char *buf, unsigned count)
+{
+	unsigned char *p = buf, *end = buf + count;
+	unsigned cmd = o->istatus >> 4;
+	struct ev ev;
+
+	ev.cmd = cmd;
+	ev.dev = o->unit;
+	ev.ch = o->istatus & 0x0f;
+	if (MIDIDEV_EVLEN(o->istatus) == 1) {
+		ev.v1 = o->idata[1];
+		while (p < end && *p < 0x80) {
+			ev.v0 = *p++;
+			mux_evcb(o->unit, &ev);
+		}
+		if (p > buf)
+			o->idata[0] = p[-1];
+		return p - buf;
+	}
+	while (end - p >= 2 && (p[0] | p[1]) < 0x80) {
+		if (cmd == EV_NON && p[1] == 0) {
+			ev.cmd = EV_NOFF;
+			ev.note_num = p[0];
+			ev.note_vel = EV_NOFF_DEFAULTVEL;
+		} else if (cmd == EV_BEND) {
+			ev.bend_val = ((unsigned)p[1] << 7) + p[0];
+		} else {
+			ev.v0 = p[0];
+			ev.v1 = p[1];
+		}
+		mux_evcb(o->unit, &ev);
+		ev.cmd = cmd;
+		p += 2;
+	}
+	if (p > buf) {
+		o->idata[0] = p[-2];
+		o->idata[1] = p[-1];
+	}
+	return p - buf;
 }
 
 /*
@@ -334,7 +512,7 @@ void
 mididev_inputcb(struct mididev *o, unsigned char *buf, unsigned count)
 {
 	struct ev ev;
-	unsigned i, data;
+	unsigned i, n, data;
 
 	if (!(o->mode & MIDIDEV_MODE_IN)) {
 		log_puts("received data from output only device\n");
@@ -353,6 +531,13 @@ mididev_inputcb(struct mididev *o, unsigned char *buf, unsigned count)
 		log_puts("\n");
 	}
 	while (count != 0) {
+		if (o->icount == 0 && o->istatus >= 0x80 && o->istatus < 0xf0) {
+			n = mididev_inrun(o, buf, count);
+			count -= n;
+			buf += n;
+			if (count == 0)
+				break;
+		}
 		data = *buf;
 		count--;
 		buf++;
@@ -452,7 +637,15 @@ mididev_inputcb(struct mididev *o, unsigned char *buf, unsigned count)
 				mux_evcb(o->unit, &ev);
 			}
 		} else if (o->istatus == MIDI_SYSEXSTART) {
+			/*
+			 * add the whole run of data bytes at once
+			 */
+			for (n = 0; n < count && buf[n] < 0x80; n++)
+				; /* nothing */
 			sysex_add(o->isysex, data);
+			sysex_addbuf(o->isysex, buf, n);
+			count -= n;
+			buf += n;
 		} else if (o->istatus == MIDI_QFRAME) {
 			/*
 			 * NOTE: MIDI uses running status only for voice events
@@ -487,32 +680,28 @@ void
 mididev_putstart(struct mididev *o)
 {
 	mididev_out(o, MIDI_START);
-	if (o->sync)
-		mididev_flush(o);
+	mididev_endmsg(o);
 }
 
 void
 mididev_putstop(struct mididev *o)
 {
 	mididev_out(o, MIDI_STOP);
-	if (o->sync)
-		mididev_flush(o);
+	mididev_endmsg(o);
 }
 
 void
 mididev_puttic(struct mididev *o)
 {
 	mididev_out(o, MIDI_TIC);
-	if (o->sync)
-		mididev_flush(o);
+	mididev_endmsg(o);
 }
 
 void
 mididev_putack(struct mididev *o)
 {
 	mididev_out(o, MIDI_ACK);
-	if (o->sync)
-		mididev_flush(o);
+	mididev_endmsg(o);
 }
 
 /*
@@ -581,8 +770,7 @@ mididev_putev(struct mididev *o, struct ev *ev)
 		}
 	}
 end:
-	if (o->sync)
-		mididev_flush(o);
+	mididev_endmsg(o);
 }
 
 /*
@@ -607,8 +795,7 @@ mididev_sendraw(struct mididev *o, unsigned char *buf, unsigned len)
 	 * since we don't parse the buffer, reset running status
 	 */
 	o->ostatus = 0;
-	if (o->sync)
-		mididev_flush(o);
+	mididev_endmsg(o);
 }
 
 /*
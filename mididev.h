@@ -17,6 +17,8 @@
 #ifndef MIDISH_MIDIDEV_H
 #define MIDISH_MIDIDEV_H
 
+#include "timo.h"
+
 /*
  * timeouts for active sensing
  * (as usual units are 24th of microsecond)
@@ -35,6 +37,15 @@
  */
 #define MIDIDEV_BUFLEN	0x400
 
+/*
+ * output flush policies: when the output buffer is written to the
+ * device
+ */
+#define MIDIDEV_FLUSH_MSG	0	/* after each message */
+#define MIDIDEV_FLUSH_TICK	1	/* once per tick (default) */
+#define MIDIDEV_FLUSH_BUF	2	/* when the bytes or usec limit is hit */
+#define MIDIDEV_FLUSH_MAXUSEC	100000	/* max usec limit */
+
 struct pollfd;
 struct mididev;
 struct ev;
@@ -54,6 +65,13 @@ struct devops {
 	 * of bytes actually written, set the ``eof'' flag on error
 	 */
 	unsigned (*write)(struct mididev *, unsigned char *, unsigned);
+	/*
+	 * same as write, but called by the output thread: don't touch
+	 * the mididev structure nor log anything, return -1 and set
+	 * errno on error. NULL if the device can't be used by the
+	 * output thread
+	 */
+	int (*rtwrite)(struct mididev *, unsigned char *, unsigned);
 	/*
 	 * return the number of pollfd structures the device requires
 	 */
@@ -91,7 +109,7 @@ struct mtc {
 #define MTC_START	1		/* got a full frame but no tick yet */
 #define MTC_RUN		2		/* got at least 1 tick */
 	unsigned state;			/* one of above */
-	unsigned timo;
+	struct timo timo;		/* to detect when the master stops */
 };
 
 struct mididev {
@@ -110,13 +128,16 @@ struct mididev {
 	unsigned ticrate, ticdelta;	/* tick rate (default 96) */
 	unsigned sendclk;		/* send MIDI clock */
 	unsigned sendmmc;		/* send MMC start/stop/relocate */
-	unsigned isensto, osensto;	/* active sensing timeouts */
+	struct timo isensto, osensto;	/* active sensing timeouts */
 	unsigned mode;			/* read, write */
 	unsigned ixctlset, oxctlset;	/* bitmap of 14bit controllers */
 	unsigned ievset, oevset;	/* bitmap of CONV_{XPC,NRPN,RPN} */
 	unsigned eof;			/* i/o error pending */
 	unsigned runst;			/* use running status for output */
-	unsigned sync;			/* flush buffer after each message */
+	unsigned oflush;		/* one of MIDIDEV_FLUSH_xxx */
+	unsigned oflush_bytes;		/* bytes limit for MIDIDEV_FLUSH_BUF */
+	unsigned oflush_usec;		/* usec limit for MIDIDEV_FLUSH_BUF */
+	struct timo oflushto;		/* to flush after oflush_usec */
 
 	/*
 	 * midi events parser state
@@ -129,11 +150,21 @@ struct mididev {
 	unsigned 	  oused;		/* bytes in obuf */
 	unsigned	  ostatus;		/* output running status */
 	unsigned char	  obuf[MIDIDEV_BUFLEN];	/* output buffer */
+	unsigned long long otime;		/* time of last output */
+	unsigned long long obuftime;		/* time of first byte in obuf */
+
+	/*
+	 * output statistics, reset when the device is opened
+	 */
+	unsigned long onwrites;			/* write() calls */
+	unsigned long onbytes;			/* bytes written */
 };
 
 void mididev_init(struct mididev *, struct devops *, unsigned);
 void mididev_done(struct mididev *);
 void mididev_flush(struct mididev *);
+void mididev_tickflush(struct mididev *);
+void mididev_setflush(struct mididev *, unsigned, unsigned, unsigned);
 void mididev_putstart(struct mididev *);
 void mididev_putstop(struct mididev *);
 void mididev_puttic(struct mididev *);
@@ -144,7 +175,7 @@ void mididev_open(struct mididev *);
 void mididev_close(struct mididev *);
 void mididev_inputcb(struct mididev *, unsigned char *, unsigned);
 
-void mtc_timo(struct mtc *); /* XXX, use timeouts */
+void mtc_timo(void *);
 
 extern unsigned mididev_debug;
 
@@ -53,6 +53,7 @@ void
 mixout_start(void)
 {
 	statelist_init(&mixout_slist);
+	statelist_hash(&mixout_slist);
 	timo_set(&mixout_timo, mixout_timocb, NULL);
 	timo_add(&mixout_timo, MIXOUT_TIMO);
 	if (mixout_debug) {
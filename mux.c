@@ -67,6 +67,7 @@
 #include "timo.h"
 #include "state.h"
 #include "conv.h"
+#include "rt.h"
 
 #include "norm.h"
 #include "mixout.h"
@@ -88,7 +89,9 @@ unsigned mux_phase, mux_reqphase;
 unsigned mux_manualstart = 1;
 void *mux_addr;
 unsigned long mux_wallclock;
-
+unsigned long mux_outlag;
+unsigned mux_lookahead = 0;	/* look-ahead in play mode, in ms */
+unsigned long long mux_outdelay = 0;	/* current look-ahead, in ns */
 
 struct statelist mux_istate, mux_ostate;
 
@@ -133,11 +136,12 @@ mux_open(void)
 	mux_isopen = 1;
 	for (i = mididev_list; i != NULL; i = i->next) {
 		i->ticdelta = i->ticrate;
-		i->isensto = 0;
-		i->osensto = MIDIDEV_OSENSTO;
 		mididev_open(i);
 	}
 	mux_mdep_open();
+	mux_outdelay = 0;
+	if (rt_enabled || mux_lookahead > 0)
+		rt_start();
 
 	mux_curpos = 0;
 	mux_nextpos = 0;
@@ -158,7 +162,10 @@ mux_close(void)
 	log_sync = 1;
 	norm_stop();
 	mixout_stop();
-	mux_flush();
+	for (i = mididev_list; i != NULL; i = i->next)
+		mididev_flush(i);
+	if (rt_running)
+		rt_stop();
 	for (i = mididev_list; i != NULL; i = i->next) {
 		if (i->isysex) {
 			cons_err("lost incomplete sysex");
@@ -403,9 +410,11 @@ mux_mtctick(unsigned delta)
 		 * the start signal).
 		 */
 		if (!mux_manualstart || mux_phase != MUX_START) {
+			mux_outlag = mux_curpos;
 			mux_sendtic();
 			mux_ticcb();
 			mux_flush();
+			mux_outlag = 0;
 		}
 	}
 }
@@ -438,51 +447,17 @@ mux_mtcstop(void)
 void
 mux_timercb(unsigned long delta)
 {
-	struct mididev *dev;
-
 	/*
 	 * update wall clock
 	 */
 	mux_wallclock += delta;
 
-
 	/*
-	 * run expired timeouts
+	 * run expired timeouts, including devices' active sensing
+	 * and MTC timeouts
 	 */
 	timo_update(delta);
 
-	/*
-	 * handle timeouts not using the timo.c interface
-	 * XXX: convert this to timo_xxx() routines
-	 */
-	for (dev = mididev_list; dev != NULL; dev = dev->next) {
-		if (dev->isensto) {
-			if (dev->isensto <= delta) {
-				dev->isensto = 0;
-				cons_erru(dev->unit, "sensing timeout, disabled");
-			} else {
-				dev->isensto -= delta;
-			}
-		}
-		if (dev->osensto) {
-			if (dev->osensto <= delta) {
-				mididev_putack(dev);
-				mididev_flush(dev);
-				dev->osensto = MIDIDEV_OSENSTO;
-			} else {
-				dev->osensto -= delta;
-			}
-		}
-		if (dev->imtc.timo) {
-			if (dev->imtc.timo <= delta) {
-				dev->imtc.timo = 0;
-				mtc_timo(&dev->imtc);
-			} else {
-				dev->imtc.timo -= delta;
-			}
-		}
-	}
-
 	/*
 	 * if there's no ext MTC source, then generate one internally
 	 * using the current sequencer state as hints
@@ -511,6 +486,43 @@ mux_timercb(unsigned long delta)
 	}
 }
 
+/*
+ * if something is scheduled (internal clock tick, timeout, active
+ * sensing, ...) store in 'delta' the number of 24-th of microseconds
+ * until it's due and return 1. If nothing is scheduled, return 0, in
+ * which case there's no need to call mux_timercb() until some input
+ * is received.
+ */
+unsigned
+mux_nextdelta(unsigned long *delta)
+{
+	unsigned long min;
+	unsigned timo, set;
+
+	set = 0;
+	min = 0;
+	if (timo_next(&timo)) {
+		min = timo;
+		set = 1;
+	}
+	if (!mididev_mtcsrc && !mididev_clksrc) {
+		switch (mux_phase) {
+		case MUX_START:
+		case MUX_FIRST:
+		case MUX_NEXT:
+			timo = (mux_curpos < mux_nextpos) ?
+			    mux_nextpos - mux_curpos : 0;
+			if (!set || timo < min) {
+				min = timo;
+				set = 1;
+			}
+			break;
+		}
+	}
+	*delta = min;
+	return set;
+}
+
 /*
  * called when a MIDI TICK is received
  */
@@ -588,9 +600,9 @@ mux_ackcb(unsigned unit)
 {
 	struct mididev *dev = mididev_byunit[unit];
 
-	if (dev->isensto == 0) {
+	if (!dev->isensto.set) {
 		cons_erru(dev->unit, "sensing enabled");
-		dev->isensto = MIDIDEV_ISENSTO;
+		timo_add(&dev->isensto, MIDIDEV_ISENSTO);
 	}
 }
 
@@ -695,7 +707,7 @@ mux_sysexcb(unsigned unit, struct sysex *sysex)
 }
 
 /*
- * flush all devices
+ * flush all devices, except those waiting for their flush limit
  */
 void
 mux_flush(void)
@@ -703,10 +715,23 @@ mux_flush(void)
 	struct mididev *dev;
 
 	for (dev = mididev_list; dev != NULL; dev = dev->next) {
-		mididev_flush(dev);
+		mididev_tickflush(dev);
 	}
 }
 
+/*
+ * return the time (in nanoseconds) at which the data being flushed
+ * is to be sent. If we're late (eg. several ticks are processed in
+ * a row because the process was not scheduled in time), this is
+ * the time the current tick was supposed to be processed at, plus
+ * the look-ahead.
+ */
+unsigned long long
+mux_outtime(void)
+{
+	return mux_mdep_clock() - 1000ULL * mux_outlag / 24 + mux_outdelay;
+}
+
 /*
  * return the current phase
  */
@@ -740,6 +765,17 @@ mux_chgticrate(unsigned tpu)
 	mux_ticrate = tpu;
 }
 
+/*
+ * change the delay (in milliseconds) between the time data is
+ * produced and the time it's sent. Devices that can't schedule
+ * output (and the output thread is not running) send it immediately
+ */
+void
+mux_chglookahead(unsigned msec)
+{
+	mux_outdelay = 1000000ULL * msec;
+}
+
 /*
  * start waiting for a MIDI START event (or generate one if
  * we're the clock master).
@@ -25,8 +25,27 @@
 
 #define MUX_LINESIZE		1024
 
+/*
+ * timer modes, see mux_mdep_open()
+ */
+#define MUX_TIMER_ITIMER	0	/* periodic 1ms SIGALRM */
+#define MUX_TIMER_DEADLINE	1	/* wake up only when something is due */
+
+/*
+ * timer statistics, reset every time the mux is opened
+ */
+struct muxstat {
+	unsigned mode;			/* timer mode actually used */
+	unsigned long nwakeups;		/* number of times poll() returned */
+	unsigned long ndeadlines;	/* number of deadlines reached */
+	unsigned long long elapsed;	/* nanoseconds since mux_open() */
+	unsigned long long jitter_sum;	/* total lateness in nanoseconds */
+	unsigned long long jitter_max;	/* max lateness in nanoseconds */
+};
+
 struct ev;
 struct sysex;
+struct mididev;
 
 /*
  * modules are chained as follows: mux -> norm -> filt -> song -> output
@@ -44,6 +63,9 @@ extern struct song *usong;
 extern unsigned mux_isopen;
 extern unsigned mux_manualstart;
 extern unsigned long mux_wallclock;
+extern unsigned mux_timermode;
+extern unsigned mux_lookahead;
+extern struct muxstat mux_stat;
 
 void song_startcb(struct song *);
 void song_stopcb(struct song *);
@@ -74,10 +96,16 @@ unsigned mux_getphase(void);
 struct sysex *mux_getsysex(void);
 void mux_chgtempo(unsigned long);
 void mux_chgticrate(unsigned);
+void mux_chglookahead(unsigned);
 void mux_startreq(int);
 void mux_stopreq(void);
 void mux_gotoreq(unsigned);
 int mux_mdep_wait(int); /* XXX: hide this prototype */
+unsigned mux_nextdelta(unsigned long *);
+unsigned long long mux_mdep_clock(void);
+void mux_mdep_register(struct mididev *);
+void mux_mdep_unregister(struct mididev *);
+unsigned long long mux_outtime(void);
 
 /*
  * call-backs called by midi device drivers
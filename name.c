@@ -16,6 +16,13 @@
 
 /*
  * name is a singly-linked list of strings
+ *
+ * Lists that may grow big (procs, global variables, tracks, ...) have
+ * a namelist head and are handled with the namelist_xxx() routines.
+ * If the list is hashed, names are also linked in one of
+ * NAME_HASHSIZE buckets, in the same order as in the list, so
+ * lookups return the same name as with the list. Code changing the
+ * string of a name of a hashed list must call namelist_rehash().
  */
 
 #include "utils.h"
@@ -70,6 +77,21 @@ name_log(struct name *o)
 	}
 }
 
+/*
+ * return the hash of the given string
+ */
+unsigned
+name_hashstr(char *str)
+{
+	unsigned h = 2166136261U;
+
+	if (str == NULL)
+		return 0;
+	while (*str != '\0')
+		h = (h ^ (unsigned char)*str++) * 16777619U;
+	return h;
+}
+
 void
 name_insert(struct name **first, struct name *i)
 {
@@ -162,3 +184,160 @@ name_lookup(struct name **first, char *str)
 	}
 	return 0;
 }
+
+
+
+
+
+/*
+ * initialize an empty list, and allocate a hash table if requested
+ */
+void
+namelist_init(struct namelist *o, unsigned hashed)
+{
+	unsigned h;
+
+	o->first = NULL;
+	if (hashed) {
+		o->htab = xmalloc(NAME_HASHSIZE * sizeof(struct name *),
+		    "htab");
+		for (h = 0; h < NAME_HASHSIZE; h++)
+			o->htab[h] = NULL;
+	} else
+		o->htab = NULL;
+}
+
+/*
+ * free the hash table, the list must be empty
+ */
+void
+namelist_done(struct namelist *o)
+{
+	if (o->first != NULL) {
+		log_puts("namelist_done: list not empty\n");
+		panic();
+	}
+	if (o->htab) {
+		xfree(o->htab);
+		o->htab = NULL;
+	}
+}
+
+void
+namelist_insert(struct namelist *o, struct name *i)
+{
+	struct name **b;
+
+	name_insert(&o->first, i);
+	if (o->htab) {
+		i->hash = name_hashstr(i->str);
+		b = &o->htab[i->hash & (NAME_HASHSIZE - 1)];
+		i->hnext = *b;
+		*b = i;
+	}
+}
+
+void
+namelist_add(struct namelist *o, struct name *v)
+{
+	struct name **i;
+
+	name_add(&o->first, v);
+	if (o->htab) {
+		v->hash = name_hashstr(v->str);
+		i = &o->htab[v->hash & (NAME_HASHSIZE - 1)];
+		while (*i != NULL)
+			i = &(*i)->hnext;
+		v->hnext = NULL;
+		*i = v;
+	}
+}
+
+void
+namelist_remove(struct namelist *o, struct name *v)
+{
+	struct name **i;
+
+	if (o->htab) {
+		i = &o->htab[v->hash & (NAME_HASHSIZE - 1)];
+		while (*i != v) {
+			if (*i == NULL) {
+				log_puts("namelist_remove: not in bucket\n");
+				panic();
+			}
+			i = &(*i)->hnext;
+		}
+		*i = v->hnext;
+	}
+	name_remove(&o->first, v);
+}
+
+struct name *
+namelist_lookup(struct namelist *o, char *str)
+{
+	struct name *i;
+	unsigned h;
+
+	if (o->htab == NULL)
+		return name_lookup(&o->first, str);
+	h = name_hashstr(str);
+	for (i = o->htab[h & (NAME_HASHSIZE - 1)]; i != NULL; i = i->hnext) {
+		if (i->hash != h || i->str == NULL)
+			continue;
+		if (str_eq(i->str, str))
+			return i;
+	}
+	return 0;
+}
+
+/*
+ * return the next name of the list with the same string as the
+ * given one
+ */
+struct name *
+namelist_lookupnext(struct namelist *o, struct name *n)
+{
+	struct name *i;
+
+	if (o->htab) {
+		for (i = n->hnext; i != NULL; i = i->hnext) {
+			if (i->hash != n->hash || i->str == NULL)
+				continue;
+			if (str_eq(i->str, n->str))
+				return i;
+		}
+		return 0;
+	}
+	for (i = n->next; i != NULL; i = i->next) {
+		if (i->str == NULL)
+			continue;
+		if (str_eq(i->str, n->str))
+			return i;
+	}
+	return 0;
+}
+
+/*
+ * put all names of the list in the buckets, in list order; must be
+ * called after names of the list were renamed
+ */
+void
+namelist_rehash(struct namelist *o)
+{
+	struct name **tail[NAME_HASHSIZE], *i;
+	unsigned h;
+
+	if (o->htab == NULL)
+		return;
+	for (h = 0; h < NAME_HASHSIZE; h++) {
+		o->htab[h] = NULL;
+		tail[h] = &o->htab[h];
+	}
+	for (i = o->first; i != NULL; i = i->next) {
+		i->hash = name_hashstr(i->str);
+		h = i->hash & (NAME_HASHSIZE - 1);
+		i->hnext = NULL;
+		*tail[h] = i;
+		tail[h] = &i->hnext;
+	}
+}
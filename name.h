@@ -27,6 +27,20 @@
 struct name {
 	char *str;
 	struct name *next;
+	struct name *hnext;		/* next in bucket, if list is hashed */
+	unsigned hash;			/* hash of 'str', if list is hashed */
+};
+
+/*
+ * head of a list of names that may grow big (procs, global
+ * variables, tracks, ...). If it's hashed, names are also linked in
+ * one of NAME_HASHSIZE buckets, in the same order as in the list
+ */
+#define NAME_HASHSIZE	512		/* buckets, power of two */
+
+struct namelist {
+	struct name *first;		/* the list */
+	struct name **htab;		/* hash table, or NULL */
 };
 
 void	     name_init(struct name *, char *);
@@ -43,4 +57,13 @@ void         name_cat(struct name **, struct name **);
 unsigned     name_eq(struct name **, struct name **);
 struct name *name_lookup(struct name **, char *);
 
+void	     namelist_init(struct namelist *, unsigned);
+void	     namelist_done(struct namelist *);
+void	     namelist_insert(struct namelist *, struct name *);
+void	     namelist_add(struct namelist *, struct name *);
+void	     namelist_remove(struct namelist *, struct name *);
+struct name *namelist_lookup(struct namelist *, char *);
+struct name *namelist_lookupnext(struct namelist *, struct name *);
+void	     namelist_rehash(struct namelist *);
+
 #endif /* MIDISH_NAME_H */
@@ -27,6 +27,8 @@
 #include "cons.h"
 #include "user.h"
 #include "textio.h"
+#include "vm.h"
+#include "pool.h"
 
 struct node *
 node_new(struct node_vmt *vmt, struct data *data)
@@ -201,13 +203,19 @@ node_exec_proc(struct node *o, struct exec *x, struct data **r)
 	if (p != NULL) {
 		name_empty(&p->args);
 		node_delete(p->code);
+		if (p->vm) {
+			vm_release(p->vm);
+			p->vm = NULL;
+		}
+		p->novm = 0;
 	} else {
 		p = proc_new(o->data->val.list->val.ref);
-		name_insert((struct name **)&x->procs, (struct name *)p);
+		namelist_insert(&x->procs, (struct name *)p);
 	}
 	p->args = args;
 	p->code = o->list;
 	o->list = NULL;
+	x->gen++;
 	return RESULT_OK;
 }
 
@@ -242,6 +250,10 @@ node_exec_builtin(struct node *o, struct exec *x, struct data **r)
 	    o->data->val.user)(x, r)) {
 		return RESULT_ERR;
 	}
+	if (pool_overflow) {
+		cons_errs(x->procname, "memory limit reached");
+		return RESULT_ERR;
+	}
 	if (!*r) {
 		*r = data_newnil();
 	}
@@ -306,14 +318,14 @@ unsigned
 node_exec_call(struct node *o, struct exec *x, struct data **r)
 {
 	struct proc *p;
-	struct name **oldlocals, *newlocals;
+	struct namelist *oldlocals, newlocals;
 	struct name *argn;
 	struct node *argv;
 	struct var *valist;
 	char *procname_save;
 	unsigned result;
 
-	newlocals = NULL;
+	namelist_init(&newlocals, 0);
 	result = RESULT_ERR;
 
 	p = exec_proclookup(x, o->data->val.ref);
@@ -68,6 +68,7 @@ void
 norm_start(void)
 {
 	statelist_init(&norm_slist);
+	statelist_hash(&norm_slist);
 	timo_set(&norm_timo, norm_timocb, NULL);
 	timo_add(&norm_timo, NORM_TIMO);
 	if (norm_debug) {
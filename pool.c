@@ -15,26 +15,55 @@
  */
 
 /*
- * a pool is a large memory block (the pool) that is split into
- * small blocks of equal size (pools entries). Its used for
- * fast allocation of pool entries. Free enties are on a singly
- * linked list
+ * a pool is a set of large memory blocks (slabs) that are split into
+ * small blocks of equal size (pools entries). Its used for fast
+ * allocation of pool entries. Free enties are on a singly linked
+ * list. When the list is empty, a new slab is allocated, so pools
+ * grow as needed; slabs whose entries are all free are given back
+ * to the system by pool_trim()
+ *
+ * If a memory limit is set (pool_maxmem), allocations never fail,
+ * since callers can't handle it. Instead, growing beyond the limit
+ * sets pool_overflow, which is checked at safe places: loading
+ * files stops and the interpreter fails the current command
+ *
+ * While batch jobs run on worker threads (pool_mt is set), each
+ * thread allocates from its own magazine, a small private free list
+ * per pool. Magazines are refilled from and drained to the pool free
+ * list by batches of POOL_MAGSIZE entries, so the pool lock is taken
+ * once every POOL_MAGSIZE allocations rather than for each one.
  */
 
+#include <pthread.h>
+#include <stdlib.h>
 #include "utils.h"
 #include "pool.h"
 
+#define POOL_MAGSIZE	64	/* entries moved per magazine refill */
+#define POOL_NMAGS	8	/* max pools a thread may use */
+
+struct poolmag {
+	struct pool *pool;	/* pool the entries belong to */
+	struct poolent *first;	/* private free list */
+	unsigned n;		/* number of entries in the list */
+};
+
 unsigned pool_debug = 0;
+unsigned pool_mt = 0;		/* if true, use per-thread magazines */
+pthread_mutex_t pool_mtx = PTHREAD_MUTEX_INITIALIZER;
+__thread struct poolmag pool_mags[POOL_NMAGS];
+struct pool *pool_list = NULL;
+unsigned long pool_maxmem = 0;	/* max bytes in all slabs, 0 if no limit */
+unsigned long pool_mem = 0;	/* bytes in all slabs */
+unsigned pool_overflow = 0;	/* set if pool_maxmem was exceeded */
 
 /*
- * initialises a pool of "itemnum" elements of size "itemsize"
+ * initialises a pool of elements of size "itemsize", allocated by
+ * slabs of "slabnum" elements
  */
 void
-pool_init(struct pool *o, char *name, unsigned itemsize, unsigned itemnum)
+pool_init(struct pool *o, char *name, unsigned itemsize, unsigned slabnum)
 {
-	unsigned i;
-	unsigned char *p;
-
 	/*
 	 * round item size to sizeof unsigned
 	 */
@@ -44,43 +73,71 @@ pool_init(struct pool *o, char *name, unsigned itemsize, unsigned itemnum)
 	itemsize += sizeof(unsigned) - 1;
 	itemsize &= ~(sizeof(unsigned) - 1);
 
-	o->data = xmalloc(itemsize * itemnum, "pool");
-	if (!o->data) {
-		log_puts("pool_init(");
-		log_puts(name);
-		log_puts("): out of memory\n");
-		panic();
-	}
+	o->slabs = NULL;
 	o->first = NULL;
+	o->nslab = 0;
+	o->slabnum = slabnum;
 	o->itemsize = itemsize;
-	o->itemnum = itemnum;
 	o->name = name;
-#ifdef POOL_DEBUG
 	o->maxused = 0;
 	o->used = 0;
+	o->trimfree = 0;
+#ifdef POOL_DEBUG
 	o->newcnt = 0;
 #endif
+	o->next = pool_list;
+	pool_list = o;
+}
+
+/*
+ * allocate a new slab and put its entries on the free list
+ */
+void
+pool_grow(struct pool *o)
+{
+	struct poolslab *slab;
+	unsigned char *p;
+	unsigned long size;
+	unsigned i;
+
+	size = (unsigned long)o->itemsize * o->slabnum;
+	if (pool_maxmem > 0 && pool_mem + size > pool_maxmem) {
+		if (pool_debug) {
+			log_puts("pool_grow(");
+			log_puts(o->name);
+			log_puts("): memory limit reached\n");
+		}
+		pool_overflow = 1;
+	}
+	slab = xmalloc(sizeof(struct poolslab), "poolslab");
+	slab->data = xmalloc(size, "pool");
+	slab->next = o->slabs;
+	o->slabs = slab;
+	o->nslab++;
+	o->trimfree = 0;
+	pool_mem += size;
 
 	/*
-	 * create a linked list of all entries
+	 * create a linked list of all entries, so that they are
+	 * allocated in address order
 	 */
-	p = o->data;
-	for (i = itemnum; i != 0; i--) {
+	p = slab->data + size;
+	for (i = o->slabnum; i != 0; i--) {
+		p -= o->itemsize;
 		((struct poolent *)p)->next = o->first;
 		o->first = (struct poolent *)p;
-		p += itemsize;
-		o->itemnum++;
 	}
 }
 
-
 /*
  * free the given pool
  */
 void
 pool_done(struct pool *o)
 {
-	xfree(o->data);
+	struct poolslab *slab;
+	struct pool **i;
+
 #ifdef POOL_DEBUG
 	if (o->used != 0) {
 		log_puts("pool_done(");
@@ -89,18 +146,146 @@ pool_done(struct pool *o)
 		log_putu(o->used);
 		log_puts(" items still allocated\n");
 	}
+#endif
 	if (pool_debug) {
 		log_puts("pool_done(");
 		log_puts(o->name);
 		log_puts("): using ");
-		log_putu((1023 + o->itemnum * o->itemsize) / 1024);
+		log_putu((1023 + o->nslab * o->slabnum * o->itemsize) / 1024);
 		log_puts("kB maxused = ");
-		log_putu(100 * o->maxused / o->itemnum);
-		log_puts("% allocs = ");
-		log_putu(100 * o->newcnt / o->itemnum);
-		log_puts("%\n");
+		log_putu(o->maxused);
+		log_puts(" in ");
+		log_putu(o->nslab);
+		log_puts(" slabs\n");
 	}
-#endif
+	while ((slab = o->slabs) != NULL) {
+		o->slabs = slab->next;
+		pool_mem -= (unsigned long)o->itemsize * o->slabnum;
+		xfree(slab->data);
+		xfree(slab);
+	}
+	for (i = &pool_list; *i != NULL; i = &(*i)->next) {
+		if (*i == o) {
+			*i = o->next;
+			break;
+		}
+	}
+}
+
+/*
+ * return the magazine of the current thread for the given pool
+ */
+struct poolmag *
+pool_magget(struct pool *o)
+{
+	struct poolmag *m;
+
+	for (m = pool_mags; m != pool_mags + POOL_NMAGS; m++) {
+		if (m->pool == o)
+			return m;
+	}
+	for (m = pool_mags; m != pool_mags + POOL_NMAGS; m++) {
+		if (m->pool == NULL) {
+			m->pool = o;
+			m->first = NULL;
+			m->n = 0;
+			return m;
+		}
+	}
+	log_puts("pool_magget(");
+	log_puts(o->name);
+	log_puts("): too many pools\n");
+	panic();
+	return NULL;
+}
+
+/*
+ * give back the given number of entries of the magazine to its pool
+ */
+void
+pool_magput(struct poolmag *m, unsigned n)
+{
+	struct pool *o = m->pool;
+	struct poolent *e;
+
+	pthread_mutex_lock(&pool_mtx);
+	o->used -= n;
+	for (; n > 0; n--) {
+		e = m->first;
+		m->first = e->next;
+		m->n--;
+		e->next = o->first;
+		o->first = e;
+	}
+	pthread_mutex_unlock(&pool_mtx);
+}
+
+/*
+ * give back all entries of the magazines of the current thread,
+ * must be called by worker threads before they exit
+ */
+void
+pool_magflush(void)
+{
+	struct poolmag *m;
+
+	for (m = pool_mags; m != pool_mags + POOL_NMAGS; m++) {
+		if (m->pool == NULL)
+			continue;
+		pool_magput(m, m->n);
+		m->pool = NULL;
+	}
+}
+
+/*
+ * allocate an entry from the magazine of the current thread. If it's
+ * empty, refill it from the pool. Entries in magazines are accounted
+ * as used
+ */
+struct poolent *
+pool_magnew(struct pool *o)
+{
+	struct poolmag *m;
+	struct poolent *e;
+
+	m = pool_magget(o);
+	if (m->first == NULL) {
+		pthread_mutex_lock(&pool_mtx);
+		while (m->n < POOL_MAGSIZE) {
+			if (!o->first)
+				pool_grow(o);
+			e = o->first;
+			o->first = e->next;
+			e->next = m->first;
+			m->first = e;
+			m->n++;
+		}
+		o->used += POOL_MAGSIZE;
+		if (o->used > o->maxused)
+			o->maxused = o->used;
+		pthread_mutex_unlock(&pool_mtx);
+	}
+	e = m->first;
+	m->first = e->next;
+	m->n--;
+	return e;
+}
+
+/*
+ * free an entry to the magazine of the current thread. If it holds
+ * too many entries, give half of them back to the pool
+ */
+void
+pool_magdel(struct pool *o, struct poolent *e)
+{
+	struct poolmag *m;
+
+	m = pool_magget(o);
+	e->next = m->first;
+	m->first = e;
+	m->n++;
+	if (m->n >= 2 * POOL_MAGSIZE)
+		pool_magput(m, POOL_MAGSIZE);
 }
 
 /*
@@ -117,25 +302,26 @@ pool_new(struct pool *o)
 
 	struct poolent *e;
 
-	if (!o->first) {
-		log_puts("pool_new(");
-		log_puts(o->name);
-		log_puts("): pool is empty\n");
-		panic();
-	}
-
-	/*
-	 * unlink from the free list
-	 */
-	e = o->first;
-	o->first = e->next;
+	if (pool_mt)
+		e = pool_magnew(o);
+	else {
+		if (!o->first)
+			pool_grow(o);
 
+		/*
+		 * unlink from the free list
+		 */
+		e = o->first;
+		o->first = e->next;
+		o->used++;
+		if (o->used > o->maxused)
+			o->maxused = o->used;
 #ifdef POOL_DEBUG
-	o->newcnt++;
-	o->used++;
-	if (o->used > o->maxused)
-		o->maxused = o->used;
+		o->newcnt++;
+#endif
+	}
 
+#ifdef POOL_DEBUG
 	/*
 	 * overwrite the entry with garbage so any attempt to use
 	 * uninitialized memory will probably segfault
@@ -162,13 +348,12 @@ pool_del(struct pool *o, void *p)
 	 * check if we aren't trying to free more
 	 * entries than the poll size
 	 */
-	if (o->used == 0) {
+	if (!pool_mt && o->used == 0) {
 		log_puts("pool_del(");
 		log_puts(o->name);
 		log_puts("): pool is full\n");
 		panic();
 	}
-	o->used--;
 
 	/*
 	 * overwrite the entry with garbage so any attempt to use a
@@ -178,9 +363,117 @@ pool_del(struct pool *o, void *p)
 	for (i = o->itemsize; i > 0; i--)
 		*(buf++) = 0xdf;
 #endif
+	if (pool_mt) {
+		pool_magdel(o, e);
+		return;
+	}
+	o->used--;
+
 	/*
 	 * link on the free list
 	 */
 	e->next = o->first;
 	o->first = e;
 }
+
+/*
+ * compare slabs by address, for qsort() and bsearch()
+ */
+int
+pool_slabcmp(const void *a, const void *b)
+{
+	unsigned char *pa = (*(struct poolslab **)a)->data;
+	unsigned char *pb = (*(struct poolslab **)b)->data;
+
+	return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+/*
+ * return the slab containing the given entry
+ */
+struct poolslab *
+pool_findslab(struct pool *o, struct poolslab **tab, struct poolent *e)
+{
+	unsigned lo, hi, mid;
+
+	lo = 0;
+	hi = o->nslab;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (tab[mid]->data <= (unsigned char *)e)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return tab[lo];
+}
+
+/*
+ * free slabs whose entries are all free
+ */
+void
+pool_trim(struct pool *o)
+{
+	struct poolslab **tab, *slab, **ps;
+	struct poolent *e, **pe;
+	unsigned i;
+
+	if (o->nslab == 0)
+		return;
+
+	/*
+	 * count free entries of each slab
+	 */
+	tab = xmalloc(o->nslab * sizeof(struct poolslab *), "pooltab");
+	for (i = 0, slab = o->slabs; slab != NULL; slab = slab->next) {
+		slab->nfree = 0;
+		tab[i++] = slab;
+	}
+	qsort(tab, o->nslab, sizeof(struct poolslab *), pool_slabcmp);
+	for (e = o->first; e != NULL; e = e->next)
+		pool_findslab(o, tab, e)->nfree++;
+
+	/*
+	 * remove entries of free slabs from the free list
+	 */
+	for (pe = &o->first; (e = *pe) != NULL; ) {
+		if (pool_findslab(o, tab, e)->nfree == o->slabnum)
+			*pe = e->next;
+		else
+			pe = &e->next;
+	}
+	xfree(tab);
+
+	/*
+	 * free them
+	 */
+	for (ps = &o->slabs; (slab = *ps) != NULL; ) {
+		if (slab->nfree == o->slabnum) {
+			*ps = slab->next;
+			o->nslab--;
+			pool_mem -= (unsigned long)o->itemsize * o->slabnum;
+			xfree(slab->data);
+			xfree(slab);
+		} else
+			ps = &slab->next;
+	}
+	o->trimfree = o->nslab * o->slabnum - o->used;
+}
+
+/*
+ * trim pools with at least two slabs worth of free entries more than
+ * after their last trim. Called by the interpreter after each
+ * command, to give memory back to the system after large deletions
+ */
+void
+pool_gc(void)
+{
+	struct pool *o;
+	unsigned nfree;
+
+	for (o = pool_list; o != NULL; o = o->next) {
+		nfree = o->nslab * o->slabnum - o->used;
+		if (nfree >= o->trimfree + 2 * o->slabnum)
+			pool_trim(o);
+	}
+}
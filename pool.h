@@ -27,26 +27,47 @@ struct poolent {
 };
 
 /*
- * the pool is a linked list of 'itemnum' blocks of size
- * 'itemsize'. The pool name is for debugging prurposes only
+ * a block of 'slabnum' entries, allocated when the pool is empty
+ */
+struct poolslab {
+	struct poolslab *next;	/* next slab of the pool */
+	unsigned char *data;	/* memory block of the entries */
+	unsigned nfree;		/* free entries, used by pool_trim() */
+};
+
+/*
+ * the pool is a linked list of free entries of size 'itemsize',
+ * taken from slabs of 'slabnum' entries. The pool name is for
+ * debugging and statistics purposes only
  */
 struct pool {
-	unsigned char *data;	/* memory block of the pool */
+	struct poolslab *slabs;	/* memory blocks of the pool */
 	struct poolent *first;	/* head of linked list */
-#ifdef POOL_DEBUG
-	unsigned maxused;	/* max pool usage */
+	struct pool *next;	/* next pool in pool_list */
+	unsigned nslab;		/* number of slabs */
+	unsigned slabnum;	/* number of entries per slab */
 	unsigned used;		/* current pool usage */
+	unsigned maxused;	/* max pool usage */
+	unsigned trimfree;	/* free entries after the last trim */
+#ifdef POOL_DEBUG
 	unsigned newcnt;	/* current items allocated */
 #endif
-	unsigned itemnum;	/* total number of entries */
 	unsigned itemsize;	/* size of a sigle entry */
 	char *name;		/* name of the pool */
 };
 
+extern struct pool *pool_list;
+extern unsigned long pool_maxmem;
+extern unsigned pool_overflow;
+extern unsigned pool_mt;
+
 void  pool_init(struct pool *, char *, unsigned, unsigned);
 void  pool_done(struct pool *);
 
 void *pool_new(struct pool *);
 void  pool_del(struct pool *, void *);
+void  pool_trim(struct pool *);
+void  pool_gc(void);
+void  pool_magflush(void);
 
 #endif /* MIDISH_POOL_H */
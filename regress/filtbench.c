@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * filter micro-benchmark: compare filt_do(), which uses compiled
+ * rules, with filt_scan(), which walks the rule lists. The filter
+ * has keyboard splits and layers on several devices, controller
+ * remaps, velocity curves and transpositions. Random voice events
+ * are passed through both and the output events are checked to be
+ * the same, then the time per event of each is measured.
+ *
+ * usage: filtbench [nevents]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "ev.h"
+#include "filt.h"
+
+#define NDEVS		4
+
+unsigned long seed;
+
+/*
+ * needed by utils.c and ev.c
+ */
+void
+tty_write(void *buf, size_t len)
+{
+	fwrite(buf, 1, len, stderr);
+}
+
+void
+cons_err(char *mesg)
+{
+	fprintf(stderr, "%s\n", mesg);
+}
+
+/*
+ * deterministic pseudo-random numbers
+ */
+unsigned
+bench_rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fffffff;
+}
+
+void
+spec_set(struct evspec *es, unsigned cmd, unsigned dev, unsigned ch,
+    unsigned v0_min, unsigned v0_max)
+{
+	evspec_reset(es);
+	es->cmd = cmd;
+	es->dev_min = es->dev_max = dev;
+	es->ch_min = es->ch_max = ch;
+	if (evinfo[cmd].nparams > 0) {
+		es->v0_min = v0_min;
+		es->v0_max = v0_max;
+	}
+}
+
+/*
+ * build a filter with 32 map rules: on each device, a keyboard
+ * split and a layer, plus controllers routed to other channels
+ */
+void
+filt_setup(struct filt *f)
+{
+	struct evspec from, to;
+	unsigned dev;
+
+	filt_init(f);
+	for (dev = 0; dev < NDEVS; dev++) {
+		spec_set(&from, EVSPEC_NOTE, dev, 0, 0, 59);
+		spec_set(&to, EVSPEC_NOTE, 0, 2 * dev, 0, 59);
+		filt_mapnew(f, &from, &to);
+		spec_set(&from, EVSPEC_NOTE, dev, 0, 60, 127);
+		spec_set(&to, EVSPEC_NOTE, 1, 2 * dev, 60, 127);
+		filt_mapnew(f, &from, &to);
+		spec_set(&to, EVSPEC_NOTE, 1, 2 * dev + 1, 60, 127);
+		filt_mapnew(f, &from, &to);
+		spec_set(&from, EVSPEC_XCTL, dev, 0, 1, 1);
+		spec_set(&to, EVSPEC_XCTL, 0, 2 * dev, 1, 1);
+		filt_mapnew(f, &from, &to);
+		spec_set(&from, EVSPEC_XCTL, dev, 0, 7, 7);
+		spec_set(&to, EVSPEC_XCTL, 1, 2 * dev, 11, 11);
+		filt_mapnew(f, &from, &to);
+		spec_set(&from, EVSPEC_XCTL, dev, 0, 64, 64);
+		spec_set(&to, EVSPEC_XCTL, 0, 2 * dev, 64, 64);
+		filt_mapnew(f, &from, &to);
+		spec_set(&from, EVSPEC_BEND, dev, 0, 0, 0);
+		spec_set(&to, EVSPEC_BEND, 0, 2 * dev, 0, 0);
+		filt_mapnew(f, &from, &to);
+		spec_set(&from, EVSPEC_ANY, dev, 1, 0, 0);
+		spec_set(&to, EVSPEC_ANY, 1, 15 - dev, 0, 0);
+		filt_mapnew(f, &from, &to);
+		spec_set(&from, EVSPEC_NOTE, 0, 2 * dev, 0, 127);
+		filt_vcurve(f, &from, 20 + dev);
+		spec_set(&from, EVSPEC_NOTE, 1, 2 * dev + 1, 0, 127);
+		filt_transp(f, &from, 12);
+	}
+}
+
+/*
+ * generate a random input event
+ */
+void
+bench_ev(struct ev *ev)
+{
+	ev->dev = bench_rand() % (NDEVS + 1);
+	ev->ch = bench_rand() % 2;
+	switch (bench_rand() % 8) {
+	case 0:
+		ev->cmd = EV_XCTL;
+		ev->ctl_num = bench_rand() % 2 ? 7 : 1;
+		ev->ctl_val = bench_rand() % (EV_MAXFINE + 1);
+		break;
+	case 1:
+		ev->cmd = EV_BEND;
+		ev->bend_val = bench_rand() % (EV_MAXFINE + 1);
+		break;
+	case 2:
+		ev->cmd = EV_CAT;
+		ev->cat_val = bench_rand() % (EV_MAXCOARSE + 1);
+		break;
+	default:
+		ev->cmd = bench_rand() % 2 ? EV_NON : EV_NOFF;
+		ev->note_num = bench_rand() % (EV_MAXCOARSE + 1);
+		ev->note_vel = 1 + bench_rand() % EV_MAXCOARSE;
+		break;
+	}
+}
+
+double
+bench_run(unsigned (*func)(struct filt *, struct ev *, struct ev *),
+    struct filt *f, struct ev *evs, unsigned n, unsigned long *nout)
+{
+	struct timespec ts0, ts1;
+	struct ev out[FILT_MAXNRULES];
+	unsigned i;
+
+	*nout = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < n; i++)
+		*nout += func(f, &evs[i], out);
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	return (ts1.tv_sec - ts0.tv_sec) * 1e9 +
+	    (ts1.tv_nsec - ts0.tv_nsec);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct filt f;
+	struct ev *evs, out1[FILT_MAXNRULES], out2[FILT_MAXNRULES];
+	unsigned i, j, n, n1, n2;
+	unsigned long nout1, nout2;
+	double ns;
+
+	n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	if (n == 0) {
+		fprintf(stderr, "usage: filtbench [nevents]\n");
+		return 1;
+	}
+	evs = xmalloc(n * sizeof(struct ev), "filtbench");
+	seed = 1;
+	for (i = 0; i < n; i++)
+		bench_ev(&evs[i]);
+	filt_setup(&f);
+
+	for (i = 0; i < n; i++) {
+		n1 = filt_scan(&f, &evs[i], out1);
+		n2 = filt_do(&f, &evs[i], out2);
+		for (j = 0; j < n1; j++) {
+			if (!ev_eq(&out1[j], &out2[j]))
+				break;
+		}
+		if (n1 != n2 || j < n1) {
+			fprintf(stderr, "event %u: outputs differ\n", i);
+			return 1;
+		}
+	}
+
+	ns = bench_run(filt_scan, &f, evs, n, &nout1);
+	printf("scan:     %lu events out, %.1f ns/event\n", nout1, ns / n);
+	ns = bench_run(filt_do, &f, evs, n, &nout2);
+	printf("compiled: %lu events out, %.1f ns/event\n", nout2, ns / n);
+	if (nout1 != nout2)
+		return 1;
+	filt_done(&f);
+	xfree(evs);
+	return 0;
+}
@@ -0,0 +1,40 @@
+#
+# midish (unknown release)
+#
+{
+	format 1
+	tics_per_unit 96
+	tempo_factor 256
+	meta {
+		timesig 4 24
+		tempo 500000
+	}
+	songfilt f {
+		filt {
+			transp note {0 0} 0..127 12
+			vcurve note {0 1} 0..127 10
+			vmap note {0 2} 0..127 {
+				0 127 126 125 124 123 122 121 120 119 118 117 116 115 114 113
+				112 111 110 109 108 107 106 105 104 103 102 101 100 99 98 97
+				96 95 94 93 92 91 90 89 88 87 86 85 84 83 82 81
+				80 79 78 77 76 75 74 73 72 71 70 69 68 67 66 65
+				64 63 62 61 60 59 58 57 56 55 54 53 52 51 50 49
+				48 47 46 45 44 43 42 41 40 39 38 37 36 35 34 33
+				32 31 30 29 28 27 26 25 24 23 22 21 20 19 18 17
+				16 15 14 13 12 11 10 9 8 7 6 5 4 3 2 1
+			}
+		}
+	}
+	curfilt f
+	curpos 0
+	curlen 0
+	curquant 0
+	curev any {0..15 0..15}
+	metro {
+		mask	rec
+		lo	non {0 9} 68 90
+		hi	non {0 9} 67 127
+	}
+	tap off
+	tapev none
+}
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * MIDI input parser test and benchmark.
+ *
+ * First, random byte streams are fed, split at random places, to
+ * mididev_inputcb() and to the byte-by-byte parser it replaced, and
+ * the events and sysex messages they produce are checked to be the
+ * same. Then the throughput of both parsers is measured on the given
+ * captured byte stream (raw MIDI bytes, as read from the device), or
+ * if none is given on a synthetic stream of 14-bit controllers, as
+ * sent by a bank of motorized faders.
+ *
+ * usage: inbench [capture_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "defs.h"
+#include "ev.h"
+#include "sysex.h"
+#include "mididev.h"
+
+#define LOGMAX		0x10000
+#define FUZZ_NITER	2000
+#define FUZZ_LEN	4096
+#define BENCH_LEN	(1024 * 1024)
+
+/*
+ * same as in mididev.c
+ */
+#define MIDI_SYSEXSTART	0xf0
+#define MIDI_QFRAME	0xf1
+#define MIDI_SYSEXSTOP	0xf7
+#define MIDI_TIC	0xf8
+#define MIDI_START	0xfa
+#define MIDI_STOP	0xfc
+#define MIDI_ACK	0xfe
+
+extern unsigned mididev_evlen[];
+#define MIDIDEV_EVLEN(status) (mididev_evlen[((status) >> 4) & 7])
+
+/*
+ * log of events produced by the parser, if logging is disabled
+ * (benchmark), only count them
+ */
+unsigned inlog[LOGMAX], inlog_used, inlog_enabled;
+unsigned long nev;
+unsigned seed;
+
+/*
+ * stubs for the functions called by mididev.c
+ */
+unsigned mux_isopen = 0;
+unsigned rt_running = 0;
+
+void
+inlog_put(unsigned a, unsigned b, unsigned c, unsigned d)
+{
+	nev++;
+	if (!inlog_enabled || inlog_used + 4 > LOGMAX)
+		return;
+	inlog[inlog_used++] = a;
+	inlog[inlog_used++] = b;
+	inlog[inlog_used++] = c;
+	inlog[inlog_used++] = d;
+}
+
+void
+mux_evcb(unsigned unit, struct ev *ev)
+{
+	unsigned v1;
+
+	/*
+	 * v1 is not set for bend and 1-byte messages
+	 */
+	v1 = (ev->cmd == EV_BEND || ev->cmd == EV_PC || ev->cmd == EV_CAT) ?
+	    0 : ev->v1;
+	inlog_put(ev->cmd, ev->ch, ev->v0, v1);
+}
+
+void
+mux_sysexcb(unsigned unit, struct sysex *x)
+{
+	struct chunk *ck;
+	unsigned i, len, sum;
+
+	len = sum = 0;
+	for (ck = x->first; ck != NULL; ck = ck->next) {
+		for (i = 0; i < ck->used; i++)
+			sum = sum * 31 + ck->data[i];
+		len += ck->used;
+	}
+	inlog_put(0x100, len, sum, 0);
+	sysex_del(x);
+}
+
+void mux_ticcb(void) { inlog_put(MIDI_TIC, 0, 0, 0); }
+void mux_startcb(void) { inlog_put(MIDI_START, 0, 0, 0); }
+void mux_stopcb(void) { inlog_put(MIDI_STOP, 0, 0, 0); }
+void mux_ackcb(unsigned unit) { inlog_put(MIDI_ACK, 0, 0, 0); }
+void mux_mtcstart(unsigned pos) {}
+void mux_mtcstop(void) {}
+void mux_mtctick(unsigned delta) {}
+void mux_mdep_register(struct mididev *dev) {}
+void mux_mdep_unregister(struct mididev *dev) {}
+unsigned long long mux_outtime(void) { return 0; }
+void rt_put(struct mididev *dev, unsigned char *buf, unsigned len,
+    unsigned long long time) {}
+void rt_poll(struct mididev *dev) {}
+void cons_err(char *mesg) {}
+void cons_erru(unsigned long num, char *mesg) {}
+
+void
+tty_write(void *buf, size_t len)
+{
+	fwrite(buf, 1, len, stderr);
+}
+
+/*
+ * the byte-by-byte parser, as it was before runs of voice messages
+ * and sysex data were decoded in bulk
+ */
+void
+ref_inputcb(struct mididev *o, unsigned char *buf, unsigned count)
+{
+	struct ev ev;
+	unsigned data;
+
+	while (count != 0) {
+		data = *buf;
+		count--;
+		buf++;
+		if (data >= 0xf8) {
+			switch(data) {
+			case MIDI_TIC:
+				if (o == mididev_clksrc)
+					mux_ticcb();
+				break;
+			case MIDI_START:
+				if (o == mididev_clksrc) {
+					o->ticdelta = o->ticrate;
+					mux_startcb();
+				}
+				break;
+			case MIDI_STOP:
+				if (o == mididev_clksrc)
+					mux_stopcb();
+				break;
+			case MIDI_ACK:
+				mux_ackcb(o->unit);
+				break;
+			}
+		} else if (data >= 0x80) {
+			o->istatus = data;
+			o->icount = 0;
+			switch(data) {
+			case MIDI_SYSEXSTART:
+				if (o->isysex)
+					sysex_del(o->isysex);
+				o->isysex = sysex_new(o->unit);
+				sysex_add(o->isysex, data);
+				break;
+			case MIDI_SYSEXSTOP:
+				if (o->isysex) {
+					sysex_add(o->isysex, data);
+					mux_sysexcb(o->unit, o->isysex);
+					o->isysex = NULL;
+				}
+				o->istatus = 0;
+				break;
+			default:
+				if (o->isysex) {
+					sysex_del(o->isysex);
+					o->isysex = NULL;
+				}
+				break;
+			}
+		} else if (o->istatus >= 0x80 && o->istatus < 0xf0) {
+			o->idata[o->icount] = (unsigned char)data;
+			o->icount++;
+
+			if (o->icount == MIDIDEV_EVLEN(o->istatus)) {
+				o->icount = 0;
+				ev.cmd = o->istatus >> 4;
+				ev.dev = o->unit;
+				ev.ch = o->istatus & 0x0f;
+				if (ev.cmd == EV_NON && o->idata[1] == 0) {
+					ev.cmd = EV_NOFF;
+					ev.note_num = o->idata[0];
+					ev.note_vel = EV_NOFF_DEFAULTVEL;
+				} else if (ev.cmd == EV_BEND) {
+					ev.bend_val = ((unsigned)o->idata[1] << 7) + o->idata[0];
+				} else {
+					ev.v0 = o->idata[0];
+					ev.v1 = o->idata[1];
+				}
+				mux_evcb(o->unit, &ev);
+			}
+		} else if (o->istatus == MIDI_SYSEXSTART) {
+			sysex_add(o->isysex, data);
+		} else if (o->istatus == MIDI_QFRAME) {
+			o->istatus = 0;
+		}
+	}
+}
+
+unsigned
+inbench_rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+/*
+ * generate a random stream, mostly made of data bytes to get long
+ * runs of voice messages and sysex data
+ */
+void
+inbench_gen(unsigned char *buf, unsigned len)
+{
+	static unsigned char sys[] = {
+		0xf0, 0xf7, 0xf1, 0xf8, 0xfa, 0xfc, 0xfe, 0xf2, 0xf9
+	};
+	unsigned i, r;
+
+	for (i = 0; i < len; i++) {
+		r = inbench_rand() % 100;
+		if (r < 8)
+			buf[i] = 0x80 | (inbench_rand() & 0x7f);
+		else if (r < 10)
+			buf[i] = sys[inbench_rand() % sizeof(sys)];
+		else
+			buf[i] = inbench_rand() & 0x7f;
+	}
+}
+
+/*
+ * feed the given buffer to the given parser, in random sized pieces
+ */
+void
+inbench_feed(void (*cb)(struct mididev *, unsigned char *, unsigned),
+    struct mididev *dev, unsigned char *buf, unsigned len)
+{
+	unsigned n;
+
+	while (len > 0) {
+		n = 1 + inbench_rand() % 300;
+		if (n > len)
+			n = len;
+		cb(dev, buf, n);
+		buf += n;
+		len -= n;
+	}
+}
+
+void
+inbench_devinit(struct mididev *dev, struct devops *ops)
+{
+	mididev_init(dev, ops, MIDIDEV_MODE_IN);
+	dev->icount = 0;
+	mididev_clksrc = dev;
+}
+
+/*
+ * check that both parsers give the same result
+ */
+int
+inbench_fuzz(void)
+{
+	static struct devops ops;
+	static unsigned char buf[FUZZ_LEN];
+	static unsigned reflog[LOGMAX];
+	struct mididev dev, refdev;
+	unsigned i, s, refused;
+
+	inlog_enabled = 1;
+	for (i = 0; i < FUZZ_NITER; i++) {
+		seed = i;
+		inbench_gen(buf, FUZZ_LEN);
+		s = seed;
+
+		inlog_used = 0;
+		inbench_devinit(&refdev, &ops);
+		inbench_feed(ref_inputcb, &refdev, buf, FUZZ_LEN);
+		refused = inlog_used;
+		memcpy(reflog, inlog, refused * sizeof(unsigned));
+
+		seed = s;
+		inlog_used = 0;
+		inbench_devinit(&dev, &ops);
+		inbench_feed(mididev_inputcb, &dev, buf, FUZZ_LEN);
+
+		if (inlog_used != refused ||
+		    memcmp(inlog, reflog, refused * sizeof(unsigned)) != 0 ||
+		    dev.istatus != refdev.istatus ||
+		    dev.icount != refdev.icount) {
+			fprintf(stderr, "fuzz: iteration %u: mismatch\n", i);
+			return 0;
+		}
+		if (dev.isysex)
+			sysex_del(dev.isysex);
+		if (refdev.isysex)
+			sysex_del(refdev.isysex);
+	}
+	printf("fuzz: %u streams of %u bytes, ok\n", FUZZ_NITER, FUZZ_LEN);
+	return 1;
+}
+
+/*
+ * synthetic capture: 16 faders on 16 channels, each sending 14-bit
+ * volume (controllers 7 and 39) with running status
+ */
+unsigned
+inbench_faders(unsigned char *buf, unsigned len)
+{
+	unsigned i, ch, val;
+
+	i = 0;
+	while (i + 3 + 4 * 16 <= len) {
+		ch = (i / 67) & 15;
+		buf[i++] = 0xb0 | ch;
+		for (val = 0; val < 16; val++) {
+			buf[i++] = 7;
+			buf[i++] = val;
+			buf[i++] = 39;
+			buf[i++] = (val * 8) & 0x7f;
+		}
+		if ((i & 0x3ff) < 67)
+			buf[i++] = MIDI_ACK;
+	}
+	return i;
+}
+
+double
+inbench_run(void (*cb)(struct mididev *, unsigned char *, unsigned),
+    unsigned char *buf, unsigned len, unsigned nrep)
+{
+	static struct devops ops;
+	struct mididev dev;
+	struct timespec ts0, ts1;
+	unsigned i, off, n;
+	double sec;
+
+	inlog_enabled = 0;
+	nev = 0;
+	inbench_devinit(&dev, &ops);
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < nrep; i++) {
+		/*
+		 * same chunks as returned by read() in mux_mdep_wait()
+		 */
+		for (off = 0; off < len; off += n) {
+			n = len - off < 1024 ? len - off : 1024;
+			cb(&dev, buf + off, n);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	if (dev.isysex)
+		sysex_del(dev.isysex);
+	sec = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+	return (double)len * nrep / sec / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char *buf;
+	unsigned len, nrep;
+	double rate;
+	FILE *f;
+
+	chunk_pool_init(DEFAULT_NCHUNKS);
+	sysex_pool_init(DEFAULT_NSYSEXS);
+	if (!inbench_fuzz())
+		return 1;
+
+	buf = xmalloc(BENCH_LEN, "inbench");
+	if (argc > 1) {
+		f = fopen(argv[1], "rb");
+		if (f == NULL) {
+			perror(argv[1]);
+			return 1;
+		}
+		len = fread(buf, 1, BENCH_LEN, f);
+		fclose(f);
+	} else
+		len = inbench_faders(buf, BENCH_LEN);
+	if (len == 0) {
+		fprintf(stderr, "empty capture\n");
+		return 1;
+	}
+	nrep = 1 + 64 * 1024 * 1024 / len;
+	rate = inbench_run(ref_inputcb, buf, len, nrep);
+	printf("reference: %.1f MB/s, %lu events\n", rate, nev);
+	rate = inbench_run(mididev_inputcb, buf, len, nrep);
+	printf("bulk:      %.1f MB/s, %lu events\n", rate, nev);
+	xfree(buf);
+	return 0;
+}
@@ -0,0 +1,4 @@
+load "note.sng"
+g 0
+p
+s
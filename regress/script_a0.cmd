@@ -0,0 +1,26 @@
+proc note type i {
+	return {$type {0 0} (48 + $i * 2) (100 - $i)}
+}
+proc sum ... {
+	let s = 0
+	for i in ... {
+		let s = $s + $i
+	}
+	return $s
+}
+proc put i key {
+	taddev ($i / 4) ($i % 4) 0 [note non $key]
+	taddev ($i / 4) ($i % 4) ($i * 4 % 12 + 6) [note noff $key]
+}
+proc fill l {
+	for i in $l {
+		if $i % 3 == 0 && $i != 0 {
+			put $i [sum $i 1 2]
+		} else {
+			put $i $i
+		}
+	}
+}
+tnew t
+fill {0 1 2 3 4 5 6 7 8 9}
+ct nil
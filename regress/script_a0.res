@@ -0,0 +1,67 @@
+#
+# midish (unknown release)
+#
+{
+	format 1
+	tics_per_unit 96
+	tempo_factor 256
+	meta {
+		timesig 4 24
+		tempo 500000
+	}
+	songtrk t {
+		mute 0
+		track {
+			non {0 0} 48 100
+			6
+			noff {0 0} 48 100
+			18
+			non {0 0} 50 99
+			10
+			noff {0 0} 50 99
+			14
+			non {0 0} 52 98
+			14
+			noff {0 0} 52 98
+			10
+			non {0 0} 60 94
+			6
+			noff {0 0} 60 94
+			18
+			non {0 0} 56 96
+			10
+			noff {0 0} 56 96
+			14
+			non {0 0} 58 95
+			14
+			noff {0 0} 58 95
+			10
+			non {0 0} 66 91
+			6
+			noff {0 0} 66 91
+			18
+			non {0 0} 62 93
+			10
+			noff {0 0} 62 93
+			14
+			non {0 0} 64 92
+			14
+			noff {0 0} 64 92
+			10
+			non {0 0} 72 88
+			6
+			noff {0 0} 72 88
+		}
+	}
+	curpos 0
+	curlen 0
+	curquant 0
+	curev any {0..15 0..15}
+	metro {
+		mask	rec
+		lo	non {0 9} 68 90
+		hi	non {0 9} 67 127
+	}
+	tap off
+	tapev none
+}
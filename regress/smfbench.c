@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * standard midi file import benchmark: generate a corpus of format 0
+ * and format 1 files of increasing density, then measure the time
+ * song_importsmf() takes to load them and song_exportsmf() takes to
+ * save them back. Files contain notes (with
+ * running status and zero-velocity note-offs), controllers, bank and
+ * program changes, NRPNs, pitch bends, aftertouch, tempo and time
+ * signature changes, text meta events and sysex messages.
+ *
+ * usage: smfbench [nfiles [dir]]
+ *
+ * If a directory is given, the corpus is written there and kept,
+ * else it's created in a temporary directory and removed at exit.
+ */
+
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "utils.h"
+#include "defs.h"
+#include "ev.h"
+#include "track.h"
+#include "frame.h"
+#include "state.h"
+#include "sysex.h"
+#include "song.h"
+#include "smf.h"
+
+#define NDENS		3	/* number of density classes */
+#define MAXLEN		(1 << 22)
+
+unsigned bench_dens[NDENS] = {1, 8, 64};	/* events per beat */
+char *bench_densname[NDENS] = {"sparse", "medium", "dense"};
+
+unsigned char *buf;
+unsigned used;
+unsigned long seed;
+
+/*
+ * deterministic pseudo-random numbers
+ */
+unsigned
+bench_rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fffffff;
+}
+
+void
+put8(unsigned val)
+{
+	if (used < MAXLEN)
+		buf[used++] = val;
+}
+
+void
+put16(unsigned val)
+{
+	put8(val >> 8);
+	put8(val & 0xff);
+}
+
+void
+put32(unsigned val)
+{
+	put16(val >> 16);
+	put16(val & 0xffff);
+}
+
+void
+putvar(unsigned val)
+{
+	unsigned bits;
+
+	for (bits = 28; bits > 0; bits -= 7) {
+		if (val >= (1U << bits))
+			put8(((val >> bits) & 0x7f) | 0x80);
+	}
+	put8(val & 0x7f);
+}
+
+/*
+ * put a voice event, using running status if possible
+ */
+void
+putvoice(unsigned *status, unsigned delta, unsigned st, unsigned v0, int v1)
+{
+	putvar(delta);
+	if (st != *status) {
+		put8(st);
+		*status = st;
+	}
+	put8(v0);
+	if (v1 >= 0)
+		put8(v1);
+}
+
+/*
+ * generate a track of 'nbeats' beats, with 'dens' events per beat
+ * on the given channels
+ */
+void
+gentrack(unsigned nbeats, unsigned dens, unsigned chmin, unsigned chmax,
+    int meta)
+{
+	unsigned start, status, tic, last, i, ch, note, b, n;
+	unsigned char on[16][128];
+
+	memset(on, 0, sizeof(on));
+	put8('M');
+	put8('T');
+	put8('r');
+	put8('k');
+	start = used;
+	put32(0);
+	status = 0;
+	last = 0;
+	if (meta) {
+		putvar(0);
+		put8(0xff);
+		put8(0x03);
+		put8(4);
+		put8('b');
+		put8('e');
+		put8('n');
+		put8('c');
+		putvar(0);
+		put8(0xff);
+		put8(0x58);
+		put8(4);
+		put8(4);
+		put8(2);
+		put8(24);
+		put8(8);
+		putvar(0);
+		put8(0xf0);
+		putvar(5);
+		put8(0x7e);
+		put8(0x7f);
+		put8(0x09);
+		put8(0x01);
+		put8(0xf7);
+		status = 0;
+	}
+	for (b = 0; b < nbeats; b++) {
+		if (meta && b % 64 == 0) {
+			putvar(b * 96 - last);
+			last = b * 96;
+			put8(0xff);
+			put8(0x51);
+			put8(3);
+			n = 400000 + bench_rand() % 200000;
+			put8(n >> 16);
+			put8((n >> 8) & 0xff);
+			put8(n & 0xff);
+			status = 0;
+		}
+		for (i = 0; i < dens; i++) {
+			tic = b * 96 + (i * 96 / dens);
+			ch = chmin + bench_rand() % (chmax - chmin + 1);
+			switch (bench_rand() % 16) {
+			case 0:
+				putvoice(&status, tic - last,
+				    0xb0 + ch, bench_rand() % 2 ? 1 : 7,
+				    bench_rand() % 128);
+				break;
+			case 1:
+				putvoice(&status, tic - last,
+				    0xe0 + ch, bench_rand() % 128,
+				    bench_rand() % 128);
+				break;
+			case 2:
+				putvoice(&status, tic - last,
+				    0xd0 + ch, bench_rand() % 128, -1);
+				break;
+			case 3:
+				putvoice(&status, tic - last,
+				    0xb0 + ch, 0, bench_rand() % 4);
+				putvoice(&status, 0,
+				    0xc0 + ch, bench_rand() % 128, -1);
+				break;
+			case 4:
+				putvoice(&status, tic - last,
+				    0xb0 + ch, 99, 1);
+				putvoice(&status, 0, 0xb0 + ch, 98, 8);
+				putvoice(&status, 0, 0xb0 + ch, 6,
+				    bench_rand() % 128);
+				break;
+			default:
+				note = bench_rand() % 128;
+				if (on[ch][note]) {
+					putvoice(&status, tic - last,
+					    0x90 + ch, note, 0);
+					on[ch][note] = 0;
+				} else {
+					putvoice(&status, tic - last,
+					    0x90 + ch, note,
+					    1 + bench_rand() % 127);
+					on[ch][note] = 1;
+				}
+			}
+			last = tic;
+		}
+	}
+	for (ch = chmin; ch <= chmax; ch++) {
+		for (note = 0; note < 128; note++) {
+			if (on[ch][note]) {
+				putvoice(&status, 0, 0x80 + ch, note, 64);
+				on[ch][note] = 0;
+			}
+		}
+	}
+	putvar(nbeats * 96 - last);
+	put8(0xff);
+	put8(0x2f);
+	put8(0);
+	n = used - start - 4;
+	buf[start] = n >> 24;
+	buf[start + 1] = (n >> 16) & 0xff;
+	buf[start + 2] = (n >> 8) & 0xff;
+	buf[start + 3] = n & 0xff;
+}
+
+/*
+ * generate the given file, return the number of bytes written
+ */
+unsigned
+genfile(char *path, unsigned format, unsigned ntrks, unsigned dens)
+{
+	FILE *f;
+	unsigned i, nbeats;
+
+	used = 0;
+	nbeats = 64 + bench_rand() % 256;
+	put8('M');
+	put8('T');
+	put8('h');
+	put8('d');
+	put32(6);
+	put16(format);
+	put16(format == 0 ? 1 : ntrks);
+	put16(24);
+	if (format == 0)
+		gentrack(nbeats, dens * ntrks, 0, 15, 1);
+	else {
+		for (i = 0; i < ntrks; i++)
+			gentrack(nbeats, dens, i, i, i == 0);
+	}
+	f = fopen(path, "w");
+	if (f == NULL || fwrite(buf, 1, used, f) != used) {
+		perror(path);
+		exit(1);
+	}
+	fclose(f);
+	return used;
+}
+
+int
+main(int argc, char **argv)
+{
+	char tmpl[] = "/tmp/smfbench.XXXXXX", path[PATH_MAX], *dir;
+	struct timespec ts0, ts1;
+	struct song *s;
+	unsigned nfiles, i, d, fmt, ntrks, *size;
+	unsigned long bytes[NDENS], nerr;
+	double ms[NDENS], ems[NDENS];
+
+	nfiles = argc > 1 ? strtoul(argv[1], NULL, 10) : 300;
+	if (nfiles == 0 || argc > 3) {
+		fprintf(stderr, "usage: smfbench [nfiles [dir]]\n");
+		return 1;
+	}
+	if (argc > 2) {
+		dir = argv[2];
+		if (mkdir(dir, 0777) < 0) {
+			perror(dir);
+			return 1;
+		}
+	} else {
+		dir = mkdtemp(tmpl);
+		if (dir == NULL) {
+			perror(tmpl);
+			return 1;
+		}
+	}
+	buf = xmalloc(MAXLEN, "smfbench");
+	size = xmalloc(nfiles * sizeof(unsigned), "smfbench");
+	seed = 1;
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/%05u.mid", dir, i);
+		d = i % NDENS;
+		fmt = (i / NDENS) % 2;
+		ntrks = 1 + bench_rand() % 8;
+		size[i] = genfile(path, fmt, ntrks, bench_dens[d]);
+	}
+
+	evctl_init();
+	seqev_pool_init(DEFAULT_NSEQEVS);
+	state_pool_init(DEFAULT_NSTATES);
+	chunk_pool_init(DEFAULT_NCHUNKS);
+	sysex_pool_init(DEFAULT_NSYSEXS);
+	seqptr_pool_init(DEFAULT_NSEQPTRS);
+	for (d = 0; d < NDENS; d++) {
+		ms[d] = ems[d] = 0;
+		bytes[d] = 0;
+	}
+	nerr = 0;
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/%05u.mid", dir, i);
+		d = i % NDENS;
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
+		s = song_importsmf(path);
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		if (s == NULL) {
+			nerr++;
+			continue;
+		}
+		ms[d] += (ts1.tv_sec - ts0.tv_sec) * 1e3 +
+		    (ts1.tv_nsec - ts0.tv_nsec) / 1e6;
+		snprintf(path, sizeof(path), "%s/%05u.out", dir, i);
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
+		if (!song_exportsmf(s, path))
+			nerr++;
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		ems[d] += (ts1.tv_sec - ts0.tv_sec) * 1e3 +
+		    (ts1.tv_nsec - ts0.tv_nsec) / 1e6;
+		song_delete(s);
+		bytes[d] += size[i];
+	}
+	for (d = 0; d < NDENS; d++) {
+		printf("%-7s %2u ev/beat: %8.1f ms, %6.3f ms/file, %5.1f MB/s\n",
+		    bench_densname[d], bench_dens[d], ms[d],
+		    ms[d] / ((nfiles + NDENS - 1 - d) / NDENS),
+		    bytes[d] / ms[d] / 1e3);
+		printf("%-7s %2u ev/beat: %8.1f ms, %6.3f ms/file (export)\n",
+		    bench_densname[d], bench_dens[d], ems[d],
+		    ems[d] / ((nfiles + NDENS - 1 - d) / NDENS));
+	}
+	if (argc <= 2) {
+		for (i = 0; i < nfiles; i++) {
+			snprintf(path, sizeof(path), "%s/%05u.mid", dir, i);
+			unlink(path);
+			snprintf(path, sizeof(path), "%s/%05u.out", dir, i);
+			unlink(path);
+		}
+		rmdir(dir);
+	}
+	xfree(size);
+	xfree(buf);
+	return nerr > 0;
+}
@@ -0,0 +1,5 @@
+load "note.sng"
+ct t; g 0; sel 4; tcopy; tnew t2; tpaste
+tbatch {t t2} ttransp 2
+tbatch {t t2} tvcurve 10
+u
@@ -0,0 +1,50 @@
+#
+# midish (unknown release)
+#
+{
+	format 1
+	tics_per_unit 96
+	tempo_factor 256
+	meta {
+		timesig 4 24
+		tempo 500000
+	}
+	songtrk t {
+		mute 0
+		track {
+			48
+			non {0 0} 67 100
+			48
+			kat {0 0} 67 123
+			96
+			kat {0 0} 67 124
+			48
+			noff {0 0} 67 100
+		}
+	}
+	songtrk t2 {
+		mute 0
+		track {
+			48
+			non {0 0} 67 100
+			48
+			kat {0 0} 67 123
+			96
+			kat {0 0} 67 124
+			48
+			noff {0 0} 67 100
+		}
+	}
+	curtrk t2
+	curpos 0
+	curlen 4
+	curquant 0
+	curev any {0..15 0..15}
+	metro {
+		mask	rec
+		lo	non {0 9} 68 90
+		hi	non {0 9} 67 127
+	}
+	tap off
+	tapev none
+}
@@ -0,0 +1,24 @@
+proc note pos key len {
+	return {{$pos {non {0 0} $key 100}} {($pos + $len) {noff {0 0} $key 100}}}
+}
+proc arpeggio pos key {
+	let l = {}
+	for i in {0 4 7 12} {
+		let l = [note ($pos + $i * 4) ($key + $i) 90] + $l
+	}
+	return $l
+}
+tnew t
+g 1
+taddevs {{48 {xctl {0 0} 7 1000}} {0 {xpc {0 0} nil 5}}}
+taddevs [arpeggio 96 48]
+taddevs [arpeggio 0 60]
+taddevs {{0 {bend {0 0} 100}} {48 {bend {0 0} 8192}}}
+taddevs [note 0 36 10]
+u
+g 1; sel 2
+let evs = [tgetevs]
+tnew u
+g 4
+taddevs $evs
+g 0; sel 0; ct nil
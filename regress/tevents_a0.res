@@ -0,0 +1,105 @@
+#
+# midish (unknown release)
+#
+{
+	format 1
+	tics_per_unit 96
+	tempo_factor 256
+	meta {
+		timesig 4 24
+		tempo 500000
+	}
+	songtrk t {
+		mute 0
+		track {
+			96
+			bend {0 0} 100 0
+			non {0 0} 60 100
+			xpc {0 0} nil 5
+			16
+			non {0 0} 64 100
+			12
+			non {0 0} 67 100
+			20
+			bend {0 0} 0 64
+			non {0 0} 72 100
+			xctl {0 0} 7 1000 # 7
+			42
+			noff {0 0} 60 100
+			6
+			non {0 0} 48 100
+			10
+			noff {0 0} 64 100
+			6
+			non {0 0} 52 100
+			6
+			noff {0 0} 67 100
+			6
+			non {0 0} 55 100
+			14
+			noff {0 0} 72 100
+			6
+			non {0 0} 60 100
+			42
+			noff {0 0} 48 100
+			16
+			noff {0 0} 52 100
+			12
+			noff {0 0} 55 100
+			20
+			noff {0 0} 60 100
+		}
+	}
+	songtrk u {
+		mute 0
+		track {
+			384
+			bend {0 0} 100 0
+			non {0 0} 60 100
+			xpc {0 0} nil 5
+			16
+			non {0 0} 64 100
+			12
+			non {0 0} 67 100
+			20
+			bend {0 0} 0 64
+			non {0 0} 72 100
+			xctl {0 0} 7 1000 # 7
+			42
+			noff {0 0} 60 100
+			6
+			non {0 0} 48 100
+			10
+			noff {0 0} 64 100
+			6
+			non {0 0} 52 100
+			6
+			noff {0 0} 67 100
+			6
+			non {0 0} 55 100
+			14
+			noff {0 0} 72 100
+			6
+			non {0 0} 60 100
+			42
+			noff {0 0} 48 100
+			16
+			noff {0 0} 52 100
+			12
+			noff {0 0} 55 100
+			20
+			noff {0 0} 60 100
+		}
+	}
+	curpos 0
+	curlen 0
+	curquant 0
+	curev any {0..15 0..15}
+	metro {
+		mask	rec
+		lo	non {0 9} 68 90
+		hi	non {0 9} 67 127
+	}
+	tap off
+	tapev none
+}
@@ -0,0 +1,15 @@
+load "sign2.sng"
+tnew t
+taddev 2 0 0 {xctl {0 0} 7 1}
+g 0; mins 1 {6 8}
+taddev 2 0 0 {xctl {0 0} 7 2}
+taddev 3 1 0 {xctl {0 0} 7 3}
+g 1; sel 1; mcut
+taddev 2 0 0 {xctl {0 0} 7 4}
+g 1; t 60
+taddev 4 1 0 {xctl {0 0} 7 5}
+u; u
+taddev 3 0 0 {xctl {0 0} 7 6}
+g 3; sel 2; tins 1
+taddev 5 0 0 {xctl {0 0} 7 7}
+g 0; sel 0; ct nil; ci nil; co nil
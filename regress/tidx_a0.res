@@ -0,0 +1,43 @@
+#
+# midish (unknown release)
+#
+{
+	format 1
+	tics_per_unit 96
+	tempo_factor 256
+	meta {
+		timesig 6 12
+		tempo 400000
+		72
+		timesig 2 24
+		96
+		timesig 4 24
+	}
+	songtrk t {
+		mute 0
+		track {
+			72
+			xctl {0 0} 7 2 # 0
+			48
+			xctl {0 0} 7 4 # 0
+			xctl {0 0} 7 1 # 0
+			24
+			xctl {0 0} 7 3 # 0
+			120
+			xctl {0 0} 7 6 # 0
+			96
+			xctl {0 0} 7 7 # 0
+		}
+	}
+	curpos 0
+	curlen 0
+	curquant 0
+	curev any {0..15 0..15}
+	metro {
+		mask	rec
+		lo	non {0 9} 68 90
+		hi	non {0 9} 67 127
+	}
+	tap off
+	tapev none
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * timeouts micro-benchmark: compare the timing wheel of timo.c with
+ * the sorted list it replaced. A given number of timeouts is kept
+ * active: each one is rescheduled when it expires, and random ones
+ * are aborted and rescheduled between timer ticks. Both
+ * implementations are checked to call each callback at the right
+ * tick.
+ *
+ * usage: timobench [ntimo [nticks]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "utils.h"
+#include "timo.h"
+
+#define TICK		24000		/* 1ms, in 24-th of microsecond */
+#define MAXDELTA	(2 * 24000000)	/* 2s */
+
+struct bench {
+	void (*add)(struct timo *, unsigned);
+	void (*del)(struct timo *);
+	void (*update)(unsigned);
+	unsigned *abstime;
+};
+
+struct timo *timos;
+struct bench *cur;
+unsigned long nexp, nerr, seed;
+unsigned list_abstime;
+struct timo *list_queue;
+
+/*
+ * the sorted list implementation, as it was before the timing wheel
+ */
+void
+list_add(struct timo *o, unsigned delta)
+{
+	struct timo **i;
+	unsigned val;
+	int diff;
+
+	val = list_abstime + delta;
+	for (i = &list_queue; *i != NULL; i = &(*i)->next) {
+		diff = (*i)->val - val;
+		if (diff > 0) {
+			break;
+		}
+	}
+	o->set = 1;
+	o->val = val;
+	o->next = *i;
+	*i = o;
+}
+
+void
+list_del(struct timo *o)
+{
+	struct timo **i;
+
+	for (i = &list_queue; *i != NULL; i = &(*i)->next) {
+		if (*i == o) {
+			*i = o->next;
+			o->set = 0;
+			return;
+		}
+	}
+}
+
+void
+list_update(unsigned delta)
+{
+	struct timo *to;
+	int diff;
+
+	list_abstime += delta;
+	while (list_queue != NULL) {
+		diff = list_queue->val - list_abstime;
+		if (diff > 0)
+			break;
+		to = list_queue;
+		list_queue = to->next;
+		to->set = 0;
+		to->cb(to->arg);
+	}
+}
+
+/*
+ * needed by utils.c
+ */
+void
+tty_write(void *buf, size_t len)
+{
+	fwrite(buf, 1, len, stderr);
+}
+
+/*
+ * deterministic pseudo-random numbers, same sequence for both
+ * implementations
+ */
+unsigned
+bench_rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fffffff;
+}
+
+/*
+ * called on expiration: check we're called at the right tick and
+ * reschedule
+ */
+void
+bench_cb(void *arg)
+{
+	struct timo *o = arg;
+	int late;
+
+	late = *cur->abstime - o->val;
+	if (late < 0 || late >= TICK)
+		nerr++;
+	nexp++;
+	cur->add(o, 1 + bench_rand() % MAXDELTA);
+}
+
+double
+bench_run(struct bench *b, unsigned ntimo, unsigned nticks)
+{
+	struct timespec ts0, ts1;
+	struct timo *o;
+	unsigned i, j;
+
+	cur = b;
+	seed = 1;
+	nexp = nerr = 0;
+	for (i = 0; i < ntimo; i++) {
+		timo_set(&timos[i], bench_cb, &timos[i]);
+		b->add(&timos[i], 1 + bench_rand() % MAXDELTA);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < nticks; i++) {
+		for (j = 0; j < 10; j++) {
+			o = &timos[bench_rand() % ntimo];
+			b->del(o);
+			b->add(o, 1 + bench_rand() % MAXDELTA);
+		}
+		b->update(TICK);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (i = 0; i < ntimo; i++)
+		b->del(&timos[i]);
+	return (ts1.tv_sec - ts0.tv_sec) * 1e3 +
+	    (ts1.tv_nsec - ts0.tv_nsec) / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench list = {list_add, list_del, list_update, &list_abstime};
+	struct bench wheel = {timo_add, timo_del, timo_update, &timo_abstime};
+	unsigned ntimo, nticks;
+	unsigned long lexp;
+	double ms;
+
+	ntimo = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+	nticks = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+	if (ntimo == 0) {
+		fprintf(stderr, "usage: timobench [ntimo [nticks]]\n");
+		return 1;
+	}
+	timos = xmalloc(ntimo * sizeof(struct timo), "timobench");
+
+	timo_init();
+	ms = bench_run(&wheel, ntimo, nticks);
+	timo_done();
+	printf("wheel: %lu expired, %lu errors, %.1f ms, %.1f us/tick\n",
+	    nexp, nerr, ms, 1000 * ms / nticks);
+	if (nerr > 0)
+		return 1;
+	lexp = nexp;
+
+	list_queue = NULL;
+	list_abstime = 0;
+	ms = bench_run(&list, ntimo, nticks);
+	printf("list:  %lu expired, %lu errors, %.1f ms, %.1f us/tick\n",
+	    nexp, nerr, ms, 1000 * ms / nticks);
+	if (nerr > 0 || nexp != lexp)
+		return 1;
+	xfree(timos);
+	return 0;
+}
@@ -0,0 +1,18 @@
+proc note pos key len {
+	return {{$pos {non {0 0} $key 100}} {($pos + $len) {noff {0 0} $key 100}}}
+}
+proc notes {
+	let l = {}
+	for i in {0 1 2 3 4 5 6 7 8 9} {
+		for j in {0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19} {
+			let l = [note (($i * 20 + $j) * 24 + 5) 60 12] + $l
+		}
+	}
+	return $l
+}
+load "note.sng"
+tnew t2; g 0; sel 0
+taddevs [notes]
+g 0; sel 200; setq 24; tquanta 100; u
+g 0; sel 0; setq nil
+g 0; sel 0; ct nil; ci nil; co nil
@@ -0,0 +1,842 @@
+#
+# midish (unknown release)
+#
+{
+	format 1
+	tics_per_unit 96
+	tempo_factor 256
+	meta {
+		timesig 4 24
+		tempo 500000
+	}
+	songtrk t {
+		mute 0
+		track {
+			48
+			non {0 0} 65 100
+			48
+			kat {0 0} 65 123
+			96
+			kat {0 0} 65 124
+			48
+			noff {0 0} 65 100
+			48
+		}
+	}
+	songtrk t2 {
+		mute 0
+		track {
+			5
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+			12
+			non {0 0} 60 100
+			12
+			noff {0 0} 60 100
+		}
+	}
+	curpos 0
+	curlen 0
+	curquant 0
+	curev any {0..15 0..15}
+	metro {
+		mask	rec
+		lo	non {0 9} 68 90
+		hi	non {0 9} 67 127
+	}
+	tap off
+	tapev none
+}
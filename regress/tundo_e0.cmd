@@ -0,0 +1,23 @@
+proc note pos key len {
+	return {{$pos {non {0 0} $key 100}} {($pos + $len) {noff {0 0} $key 100}}}
+}
+proc grow n {
+	let l = {}
+	for i in {0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15} {
+		let l = [note ($i * 6) 60 3] + $l
+	}
+	g 0; sel 1
+	taddevs $l
+	for i in $n {
+		tcopy
+		tins $i
+		tpaste
+		sel ($i * 2)
+	}
+}
+load "note.sng"
+tnew t2
+grow {1 2 4 8 16 32 64 128 256 512 1024 2048}
+tdel
+ct t; g 0; sel 4; ttransp 2; u
+g 0; sel 0; ct nil; ci nil; co nil
@@ -0,0 +1,3 @@
+load "note_e1.sng"
+ct t2; tmerge t; u
+g 0; sel 0; ct nil; ci nil; co nil
@@ -0,0 +1,3 @@
+load "quant.sng"
+ct t; g 0; sel 16; setq 24; tquanta 100; u
+g 0; sel 0; setq nil; ct nil; ci nil; co nil
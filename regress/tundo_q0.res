@@ -0,0 +1,56 @@
+#
+# midish (unknown release)
+#
+{
+	format 1
+	tics_per_unit 96
+	tempo_factor 256
+	meta {
+		timesig 4 24
+		tempo 500000
+	}
+	songtrk t {
+		mute 0
+		track {
+			48
+			non {0 0} 60 100
+			48
+			noff {0 0} 60 100
+			49
+			non {0 0} 61 100
+			47
+			noff {0 0} 61 100
+			50
+			non {0 0} 62 100
+			46
+			noff {0 0} 62 100
+			51
+			non {0 0} 63 100
+			45
+			noff {0 0} 63 100
+			47
+			non {0 0} 59 100
+			49
+			noff {0 0} 59 100
+			46
+			non {0 0} 58 100
+			50
+			noff {0 0} 58 100
+			45
+			non {0 0} 57 100
+			51
+			noff {0 0} 57 100
+		}
+	}
+	curpos 0
+	curlen 0
+	curquant 0
+	curev any {0..15 0..15}
+	metro {
+		mask	rec
+		lo	non {0 9} 68 90
+		hi	non {0 9} 67 127
+	}
+	tap off
+	tapev none
+}
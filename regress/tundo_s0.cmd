@@ -0,0 +1,7 @@
+load "note.sng"
+ct t; g 1; sel 2; tcut
+g 0; tins 2
+g 2; sel 1; tcopy; g 5; tpaste
+g 0; sel 8; tevmap {note {0 0}} {note {0 1}}
+u; u; u; u
+g 0; sel 0; ct nil; ci nil; co nil
@@ -0,0 +1,3 @@
+load "tevmap.sng"
+ct t; g 0; sel 100; tevmap {note {0 0} 60..100} {note {1 1} 66..106}; u
+g 0; sel 0; ct nil; ci nil; co nil
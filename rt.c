@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * real-time output thread.
+ *
+ * When enabled, mididev_flush() doesn't write to the device, instead
+ * it time-stamps the contents of the output buffer and queues it on
+ * a per-device ring. A separate thread (with SCHED_FIFO priority if
+ * permitted) sleeps until the first queued message is due and writes
+ * it with the device write() method. This way, the main thread,
+ * which also runs the interpreter and the line editor, never blocks
+ * in write(2) and can render output ahead of time.
+ *
+ * Rings are single-producer (the main thread) and single-consumer
+ * (the output thread), so no lock is needed to queue or dequeue
+ * messages. The mutex and condition variables are used to wake up
+ * the output thread when it's waiting for new messages, and the main
+ * thread when it's waiting for room in a full ring. The mutex also
+ * protects the statistics, which the output thread updates once per
+ * pass and the main thread reads with rt_getstat().
+ *
+ * The output thread uses the device rtwrite() method, which doesn't
+ * touch the device structure. Write errors and statistics are stored
+ * in the ring and handed to the device by the main thread, which
+ * also does the logging. Once a write failed, the thread discards
+ * the messages of the ring.
+ *
+ * Devices without the rtwrite() method don't use the thread, they
+ * are written directly.
+ *
+ * The thread is started by mux_open() just after the devices are
+ * opened and stopped by mux_close() before they are closed. It's
+ * stopped only once all queued messages are written.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "defs.h"
+#include "mididev.h"
+#include "rt.h"
+
+#define RT_NSEC	1000000000ULL
+
+unsigned rt_debug = 0;
+unsigned rt_enabled = 0;	/* use the thread next time mux is opened */
+unsigned rt_running = 0;	/* true if the thread is running */
+struct rtstat rt_stat;
+
+struct rtring *rt_rings[DEFAULT_MAXNDEVS];
+pthread_t rt_thread;
+pthread_mutex_t rt_mtx;
+pthread_cond_t rt_cond;		/* output thread waits for messages */
+pthread_cond_t rt_room;		/* main thread waits for room */
+unsigned rt_quit;
+unsigned rt_nwait;		/* true if main thread waits for room */
+
+/*
+ * return the current time in nanoseconds
+ */
+unsigned long long
+rt_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		log_perror("rt_now: clock_gettime");
+		panic();
+	}
+	return RT_NSEC * ts.tv_sec + ts.tv_nsec;
+}
+
+/*
+ * find the ring whose first message is the earliest, return NULL if
+ * all rings are empty
+ */
+struct rtring *
+rt_first(void)
+{
+	struct rtring *r, *first;
+	unsigned i, head;
+
+	first = NULL;
+	for (i = 0; i < DEFAULT_MAXNDEVS; i++) {
+		r = rt_rings[i];
+		if (r == NULL)
+			continue;
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (head == r->tail)
+			continue;
+		if (first == NULL || r->msg[r->tail % RT_NMSG].time <
+		    first->msg[first->tail % RT_NMSG].time)
+			first = r;
+	}
+	return first;
+}
+
+/*
+ * write the given bytes to the ring device, on error store errno in
+ * the ring for the main thread
+ */
+void
+rt_write(struct rtring *r, unsigned char *buf, unsigned todo)
+{
+	int count;
+
+	while (todo > 0) {
+		if (__atomic_load_n(&r->err, __ATOMIC_ACQUIRE))
+			return;
+		count = r->dev->ops->rtwrite(r->dev, buf, todo);
+		if (count < 0) {
+			__atomic_store_n(&r->err, errno ? errno : EIO,
+			    __ATOMIC_RELEASE);
+			return;
+		}
+		__atomic_fetch_add(&r->nwrites, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&r->nbytes, count, __ATOMIC_RELAXED);
+		todo -= count;
+		buf += count;
+	}
+}
+
+/*
+ * write all messages of the given ring that are due and account
+ * them in the given statistics. Messages are copied in a single
+ * buffer so they are written with a single system call, this is much
+ * cheaper than one call per message
+ */
+void
+rt_drain(struct rtring *r, unsigned long long now, struct rtstat *st)
+{
+	struct rtmsg *m;
+	unsigned head, used;
+	unsigned char buf[MIDIDEV_BUFLEN];
+	unsigned long long late;
+
+	used = 0;
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	while (r->tail != head) {
+		m = &r->msg[r->tail % RT_NMSG];
+		if (m->time > now)
+			break;
+		if (used + m->len > MIDIDEV_BUFLEN) {
+			rt_write(r, buf, used);
+			used = 0;
+		}
+		memcpy(buf + used, m->data, m->len);
+		used += m->len;
+		late = rt_now() - m->time;
+		st->nmsg++;
+		st->late_sum += late;
+		if (st->late_max < late)
+			st->late_max = late;
+		__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+	}
+	rt_write(r, buf, used);
+}
+
+/*
+ * output thread main loop
+ */
+void *
+rt_run(void *arg)
+{
+	struct rtring *r;
+	struct rtstat st;
+	struct timespec ts;
+	unsigned long long now, due;
+	unsigned i;
+
+	pthread_mutex_lock(&rt_mtx);
+	for (;;) {
+		r = rt_first();
+		if (r == NULL) {
+			if (rt_quit)
+				break;
+			pthread_cond_wait(&rt_cond, &rt_mtx);
+			continue;
+		}
+		now = rt_now();
+		due = r->msg[r->tail % RT_NMSG].time;
+		if (due > now) {
+			ts.tv_sec = due / RT_NSEC;
+			ts.tv_nsec = due % RT_NSEC;
+			pthread_cond_timedwait(&rt_cond, &rt_mtx, &ts);
+			continue;
+		}
+		pthread_mutex_unlock(&rt_mtx);
+		st.nmsg = st.late_sum = st.late_max = 0;
+		for (i = 0; i < DEFAULT_MAXNDEVS; i++) {
+			if (rt_rings[i])
+				rt_drain(rt_rings[i], now, &st);
+		}
+		pthread_mutex_lock(&rt_mtx);
+		rt_stat.nmsg += st.nmsg;
+		rt_stat.late_sum += st.late_sum;
+		if (rt_stat.late_max < st.late_max)
+			rt_stat.late_max = st.late_max;
+		if (rt_nwait) {
+			rt_nwait = 0;
+			pthread_cond_signal(&rt_room);
+		}
+	}
+	pthread_mutex_unlock(&rt_mtx);
+	return NULL;
+}
+
+/*
+ * hand the errors and statistics of the output thread to the given
+ * device. On error, the device is marked as failed
+ */
+void
+rt_poll(struct mididev *dev)
+{
+	struct rtring *r = rt_rings[dev->unit];
+	int err;
+
+	if (r == NULL)
+		return;
+	dev->onwrites += __atomic_exchange_n(&r->nwrites, 0, __ATOMIC_RELAXED);
+	dev->onbytes += __atomic_exchange_n(&r->nbytes, 0, __ATOMIC_RELAXED);
+	err = __atomic_load_n(&r->err, __ATOMIC_ACQUIRE);
+	if (err && !dev->eof) {
+		log_puts("dev ");
+		log_putu(dev->unit);
+		log_puts(": write failed: ");
+		log_puts(strerror(err));
+		log_puts("\n");
+		dev->eof = 1;
+	}
+}
+
+/*
+ * copy the output thread statistics
+ */
+void
+rt_getstat(struct rtstat *st)
+{
+	if (rt_running)
+		pthread_mutex_lock(&rt_mtx);
+	*st = rt_stat;
+	if (rt_running)
+		pthread_mutex_unlock(&rt_mtx);
+}
+
+/*
+ * queue the given bytes to be written on the given device at the
+ * given time. If the ring is full, wait for the output thread to
+ * make room. Nothing is queued once a write failed
+ */
+void
+rt_put(struct mididev *dev, unsigned char *buf, unsigned len,
+    unsigned long long time)
+{
+	struct rtring *r = rt_rings[dev->unit];
+	struct rtmsg *m;
+	unsigned tail, n;
+
+	while (len > 0) {
+		for (;;) {
+			if (__atomic_load_n(&r->err, __ATOMIC_ACQUIRE))
+				return;
+			tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+			if (r->head - tail < RT_NMSG)
+				break;
+			if (rt_debug)
+				log_puts("rt_put: ring full, waiting\n");
+			pthread_mutex_lock(&rt_mtx);
+			tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+			if (r->head - tail == RT_NMSG) {
+				rt_nwait = 1;
+				pthread_cond_wait(&rt_room, &rt_mtx);
+			}
+			pthread_mutex_unlock(&rt_mtx);
+		}
+		m = &r->msg[r->head % RT_NMSG];
+		n = len < RT_MSGLEN ? len : RT_MSGLEN;
+		memcpy(m->data, buf, n);
+		m->len = n;
+		m->time = time;
+		__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+		buf += n;
+		len -= n;
+	}
+	pthread_mutex_lock(&rt_mtx);
+	pthread_cond_signal(&rt_cond);
+	pthread_mutex_unlock(&rt_mtx);
+}
+
+/*
+ * create rings for all opened output devices and start the thread
+ */
+void
+rt_start(void)
+{
+	struct mididev *dev;
+	struct rtring *r;
+	struct sched_param sp;
+	pthread_condattr_t attr;
+	int err;
+
+	memset(&rt_stat, 0, sizeof(struct rtstat));
+	for (dev = mididev_list; dev != NULL; dev = dev->next) {
+		if (!(dev->mode & MIDIDEV_MODE_OUT) || dev->eof ||
+		    !dev->ops->rtwrite)
+			continue;
+		r = xmalloc(sizeof(struct rtring), "rtring");
+		r->dev = dev;
+		r->head = r->tail = 0;
+		r->err = 0;
+		r->nwrites = r->nbytes = 0;
+		rt_rings[dev->unit] = r;
+	}
+	rt_quit = 0;
+	rt_nwait = 0;
+	pthread_mutex_init(&rt_mtx, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&rt_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&rt_room, NULL);
+	err = pthread_create(&rt_thread, NULL, rt_run, NULL);
+	if (err) {
+		log_puts("rt_start: ");
+		log_puts(strerror(err));
+		log_puts("\n");
+		panic();
+	}
+	sp.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	err = pthread_setschedparam(rt_thread, SCHED_FIFO, &sp);
+	if (err == 0)
+		rt_stat.fifo = 1;
+	else if (rt_debug) {
+		log_puts("rt_start: SCHED_FIFO: ");
+		log_puts(strerror(err));
+		log_puts("\n");
+	}
+	rt_running = 1;
+}
+
+/*
+ * wait for all queued messages to be written, stop the thread,
+ * collect pending errors and free the rings
+ */
+void
+rt_stop(void)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&rt_mtx);
+	rt_quit = 1;
+	pthread_cond_signal(&rt_cond);
+	pthread_mutex_unlock(&rt_mtx);
+	pthread_join(rt_thread, NULL);
+	pthread_cond_destroy(&rt_room);
+	pthread_cond_destroy(&rt_cond);
+	pthread_mutex_destroy(&rt_mtx);
+	for (i = 0; i < DEFAULT_MAXNDEVS; i++) {
+		if (rt_rings[i]) {
+			rt_poll(rt_rings[i]->dev);
+			xfree(rt_rings[i]);
+			rt_rings[i] = NULL;
+		}
+	}
+	rt_running = 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MIDISH_RT_H
+#define MIDISH_RT_H
+
+#define RT_NMSG		512	/* messages per ring, power of two */
+#define RT_MSGLEN	28	/* max bytes per message */
+
+struct mididev;
+
+/*
+ * a message, ie a chunk of bytes to write at the given time
+ */
+struct rtmsg {
+	unsigned long long time;	/* CLOCK_MONOTONIC, in nanoseconds */
+	unsigned len;			/* bytes in data[] */
+	unsigned char data[RT_MSGLEN];
+};
+
+/*
+ * single-producer single-consumer ring of messages: the main thread
+ * only moves 'head' and the output thread only moves 'tail'. The
+ * output thread doesn't touch the device structure, it reports
+ * errors and statistics with 'err', 'nwrites' and 'nbytes', which
+ * are collected by the main thread in rt_poll()
+ */
+struct rtring {
+	struct mididev *dev;		/* device to write to */
+	unsigned head, tail;		/* free running counters */
+	int err;			/* errno of failed write, or 0 */
+	unsigned long nwrites;		/* write() calls not collected */
+	unsigned long nbytes;		/* bytes written not collected */
+	struct rtmsg msg[RT_NMSG];
+};
+
+/*
+ * output thread statistics, reset by rt_start(), read with
+ * rt_getstat()
+ */
+struct rtstat {
+	unsigned fifo;			/* true if running with SCHED_FIFO */
+	unsigned long nmsg;		/* messages written */
+	unsigned long long late_sum;	/* total lateness in nanoseconds */
+	unsigned long long late_max;	/* max lateness in nanoseconds */
+};
+
+extern unsigned rt_enabled;
+extern unsigned rt_running;
+
+void rt_start(void);
+void rt_stop(void);
+void rt_put(struct mididev *, unsigned char *, unsigned, unsigned long long);
+void rt_poll(struct mididev *);
+void rt_getstat(struct rtstat *);
+
+#endif /* MIDISH_RT_H */
@@ -15,6 +15,7 @@
  */
 
 #include <limits.h>
+#include <string.h>
 #include "utils.h"
 #include "name.h"
 #include "song.h"
@@ -25,6 +26,7 @@
 #include "conv.h"
 #include "version.h"
 #include "cons.h"
+#include "pool.h"
 
 #define FORMAT_VERSION	1
 
@@ -221,6 +223,8 @@ filt_output(struct filt *o, struct textout *f)
 {
 	struct filtnode *s, *snext;
 	struct filtnode *d;
+	unsigned i;
+
 	textout_putstr(f, "{\n");
 	textout_shiftright(f);
 
@@ -248,6 +252,19 @@ filt_output(struct filt *o, struct textout *f)
 		textout_putstr(f, "\n");
 	}
 	for (d = o->vcurve; d != NULL; d = d->next) {
+		if (d->u.vel.nweight == 0) {
+			textout_putstr(f, "vmap ");
+			evspec_output(&d->es, f);
+			textout_putstr(f, " {\n");
+			textout_shiftright(f);
+			for (i = 0; i <= EV_MAXCOARSE; i++) {
+				textout_putlong(f, d->u.vel.map[i]);
+				textout_putstr(f, i % 16 == 15 ? "\n" : " ");
+			}
+			textout_shiftleft(f);
+			textout_putstr(f, "}\n");
+			continue;
+		}
 		textout_putstr(f, "vcurve ");
 		evspec_output(&d->es, f);
 		textout_putstr(f, " ");
@@ -602,9 +619,10 @@ struct load {
 #define TOK_MAXLEN	31
 	char strval[TOK_MAXLEN + 1];
 	unsigned long longval;
-	struct textin *in;		/* input file */
-	int lookchar;			/* used by ungetchar */
-	unsigned line, col;		/* for error reporting */
+	struct textmap map;		/* input file */
+	unsigned char *p, *end;		/* next char, end of the file */
+	unsigned char *pos;		/* last char read, for errors */
+	unsigned ahead;		/* 'p' was read and put back */
 	unsigned lookavail;
 	int format;
 };
@@ -614,35 +632,111 @@ void	      load_ungetsym(struct load *);
 
 /* ----------------------------------------------------- tokdefs --- */
 
+/*
+ * character classes used by the scanner
+ */
+#define LOAD_BAD	0	/* not allowed */
+#define LOAD_SPACE	1	/* space, tab, cr */
+#define LOAD_NL		2	/* new line */
+#define LOAD_DIGIT	3	/* 0..9 */
+#define LOAD_ALPHA	4	/* a..z, A..Z, _ */
+#define LOAD_PUNCT	5	/* single char tokens, see load_tok[] */
+#define LOAD_DOT	6	/* first char of '..' */
+#define LOAD_COMMENT	7	/* '#' */
+#define LOAD_ESC	8	/* '\' */
+
+unsigned char load_ctype[256];		/* class of each char */
+unsigned char load_tok[256];		/* token of LOAD_PUNCT chars */
+unsigned char load_digit[256];		/* value of each digit, or 0xff */
+
+/*
+ * build the character tables
+ */
+void
+load_inittab(void)
+{
+	unsigned i;
+
+	for (i = 0; i < 256; i++) {
+		load_ctype[i] = LOAD_BAD;
+		load_digit[i] = 0xff;
+	}
+	for (i = 'a'; i <= 'z'; i++) {
+		load_ctype[i] = LOAD_ALPHA;
+		load_digit[i] = 10 + i - 'a';
+	}
+	for (i = 'A'; i <= 'Z'; i++) {
+		load_ctype[i] = LOAD_ALPHA;
+		load_digit[i] = 10 + i - 'A';
+	}
+	for (i = '0'; i <= '9'; i++) {
+		load_ctype[i] = LOAD_DIGIT;
+		load_digit[i] = i - '0';
+	}
+	load_ctype['_'] = LOAD_ALPHA;
+	load_ctype[' '] = LOAD_SPACE;
+	load_ctype['\t'] = LOAD_SPACE;
+	load_ctype['\r'] = LOAD_SPACE;
+	load_ctype['\n'] = LOAD_NL;
+	load_ctype['.'] = LOAD_DOT;
+	load_ctype['#'] = LOAD_COMMENT;
+	load_ctype['\\'] = LOAD_ESC;
+	load_ctype['{'] = LOAD_PUNCT;
+	load_tok['{'] = TOK_LBRACE;
+	load_ctype['}'] = LOAD_PUNCT;
+	load_tok['}'] = TOK_RBRACE;
+	load_ctype['<'] = LOAD_PUNCT;
+	load_tok['<'] = TOK_LT;
+	load_ctype['>'] = LOAD_PUNCT;
+	load_tok['>'] = TOK_GT;
+}
+
 unsigned
 load_getchar(struct load *o, int *c)
 {
-	if (o->lookchar < 0) {
-		textin_getpos(o->in, &o->line, &o->col);
-		if (!textin_getchar(o->in, c)) {
-			return 0;
-		}
-	} else {
-		*c = o->lookchar;
-		o->lookchar = -1;
+	if (o->ahead)
+		o->ahead = 0;
+	else
+		o->pos = o->p;
+	if (o->p == o->end) {
+		*c = CHAR_EOF;
+		return 1;
 	}
+	*c = *o->p++;
 	return 1;
 }
 
 void
 load_ungetchar(struct load *o, int c)
 {
-	if (o->lookchar >= 0) {
+	if (o->ahead) {
 		log_puts("load_ungetchar: lookchar already set\n");
 		panic();
 	}
-	o->lookchar = c;
+	if (c != CHAR_EOF)
+		o->p--;
+	o->ahead = 1;
+}
+
+/*
+ * put back the char at the given position: it's the last char
+ * read. Used by the loops of load_scan() that read chars without
+ * load_getchar()
+ */
+void
+load_stop(struct load *o, unsigned char *p)
+{
+	o->p = o->pos = p;
+	o->ahead = 1;
 }
 
 void
 load_err(struct load *o, char *msg)
 {
-	cons_erruu(o->line + 1, o->col + 1, msg);
+	unsigned line, col;
+
+	textmap_getpos(&o->map, o->pos - o->map.data, &line, &col);
+	cons_erruu(line + 1, col + 1, msg);
 }
 
 unsigned
@@ -651,6 +745,7 @@ load_scan(struct load *o)
 	int c, cn;
 	unsigned i, dig, base;
 	unsigned long val, maxq, maxr;
+	unsigned char *p, *end = o->end;
 
 	for (;;) {
 		if (!load_getchar(o, &c))
@@ -661,8 +756,24 @@ load_scan(struct load *o)
 			return 1;
 		}
 
-		/* check if line continues */
-		if (c == '\\') {
+		switch (load_ctype[c]) {
+		case LOAD_SPACE:
+			for (p = o->p; p != end && load_ctype[*p] == LOAD_SPACE; p++)
+				; /* nothing */
+			o->p = p;
+			continue;
+		case LOAD_NL:
+			o->id = TOK_ENDLINE;
+			return 1;
+		case LOAD_PUNCT:
+			o->id = load_tok[c];
+			return 1;
+		case LOAD_COMMENT:
+			p = memchr(o->p, '\n', end - o->p);
+			load_stop(o, p != NULL ? p : end);
+			continue;
+		case LOAD_ESC:
+			/* check if line continues */
 			do {
 				if (!load_getchar(o, &c))
 					return 0;
@@ -676,127 +787,78 @@ load_scan(struct load *o)
 			load_ungetchar(o, c);
 			load_err(o, "newline exected after '\\'");
 			return 0;
-		}
-
-		/* skip comments */
-		if (c == '#') {
-			do {
-				if (!load_getchar(o, &c))
+		case LOAD_DOT:
+			if (!load_getchar(o, &cn))
+				return 0;
+			if (cn == '.') {
+				o->id = TOK_RANGE;
+				return 1;
+			}
+			load_ungetchar(o, cn);
+			break;
+		case LOAD_ALPHA:
+			o->strval[0] = c;
+			i = 1;
+			for (p = o->p; ; p++) {
+				if (p == end || (load_ctype[*p] != LOAD_ALPHA &&
+					load_ctype[*p] != LOAD_DIGIT))
+					break;
+				if (i >= TOK_MAXLEN) {
+					o->pos = p;
+					o->p = p + 1;
+					load_err(o, "word too long");
 					return 0;
-			} while (c != '\n' && c != CHAR_EOF);
-			load_ungetchar(o, c);
-			continue;
-		}
-
-		if (c >= '0' && c <= '9') {
+				}
+				o->strval[i++] = *p;
+			}
+			o->strval[i] = '\0';
+			load_stop(o, p);
+			if (i == 3 && str_eq(o->strval, "nil"))
+				o->id = TOK_NIL;
+			else
+				o->id = TOK_WORD;
+			return 1;
+		case LOAD_DIGIT:
 			base = 10;
-			if (c == '0') {
-				if (!load_getchar(o, &c))
+			p = o->p;
+			if (c == '0' && p != end && (*p == 'x' || *p == 'X')) {
+				base = 16;
+				p++;
+				if (p == end || load_digit[*p] >= 16) {
+					load_stop(o, p);
+					load_err(o, "bad hex number");
 					return 0;
-				if (c == 'x' || c == 'X') {
-					base = 16;
-					if (!load_getchar(o, &c))
-						return 0;
-					if ((c < '0' || c > '9') &&
-					    (c < 'A' || c > 'F') &&
-					    (c < 'a' || c > 'f')) {
-						load_ungetchar(o, c);
-						load_err(o, "bad hex number");
-						return 0;
-					}
 				}
+				c = *p++;
 			}
-
 			val = 0;
 			maxq = ULONG_MAX / base;
 			maxr = ULONG_MAX % base;
 			for (;;) {
-				if (c >= 'a' && c <= 'z') {
-					dig = 10 + c - 'a';
-				} else if (c >= 'A' && c <= 'Z') {
-					dig = 10 + c - 'A';
-				} else if (c >= '0' && c <= '9') {
-					dig = c - '0';
-				} else {
-					load_ungetchar(o, c);
-					break;
-				}
+				dig = load_digit[c];
 				if (dig >= base) {
+					o->pos = p - 1;
+					o->p = p;
 					load_err(o, "bad number");
 					return 0;
 				}
 				if ((val > maxq) ||
 				    (val == maxq && dig > maxr)) {
+					o->pos = p - 1;
+					o->p = p;
 					load_err(o, "number too large");
 					return 0;
 				}
 				val = val * base + dig;
-				if (!load_getchar(o, &c))
-					return 0;
+				if (p == end || load_digit[*p] == 0xff)
+					break;
+				c = *p++;
 			}
+			load_stop(o, p);
 			o->longval = val;
 			o->id = TOK_NUM;
 			return 1;
 		}
-
-		if ((c >= 'a' && c <= 'z') ||
-		    (c >= 'A' && c <= 'Z') ||
-		    (c == '_')) {
-			i = 0;
-			for (;;) {
-				if (i >= TOK_MAXLEN) {
-					load_err(o, "word too long");
-					return 0;
-				}
-				o->strval[i++] = c;
-				if (!load_getchar(o, &c)) {
-					return 0;
-				}
-				if ((c < 'a' || c > 'z') &&
-				    (c < 'A' || c > 'Z') &&
-				    (c < '0' || c > '9') &&
-				    (c != '_')) {
-					o->strval[i++] = '\0';
-					load_ungetchar(o, c);
-					break;
-				}
-			}
-			if (str_eq(o->strval, "nil"))
-				o->id = TOK_NIL;
-			else
-				o->id = TOK_WORD;
-			return 1;
-		}
-
-		switch (c) {
-		case ' ':
-		case '\t':
-		case '\r':
-			continue;
-		case '\n':
-			o->id = TOK_ENDLINE;
-			return 1;
-		case '{':
-			o->id = TOK_LBRACE;
-			return 1;
-		case '}':
-			o->id = TOK_RBRACE;
-			return 1;
-		case '<':
-			o->id = TOK_LT;
-			return 1;
-		case '>':
-			o->id = TOK_GT;
-			return 1;
-		case '.':
-			if (!load_getchar(o, &cn))
-				return 0;
-			if (cn == '.') {
-				o->id = TOK_RANGE;
-				return 1;
-			}
-			load_ungetchar(o, cn);
-		}
 		load_err(o, "bad token");
 		return 0;
 	}
@@ -806,10 +868,13 @@ load_scan(struct load *o)
 int
 load_init(struct load *o, char *filename)
 {
-	o->lookchar = -1;
-	o->in = textin_new(filename);
-	if (!o->in)
+	if (load_ctype['{'] == LOAD_BAD)
+		load_inittab();
+	if (!textmap_init(&o->map, filename))
 		return 0;
+	o->p = o->pos = o->map.data;
+	o->end = o->map.data + o->map.size;
+	o->ahead = 0;
 	o->lookavail = 0;
 	o->format = 0;
 	return 1;
@@ -818,7 +883,7 @@ load_init(struct load *o, char *filename)
 void
 load_done(struct load *o)
 {
-	textin_delete(o->in);
+	textmap_done(&o->map);
 }
 
 unsigned
@@ -1203,6 +1268,11 @@ load_track(struct load *o, struct track *t)
 	statelist_init(&slist);
 	pos = t->first;
 	for (;;) {
+		if (pool_overflow) {
+			load_err(o, "memory limit reached");
+			statelist_done(&slist);
+			return 0;
+		}
 		if (!load_getsym(o)) {
 			statelist_done(&slist);
 			return 0;
@@ -1218,6 +1288,7 @@ load_track(struct load *o, struct track *t)
 				return 0;
 			}
 			pos->delta += delta;
+			t->gen++;
 		} else {
 			load_ungetsym(o);
 			if (!load_ev(o, &ev)) {
@@ -1231,6 +1302,7 @@ load_track(struct load *o, struct track *t)
 					se = seqev_new();
 					se->ev = rev;
 					seqev_ins(pos, se);
+					t->gen++;
 				}
 			}
 		}
@@ -1325,6 +1397,8 @@ load_rule(struct load *o, struct filt *f)
 {
 	unsigned long idev, ich, odev, och, ictl, octl, keylo, keyhi, ukeyplus;
 	struct evspec from, to;
+	unsigned char vmap[EV_MAXCOARSE + 1];
+	unsigned i;
 	int keyplus;
 
 	if (!load_getsym(o))
@@ -1513,6 +1587,38 @@ load_rule(struct load *o, struct filt *f)
 			return 0;
 		}
 		filt_vcurve(f, &to, ukeyplus);
+	} else if (str_eq(o->strval, "vmap")) {
+		if (!load_evspec(o, &to)) {
+			return 0;
+		}
+		if (!load_getsym(o))
+			return 0;
+		if (o->id != TOK_LBRACE) {
+			load_err(o, "'{' expected while parsing vmap");
+			return 0;
+		}
+		for (i = 0;;) {
+			if (!load_getsym(o))
+				return 0;
+			if (o->id == TOK_ENDLINE)
+				continue;
+			if (o->id == TOK_RBRACE)
+				break;
+			load_ungetsym(o);
+			if (i > EV_MAXCOARSE) {
+				load_err(o, "too many velocities in vmap");
+				return 0;
+			}
+			if (!load_long(o, i > 0 ? 1 : 0, EV_MAXCOARSE, &ukeyplus)) {
+				return 0;
+			}
+			vmap[i++] = ukeyplus;
+		}
+		if (i <= EV_MAXCOARSE) {
+			load_err(o, "vmap must have 128 velocities");
+			return 0;
+		}
+		filt_vmap(f, &to, vmap);
 	} else {
 		load_ungetsym(o);
 		if (!load_ukline(o)) {
@@ -14,10 +14,17 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "utils.h"
 #include "sysex.h"
@@ -27,9 +34,15 @@
 #include "cons.h"
 #include "frame.h"
 #include "conv.h"
+#include "batch.h"
+#include "pool.h"
 
 #define MAXTRACKNAME 100
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024		/* max iovecs per writev(2), as on Linux */
+#endif
+
 char smftype_header[4] = { 'M', 'T', 'h', 'd' };
 char smftype_track[4]  = { 'M', 'T', 'r', 'k' };
 
@@ -38,24 +51,104 @@ unsigned smf_evlen[] = { 2, 2, 2, 2, 1, 1, 2, 0 };
 
 /* --------------------------------------------- chunk read/write --- */
 
+/*
+ * Files to read are mapped in memory (or loaded, if they can't be
+ * mapped) so the parser reads bytes from a buffer rather than calling
+ * fgetc() for each byte. Files to write are encoded in memory first,
+ * see song_exportsmf().
+ */
+/*
+ * track being built by the parser, events are appended at its end
+ */
+struct smfdst {
+	struct track *track;
+	unsigned tic;			/* absolute position of the end */
+};
+
+/*
+ * memory buffer a chunk is encoded in
+ */
+struct smfbuf {
+	unsigned char *data;
+	unsigned used, size;
+};
+
+/*
+ * chunk of the file being written, if 'track' is set, the chunk
+ * is encoded by smf_trackjob()
+ */
+struct smfchunk {
+	struct smfbuf buf;
+	struct song *song;
+	struct track *track;
+	unsigned ok;			/* track encoded successfully */
+};
+
 struct smf
 {
-	FILE *file;
+	unsigned char *data;		/* contents of the file to read */
+	unsigned char *ptr, *end;	/* current position, end of data */
+	size_t size;			/* size of data */
+	unsigned mapped;		/* if true, data is mmap()'ed */
 	unsigned length, index;		/* current chunk length/position */
 };
 
 /*
- * open a standard midi file and initialize
- * the smf structure
+ * map the given file in memory, or load it if it can't be mapped
  */
 unsigned
-smf_open(struct smf *o, char *path, char *mode)
+smf_map(struct smf *o, char *path)
 {
-	o->file = fopen(path, mode);
-	if (!o->file) {
+	struct stat sb;
+	ssize_t n;
+	size_t done;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
 		cons_errs(path, "failed to open file");
 		return 0;
 	}
+	if (fstat(fd, &sb) < 0) {
+		cons_errs(path, "failed to stat file");
+		close(fd);
+		return 0;
+	}
+	o->size = sb.st_size;
+	o->data = NULL;
+	o->mapped = 0;
+	if (o->size > 0) {
+		o->data = mmap(NULL, o->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (o->data != MAP_FAILED)
+			o->mapped = 1;
+		else {
+			o->data = xmalloc(o->size, "smf");
+			for (done = 0; done < o->size; done += n) {
+				n = read(fd, o->data + done, o->size - done);
+				if (n <= 0) {
+					cons_errs(path, "failed to read file");
+					xfree(o->data);
+					close(fd);
+					return 0;
+				}
+			}
+		}
+	}
+	close(fd);
+	o->ptr = o->data;
+	o->end = o->data + o->size;
+	return 1;
+}
+
+/*
+ * open a standard midi file for reading and initialize
+ * the smf structure
+ */
+unsigned
+smf_open(struct smf *o, char *path)
+{
+	if (!smf_map(o, path))
+		return 0;
 	o->length = 0;
 	o->index = 0;
 	return 1;
@@ -67,21 +160,33 @@ smf_open(struct smf *o, char *path, char *mode)
 void
 smf_close(struct smf *o)
 {
-	fclose(o->file);
+	if (o->mapped)
+		munmap(o->data, o->size);
+	else if (o->data)
+		xfree(o->data);
 }
 
+/*
+ * return true if the given number of bytes can be read from the
+ * current chunk
+ */
+#define SMF_CANREAD(o, n) \
+	((o)->index + (n) <= (o)->length && (o)->end - (o)->ptr >= (n))
+
 /*
  * read a 32bit fixed-size number, return 0 on error
  */
 unsigned
 smf_get32(struct smf *o, unsigned *val)
 {
-	unsigned char buf[4];
-	if (o->index + 4 > o->length || fread(buf, 1, 4, o->file) != 4) {
+	unsigned char *buf = o->ptr;
+
+	if (!SMF_CANREAD(o, 4)) {
 		cons_err("failed to read 32bit number");
 		return 0;
 	}
 	*val = (buf[0] << 24) + (buf[1] << 16) + (buf[2] << 8) + buf[3];
+	o->ptr += 4;
 	o->index += 4;
 	return 1;
 }
@@ -92,12 +197,14 @@ smf_get32(struct smf *o, unsigned *val)
 unsigned
 smf_get24(struct smf *o, unsigned *val)
 {
-	unsigned char buf[4];
-	if (o->index + 3 > o->length || fread(buf, 1, 3, o->file) != 3) {
+	unsigned char *buf = o->ptr;
+
+	if (!SMF_CANREAD(o, 3)) {
 		cons_err("failed to read 24bit number");
 		return 0;
 	}
 	*val = (buf[0] << 16) + (buf[1] << 8) + buf[2];
+	o->ptr += 3;
 	o->index += 3;
 	return 1;
 }
@@ -108,12 +215,14 @@ smf_get24(struct smf *o, unsigned *val)
 unsigned
 smf_get16(struct smf *o, unsigned *val)
 {
-	unsigned char buf[4];
-	if (o->index + 2 > o->length || fread(buf, 1, 2, o->file) != 2) {
+	unsigned char *buf = o->ptr;
+
+	if (!SMF_CANREAD(o, 2)) {
 		cons_err("failed to read 16bit number");
 		return 0;
 	}
 	*val =  (buf[0] << 8) + buf[1];
+	o->ptr += 2;
 	o->index += 2;
 	return 1;
 }
@@ -124,13 +233,12 @@ smf_get16(struct smf *o, unsigned *val)
 unsigned
 smf_getc(struct smf *o, unsigned *res)
 {
-	int c;
-	if (o->index + 1 > o->length || (c = fgetc(o->file)) < 0) {
+	if (!SMF_CANREAD(o, 1)) {
 		cons_err("failed to read one byte");
 		return 0;
 	}
 	o->index++;
-	*res = c & 0xff;
+	*res = *o->ptr++;
 	return 1;
 }
 
@@ -145,10 +253,11 @@ smf_getvar(struct smf *o, unsigned *val)
 	*val = 0;
 	bits = 0;
 	for (;;) {
-		if (o->index + 1 > o->length || (c = fgetc(o->file)) == EOF) {
+		if (!SMF_CANREAD(o, 1)) {
 			cons_err("failed to read varlength number");
 			return 0;
 		}
+		c = *o->ptr++;
 		o->index++;
 		*val += (c & 0x7f);
 		if (!(c & 0x80)) {
@@ -176,20 +285,20 @@ smf_getvar(struct smf *o, unsigned *val)
 unsigned
 smf_getheader(struct smf *o, char *hdr)
 {
-	char buf[4];
 	unsigned len;
 	if (o->index != o->length) {
 		cons_err("chunk not finished");
 		return 0;
 	}
-	if (fread(buf, 1, 4, o->file) != 4) {
+	if (o->end - o->ptr < 4) {
 		cons_err("failed to read header");
 		return 0;
 	}
-	if (memcmp(buf, hdr, 4) != 0) {
+	if (memcmp(o->ptr, hdr, 4) != 0) {
 		cons_err("header corrupted");
 		return 0;
 	}
+	o->ptr += 4;
 	o->index = 0;
 	o->length = 4;
 	if (!smf_get32(o, &len)) {
@@ -201,152 +310,131 @@ smf_getheader(struct smf *o, char *hdr)
 }
 
 /*
- * in smf_putxxx routines there is a 'unsigned *used' argument if
- * (used == NULL) then data is not written in the smf structure, only
- * *user is incremented by the number of bytes that would be written
- * otherwise.  This is used to determine chunk's length
+ * Chunks are encoded in growable memory buffers; the length field of
+ * the chunk is set once it's complete. Then all chunks are written
+ * to the file with a single writev(2) call.
  */
 
+/*
+ * make room for at least 'n' more bytes in the buffer
+ */
+void
+smf_grow(struct smfbuf *o, unsigned n)
+{
+	unsigned char *data;
+	unsigned size;
+
+	size = o->size < 256 ? 256 : 2 * o->size;
+	while (size < o->used + n)
+		size *= 2;
+	data = xmalloc(size, "smfbuf");
+	if (o->data) {
+		memcpy(data, o->data, o->used);
+		xfree(o->data);
+	}
+	o->data = data;
+	o->size = size;
+}
 
 /*
  * put a fixed-size 32-bit number
  */
 void
-smf_put32(struct smf *o, unsigned *used, unsigned val)
+smf_put32(struct smfbuf *o, unsigned val)
 {
-	unsigned char buf[4];
-	if (used) {
-		(*used) += 4;
-	} else {
-		if (o->index + 4 > o->length) {
-			log_puts("smf_put32: bad chunk length\n");
-			panic();
-		}
-		buf[0] = (val >> 24) & 0xff;
-		buf[1] = (val >> 16) & 0xff;
-		buf[2] = (val >> 8) & 0xff;
-		buf[3] = val & 0xff;
-		fwrite(buf, 1, 4, o->file);
-		o->index += 4;
-	}
+	if (o->used + 4 > o->size)
+		smf_grow(o, 4);
+	o->data[o->used++] = (val >> 24) & 0xff;
+	o->data[o->used++] = (val >> 16) & 0xff;
+	o->data[o->used++] = (val >> 8) & 0xff;
+	o->data[o->used++] = val & 0xff;
 }
 
 /*
  * put a fixed-size 24-bit number
  */
 void
-smf_put24(struct smf *o, unsigned *used, unsigned val)
+smf_put24(struct smfbuf *o, unsigned val)
 {
-	unsigned char buf[4];
-	if (used) {
-		(*used) += 3;
-	} else {
-		if (o->index + 3 > o->length) {
-			log_puts("smf_put24: bad chunk length\n");
-			panic();
-		}
-		buf[0] = (val >> 16) & 0xff;
-		buf[1] = (val >> 8) & 0xff;
-		buf[2] = val & 0xff;
-		fwrite(buf, 1, 3, o->file);
-		o->index += 3;
-	}
+	if (o->used + 3 > o->size)
+		smf_grow(o, 3);
+	o->data[o->used++] = (val >> 16) & 0xff;
+	o->data[o->used++] = (val >> 8) & 0xff;
+	o->data[o->used++] = val & 0xff;
 }
 
 /*
  * put a fixed-size 16-bit number
  */
 void
-smf_put16(struct smf *o, unsigned *used, unsigned val)
+smf_put16(struct smfbuf *o, unsigned val)
 {
-	unsigned char buf[4];
-	if (used) {
-		(*used) += 2;
-	} else {
-		if (o->index + 2 > o->length) {
-			log_puts("smf_put16: bad chunk length\n");
-			panic();
-		}
-		buf[0] = (val >> 8) & 0xff;
-		buf[1] = val & 0xff;
-		fwrite(buf, 1, 2, o->file);
-		o->index += 2;
-	}
+	if (o->used + 2 > o->size)
+		smf_grow(o, 2);
+	o->data[o->used++] = (val >> 8) & 0xff;
+	o->data[o->used++] = val & 0xff;
 }
 
-
 /*
  * put a fixed-size 8-bit number
  */
 void
-smf_putc(struct smf *o, unsigned *used, unsigned val)
+smf_putc(struct smfbuf *o, unsigned val)
 {
-	if (used) {
-		(*used) ++;
-	} else {
-		if (o->index + 1 > o->length) {
-			log_puts("smf_putc: bad chunk length\n");
-			panic();
-		}
-		fputc((int)val & 0xff, o->file);
-		o->index++;
-	}
+	if (o->used == o->size)
+		smf_grow(o, 1);
+	o->data[o->used++] = val & 0xff;
 }
 
-
 /*
  * put a variable length number
  */
 void
-smf_putvar(struct smf *o, unsigned *used, unsigned val)
+smf_putvar(struct smfbuf *o, unsigned val)
 {
-#define MAXBYTES 5			/* 32bit / 7bit = 4bytes + 4bit */
-	unsigned char buf[MAXBYTES];
-	unsigned index = 0, bits;
-	for (bits = 7; bits < MAXBYTES * 7; bits += 7) {
-		if (val < (1U << bits)) {
-			bits -= 7;
-			for (; bits != 0; bits -= 7) {
-				buf[index++] = ((val >> bits) & 0x7f) | 0x80;
-			}
-			buf[index++] = val & 0x7f;
-			if (used) {
-				(*used) += index;
-			} else {
-				if (o->index + index > o->length) {
-					log_puts("smf_putvar: bad chunk length\n");
-					panic();
-				}
-				o->index += index;
-				fwrite(buf, 1, index, o->file);
-			}
-			return;
-		}
+	unsigned bits;
+
+	for (bits = 28; bits > 0; bits -= 7) {
+		if (val >= (1U << bits))
+			smf_putc(o, ((val >> bits) & 0x7f) | 0x80);
 	}
-	log_puts("smf_putvar: bogus value\n");
-	panic();
-#undef MAXBYTES
+	smf_putc(o, val & 0x7f);
 }
 
 /*
- * put the given chunk header with the given magic and size field
+ * start a chunk with the given magic, the size field is
+ * set by smf_putlen() once the chunk is complete
  */
 void
-smf_putheader(struct smf *o, char *hdr, unsigned len)
+smf_putheader(struct smfbuf *o, char *hdr)
 {
-	fwrite(hdr, 1, 4, o->file);
-	o->length = 4;
-	o->index = 0;
-	smf_put32(o, NULL, len);
-	o->length = len;
-	o->index = 0;
+	if (o->used + 4 > o->size)
+		smf_grow(o, 4);
+	memcpy(o->data + o->used, hdr, 4);
+	o->used += 4;
+	smf_put32(o, 0);
 }
 
 /*
- * store a track in the smf
+ * set the size field of the chunk
  */
 void
-smf_puttrack(struct smf *o, unsigned *used, struct song *s, struct track *t)
+smf_putlen(struct smfbuf *o)
+{
+	unsigned len = o->used - 8;
+
+	o->data[4] = (len >> 24) & 0xff;
+	o->data[5] = (len >> 16) & 0xff;
+	o->data[6] = (len >> 8) & 0xff;
+	o->data[7] = len & 0xff;
+}
+
+/*
+ * store a track in the smf, return 0 if it can't be represented. As
+ * it may run in a batch_run() thread, it doesn't log anything
+ */
+unsigned
+smf_puttrack(struct smfbuf *o, struct song *s, struct track *t)
 {
 	struct seqev *pos;
 	unsigned status, newstatus, delta, chan, denom;
@@ -354,8 +442,9 @@ smf_puttrack(struct smf *o, unsigned *used, struct song *s, struct track *t)
 	struct statelist slist;
 	unsigned i, nev;
 
-
+	smf_putheader(o, smftype_track);
 	statelist_init(&slist);
+	statelist_hash(&slist);
 	delta = 0;
 	status = 0;
 	for (pos = t->first; pos != NULL; pos = pos->next) {
@@ -367,31 +456,31 @@ smf_puttrack(struct smf *o, unsigned *used, struct song *s, struct track *t)
 			nev = conv_unpackev(&slist, 0U,
 			    CONV_XPC | CONV_NRPN | CONV_RPN, &pos->ev, rev);
 			for (i = 0; i < nev; i++) {
-				smf_putvar(o, used, delta);
+				smf_putvar(o, delta);
 				delta = 0;
 				chan = rev[i].ch;
 				newstatus = (rev[i].cmd << 4) + (chan & 0x0f);
 				if (newstatus != status) {
 					status = newstatus;
-					smf_putc(o, used, status);
+					smf_putc(o, status);
 				}
 				if (rev[i].cmd == EV_BEND) {
-					smf_putc(o, used, rev[i].bend_val & 0x7f);
-					smf_putc(o, used, rev[i].bend_val >> 7);
+					smf_putc(o, rev[i].bend_val & 0x7f);
+					smf_putc(o, rev[i].bend_val >> 7);
 				} else {
-					smf_putc(o, used, rev[i].v0);
+					smf_putc(o, rev[i].v0);
 					if (SMF_EVLEN(status) == 2) {
-						smf_putc(o, used, rev[i].v1);
+						smf_putc(o, rev[i].v1);
 					}
 				}
 			}
 		} else if (pos->ev.cmd == EV_TEMPO) {
-			smf_putvar(o, used, delta);
+			smf_putvar(o, delta);
 			delta = 0;
-			smf_putc(o, used, 0xff);
-			smf_putc(o, used, 0x51);
-			smf_putc(o, used, 0x03);
-			smf_put24(o, used, pos->ev.tempo_usec24 * s->tics_per_unit / 96);
+			smf_putc(o, 0xff);
+			smf_putc(o, 0x51);
+			smf_putc(o, 0x03);
+			smf_put24(o, pos->ev.tempo_usec24 * s->tics_per_unit / 96);
 		} else if (pos->ev.cmd == EV_TIMESIG) {
 			denom = s->tics_per_unit / pos->ev.timesig_tics;
 			switch(denom) {
@@ -411,35 +500,37 @@ smf_puttrack(struct smf *o, unsigned *used, struct song *s, struct track *t)
 				denom = 4;
 				break;
 			default:
-				log_puts("smf_puttrack: bad time signature\n");
-				panic();
+				statelist_done(&slist);
+				return 0;
 			}
-			smf_putvar(o, used, delta);
+			smf_putvar(o, delta);
 			delta = 0;
-			smf_putc(o, used, 0xff);
-			smf_putc(o, used, 0x58);
-			smf_putc(o, used, 0x04);
-			smf_putc(o, used, pos->ev.timesig_beats);
-			smf_putc(o, used, denom);
+			smf_putc(o, 0xff);
+			smf_putc(o, 0x58);
+			smf_putc(o, 0x04);
+			smf_putc(o, pos->ev.timesig_beats);
+			smf_putc(o, denom);
 			/* metronome tics per metro beat */
-			smf_putc(o, used, pos->ev.timesig_tics);
+			smf_putc(o, pos->ev.timesig_tics);
 			/* metronome 1/32 notes per 24 tics */
-			smf_putc(o, used, 8 * s->tics_per_unit / 96);
+			smf_putc(o, 8 * s->tics_per_unit / 96);
 		}
 
 	}
-	smf_putvar(o, used, delta);
-	smf_putc(o, used, 0xff);
-	smf_putc(o, used, 0x2f);
-	smf_putc(o, used, 0x00);
+	smf_putvar(o, delta);
+	smf_putc(o, 0xff);
+	smf_putc(o, 0x2f);
+	smf_putc(o, 0x00);
+	smf_putlen(o);
 	statelist_done(&slist);
+	return 1;
 }
 
 /*
  * store a sysex in the smf
  */
 void
-smf_putsysex(struct smf *o, unsigned *used, struct sysex *sx)
+smf_putsysex(struct smfbuf *o, struct sysex *sx)
 {
 	struct chunk *c;
 	unsigned i, first;
@@ -450,7 +541,7 @@ smf_putsysex(struct smf *o, unsigned *used, struct sysex *sx)
 			if (first) {
 				first = 0;
 			} else {
-				smf_putc(o, used, c->data[i]);
+				smf_putc(o, c->data[i]);
 			}
 		}
 	}
@@ -460,104 +551,217 @@ smf_putsysex(struct smf *o, unsigned *used, struct sysex *sx)
  * store a sysex back in the smf
  */
 void
-smf_putsx(struct smf *o, unsigned *used, struct song *s, struct songsx *songsx)
+smf_putsx(struct smfbuf *o, struct song *s, struct songsx *songsx)
 {
-	unsigned sysexused;
 	struct sysex *sx;
+	struct chunk *c;
+	unsigned len;
 
+	smf_putheader(o, smftype_track);
 	for (sx = songsx->sx.first; sx != NULL; sx = sx->next) {
-		sysexused = 0;
-		smf_putvar(o, used, 0);
-		smf_putc(o, used, 0xf0);
-		smf_putsysex(o, &sysexused, sx);
-		smf_putvar(o, used, sysexused);
-		smf_putsysex(o, used, sx);
-	}
-	smf_putvar(o, used, 0);
-	smf_putc(o, used, 0xff);
-	smf_putc(o, used, 0x2f);
-	smf_putc(o, used, 0x00);
+		len = 0;
+		for (c = sx->first; c != NULL; c = c->next)
+			len += c->used;
+		smf_putvar(o, 0);
+		smf_putc(o, 0xf0);
+		smf_putvar(o, len - 1);		/* without the 0xf0 */
+		smf_putsysex(o, sx);
+	}
+	smf_putvar(o, 0);
+	smf_putc(o, 0xff);
+	smf_putc(o, 0x2f);
+	smf_putc(o, 0x00);
+	smf_putlen(o);
 }
 
 /*
- * open the smf and store the whole song
+ * encode a track chunk, called by batch_run()
+ */
+void
+smf_trackjob(void *arg)
+{
+	struct smfchunk *c = arg;
+
+	c->ok = smf_puttrack(&c->buf, c->song, c->track);
+}
+
+/*
+ * write the given buffers to a temporary file, sync it to disk and
+ * rename it to the given name. This way, if anything fails, the
+ * previous file is left unchanged. If the file is a symbolic link,
+ * the file it points to is replaced. The new file gets the mode and,
+ * if permitted, the owner of the file it replaces
+ */
+unsigned
+smf_writefile(char *path, struct iovec *iov, unsigned niov)
+{
+	char tmp[PATH_MAX], real[PATH_MAX];
+	struct stat sb;
+	ssize_t n;
+	int fd, exists;
+
+	if (realpath(path, real) != NULL)
+		path = real;
+	exists = stat(path, &sb) == 0;
+	if (snprintf(tmp, PATH_MAX, "%s.tmp", path) >= PATH_MAX) {
+		cons_errs(path, "path too long");
+		return 0;
+	}
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		cons_errs(tmp, "failed to open file");
+		return 0;
+	}
+	if (exists) {
+		/*
+		 * only root may give the file away, so failing to
+		 * change the owner isn't an error, but then don't
+		 * keep set-id bits. Set the mode after the owner,
+		 * since fchown() may clear them
+		 */
+		if (fchown(fd, sb.st_uid, sb.st_gid) < 0)
+			sb.st_mode &= ~(S_ISUID | S_ISGID);
+		if (fchmod(fd, sb.st_mode & 07777) < 0) {
+			cons_errs(tmp, "failed to set file mode");
+			goto bad;
+		}
+	}
+	while (niov > 0) {
+		n = writev(fd, iov, niov < IOV_MAX ? niov : IOV_MAX);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			cons_errs(tmp, "failed to write file");
+			goto bad;
+		}
+		while (niov > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	if (fsync(fd) < 0) {
+		cons_errs(tmp, "failed to sync file");
+		goto bad;
+	}
+	if (close(fd) < 0) {
+		cons_errs(tmp, "failed to close file");
+		unlink(tmp);
+		return 0;
+	}
+	if (rename(tmp, path) < 0) {
+		cons_errs(path, "failed to rename file");
+		unlink(tmp);
+		return 0;
+	}
+	return 1;
+bad:
+	close(fd);
+	unlink(tmp);
+	return 0;
+}
+
+/*
+ * encode the whole song and store it in the given file; tracks
+ * are encoded in parallel
  */
 unsigned
 song_exportsmf(struct song *o, char *filename)
 {
-	struct smf f;
+	struct smfchunk *chunks, *c;
 	struct songtrk *t;
 	struct songchan *i;
 	struct songsx *s;
-	unsigned ntrks, nchan, nsx, used;
+	struct iovec *iov;
+	void **jobs;
+	unsigned nchunks, njobs, n, res;
 
-	if (!smf_open(&f, filename, "w")) {
-		return 0;
-	}
-	ntrks = 0;
+	nchunks = 2;				/* header and meta track */
 	SONG_FOREACH_TRK(o, t) {
-		ntrks++;
+		nchunks++;
 	}
-	nchan = 0;
 	SONG_FOREACH_CHAN(o, i) {
 		if (i->isinput)
 			continue;
-		nchan++;
+		nchunks++;
 	}
-	nsx = 0;
 	SONG_FOREACH_SX(o, s) {
-		nsx++;
+		nchunks++;
+	}
+	chunks = xmalloc(nchunks * sizeof(struct smfchunk), "smfchunk");
+	for (n = 0; n < nchunks; n++) {
+		chunks[n].buf.data = NULL;
+		chunks[n].buf.used = chunks[n].buf.size = 0;
+		chunks[n].song = o;
+		chunks[n].track = NULL;
+		chunks[n].ok = 1;
 	}
 
 	/*
-	 * write the header
-	 */
-	smf_putheader(&f, smftype_header, 6);
-	smf_put16(&f, NULL, 1);				/* format = 1 */
-	smf_put16(&f, NULL, nsx + ntrks + nchan + 1);	/* +1 -> meta track */
-	smf_put16(&f, NULL, o->tics_per_unit / 4);		/* tics per quarter */
-
-	/*
-	 * write the tempo track
+	 * encode the header
 	 */
-	used = 0;
-	smf_puttrack(&f, &used, o, &o->meta);
-	smf_putheader(&f, smftype_track, used);
-	smf_puttrack(&f, NULL, o, &o->meta);
+	c = chunks;
+	smf_putheader(&c->buf, smftype_header);
+	smf_put16(&c->buf, 1);			/* format = 1 */
+	smf_put16(&c->buf, nchunks - 1);	/* number of tracks */
+	smf_put16(&c->buf, o->tics_per_unit / 4);	/* tics per quarter */
+	smf_putlen(&c->buf);
+	c++;
 
 	/*
-	 * write each sx
+	 * the tempo track comes first, then each sx, each chan
+	 * and each track
 	 */
+	(c++)->track = &o->meta;
 	SONG_FOREACH_SX(o, s) {
-		used = 0;
-		smf_putsx(&f, &used, o, s);
-		smf_putheader(&f, smftype_track, used);
-		smf_putsx(&f, NULL, o, s);
+		smf_putsx(&(c++)->buf, o, s);
 	}
-
-	/*
-	 * write each chan
-	 */
 	SONG_FOREACH_CHAN(o, i) {
 		if (i->isinput)
 			continue;
-		used = 0;
-		smf_puttrack(&f, &used, o, &i->conf);
-		smf_putheader(&f, smftype_track, used);
-		smf_puttrack(&f, NULL, o, &i->conf);
+		(c++)->track = &i->conf;
+	}
+	SONG_FOREACH_TRK(o, t) {
+		(c++)->track = &t->track;
 	}
 
 	/*
-	 * write each track
+	 * encode tracks
 	 */
-	SONG_FOREACH_TRK(o, t) {
-		used = 0;
-		smf_puttrack(&f, &used, o, &t->track);
-		smf_putheader(&f, smftype_track, used);
-		smf_puttrack(&f, NULL, o, &t->track);
+	jobs = xmalloc(nchunks * sizeof(void *), "smfjobs");
+	njobs = 0;
+	for (n = 0; n < nchunks; n++) {
+		if (chunks[n].track)
+			jobs[njobs++] = &chunks[n];
 	}
-	smf_close(&f);
-	return 1;
+	batch_run(smf_trackjob, jobs, njobs);
+	xfree(jobs);
+
+	res = 1;
+	for (n = 0; n < nchunks; n++) {
+		if (!chunks[n].ok) {
+			cons_errs(filename, "bad time signature");
+			res = 0;
+			break;
+		}
+	}
+	if (res) {
+		iov = xmalloc(nchunks * sizeof(struct iovec), "smfiov");
+		for (n = 0; n < nchunks; n++) {
+			iov[n].iov_base = chunks[n].buf.data;
+			iov[n].iov_len = chunks[n].buf.used;
+		}
+		res = smf_writefile(filename, iov, nchunks);
+		xfree(iov);
+	}
+	for (n = 0; n < nchunks; n++)
+		xfree(chunks[n].buf.data);
+	xfree(chunks);
+	return res;
 }
 
 /*
@@ -581,16 +785,49 @@ smf_getsysex(struct smf *o, struct sysex *sx)
 }
 
 /*
- * parse a track 'varlen event varlen event ... varlen event'
+ * append the given event at the given absolute position, which must
+ * not be before the end of the track
+ */
+void
+smf_append(struct smfdst *d, unsigned tic, struct ev *ev)
+{
+	struct seqev *se;
+
+	d->track->eot.delta += tic - d->tic;
+	d->tic = tic;
+	se = seqev_new();
+	se->ev = *ev;
+	seqev_ins(&d->track->eot, se);
+}
+
+/*
+ * extend the track up to the given absolute position
+ */
+void
+smf_extend(struct smfdst *d, unsigned tic)
+{
+	if (tic > d->tic) {
+		d->track->eot.delta += tic - d->tic;
+		d->tic = tic;
+	}
+	d->track->gen++;
+}
+
+/*
+ * parse a track 'varlen event varlen event ... varlen event'. Events
+ * are in time order, so they are appended at the end of the
+ * destination tracks: voice events go to the track of their channel
+ * and meta events to the 'meta' track. Store the track length in
+ * 'len'
  */
 unsigned
-smf_gettrack(struct smf *o, struct song *s, struct songtrk *t)
+smf_gettrack(struct smf *o, struct song *s,
+    struct smfdst **chan, struct smfdst *meta, unsigned *len)
 {
 	unsigned delta, i, status, type, length, abspos;
 	unsigned tempo, num, den, dummy;
 	struct statelist slist;
 	struct songsx *songsx;
-	struct seqev *pos, *se;
 	struct sysex *sx;
 	struct ev ev, rev;
 	unsigned c;
@@ -600,23 +837,26 @@ smf_gettrack(struct smf *o, struct song *s, struct songtrk *t)
 	}
 	status = 0;
 	abspos = 0;
-	track_clear(&t->track);
-	pos = t->track.first;
-	songsx = (struct songsx *)s->sxlist;	/* first (and unique) sysex in song */
+	songsx = (struct songsx *)s->sxlist.first;	/* first (and unique) sysex in song */
 	if (songsx == NULL) {
 		songsx = song_sxnew(s, "smf");
 	}
 	statelist_init(&slist);
+	statelist_hash(&slist);
 	for (;;) {
+		if (pool_overflow) {
+			cons_err("memory limit reached");
+			goto err;
+		}
 		if (o->index >= o->length) {
 			statelist_done(&slist);
+			*len = abspos;
 			return 1;
 		}
 		if (!smf_getvar(o, &delta)) {
 			goto err;
 		}
 		abspos += delta;
-		pos->delta += delta;
 		if (!smf_getc(o, &c)) {
 			goto err;;
 		}
@@ -734,9 +974,8 @@ smf_gettrack(struct smf *o, struct song *s, struct songtrk *t)
 			}
 			if (conv_packev(&slist, 0U,
 				CONV_XPC | CONV_NRPN | CONV_RPN, &ev, &rev)) {
-				se = seqev_new();
-				se->ev = rev;
-				seqev_ins(pos, se);
+				smf_append(EV_ISVOICE(&rev) ?
+				    chan[rev.ch] : meta, abspos, &rev);
 			}
 			/*
 			log_puts("ev: ");
@@ -762,130 +1001,24 @@ smf_gettrack(struct smf *o, struct song *s, struct songtrk *t)
 }
 
 /*
- * fix song imported from format 1 smf
- */
-void
-song_fix1(struct song *o)
-{
-	struct track copy;
-	struct seqptr *tp, *cp;
-	struct state *st;
-	struct statelist slist;
-	struct songtrk *t, *tnext;
-	unsigned delta;
-
-	SONG_FOREACH_TRK(o, t) {
-		/*
-		 * move meta events into meta track
-		 */
-		delta = 0;
-		track_init(&copy);
-		cp = seqptr_new(&copy);
-		tp = seqptr_new(&t->track);
-		statelist_init(&slist);
-		for (;;) {
-			delta = seqptr_ticdel(tp, ~0U, &slist);
-			seqptr_ticput(tp, delta);
-			seqptr_ticput(cp, delta);
-			st = seqptr_evdel(tp, &slist);
-			if (st == NULL) {
-				break;
-			}
-			if (st->phase & EV_PHASE_FIRST) {
-				st->tag = EV_ISMETA(&st->ev) ? 1 : 0;
-			}
-			if (st->tag) {
-				seqptr_evput(cp, &st->ev);
-			} else {
-				seqptr_evput(tp, &st->ev);
-			}
-		}
-		statelist_done(&slist);
-		seqptr_del(tp);
-		seqptr_del(cp);
-		track_merge(&o->meta, &copy);
-		track_done(&copy);
-	}
-
-	/*
-	 * remove the first track, if there are not events
-	 */
-	for (t = (struct songtrk *)o->trklist; t != NULL; t = tnext) {
-		tnext = (struct songtrk *)t->name.next;
-		if (t->track.first->ev.cmd == EV_NULL) {
-			song_trkdel(o, t);
-		}
-	}
-}
-
-/*
- * fix song imported from format 0 SMFs: call fix1 to move meta events
- * to the meta-track then split it creating one track per channel
- */
-void
-song_fix0(struct song *o)
-{
-	char trackname[MAXTRACKNAME];
-	struct seqptr *tp, *cp;
-	struct state *st;
-	struct statelist slist;
-	struct songtrk *t, *smf;
-	unsigned delta;
-	unsigned i;
-
-	song_fix1(o);
-	smf = (struct songtrk *)o->trklist;
-	if (smf == NULL) {
-		return;
-	}
-	for (i = 1; i < 16; i++) {
-		snprintf(trackname, MAXTRACKNAME, "trk%02u", i);
-		t = song_trknew(o, trackname);
-		delta = 0;
-		cp = seqptr_new(&t->track);
-		tp = seqptr_new(&smf->track);
-		statelist_init(&slist);
-		for (;;) {
-			delta = seqptr_ticdel(tp, ~0U, &slist);
-			seqptr_ticput(tp, delta);
-			seqptr_ticput(cp, delta);
-			st = seqptr_evdel(tp, &slist);
-			if (st == NULL) {
-				break;
-			}
-			if (st->phase & EV_PHASE_FIRST) {
-				if (EV_ISVOICE(&st->ev) &&
-				    st->ev.ch == i) {
-					st->tag = 1;
-				} else {
-					st->tag = 0;
-				}
-			}
-			if (st->tag) {
-				seqptr_evput(cp, &st->ev);
-			} else {
-				seqptr_evput(tp, &st->ev);
-			}
-		}
-		statelist_done(&slist);
-		seqptr_del(tp);
-		seqptr_del(cp);
-	}
-}
-
-/*
- * open the smf and load the whole file
+ * open the smf and load the whole file. Meta events are moved to the
+ * meta track; tracks of format 0 files are split, creating one track
+ * per channel, and tracks left empty are deleted. Format 0 files with
+ * more than one track are imported as format 1 files. Format 2 files
+ * are rejected
  */
 struct song *
 song_importsmf(char *filename)
 {
 	struct song *o;
-	struct songtrk *t;
-	unsigned format, ntrks, timecode, i;
+	struct songtrk *t, *tnext;
+	struct smfdst dst[16], *chan[16], meta;
+	struct track metatrk;
+	unsigned format, ntrks, timecode, i, ch, ndst, len, split, empty;
 	char trackname[MAXTRACKNAME];
 	struct smf f;
 
-	if (!smf_open(&f, filename, "r")) {
+	if (!smf_open(&f, filename)) {
 		goto bad1;
 	}
 	if (!smf_getheader(&f, smftype_header)) {
@@ -894,6 +1027,10 @@ song_importsmf(char *filename)
 	if (!smf_get16(&f, &format)) {
 		goto bad2;
 	}
+	/*
+	 * format 2 tracks are independent sequences, each starting at
+	 * zero, merging them would make a meaningless song
+	 */
 	if (format != 1 && format != 0) {
 		cons_err("only smf format 0 or 1 can be imported");
 		goto bad2;
@@ -916,22 +1053,55 @@ song_importsmf(char *filename)
 	o = song_new();
 	o->tics_per_unit = timecode * 4;   /* timecode = tics per quarter */
 
+	/*
+	 * format 0 files have a single track, if there are more, handle
+	 * the file as format 1
+	 */
+	split = (format == 0 && ntrks == 1);
 	for (i = 0; i < ntrks; i++) {
-		snprintf(trackname, MAXTRACKNAME, "trk%02u", i);
-		t = song_trknew(o, trackname);
-		if (!smf_gettrack(&f, o, t)) {
+		ndst = split ? 16 : 1;
+		for (ch = 0; ch < ndst; ch++) {
+			snprintf(trackname, MAXTRACKNAME, "trk%02u", i + ch);
+			t = song_trknew(o, trackname);
+			dst[ch].track = &t->track;
+			dst[ch].tic = 0;
+		}
+		for (ch = 0; ch < 16; ch++)
+			chan[ch] = &dst[split ? ch : 0];
+		track_init(&metatrk);
+		meta.track = &metatrk;
+		meta.tic = 0;
+		if (!smf_gettrack(&f, o, chan, &meta, &len)) {
+			track_done(&metatrk);
 			goto bad3;
 		}
-		track_check(&t->track);
+		for (ch = 0; ch < ndst; ch++) {
+			smf_extend(&dst[ch], len);
+			track_check(dst[ch].track);
+		}
+		smf_extend(&meta, len);
+		track_check(&metatrk);
+		track_merge(&o->meta, &metatrk);
+		track_done(&metatrk);
 	}
 	smf_close(&f);
 
-	if (format == 0) {
-		song_fix0(o);
-	} else if (format == 1) {
-		song_fix1(o);
+	/*
+	 * delete empty tracks. Tracks of format 0 files are deleted
+	 * only if all of them are empty
+	 */
+	empty = 1;
+	for (t = (struct songtrk *)o->trklist.first; t != NULL; t = tnext) {
+		tnext = (struct songtrk *)t->name.next;
+		if (t->track.first->ev.cmd != EV_NULL)
+			empty = 0;
+		else if (!split)
+			song_trkdel(o, t);
+	}
+	if (split && empty) {
+		while (o->trklist.first)
+			song_trkdel(o, (struct songtrk *)o->trklist.first);
 	}
-
 
 	/*
 	 * TODO: move sysex messages into separate songsx
@@ -69,10 +69,10 @@ song_init(struct song *o)
 	 * song parameters
 	 */
 	o->mode = 0;
-	o->trklist = NULL;
-	o->chanlist = NULL;
-	o->filtlist = NULL;
-	o->sxlist = NULL;
+	namelist_init(&o->trklist, 1);
+	namelist_init(&o->chanlist, 1);
+	namelist_init(&o->filtlist, 1);
+	namelist_init(&o->sxlist, 1);
 	o->undo = NULL;
 	o->undo_size = 0;
 	o->tics_per_unit = DEFAULT_TPU;
@@ -125,6 +125,7 @@ song_init(struct song *o)
 	se->ev.timesig_beats = DEFAULT_BPM;
 	se->ev.timesig_tics = o->tics_per_unit / DEFAULT_BPM;
 	seqev_ins(o->meta.first, se);
+	o->meta.gen++;
 }
 
 /*
@@ -137,18 +138,22 @@ song_done(struct song *o)
 		song_stop(o);
 	}
 	undo_clear(o, &o->undo);
-	while (o->trklist) {
-		song_trkdel(o, (struct songtrk *)o->trklist);
+	while (o->trklist.first) {
+		song_trkdel(o, (struct songtrk *)o->trklist.first);
 	}
-	while (o->chanlist) {
-		song_chandel(o, (struct songchan *)o->chanlist);
+	while (o->chanlist.first) {
+		song_chandel(o, (struct songchan *)o->chanlist.first);
 	}
-	while (o->filtlist) {
-		song_filtdel(o, (struct songfilt *)o->filtlist);
+	while (o->filtlist.first) {
+		song_filtdel(o, (struct songfilt *)o->filtlist.first);
 	}
-	while (o->sxlist) {
-		song_sxdel(o, (struct songsx *)o->sxlist);
+	while (o->sxlist.first) {
+		song_sxdel(o, (struct songsx *)o->sxlist.first);
 	}
+	namelist_done(&o->trklist);
+	namelist_done(&o->chanlist);
+	namelist_done(&o->filtlist);
+	namelist_done(&o->sxlist);
 	track_done(&o->meta);
 	track_done(&o->clip);
 	track_done(&o->rec);
@@ -172,14 +177,75 @@ song_trknew(struct song *o, char *name)
 	name_init(&t->name, name);
 	track_init(&t->track);
 	t->curfilt = NULL;
+	t->ckpts = NULL;
+	t->ckptgen = 0;
 	t->mute = 0;
 
-	name_add(&o->trklist, (struct name *)t);
+	namelist_add(&o->trklist, (struct name *)t);
 	song_getcurfilt(o, &t->curfilt);
 	song_setcurtrk(o, t);
 	return t;
 }
 
+/*
+ * free all checkpoints of the given track
+ */
+void
+song_trkckptfree(struct songtrk *t)
+{
+	struct seqckpt *ck;
+
+	while ((ck = t->ckpts) != NULL) {
+		t->ckpts = ck->next;
+		seqckpt_done(ck);
+		xfree(ck);
+	}
+}
+
+/*
+ * return a new seqptr on the given track, moved to the given tic.
+ * Instead of replaying the track from its beginning, start from the
+ * closest checkpoint and save new checkpoints on the way, so next
+ * seeks are cheap. Checkpoints are thrown away once the track is
+ * modified
+ */
+struct seqptr *
+song_trkseek(struct song *o, struct songtrk *t, unsigned tic)
+{
+	struct seqptr *sp;
+	struct seqckpt *ck, *last, **pck;
+	unsigned len, next;
+
+	if (t->ckptgen != t->track.gen) {
+		song_trkckptfree(t);
+		t->ckptgen = t->track.gen;
+	}
+	sp = seqptr_new(&t->track);
+	last = NULL;
+	pck = &t->ckpts;
+	for (ck = t->ckpts; ck != NULL && ck->tic <= tic; ck = ck->next) {
+		last = ck;
+		pck = &ck->next;
+	}
+	if (last)
+		seqptr_ckptload(sp, last);
+	len = o->tics_per_unit * SONG_CKPTLEN;
+	for (;;) {
+		next = sp->tic - sp->tic % len + len;
+		if (next > tic)
+			break;
+		if (seqptr_skip(sp, next - sp->tic) > 0)
+			return sp;
+		ck = xmalloc(sizeof(struct seqckpt), "seqckpt");
+		seqptr_ckptsave(sp, ck);
+		ck->next = *pck;
+		*pck = ck;
+		pck = &ck->next;
+	}
+	seqptr_skip(sp, tic - sp->tic);
+	return sp;
+}
+
 /*
  * delete the current track from the song
  */
@@ -189,7 +255,8 @@ song_trkdel(struct song *o, struct songtrk *t)
 	if (o->curtrk == t) {
 		o->curtrk = NULL;
 	}
-	name_remove(&o->trklist, (struct name *)t);
+	namelist_remove(&o->trklist, (struct name *)t);
+	song_trkckptfree(t);
 	track_done(&t->track);
 	name_done(&t->name);
 	xfree(t);
@@ -201,7 +268,7 @@ song_trkdel(struct song *o, struct songtrk *t)
 struct songtrk *
 song_trklookup(struct song *o, char *name)
 {
-	return (struct songtrk *)name_lookup(&o->trklist, name);
+	return (struct songtrk *)namelist_lookup(&o->trklist, name);
 }
 
 /*
@@ -220,7 +287,7 @@ song_channew(struct song *o, char *name, unsigned dev, unsigned ch, int input)
 	c->dev = dev;
 	c->ch = ch;
 	c->isinput = input;
-	name_add(&o->chanlist, (struct name *)c);
+	namelist_add(&o->chanlist, (struct name *)c);
 	if (input)
 		c->filt = NULL;
 	else {
@@ -257,7 +324,7 @@ song_chandel(struct song *o, struct songchan *c)
 		if (o->curout == c)
 			o->curout = NULL;
 	}
-	name_remove(&o->chanlist, (struct name *)c);
+	namelist_remove(&o->chanlist, (struct name *)c);
 	track_done(&c->conf);
 	name_done(&c->name);
 	if (c->filt != NULL)
@@ -271,14 +338,17 @@ song_chandel(struct song *o, struct songchan *c)
 struct songchan *
 song_chanlookup(struct song *o, char *name, int input)
 {
+	struct name *n;
 	struct songchan *c;
 
-	SONG_FOREACH_CHAN(o, c) {
-		if (!!c->isinput == !!input && str_eq(c->name.str, name))
-			break;
+	n = namelist_lookup(&o->chanlist, name);
+	while (n != NULL) {
+		c = (struct songchan *)n;
+		if (!!c->isinput == !!input)
+			return c;
+		n = namelist_lookupnext(&o->chanlist, n);
 	}
-
-	return c;
+	return NULL;
 }
 
 /*
@@ -308,7 +378,7 @@ song_filtnew(struct song *o, char *name)
 	f = xmalloc(sizeof(struct songfilt), "songfilt");
 	name_init(&f->name, name);
 	filt_init(&f->filt);
-	name_add(&o->filtlist, (struct name *)f);
+	namelist_add(&o->filtlist, (struct name *)f);
 	song_setcurfilt(o, f);
 	return f;
 }
@@ -329,7 +399,7 @@ song_filtdel(struct song *o, struct songfilt *f)
 			t->curfilt = NULL;
 		}
 	}
-	name_remove(&o->filtlist, (struct name *)f);
+	namelist_remove(&o->filtlist, (struct name *)f);
 	filt_done(&f->filt);
 	name_done(&f->name);
 	xfree(f);
@@ -341,7 +411,7 @@ song_filtdel(struct song *o, struct songfilt *f)
 struct songfilt *
 song_filtlookup(struct song *o, char *name)
 {
-	return (struct songfilt *)name_lookup(&o->filtlist, name);
+	return (struct songfilt *)namelist_lookup(&o->filtlist, name);
 }
 
 /*
@@ -355,7 +425,7 @@ song_sxnew(struct song *o, char *name)
 	x = xmalloc(sizeof(struct songsx), "songsx");
 	name_init(&x->name, name);
 	sysexlist_init(&x->sx);
-	name_add(&o->sxlist, (struct name *)x);
+	namelist_add(&o->sxlist, (struct name *)x);
 	song_setcursx(o, x);
 	return x;
 }
@@ -369,7 +439,7 @@ song_sxdel(struct song *o, struct songsx *x)
 	if (o->cursx == x) {
 		o->cursx = NULL;
 	}
-	name_remove(&o->sxlist, (struct name *)x);
+	namelist_remove(&o->sxlist, (struct name *)x);
 	sysexlist_done(&x->sx);
 	name_done(&x->name);
 	xfree(x);
@@ -381,7 +451,7 @@ song_sxdel(struct song *o, struct songsx *x)
 struct songsx *
 song_sxlookup(struct song *o, char *name)
 {
-	return (struct songsx *)name_lookup(&o->sxlist, name);
+	return (struct songsx *)namelist_lookup(&o->sxlist, name);
 }
 
 /*
@@ -617,8 +687,7 @@ song_loop_init(struct song *o)
 	seqptr_skip(o->loop_metaptr, o->loop_tstart);
 
 	SONG_FOREACH_TRK(o, t) {
-		t->loop_trackptr = seqptr_new(&t->track);
-		seqptr_skip(t->loop_trackptr, o->loop_tstart);
+		t->loop_trackptr = song_trkseek(o, t, o->loop_tstart);
 
 		/*
 		 * Drop notes, as we don't restore them
@@ -1199,15 +1268,13 @@ song_evcb(struct song *o, struct ev *ev)
 	 */
 	if (o->curfilt) {
 		nev = filt_do(&o->curfilt->filt, ev, filtout);
-	} else {
-		filtout[0] = *ev;
+		ev = filtout;
+	} else
 		nev = 1;
-	}
 
 	/*
 	 * output and/or record resulting events
 	 */
-	ev = filtout;
 	for (i = 0; i < nev; i++) {
 		if (o->mode >= SONG_REC) {
 			s = statelist_update(&o->rec_input, ev);
@@ -1404,8 +1471,7 @@ song_loc(struct song *o, unsigned how, unsigned where, unsigned offs)
 		/*
 		 * allocate and restore new states
 		 */
-		t->trackptr = seqptr_new(&t->track);
-		seqptr_skip(t->trackptr, o->abspos);
+		t->trackptr = song_trkseek(o, t, o->abspos);
 		for (s = t->trackptr->statelist.first; s != NULL; s = s->next)
 			s->tag = 0;
 		song_confrestore(&t->trackptr->statelist,
@@ -1584,6 +1650,14 @@ song_setmode(struct song *o, unsigned newmode)
 	}
 	if (newmode > oldmode)
 		metro_setmode(&o->metro, newmode);
+
+	/*
+	 * render output ahead of time only when playing: in idle and
+	 * record modes, the input is monitored, so output must be sent
+	 * immediately to keep latency minimal
+	 */
+	if (newmode >= SONG_IDLE)
+		mux_chglookahead(newmode == SONG_PLAY ? mux_lookahead : 0);
 }
 
 /*
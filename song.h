@@ -21,6 +21,11 @@
 #define SONG_DEFAULT_TPB	24
 #define SONG_DEFAULT_TEMPO	60
 
+/*
+ * distance between track checkpoints, in unit notes
+ */
+#define SONG_CKPTLEN		16
+
 #include "name.h"
 #include "track.h"
 #include "frame.h"
@@ -41,6 +46,8 @@ struct songtrk {
 	struct seqptr *loopstate;
 	struct songfilt *curfilt;	/* source and dest. channel */
 	struct seqptr *loop_trackptr;	/* backup of trackptr */
+	struct seqckpt *ckpts;		/* checkpoints, sorted by tic */
+	unsigned ckptgen;		/* track 'gen' checkpoints are for */
 	unsigned mute;
 };
 
@@ -67,10 +74,10 @@ struct song {
 	 * music-related fields that should be saved
 	 */
 	struct track meta;		/* tempo track */
-	struct name *trklist;		/* list of tracks */
-	struct name *chanlist;		/* list of channels */
-	struct name *filtlist;		/* list of fiters */
-	struct name *sxlist;		/* list of system exclive banks */
+	struct namelist trklist;	/* list of tracks */
+	struct namelist chanlist;	/* list of channels */
+	struct namelist filtlist;	/* list of fiters */
+	struct namelist sxlist;		/* list of system exclive banks */
 	struct undo *undo;		/* list of operation to undo */
 	unsigned undo_size;		/* size of all undo buffers */
 	unsigned tics_per_unit;		/* number of tics in an unit note */
@@ -131,24 +138,24 @@ struct song {
 
 extern char *song_tap_modestr[3];
 
-#define SONG_FOREACH_TRK(s, i)				\
-	for (i = (struct songtrk *)(s)->trklist;	\
-	     i != NULL;					\
+#define SONG_FOREACH_TRK(s, i)					\
+	for (i = (struct songtrk *)(s)->trklist.first;		\
+	     i != NULL;						\
 	     i = (struct songtrk *)i->name.next)
 
-#define SONG_FOREACH_CHAN(s, i)				\
-	for (i = (struct songchan *)(s)->chanlist;	\
-	     i != NULL;					\
+#define SONG_FOREACH_CHAN(s, i)					\
+	for (i = (struct songchan *)(s)->chanlist.first;	\
+	     i != NULL;						\
 	     i = (struct songchan *)i->name.next)
 
-#define SONG_FOREACH_FILT(s, i)				\
-	for (i = (struct songfilt *)(s)->filtlist;	\
-	     i != NULL;					\
+#define SONG_FOREACH_FILT(s, i)					\
+	for (i = (struct songfilt *)(s)->filtlist.first;	\
+	     i != NULL;						\
 	     i = (struct songfilt *)i->name.next)
 
-#define SONG_FOREACH_SX(s, i)				\
-	for (i = (struct songsx *)(s)->sxlist;		\
-	     i != NULL;					\
+#define SONG_FOREACH_SX(s, i)					\
+	for (i = (struct songsx *)(s)->sxlist.first;		\
+	     i != NULL;						\
 	     i = (struct songsx *)i->name.next)
 
 struct song *song_new(void);
@@ -159,8 +166,10 @@ void song_done(struct song *);
 struct songtrk *song_trknew(struct song *, char *);
 struct songtrk *song_trklookup(struct song *, char *);
 void song_trkdel(struct song *, struct songtrk *);
+void song_trkckptfree(struct songtrk *);
 void song_trkmute(struct song *, struct songtrk *);
 void song_trkunmute(struct song *, struct songtrk *);
+struct seqptr *song_trkseek(struct song *, struct songtrk *, unsigned);
 
 struct songchan *song_channew(struct song *, char *, unsigned, unsigned, int);
 struct songchan *song_chanlookup(struct song *, char *, int);
@@ -26,9 +26,19 @@
  * state pool. In a typical performace, the maximum state list length
  * is roughly equal to the maximum sounding notes; the mean list
  * length is between 2 and 3 states and the maximum is between 10 and
- * 20 states. Currently we use a singly linked list, but for
- * performance reasons we shoud use a hash table in the future.
+ * 20 states, so we use a doubly linked list.
  *
+ * With many devices or MPE controllers, lists may hold hundreds of
+ * states. Such lists can be hashed: states are then also linked in
+ * one of STATE_HASHSIZE buckets, chosen using the fields ev_match()
+ * compares, so all states matching a given event are in the same
+ * bucket. States are always added at the head of both the list and
+ * the bucket, so the bucket order is the list order and the first
+ * matching state is the same for both.
+ *
+ * If STATE_PROF is defined, the number of states examined by each
+ * lookup is recorded and the histogram is reported when the list
+ * is destroyed.
  */
 
 #include "utils.h"
@@ -308,15 +318,148 @@ state_restore(struct state *st, struct ev *rev)
 }
 
 
+/*
+ * return the hash bucket of the given event, states matching the
+ * event are in this bucket
+ */
+unsigned
+state_hash(struct ev *ev)
+{
+	unsigned h;
+
+	if (EV_ISNOTE(ev))
+		h = EV_NON;
+	else
+		h = ev->cmd;
+	if (EV_ISVOICE(ev)) {
+		h = h * 31 + ev->dev;
+		h = h * 31 + ev->ch;
+		switch (ev->cmd) {
+		case EV_NON:
+		case EV_NOFF:
+		case EV_KAT:
+		case EV_XCTL:
+		case EV_NRPN:
+		case EV_RPN:
+			h = h * 31 + ev->v0;
+			break;
+		}
+	}
+	return (h * 2654435761U >> 16) & (STATE_HASHSIZE - 1);
+}
+
+/*
+ * build the hash table of the list. States are appended to the tail
+ * of buckets so they are in the same order as in the list
+ */
+void
+statelist_hashbuild(struct statelist *o)
+{
+	struct state **tail[STATE_HASHSIZE], *i;
+	unsigned h;
+
+	o->htab = xmalloc(STATE_HASHSIZE * sizeof(struct state *), "htab");
+	for (h = 0; h < STATE_HASHSIZE; h++) {
+		o->htab[h] = NULL;
+		tail[h] = &o->htab[h];
+	}
+	for (i = o->first; i != NULL; i = i->next) {
+		h = state_hash(&i->ev);
+		i->hnext = NULL;
+		i->hprev = tail[h];
+		*tail[h] = i;
+		tail[h] = &i->hnext;
+	}
+}
+
+/*
+ * free the hash table of the list
+ */
+void
+statelist_hashfree(struct statelist *o)
+{
+	xfree(o->htab);
+	o->htab = NULL;
+}
+
+#ifdef STATE_PROF
+/*
+ * record the number of states examined by a lookup
+ */
+void
+statelist_prof(struct statelist *o, unsigned n)
+{
+	if (n >= STATE_NPROF)
+		n = STATE_NPROF - 1;
+	o->prof[n]++;
+}
+
+/*
+ * report the lookup chain length histogram
+ */
+void
+statelist_profdump(struct statelist *o)
+{
+	unsigned long total;
+	unsigned i, last;
+
+	total = 0;
+	last = 0;
+	for (i = 0; i < STATE_NPROF; i++) {
+		total += o->prof[i];
+		if (o->prof[i] > 0)
+			last = i;
+	}
+	if (total == 0)
+		return;
+	log_puts("statelist ");
+	log_putu(o->serial);
+	log_puts(o->hashed ? " (hashed)" : "");
+	log_puts(": ");
+	log_putu(total);
+	log_puts(" lookups, chain lengths:");
+	for (i = 0; i <= last; i++) {
+		log_puts(" ");
+		log_putu(i);
+		if (i == STATE_NPROF - 1)
+			log_puts("+");
+		log_puts(":");
+		log_putu(o->prof[i]);
+	}
+	log_puts("\n");
+}
+#endif
+
 /*
  * initialize an empty state list
  */
 void
 statelist_init(struct statelist *o)
 {
+#ifdef STATE_PROF
+	unsigned i;
+
+	for (i = 0; i < STATE_NPROF; i++)
+		o->prof[i] = 0;
+#endif
 	o->first = NULL;
 	o->changed = 0;
-	o->serial = state_serial++;
+	o->serial = __atomic_fetch_add(&state_serial, 1, __ATOMIC_RELAXED);
+	o->nstates = 0;
+	o->hashed = 0;
+	o->htab = NULL;
+}
+
+/*
+ * use a hash table for lookups once the list is big enough. States
+ * added to the list must have their 'ev' field set
+ */
+void
+statelist_hash(struct statelist *o)
+{
+	o->hashed = 1;
+	if (o->htab == NULL && o->nstates >= STATE_HASHMIN)
+		statelist_hashbuild(o);
 }
 
 /*
@@ -346,7 +489,11 @@ statelist_done(struct statelist *o)
 		statelist_rm(o, i);
 		state_del(i);
 	}
-
+	if (o->htab)
+		statelist_hashfree(o);
+#ifdef STATE_PROF
+	statelist_profdump(o);
+#endif
 }
 
 void
@@ -370,6 +517,7 @@ statelist_dup(struct statelist *o, struct statelist *src)
 	struct state *i, *n;
 
 	statelist_init(o);
+	o->hashed = src->hashed;
 	for (i = src->first; i != NULL; i = i->next) {
 		n = state_new();
 		n->ev = i->ev;
@@ -379,6 +527,32 @@ statelist_dup(struct statelist *o, struct statelist *src)
 	}
 }
 
+/*
+ * make an exact copy of the given state list: states are in the
+ * same order and private fields are copied as well
+ */
+void
+statelist_copy(struct statelist *o, struct statelist *src)
+{
+	struct state *i, *n, **last;
+
+	statelist_init(o);
+	o->changed = src->changed;
+	o->hashed = src->hashed;
+	last = &o->first;
+	for (i = src->first; i != NULL; i = i->next) {
+		n = state_new();
+		*n = *i;
+		n->prev = last;
+		*last = n;
+		last = &n->next;
+		o->nstates++;
+	}
+	*last = NULL;
+	if (src->htab)
+		statelist_hashbuild(o);
+}
+
 /*
  * remove and free all states from the state list
  */
@@ -392,19 +566,34 @@ statelist_empty(struct statelist *o)
 		statelist_rm(o, i);
 		state_del(i);
 	}
+	if (o->htab)
+		statelist_hashfree(o);
 }
 
 /*
- * add a state to the state list
+ * add a state to the state list. If the list is hashed, the 'ev'
+ * field of the state must be set
  */
 void
 statelist_add(struct statelist *o, struct state *st)
 {
+	struct state **bucket;
+
 	st->next = o->first;
 	st->prev = &o->first;
 	if (o->first)
 		o->first->prev = &st->next;
 	o->first = st;
+	o->nstates++;
+	if (o->htab) {
+		bucket = &o->htab[state_hash(&st->ev)];
+		st->hnext = *bucket;
+		st->hprev = bucket;
+		if (*bucket)
+			(*bucket)->hprev = &st->hnext;
+		*bucket = st;
+	} else if (o->hashed && o->nstates >= STATE_HASHMIN)
+		statelist_hashbuild(o);
 }
 
 /*
@@ -417,6 +606,12 @@ statelist_rm(struct statelist *o, struct state *st)
 	*st->prev = st->next;
 	if (st->next)
 		st->next->prev = st->prev;
+	o->nstates--;
+	if (o->htab) {
+		*st->hprev = st->hnext;
+		if (st->hnext)
+			st->hnext->hprev = st->hprev;
+	}
 }
 
 /*
@@ -427,11 +622,30 @@ struct state *
 statelist_lookup(struct statelist *o, struct ev *ev)
 {
 	struct state *i;
-	for (i = o->first; i != NULL; i = i->next) {
-		if (state_match(i, ev)) {
-			break;
+#ifdef STATE_PROF
+	unsigned n = 0;
+#endif
+
+	if (o->htab) {
+		for (i = o->htab[state_hash(ev)]; i != NULL; i = i->hnext) {
+#ifdef STATE_PROF
+			n++;
+#endif
+			if (state_match(i, ev))
+				break;
+		}
+	} else {
+		for (i = o->first; i != NULL; i = i->next) {
+#ifdef STATE_PROF
+			n++;
+#endif
+			if (state_match(i, ev))
+				break;
 		}
 	}
+#ifdef STATE_PROF
+	statelist_prof(o, n);
+#endif
 	return i;
 }
 
@@ -448,19 +662,26 @@ statelist_update(struct statelist *statelist, struct ev *ev)
 {
 	struct state *st, *stnext;
 	unsigned phase;
+#ifdef STATE_PROF
+	unsigned n = 0;
+#endif
 
 	phase = ev_phase(ev);
 
-	st = statelist->first;
+	st = statelist->htab ?
+	    statelist->htab[state_hash(ev)] : statelist->first;
 	for (;;) {
 		if (st == NULL) {
 			st = state_new();
 			st->flags = STATE_NEW;
+			st->ev = *ev;
 			statelist_add(statelist, st);
 			break;
 		}
-
-		stnext = st->next;
+#ifdef STATE_PROF
+		n++;
+#endif
+		stnext = statelist->htab ? st->hnext : st->next;
 
 		if (state_match(st, ev)) {
 			if (!(st->phase == EV_PHASE_LAST) &&
@@ -480,6 +701,7 @@ statelist_update(struct statelist *statelist, struct ev *ev)
 		if (st->flags != STATE_NEW) {
 			st = state_new();
 			st->flags = STATE_NEW | STATE_NESTED;
+			st->ev = *ev;
 			statelist_add(statelist, st);
 #ifdef STATE_DEBUG
 			log_puts("statelist_update: ");
@@ -513,6 +735,9 @@ statelist_update(struct statelist *statelist, struct ev *ev)
 		panic();
 	}
 
+#ifdef STATE_PROF
+	statelist_prof(statelist, n);
+#endif
 	state_copyev(st, ev, phase);
 	statelist->changed = 1;
 #ifdef STATE_DEBUG
@@ -556,5 +781,7 @@ statelist_outdate(struct statelist *o)
 			i->flags &= ~STATE_CHANGED;
 		}
 	}
+	if (o->htab && o->nstates < STATE_HASHMIN / 2)
+		statelist_hashfree(o);
 }
 
@@ -20,11 +20,23 @@
 #include "ev.h"
 #include "utils.h"
 
+/*
+ * hashed state lists: the hash table is created once the list has
+ * STATE_HASHMIN states and is freed once it has less than half
+ */
+#define STATE_HASHSIZE	256		/* buckets, power of two */
+#define STATE_HASHMIN	16
+
+#ifdef STATE_PROF
+#define STATE_NPROF	16		/* chain length histogram size */
+#endif
+
 struct seqev;
 struct statelist;
 
 struct state  {
 	struct state *next, **prev;	/* for statelist */
+	struct state *hnext, **hprev;	/* for statelist hash bucket */
 	struct ev ev;			/* last event */
 	unsigned phase;			/* current phase (of the 'ev' field) */
 	/*
@@ -53,17 +65,23 @@ struct state  {
 
 struct statelist {
 	/*
-	 * instead of a simple list, we should use a hash table here,
-	 * but statistics on real-life cases seem to show that lookups
-	 * are very fast thanks to the state ordering (average lookup
-	 * time is around 1-2 iterations for a common MIDI file), so
-	 * we keep using a simple list
+	 * for a common MIDI file lookups are very fast thanks to the
+	 * state ordering (average lookup time is around 1-2
+	 * iterations), so a simple list is enough. But with hundreds
+	 * of concurrent notes and controllers (MPE, many devices)
+	 * lists get long, so lists that may grow big can enable a
+	 * hash table (see statelist_hash()). States are then also
+	 * linked in buckets, in the same order as in the list, so
+	 * lookups return the same state as with the list
 	 */
 	struct state *first;	/* head of the state list */
 	unsigned changed;	/* if changed within this tick */
 	unsigned serial;	/* unique ID */
+	unsigned nstates;	/* number of states in the list */
+	unsigned hashed;	/* use a hash table if big enough */
+	struct state **htab;	/* hash table, or NULL */
 #ifdef STATE_PROF
-	struct prof prof;
+	unsigned long prof[STATE_NPROF]; /* lookups per chain length */
 #endif
 };
 
@@ -80,9 +98,11 @@ unsigned      state_cancel(struct state *, struct ev *);
 unsigned      state_restore(struct state *, struct ev *);
 
 void	      statelist_init(struct statelist *);
+void	      statelist_hash(struct statelist *);
 void	      statelist_done(struct statelist *);
 void	      statelist_dump(struct statelist *);
 void	      statelist_dup(struct statelist *, struct statelist *);
+void	      statelist_copy(struct statelist *, struct statelist *);
 void	      statelist_empty(struct statelist *);
 void	      statelist_add(struct statelist *, struct state *);
 void	      statelist_rm(struct statelist *, struct state *);
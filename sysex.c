@@ -27,6 +27,7 @@
  * list.
  */
 
+#include <string.h>
 #include "utils.h"
 #include "sysex.h"
 #include "defs.h"
@@ -126,6 +127,35 @@ sysex_add(struct sysex *o, unsigned data)
 	ck->data[ck->used++] = data;
 }
 
+/*
+ * add the given bytes to the message
+ */
+void
+sysex_addbuf(struct sysex *o, unsigned char *buf, unsigned count)
+{
+	struct chunk *ck;
+	unsigned n;
+
+	ck = o->last;
+	if (!ck) {
+		ck = o->first = o->last = chunk_new();
+	}
+	while (count > 0) {
+		if (ck->used >= CHUNK_SIZE) {
+			ck->next = chunk_new();
+			ck = ck->next;
+			o->last = ck;
+		}
+		n = CHUNK_SIZE - ck->used;
+		if (n > count)
+			n = count;
+		memcpy(ck->data + ck->used, buf, n);
+		ck->used += n;
+		buf += n;
+		count -= n;
+	}
+}
+
 /*
  * dump the sysex message on stderr
  */
@@ -51,6 +51,7 @@ void	      sysex_pool_done(void);
 struct sysex *sysex_new(unsigned);
 void	      sysex_del(struct sysex *);
 void	      sysex_add(struct sysex *, unsigned);
+void	      sysex_addbuf(struct sysex *, unsigned char *, unsigned);
 void	      sysex_log(struct sysex *);
 unsigned      sysex_check(struct sysex *);
 
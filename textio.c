@@ -21,8 +21,17 @@
  * textout implements outputs into text files (or stdout)
  * (open/close, indentation...)
  *
+ * textmap loads a whole file in memory (mapped if possible), so it
+ * can be scanned without per-character function calls. Line and column
+ * numbers are computed only when needed, from the offset.
+ *
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -102,6 +111,107 @@ textin_getpos(struct textin *o, unsigned *line, unsigned *col)
 	*col = o->col;
 }
 
+/* -------------------------------------------------- file buffer --- */
+
+/*
+ * load the given file in memory. Regular files are mapped, others
+ * (pipes, etc...) are read
+ */
+unsigned
+textmap_init(struct textmap *o, char *filename)
+{
+	struct stat st;
+	size_t maxsize;
+	ssize_t n;
+	unsigned char *data;
+	void *addr;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		cons_errs(filename, "failed to open input file");
+		return 0;
+	}
+	o->posoff = 0;
+	o->line = o->col = 0;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED) {
+			close(fd);
+			o->data = addr;
+			o->size = st.st_size;
+			o->mapped = 1;
+			return 1;
+		}
+	}
+	o->mapped = 0;
+	o->size = 0;
+	maxsize = 0x10000;
+	o->data = xmalloc(maxsize, "textmap");
+	for (;;) {
+		if (o->size == maxsize) {
+			maxsize *= 2;
+			data = xmalloc(maxsize, "textmap");
+			memcpy(data, o->data, o->size);
+			xfree(o->data);
+			o->data = data;
+		}
+		n = read(fd, o->data + o->size, maxsize - o->size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			cons_errs(filename, "failed to read input file");
+			xfree(o->data);
+			close(fd);
+			return 0;
+		}
+		if (n == 0)
+			break;
+		o->size += n;
+	}
+	close(fd);
+	return 1;
+}
+
+void
+textmap_done(struct textmap *o)
+{
+	if (o->mapped)
+		munmap(o->data, o->size);
+	else
+		xfree(o->data);
+}
+
+/*
+ * return the line and column of the character at the given offset,
+ * counted as textin_getpos() does. Offsets are usually requested in
+ * increasing order, so the count starts from the last offset
+ */
+void
+textmap_getpos(struct textmap *o, size_t off, unsigned *line, unsigned *col)
+{
+	unsigned char *p, *end;
+
+	if (off < o->posoff) {
+		o->posoff = 0;
+		o->line = o->col = 0;
+	}
+	end = o->data + off;
+	for (p = o->data + o->posoff; p < end; p++) {
+		if (*p == '\n') {
+			o->col = 0;
+			o->line++;
+		} else if (*p == '\t') {
+			o->col += 8;
+		} else {
+			o->col++;
+		}
+	}
+	o->posoff = off;
+	*line = o->line;
+	*col = o->col;
+}
+
 /* ------------------------------------------------------- output --- */
 
 struct textout *
@@ -22,11 +22,26 @@
 struct textin;
 struct textout;
 
+/*
+ * contents of a file, in memory
+ */
+struct textmap {
+	unsigned char *data;		/* file contents */
+	size_t size;			/* size in bytes */
+	int mapped;			/* if mmap()ed, else xmalloc()ed */
+	size_t posoff;			/* offset of 'line' and 'col' */
+	unsigned line, col;		/* position, see textmap_getpos() */
+};
+
 struct textin *textin_new(char *);
 void textin_delete(struct textin *);
 unsigned textin_getchar(struct textin *, int *);
 void textin_getpos(struct textin *, unsigned *, unsigned *);
 
+unsigned textmap_init(struct textmap *, char *);
+void textmap_done(struct textmap *);
+void textmap_getpos(struct textmap *, size_t, unsigned *, unsigned *);
+
 struct textout *textout_new(char *);
 void textout_delete(struct textout *);
 void textout_shiftleft(struct textout *);
@@ -15,10 +15,10 @@
  */
 
 /*
- * trivial timeouts implementation.
+ * timeouts implementation.
  *
  * A timeout is used to schedule the call of a routine (the callback)
- * there is a global list of timeouts that is processed inside the
+ * there is a global set of timeouts that is processed inside the
  * event loop ie mux_run(). Timeouts work as follows:
  *
  *	first the timo structure must be initialized with timo_set()
@@ -32,14 +32,103 @@
  *	the timeout can be aborted with timo_del(), it is OK to try to
  *	abort a timout that has expired
  *
+ * Timeouts are stored in a hierarchical timing wheel: there are
+ * TIMO_NLEVEL levels of TIMO_NSLOT slots, each slot being a
+ * doubly linked list. A timeout is stored in the level of the most
+ * significant bit by which its expiration time differs from the
+ * current time, and in the slot given by the bits of its expiration
+ * time in this level. So, level 0 slots contain timeouts expiring at
+ * the same time, level 1 slots timeouts expiring within the same
+ * 64 time units, and so on. When the current time crosses a slot,
+ * its timeouts are moved to a lower level or, if they expired, to
+ * the list of expired timeouts. Each timeout is moved at most
+ * TIMO_NLEVEL times, so timo_add(), timo_del() and timo_update()
+ * take constant time per timeout.
  */
 
 #include "utils.h"
 #include "timo.h"
 
+#define TIMO_SHIFT(lev)	((lev) * TIMO_BITS)
+#define TIMO_MASK(lev)	(0xffffffffU >> TIMO_SHIFT(lev))
+
 unsigned timo_debug = 0;
-struct timo *timo_queue;
 unsigned timo_abstime;
+unsigned long timo_nfired;			/* callbacks called */
+struct timo *timo_wheel[TIMO_NLEVEL][TIMO_NSLOT];
+unsigned long long timo_pending[TIMO_NLEVEL];	/* maybe non-empty slots */
+struct timo *timo_expired;			/* sorted expired timeouts */
+
+/*
+ * return the index of the first bit set in the given non-zero bitmap
+ */
+unsigned
+timo_ffs(unsigned long long bits)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(bits);
+#else
+	unsigned i;
+
+	for (i = 0; (bits & 1) == 0; i++)
+		bits >>= 1;
+	return i;
+#endif
+}
+
+/*
+ * insert the timeout at the beginning of the given list
+ */
+void
+timo_link(struct timo **list, struct timo *o)
+{
+	o->next = *list;
+	if (o->next)
+		o->next->prev = &o->next;
+	o->prev = list;
+	*list = o;
+}
+
+/*
+ * remove the timeout from the list it's in
+ */
+void
+timo_unlink(struct timo *o)
+{
+	*o->prev = o->next;
+	if (o->next)
+		o->next->prev = o->prev;
+}
+
+/*
+ * store the timeout in the wheel slot corresponding to its expiration
+ * time, or in the sorted list of expired timeouts
+ */
+void
+timo_place(struct timo *o)
+{
+	struct timo **i;
+	unsigned lev, idx, diff;
+
+	/*
+	 * there is no overflow here because + and - are modulo 2^32,
+	 * they are the same for both signed and unsigned integers
+	 */
+	if ((int)(o->val - timo_abstime) <= 0) {
+		for (i = &timo_expired; *i != NULL; i = &(*i)->next) {
+			if ((int)((*i)->val - o->val) > 0)
+				break;
+		}
+		timo_link(i, o);
+		return;
+	}
+	diff = o->val ^ timo_abstime;
+	for (lev = 0; diff >= TIMO_NSLOT; lev++)
+		diff >>= TIMO_BITS;
+	idx = (o->val >> TIMO_SHIFT(lev)) & (TIMO_NSLOT - 1);
+	timo_link(&timo_wheel[lev][idx], o);
+	timo_pending[lev] |= 1ULL << idx;
+}
 
 /*
  * initialise a timeout structure, arguments are callback and argument
@@ -60,10 +149,6 @@ timo_set(struct timo *o, void (*cb)(void *), void *arg)
 void
 timo_add(struct timo *o, unsigned delta)
 {
-	struct timo **i;
-	unsigned val;
-	int diff;
-
 #ifdef TIMO_DEBUG
 	if (o->set) {
 		log_puts("timo_add: already set\n");
@@ -74,17 +159,9 @@ timo_add(struct timo *o, unsigned delta)
 		panic();
 	}
 #endif
-	val = timo_abstime + delta;
-	for (i = &timo_queue; *i != NULL; i = &(*i)->next) {
-		diff = (*i)->val - val;
-		if (diff > 0) {
-			break;
-		}
-	}
 	o->set = 1;
-	o->val = val;
-	o->next = *i;
-	*i = o;
+	o->val = timo_abstime + delta;
+	timo_place(o);
 }
 
 /*
@@ -93,17 +170,13 @@ timo_add(struct timo *o, unsigned delta)
 void
 timo_del(struct timo *o)
 {
-	struct timo **i;
-
-	for (i = &timo_queue; *i != NULL; i = &(*i)->next) {
-		if (*i == o) {
-			*i = o->next;
-			o->set = 0;
-			return;
-		}
+	if (!o->set) {
+		if (timo_debug)
+			log_puts("timo_del: not found\n");
+		return;
 	}
-	if (timo_debug)
-		log_puts("timo_del: not found\n");
+	timo_unlink(o);
+	o->set = 0;
 }
 
 /*
@@ -114,41 +187,134 @@ timo_del(struct timo *o)
 void
 timo_update(unsigned delta)
 {
-	struct timo *to;
-	int diff;
+	struct timo *todo, *to;
+	unsigned lev, idx, n, i, oldtime, oldpos, newpos;
+	unsigned long long bits;
 
 	/*
 	 * update time reference
 	 */
+	oldtime = timo_abstime;
 	timo_abstime += delta;
 
 	/*
-	 * remove from the queue and run expired timeouts
+	 * move to the 'todo' list all timeouts of the slots the
+	 * current time crossed. If no slot is crossed in a given
+	 * level, none is crossed in upper levels
 	 */
-	while (timo_queue != NULL) {
-		/*
-		 * there is no overflow here because + and - are
-		 * modulo 2^32, they are the same for both signed and
-		 * unsigned integers
-		 */
-		diff = timo_queue->val - timo_abstime;
-		if (diff > 0)
+	todo = NULL;
+	for (lev = 0; lev < TIMO_NLEVEL; lev++) {
+		oldpos = (oldtime >> TIMO_SHIFT(lev)) & TIMO_MASK(lev);
+		newpos = (timo_abstime >> TIMO_SHIFT(lev)) & TIMO_MASK(lev);
+		n = (newpos - oldpos) & TIMO_MASK(lev);
+		if (n == 0)
 			break;
-		to = timo_queue;
-		timo_queue = to->next;
+		if (n >= TIMO_NSLOT) {
+			bits = ~0ULL;
+		} else {
+			bits = 0;
+			for (i = 1; i <= n; i++) {
+				idx = (oldpos + i) & TIMO_MASK(lev);
+				bits |= 1ULL << (idx & (TIMO_NSLOT - 1));
+			}
+		}
+		bits &= timo_pending[lev];
+		timo_pending[lev] &= ~bits;
+		while (bits) {
+			idx = timo_ffs(bits);
+			bits &= bits - 1;
+			while ((to = timo_wheel[lev][idx]) != NULL) {
+				timo_unlink(to);
+				timo_link(&todo, to);
+			}
+		}
+	}
+
+	/*
+	 * move them to lower levels or to the expired list
+	 */
+	while ((to = todo) != NULL) {
+		timo_unlink(to);
+		timo_place(to);
+	}
+
+	/*
+	 * remove from the queue and run expired timeouts
+	 */
+	while ((to = timo_expired) != NULL) {
+		timo_unlink(to);
 		to->set = 0;
+		timo_nfired++;
 		to->cb(to->arg);
 	}
 }
 
+/*
+ * if there are scheduled timeouts, store in 'delta' the number of
+ * 24-th of microseconds until the first one expires and return 1,
+ * else return 0
+ */
+unsigned
+timo_next(unsigned *delta)
+{
+	struct timo *i;
+	unsigned lev, idx, start, min, diff;
+	unsigned long long bits;
+
+	if (timo_expired != NULL) {
+		*delta = 0;
+		return 1;
+	}
+
+	/*
+	 * timeouts of a given level expire before the ones of upper
+	 * levels. Within a level, the first non-empty slot after the
+	 * current time contains the first timeout to expire
+	 */
+	for (lev = 0; lev < TIMO_NLEVEL; lev++) {
+		start = ((timo_abstime >> TIMO_SHIFT(lev)) + 1) &
+		    (TIMO_NSLOT - 1);
+		for (;;) {
+			bits = timo_pending[lev];
+			if (bits == 0)
+				break;
+			if (start > 0)
+				bits = (bits >> start) | (bits << (64 - start));
+			idx = (start + timo_ffs(bits)) & (TIMO_NSLOT - 1);
+			i = timo_wheel[lev][idx];
+			if (i == NULL) {
+				timo_pending[lev] &= ~(1ULL << idx);
+				continue;
+			}
+			min = i->val - timo_abstime;
+			for (i = i->next; i != NULL; i = i->next) {
+				diff = i->val - timo_abstime;
+				if (min > diff)
+					min = diff;
+			}
+			*delta = min;
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /*
  * initialize timeout queue
  */
 void
 timo_init(void)
 {
-	timo_queue = NULL;
+	unsigned lev, idx;
+
+	for (lev = 0; lev < TIMO_NLEVEL; lev++) {
+		for (idx = 0; idx < TIMO_NSLOT; idx++)
+			timo_wheel[lev][idx] = NULL;
+		timo_pending[lev] = 0;
+	}
+	timo_expired = NULL;
 	timo_abstime = 0;
+	timo_nfired = 0;
 }
 
 /*
@@ -157,9 +323,16 @@ timo_init(void)
 void
 timo_done(void)
 {
-	if (timo_queue != NULL) {
-		log_puts("timo_done: timo_queue not empty!\n");
-		panic();
+	unsigned lev, idx;
+
+	for (lev = 0; lev < TIMO_NLEVEL; lev++) {
+		for (idx = 0; idx < TIMO_NSLOT; idx++) {
+			if (timo_wheel[lev][idx] != NULL)
+				break;
+		}
+		if (idx < TIMO_NSLOT || timo_expired != NULL) {
+			log_puts("timo_done: timo_queue not empty!\n");
+			panic();
+		}
 	}
-	timo_queue = (struct timo *)0xdeadbeef;
 }
@@ -17,8 +17,18 @@
 #ifndef MIDISH_TIMO_H
 #define MIDISH_TIMO_H
 
+/*
+ * the timing wheel has TIMO_NLEVEL levels of TIMO_NSLOT lists. A
+ * slot of level l contains timeouts expiring within a range of
+ * 2^(TIMO_BITS * l) time units
+ */
+#define TIMO_BITS	6
+#define TIMO_NSLOT	(1 << TIMO_BITS)
+#define TIMO_NLEVEL	((32 + TIMO_BITS - 1) / TIMO_BITS)
+
 struct timo {
-	struct timo *next;
+	struct timo *next;		/* next in the same list */
+	struct timo **prev;		/* pointer to us in the list */
 	unsigned val;			/* time to wait before the callback */
 	unsigned set;			/* true if the timeout is set */
 	void (*cb)(void *arg);		/* routine to call on expiration */
@@ -29,9 +39,11 @@ void timo_set(struct timo *, void (*)(void *), void *);
 void timo_add(struct timo *, unsigned);
 void timo_del(struct timo *);
 void timo_update(unsigned);
+unsigned timo_next(unsigned *);
 void timo_init(void);
 void timo_done(void);
 
 extern unsigned timo_abstime;
+extern unsigned long timo_nfired;
 
 #endif /* MIDISH_TIMO_H */
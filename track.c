@@ -27,9 +27,23 @@
  *	- each clock tick marks the begining of a delta
  *	- each event (struct ev) is played after delta ticks
  *
+ * Walking the list is slow on large tracks, so the track totals and
+ * the measure and tempo maps are cached in the track index (struct
+ * trackidx). Any function modifying a track must increment its
+ * 'gen' field, which invalidates the index; it's rebuilt on
+ * demand by track_getidx(). Functions working on events only
+ * (seqev_ins(), seqev_rm()) don't know the track, so their callers
+ * must do it.
+ *
+ * While an undo record is being built for the track, its 'log'
+ * field is set and the track_evxxx() and track_setxxx() functions
+ * record their changes in it, see track_undosave(). Any change to
+ * such a track must go through them.
  */
 
+#include <string.h>
 #include "utils.h"
+#include "defs.h"
 #include "pool.h"
 #include "track.h"
 
@@ -79,6 +93,11 @@ track_init(struct track *o)
 	o->eot.next = NULL;
 	o->eot.prev = &o->first;
 	o->first = &o->eot;
+	o->gen = 1;
+	o->idx.gen = 0;
+	o->idx.sig = NULL;
+	o->idx.tempo = NULL;
+	o->log = NULL;
 }
 
 /*
@@ -93,6 +112,10 @@ track_done(struct track *o)
 		inext = i->next;
 		seqev_del(i);
 	}
+	if (o->idx.sig)
+		xfree(o->idx.sig);
+	if (o->idx.tempo)
+		xfree(o->idx.tempo);
 #ifdef TRACK_DEBUG
 	o->first = (void *)0xdeadbeef;
 #endif
@@ -134,7 +157,7 @@ track_isempty(struct track *o)
 void
 track_chomp(struct track *o)
 {
-	o->eot.delta = 0;
+	track_setdelta(o, &o->eot, 0);
 }
 
 /*
@@ -143,7 +166,7 @@ track_chomp(struct track *o)
 void
 track_shift(struct track *o, unsigned ntics)
 {
-	o->first->delta += ntics;
+	track_setdelta(o, o->first, o->first->delta + ntics);
 }
 
 /*
@@ -154,6 +177,11 @@ track_swap(struct track *t1, struct track *t2)
 {
 	struct seqev *se, eot;
 
+	if (t1->log || t2->log) {
+		log_puts("track_swap: track changes are logged\n");
+		panic();
+	}
+
 	/* swap list of events */
 	se = t1->first;
 	t1->first = t2->first;
@@ -169,6 +197,231 @@ track_swap(struct track *t1, struct track *t2)
 	/* fix references to eot events */
 	*t1->eot.prev = &t1->eot;
 	*t2->eot.prev = &t2->eot;
+	t1->gen++;
+	t2->gen++;
+}
+
+/*
+ * replace the contents of the track by the ones of 'src', which
+ * becomes empty
+ */
+void
+track_replace(struct track *t, struct track *src)
+{
+	struct seqev *se;
+
+	if (t->log == NULL) {
+		track_swap(t, src);
+		track_clear(src);
+		return;
+	}
+	track_clear(t);
+	track_setdelta(t, &t->eot, track_numtic(src));
+	while ((se = src->first) != &src->eot) {
+		src->first = se->next;
+		se->next->prev = &src->first;
+		track_evins(t, &t->eot, se);
+	}
+	src->eot.delta = 0;
+	src->gen++;
+}
+
+/*
+ * append a change to the log
+ */
+void
+track_logop(struct track_data *d, unsigned type, unsigned delta,
+    struct seqev *se, struct seqev *aux)
+{
+	struct track_op *ops, *op;
+
+	if (d->nops == d->maxops) {
+		d->maxops = d->maxops > 0 ? 2 * d->maxops : 16;
+		ops = xmalloc(d->maxops * sizeof(struct track_op), "track_op");
+		if (d->ops) {
+			memcpy(ops, d->ops, d->nops * sizeof(struct track_op));
+			xfree(d->ops);
+		}
+		d->ops = ops;
+	}
+	op = d->ops + d->nops++;
+	op->type = type;
+	op->delta = delta;
+	op->se = se;
+	op->aux = aux;
+	d->size += sizeof(struct track_op);
+}
+
+/*
+ * remove the given event (but not the blank space) from the
+ * track. If changes are logged, the event is kept in the log
+ */
+void
+track_evrm(struct track *t, struct seqev *se)
+{
+	struct track_data *d = t->log;
+	struct seqev *next = se->next;
+
+#ifdef TRACK_DEBUG
+	if (se->ev.cmd == EV_NULL) {
+		log_puts("track_evrm: unexpected end of track\n");
+		panic();
+	}
+#endif
+	next->delta += se->delta;
+	*se->prev = next;
+	next->prev = se->prev;
+	t->gen++;
+	if (d == NULL) {
+		seqev_del(se);
+		return;
+	}
+	if (d->nops > 0 && d->ops[d->nops - 1].type == TRACK_OP_INS &&
+	    d->ops[d->nops - 1].se == se) {
+		/* inserted by the last change, forget both */
+		d->nops--;
+		d->size -= sizeof(struct track_op);
+		seqev_del(se);
+		return;
+	}
+	track_logop(d, TRACK_OP_DEL, 0, se, next);
+	d->size += sizeof(struct seqev);
+}
+
+/*
+ * insert the given seqev just before 'pos'; its delta field is the
+ * number of tics between the previous event and it, it's taken from
+ * the blank space before 'pos'
+ */
+void
+track_evins(struct track *t, struct seqev *pos, struct seqev *se)
+{
+	pos->delta -= se->delta;
+	se->next = pos;
+	se->prev = pos->prev;
+	*se->prev = se;
+	pos->prev = &se->next;
+	t->gen++;
+	if (t->log)
+		track_logop(t->log, TRACK_OP_INS, 0, se, NULL);
+}
+
+/*
+ * insert an event 'delta' tics after the event preceding 'pos',
+ * return the new seqev.
+ *
+ * If the same event was removed from this place by the last changes,
+ * it's taken back from the log rather than logging a new insertion,
+ * so functions rewriting the track by removing and putting back
+ * events log only the events that actually changed.
+ */
+struct seqev *
+track_evput(struct track *t, struct seqev *pos, unsigned delta,
+    struct ev *ev)
+{
+	struct track_data *d = t->log;
+	struct seqev *se;
+	unsigned i, n;
+
+	if (d != NULL) {
+		/*
+		 * find the first event of the group of events
+		 * removed just before 'pos'
+		 */
+		i = d->nops;
+		se = pos;
+		while (i > 0 && d->ops[i - 1].type == TRACK_OP_DEL &&
+		    d->ops[i - 1].aux == se) {
+			i--;
+			se = d->ops[i].se;
+		}
+		if (i < d->nops && se->delta == delta && ev_eq(&se->ev, ev)) {
+			for (n = i + 1; n < d->nops; n++) {
+				d->ops[n].se->delta -= delta;
+				d->ops[n - 1] = d->ops[n];
+			}
+			d->nops--;
+			d->size -= sizeof(struct track_op) + sizeof(struct seqev);
+			pos->delta -= delta;
+			se->next = pos;
+			se->prev = pos->prev;
+			*se->prev = se;
+			pos->prev = &se->next;
+			t->gen++;
+			return se;
+		}
+	}
+	se = seqev_new();
+	se->ev = *ev;
+	se->delta = delta;
+	track_evins(t, pos, se);
+	return se;
+}
+
+/*
+ * move the given event of the track just before 'pos', in another
+ * track. If changes are logged, the event is kept in the log and
+ * a copy is moved instead
+ */
+void
+track_evmove(struct track *t, struct seqev *se, struct seqev *pos)
+{
+	struct seqev *copy;
+
+	if (t->log) {
+		copy = seqev_new();
+		copy->ev = se->ev;
+		track_evrm(t, se);
+		se = copy;
+	} else {
+		seqev_rm(se);
+		t->gen++;
+	}
+	seqev_ins(pos, se);
+}
+
+/*
+ * set the number of tics before the given event
+ */
+void
+track_setdelta(struct track *t, struct seqev *se, unsigned delta)
+{
+	struct track_data *d = t->log;
+	struct track_op *op;
+
+	if (se->delta == delta)
+		return;
+	if (d != NULL) {
+		op = d->nops > 0 ? d->ops + d->nops - 1 : NULL;
+		if (op && op->type == TRACK_OP_DELTA && op->se == se) {
+			/* changed by the last change, update it */
+			if (op->delta == delta) {
+				d->nops--;
+				d->size -= sizeof(struct track_op);
+			}
+		} else
+			track_logop(d, TRACK_OP_DELTA, se->delta, se, NULL);
+	}
+	se->delta = delta;
+	t->gen++;
+}
+
+/*
+ * replace the event of the given seqev
+ */
+void
+track_setev(struct track *t, struct seqev *se, struct ev *ev)
+{
+	struct seqev *old;
+
+	if (t->log) {
+		old = seqev_new();
+		old->ev = se->ev;
+		track_logop(t->log, TRACK_OP_EV, 0, se, old);
+		t->log->size += sizeof(struct seqev);
+	}
+	se->ev = *ev;
+	t->gen++;
 }
 
 /*
@@ -216,19 +469,156 @@ seqev_rm(struct seqev *pos)
 	pos->next->prev = pos->prev;
 }
 
+/*
+ * return the index of the track, (re)build it if the track was
+ * modified since it was built
+ */
+struct trackidx *
+track_getidx(struct track *o)
+{
+	struct trackidx *idx = &o->idx;
+	struct seqev *se;
+	unsigned nsig, ntempo, tic, etic, meas, bpm, tpb, tpm, n;
+
+	if (idx->gen == o->gen)
+		return idx;
+
+	/*
+	 * count events and tics, and meta events to size the maps
+	 */
+	idx->numev = idx->numtic = 0;
+	nsig = ntempo = 0;
+	for (se = o->first; se != NULL; se = se->next) {
+		idx->numev++;
+		idx->numtic += se->delta;
+		if (se->ev.cmd == EV_TIMESIG)
+			nsig++;
+		else if (se->ev.cmd == EV_TEMPO)
+			ntempo++;
+	}
+	if (idx->sig)
+		xfree(idx->sig);
+	if (idx->tempo)
+		xfree(idx->tempo);
+	idx->sig = xmalloc((nsig + 1) * sizeof(struct tracksig), "tracksig");
+	idx->tempo = ntempo == 0 ? NULL :
+	    xmalloc(ntempo * sizeof(struct tracktempo), "tracktempo");
+
+	/*
+	 * tempo map: absolute tic of each tempo change
+	 */
+	n = 0;
+	tic = 0;
+	for (se = o->first; se != NULL; se = se->next) {
+		tic += se->delta;
+		if (se->ev.cmd == EV_TEMPO) {
+			idx->tempo[n].tic = tic;
+			idx->tempo[n].usec24 = se->ev.tempo_usec24;
+			n++;
+		}
+	}
+	idx->ntempo = n;
+
+	/*
+	 * measure map: the time signature at the beginning of a
+	 * measure is the last one at or before it. So move measure by
+	 * measure, but jump over measures without events
+	 */
+	n = 0;
+	meas = tic = 0;
+	bpm = DEFAULT_BPM;
+	tpb = DEFAULT_TPB;
+	se = o->first;
+	etic = se->delta;
+	for (;;) {
+		while (se->ev.cmd != EV_NULL && etic <= tic) {
+			if (se->ev.cmd == EV_TIMESIG) {
+				bpm = se->ev.timesig_beats;
+				tpb = se->ev.timesig_tics;
+			}
+			se = se->next;
+			etic += se->delta;
+		}
+		if (n == 0 || idx->sig[n - 1].bpm != bpm ||
+		    idx->sig[n - 1].tpb != tpb) {
+			idx->sig[n].meas = meas;
+			idx->sig[n].tic = tic;
+			idx->sig[n].bpm = bpm;
+			idx->sig[n].tpb = tpb;
+			n++;
+		}
+		if (se->ev.cmd == EV_NULL)
+			break;
+		tpm = bpm * tpb;
+		meas += (etic - tic + tpm - 1) / tpm;
+		tic += (etic - tic + tpm - 1) / tpm * tpm;
+	}
+	idx->nsig = n;
+	idx->gen = o->gen;
+	return idx;
+}
+
+/*
+ * return the absolute tic of the given measure and (if not NULL)
+ * store the time signature at this measure, using meta-events of
+ * the track
+ */
+unsigned
+track_idxmeas(struct track *o, unsigned meas, unsigned *bpm, unsigned *tpb)
+{
+	struct trackidx *idx;
+	struct tracksig *s;
+	unsigned lo, hi, mid;
+
+	idx = track_getidx(o);
+	lo = 0;
+	hi = idx->nsig;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (idx->sig[mid].meas <= meas)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	s = &idx->sig[lo];
+	if (bpm)
+		*bpm = s->bpm;
+	if (tpb)
+		*tpb = s->tpb;
+	return s->tic + (meas - s->meas) * s->bpm * s->tpb;
+}
+
+/*
+ * return the tempo at the given tic, using meta-events of the track
+ */
+unsigned long
+track_idxtempo(struct track *o, unsigned tic)
+{
+	struct trackidx *idx;
+	unsigned lo, hi, mid;
+
+	idx = track_getidx(o);
+	if (idx->ntempo == 0 || idx->tempo[0].tic > tic)
+		return DEFAULT_USEC24;
+	lo = 0;
+	hi = idx->ntempo;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (idx->tempo[mid].tic <= tic)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return idx->tempo[lo].usec24;
+}
+
 /*
  * return the number of events in the track
  */
 unsigned
 track_numev(struct track *o)
 {
-	unsigned n;
-	struct seqev *i;
-
-	n = 0;
-	for (i = o->first; i != NULL; i = i->next)
-		n++;
-	return n;
+	return track_getidx(o)->numev;
 }
 
 /*
@@ -238,31 +628,39 @@ track_numev(struct track *o)
 unsigned
 track_numtic(struct track *o)
 {
-	unsigned ntics;
-	struct seqev *i;
-
-	ntics = 0;
-	for(i = o->first; i != NULL; i = i->next)
-		ntics += i->delta;
-	return ntics;
+	return track_getidx(o)->numtic;
 }
 
-
 /*
  * remove all events from the track
  */
 void
 track_clear(struct track *o)
 {
-	struct seqev *i, *inext;
+	struct seqev *i, *inext, *last;
+	unsigned n;
 
-	for (i = o->first;  i != &o->eot;  i = inext) {
-		inext = i->next;
-		seqev_del(i);
+	if (o->log) {
+		/* keep the events in the log */
+		last = NULL;
+		n = 0;
+		for (i = o->first;  i != &o->eot;  i = i->next) {
+			last = i;
+			n++;
+		}
+		track_logop(o->log, TRACK_OP_CLEAR, o->eot.delta,
+		    last ? o->first : NULL, last);
+		o->log->size += n * sizeof(struct seqev);
+	} else {
+		for (i = o->first;  i != &o->eot;  i = inext) {
+			inext = i->next;
+			seqev_del(i);
+		}
 	}
 	o->eot.delta = 0;
 	o->eot.prev = &o->first;
 	o->first = &o->eot;
+	o->gen++;
 }
 
 /*
@@ -273,11 +671,15 @@ void
 track_setchan(struct track *src, unsigned dev, unsigned ch)
 {
 	struct seqev *i;
+	struct ev ev;
 
 	for (i = src->first; i != NULL; i = i->next) {
-		if (EV_ISVOICE(&i->ev)) {
-			i->ev.dev = dev;
-			i->ev.ch = ch;
+		if (EV_ISVOICE(&i->ev) &&
+		    (i->ev.dev != dev || i->ev.ch != ch)) {
+			ev = i->ev;
+			ev.dev = dev;
+			ev.ch = ch;
+			track_setev(src, i, &ev);
 		}
 	}
 }
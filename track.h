@@ -25,19 +25,78 @@ struct seqev {
 	struct seqev *next, **prev;
 };
 
+/*
+ * index of a track, built on demand by scanning the track and valid
+ * until the track is modified (ie. its 'gen' field changes). It contains
+ * the track totals and the measure and tempo maps, so that tick and
+ * measure lookups don't need to walk the event list
+ */
+struct trackidx {
+	unsigned gen;			/* track 'gen' when built */
+	unsigned numev;			/* number of events, eot included */
+	unsigned numtic;		/* length in tics, eot included */
+	unsigned nsig;			/* number of entries in sig[] */
+	struct tracksig {
+		unsigned meas;		/* first measure using this sig */
+		unsigned tic;		/* absolute tic of the measure */
+		unsigned bpm, tpb;	/* time signature */
+	} *sig;
+	unsigned ntempo;		/* number of entries in tempo[] */
+	struct tracktempo {
+		unsigned tic;		/* absolute tic of the change */
+		unsigned long usec24;	/* new tempo */
+	} *tempo;
+};
+
 struct track {
 	struct seqev eot;		/* end-of-track event */
 	struct seqev *first;		/* head of the event list */
+	unsigned gen;			/* incremented on each change */
+	struct trackidx idx;		/* index, see track_getidx() */
+	struct track_data *log;		/* changes to undo, or NULL */
 };
 
+/*
+ * copy of an event, used to compare or restore tracks
+ */
+struct seqev_data {
+	unsigned delta;
+	struct ev ev;
+};
+
+/*
+ * log of the changes made to a track, see track_undosave(). Removed
+ * events are not freed, they are kept in the log so they can be put
+ * back and the pointers stored in older logs remain valid
+ */
 struct track_data {
-	struct seqev_data {
-		unsigned delta;
-		struct ev ev;
-	} *evs;
-	unsigned int pos, nrm, nins;
+	struct track_op {
+		unsigned type;		/* one of TRACK_OP_xxx below */
+		unsigned delta;		/* old delta, or total delta */
+		struct seqev *se;	/* the changed event */
+		struct seqev *aux;	/* depends on 'type' */
+	} *ops;
+	unsigned nops, maxops;		/* used and allocated ops */
+	struct seqev *setpos;		/* first overwritten event */
+	unsigned char *setbuf;		/* old values, packed, undone last */
+	unsigned nset;			/* number of overwritten events */
+	unsigned setlen;		/* size of 'setbuf' in bytes */
+	unsigned size;			/* memory used, in bytes */
 };
 
+#define TRACK_OP_INS	0	/* 'se' was inserted */
+#define TRACK_OP_DEL	1	/* 'se' was removed before 'aux' */
+#define TRACK_OP_DELTA	2	/* 'se' delta was changed */
+#define TRACK_OP_EV	3	/* 'se' event was 'aux' event */
+#define TRACK_OP_CLEAR	4	/* all events, 'se' to 'aux', removed */
+#define TRACK_OP_INSLIST 5	/* 'se' to 'aux' were inserted */
+#define TRACK_OP_RMLIST	6	/* 'se' to 'aux' were removed */
+
+#define TRACK_PACK_CMD		0x1f	/* event command */
+#define TRACK_PACK_DEVCH	0x20	/* dev and ch bytes follow */
+#define TRACK_PACK_V0		0x40	/* v0 is same as previous event */
+#define TRACK_PACK_V1		0x80	/* v1 is same as previous event */
+
 void	      seqev_pool_init(unsigned);
 void	      seqev_pool_done(void);
 struct seqev *seqev_new(void);
@@ -49,11 +108,24 @@ void	      track_done(struct track *);
 void	      track_dump(struct track *);
 unsigned      track_numev(struct track *);
 unsigned      track_numtic(struct track *);
+struct trackidx *track_getidx(struct track *);
+unsigned      track_idxmeas(struct track *, unsigned, unsigned *, unsigned *);
+unsigned long track_idxtempo(struct track *, unsigned);
 void	      track_clear(struct track *);
 unsigned      track_isempty(struct track *);
 void	      track_chomp(struct track *);
 void	      track_shift(struct track *, unsigned);
 void	      track_swap(struct track *, struct track *);
+void	      track_replace(struct track *, struct track *);
+
+void	      track_logop(struct track_data *, unsigned, unsigned,
+		  struct seqev *, struct seqev *);
+void	      track_evrm(struct track *, struct seqev *);
+struct seqev *track_evput(struct track *, struct seqev *, unsigned, struct ev *);
+void	      track_evins(struct track *, struct seqev *, struct seqev *);
+void	      track_evmove(struct track *, struct seqev *, struct seqev *);
+void	      track_setdelta(struct track *, struct seqev *, unsigned);
+void	      track_setev(struct track *, struct seqev *, struct ev *);
 
 unsigned      seqev_avail(struct seqev *);
 void	      seqev_ins(struct seqev *, struct seqev *);
@@ -66,5 +138,6 @@ unsigned      track_evcnt(struct track *, unsigned);
 unsigned track_undosave(struct track *, struct track_data *);
 unsigned track_undodiff(struct track *, struct track_data *);
 void track_undorestore(struct track *, struct track_data *);
+void track_undofree(struct track_data *);
 
 #endif /* MIDISH_TRACK_H */
@@ -73,6 +73,8 @@ undo_pop(struct song *s)
 		case UNDO_STR:
 			str_delete(*u->u.ren.ptr);
 			*u->u.ren.ptr = u->u.ren.val;
+			if (u->u.ren.list)
+				namelist_rehash(u->u.ren.list);
 			break;
 		case UNDO_UINT:
 			*u->u.uint.ptr = u->u.uint.val;
@@ -81,7 +83,7 @@ undo_pop(struct song *s)
 			track_undorestore(u->u.track.track, &u->u.track.data);
 			break;
 		case UNDO_TDEL:
-			name_add(&s->trklist, &u->u.tdel.trk->name);
+			namelist_add(&s->trklist, &u->u.tdel.trk->name);
 			if (s->curtrk == NULL)
 				s->curtrk = u->u.tdel.trk;
 			break;
@@ -93,7 +95,7 @@ undo_pop(struct song *s)
 			*u->u.filt.filt = u->u.filt.data;
 			break;
 		case UNDO_FDEL:
-			name_add(&s->filtlist, &u->u.fdel.filt->name);
+			namelist_add(&s->filtlist, &u->u.fdel.filt->name);
 			if (s->curfilt == NULL)
 				s->curfilt = u->u.fdel.filt;
 			while ((p = u->u.fdel.trks) != NULL) {
@@ -106,7 +108,7 @@ undo_pop(struct song *s)
 			song_filtdel(s, u->u.fdel.filt);
 			break;
 		case UNDO_CDEL:
-			name_add(&s->chanlist, &u->u.cdel.chan->name);
+			namelist_add(&s->chanlist, &u->u.cdel.chan->name);
 			if (u->u.cdel.chan->isinput) {
 				if (s->curin == NULL)
 					s->curin = u->u.cdel.chan;
@@ -129,7 +131,7 @@ undo_pop(struct song *s)
 			    u->u.sysex.data.pos, x);
 			break;
 		case UNDO_XDEL:
-			name_add(&s->sxlist, &u->u.xdel.sx->name);
+			namelist_add(&s->sxlist, &u->u.xdel.sx->name);
 			if (s->cursx == NULL)
 				s->cursx = u->u.xdel.sx;
 			break;
@@ -175,7 +177,7 @@ undo_clear(struct song *s, struct undo **pos)
 		case UNDO_UINT:
 			break;
 		case UNDO_TRACK:
-			xfree(u->u.track.data.evs);
+			track_undofree(&u->u.track.data);
 			break;
 		case UNDO_TDEL:
 			track_done(&u->u.tdel.trk->track);
@@ -235,7 +237,7 @@ undo_clear(struct song *s, struct undo **pos)
 void
 undo_push(struct song *s, struct undo *u)
 {
-	struct undo **pu;
+	struct undo **pu, **pg;
 	size_t size;
 
 	u->next = s->undo;
@@ -250,21 +252,26 @@ undo_push(struct song *s, struct undo *u)
 #endif
 
 	/*
-	 * free old entries exceeding memory usage limit
+	 * free old entries exceeding memory usage limit. Entries
+	 * undone together (all but the oldest have no func) are
+	 * freed together. The newest group is kept, it may still
+	 * be logging track changes
 	 */
 	size = 0;
-	pu = &s->undo;
+	pu = pg = &s->undo;
 	while (1) {
 		u = *pu;
 		if (u == NULL)
 			return;
 		size += u->size;
-		if (size > UNDO_MAXSIZE)
+		if (size > UNDO_MAXSIZE && pg != &s->undo)
 			break;
 		pu = &u->next;
+		if (u->func)
+			pg = pu;
 	}
 
-	undo_clear(s, pu);
+	undo_clear(s, pg);
 }
 
 void
@@ -284,10 +291,29 @@ undo_setstr(struct song *s, char *func, char **ptr, char *val)
 	u = undo_new(s, UNDO_STR, func, *ptr);
 	u->u.ren.ptr = ptr;
 	u->u.ren.val = *ptr;
+	u->u.ren.list = NULL;
 	*ptr = str_new(val);
 	undo_push(s, u);
 }
 
+/*
+ * rename an entry of the given list, and update the list hash table
+ */
+void
+undo_rename(struct song *s, char *func, struct namelist *list,
+    struct name *n, char *val)
+{
+	struct undo *u;
+
+	u = undo_new(s, UNDO_STR, func, n->str);
+	u->u.ren.ptr = &n->str;
+	u->u.ren.val = n->str;
+	u->u.ren.list = list;
+	n->str = str_new(val);
+	namelist_rehash(list);
+	undo_push(s, u);
+}
+
 void
 undo_setuint(struct song *s, char *func, char *tag,
 	unsigned int *ptr, unsigned int val)
@@ -320,52 +346,75 @@ undo_scale(struct song *s, char *func, char *tag,
 	undo_push(s, u);
 }
 
+/*
+ * start logging changes of the given track in the given record.
+ * Removed events are kept in the log, so undoing a change doesn't
+ * need to copy the track and memory usage is proportional to the
+ * size of the change
+ */
 unsigned
 track_undosave(struct track *t, struct track_data *u)
+{
+	u->ops = NULL;
+	u->nops = u->maxops = 0;
+	u->setpos = NULL;
+	u->setbuf = NULL;
+	u->nset = 0;
+	u->setlen = 0;
+	u->size = 0;
+	t->log = u;
+	return 0;
+}
+
+/*
+ * return a copy of all the events of the track
+ */
+struct seqev_data *
+track_undosnap(struct track *t, unsigned *rn)
 {
 	struct seqev *i;
-	struct seqev_data *e;
-	unsigned size;
+	struct seqev_data *evs, *e;
 
-	u->nins = track_numev(t);
-	size = sizeof(struct seqev_data) * u->nins;
-	u->evs = xmalloc(size, "track_data");
-	e = u->evs;
+	*rn = track_numev(t);
+	evs = xmalloc(sizeof(struct seqev_data) * *rn, "track_data");
+	e = evs;
 	for (i = t->first; i != NULL; i = i->next) {
 		e->delta = i->delta;
 		e->ev = i->ev;
 		e++;
 	}
-	u->pos = 0;
-	u->nrm = 0;
-	return size;
+	return evs;
 }
 
+/*
+ * find the range of events that differ between two copies of a track
+ */
 void
-track_diff(struct track_data *u1, struct track_data *u2,
+track_diff(struct seqev_data *evs1, unsigned n1,
+	struct seqev_data *evs2, unsigned n2,
 	unsigned *pos, unsigned *nrm, unsigned *nins)
 {
 	unsigned start, end1, end2;
 
 	start = 0;
 	while (1) {
-		if (start == u1->nins || start == u2->nins)
+		if (start == n1 || start == n2)
 			break;
-		if (u1->evs[start].delta != u2->evs[start].delta)
+		if (evs1[start].delta != evs2[start].delta)
 			break;
-		if (!ev_eq(&u1->evs[start].ev, &u2->evs[start].ev))
+		if (!ev_eq(&evs1[start].ev, &evs2[start].ev))
 			break;
 		start++;
 	}
 
-	end1 = u1->nins;
-	end2 = u2->nins;
+	end1 = n1;
+	end2 = n2;
 	while (1) {
 		if (end1 == start || end2 == start)
 			break;
-		if (u1->evs[end1 - 1].delta != u2->evs[end2 - 1].delta)
+		if (evs1[end1 - 1].delta != evs2[end2 - 1].delta)
 			break;
-		if (!ev_eq(&u1->evs[end1 - 1].ev, &u2->evs[end2 - 1].ev))
+		if (!ev_eq(&evs1[end1 - 1].ev, &evs2[end2 - 1].ev))
 			break;
 		end1--;
 		end2--;
@@ -375,82 +424,360 @@ track_diff(struct track_data *u1, struct track_data *u2,
 	*nins = end2 - start;
 }
 
+/*
+ * store a number in the buffer, 7 bits per byte, most significant
+ * first, as in standard midi files. If the buffer is NULL only
+ * count bytes. Return the number of bytes
+ */
 unsigned
-track_undodiff(struct track *t, struct track_data *orig)
+track_undoputvar(unsigned char *p, unsigned val)
 {
-	struct track_data mod;
-	unsigned int i, pos, nrm, nins;
-	struct seqev_data *evs;
+	unsigned bits, n;
+
+	for (bits = 28; bits > 0 && (val >> bits) == 0; bits -= 7)
+		; /* nothing */
+	for (n = 1; ; n++) {
+		if (p)
+			*p++ = ((val >> bits) & 0x7f) | (bits > 0 ? 0x80 : 0);
+		if (bits == 0)
+			break;
+		bits -= 7;
+	}
+	return n;
+}
 
-	track_undosave(t, &mod);
-	track_diff(orig, &mod, &pos, &nrm, &nins);
+/*
+ * read a number stored with track_undoputvar()
+ */
+unsigned char *
+track_undogetvar(unsigned char *p, unsigned *val)
+{
+	unsigned c;
+
+	*val = 0;
+	do {
+		c = *p++;
+		*val = (*val << 7) | (c & 0x7f);
+	} while (c & 0x80);
+	return p;
+}
+
+/*
+ * pack the given events in the buffer, return the number of bytes
+ * used. If the buffer is NULL, only count bytes.
+ *
+ * Each event starts with a byte containing the command and flags,
+ * followed by the delta. Like the running status of midi files,
+ * the device and channel, and each of the two parameters are
+ * skipped if they are the same as in the previous event, so most
+ * voice events take 3 or 4 bytes.
+ */
+unsigned
+track_undopack(unsigned char *p, struct seqev_data *evs, unsigned n)
+{
+	struct ev *ev, *prev, null;
+	unsigned char *cmd;
+	unsigned i, len;
+
+	null.cmd = null.dev = null.ch = 0;
+	null.v0 = null.v1 = 0;
+	prev = &null;
+	len = 0;
+	for (i = 0; i < n; i++) {
+		ev = &evs[i].ev;
+		cmd = p ? p + len : NULL;
+		if (cmd)
+			*cmd = ev->cmd;
+		len++;
+		len += track_undoputvar(p ? p + len : NULL, evs[i].delta);
+		if (ev->dev != prev->dev || ev->ch != prev->ch) {
+			if (cmd) {
+				*cmd |= TRACK_PACK_DEVCH;
+				p[len] = ev->dev;
+				p[len + 1] = ev->ch;
+			}
+			len += 2;
+		}
+		if (ev->v0 != prev->v0)
+			len += track_undoputvar(p ? p + len : NULL, ev->v0);
+		else if (cmd)
+			*cmd |= TRACK_PACK_V0;
+		if (ev->v1 != prev->v1)
+			len += track_undoputvar(p ? p + len : NULL, ev->v1);
+		else if (cmd)
+			*cmd |= TRACK_PACK_V1;
+		prev = ev;
+	}
+	return len;
+}
 
-	evs = xmalloc(sizeof(struct seqev_data) * nrm, "track_diff");
-	for (i = 0; i < nrm; i++)
-		evs[i] = orig->evs[pos + i];
-	xfree(mod.evs);
-	xfree(orig->evs);
-	orig->evs = evs;
-	orig->nins = nins;
-	orig->nrm = nrm;
-	orig->pos = pos;
-	return sizeof(struct seqev_data) * nrm;
+/*
+ * unpack the event following the given one, return the position
+ * of the next event in the buffer
+ */
+unsigned char *
+track_undounpack(unsigned char *p, struct seqev_data *e)
+{
+	unsigned cmd;
+
+	cmd = *p++;
+	e->ev.cmd = cmd & TRACK_PACK_CMD;
+	p = track_undogetvar(p, &e->delta);
+	if (cmd & TRACK_PACK_DEVCH) {
+		e->ev.dev = *p++;
+		e->ev.ch = *p++;
+	}
+	if (!(cmd & TRACK_PACK_V0))
+		p = track_undogetvar(p, &e->ev.v0);
+	if (!(cmd & TRACK_PACK_V1))
+		p = track_undogetvar(p, &e->ev.v1);
+	return p;
 }
 
+/*
+ * replace the log by a shorter one: undo all logged changes and
+ * redo them as a single change of the range of events that differ
+ * between the track before and after the changes. Events of the
+ * range are overwritten in place (only their old values are kept);
+ * extra events are inserted or removed as a whole list
+ */
 void
-track_undorestore(struct track *t, struct track_data *u)
+track_undocompact(struct track *t, struct track_data *u)
 {
-	unsigned n;
-	struct seqev *pos, *se;
-	struct seqev_data *e;
-
-	/* go to pos */
-	pos = t->first;
-	for (n = u->pos; n > 0; n--)
-		pos = pos->next;
-
-	/* remove events that were inserted */
-	for (n = u->nins; n > 0; n--) {
-		if (pos->ev.cmd == EV_NULL) {
-			if (n != 1) {
-				log_puts("can't remove eot event\n");
-				panic();
+	struct seqev_data *orig, *mod;
+	struct seqev *se, *first, *last, *next;
+	unsigned i, n, norig, nmod, pos, nrm, nins, delta;
+
+	mod = track_undosnap(t, &nmod);
+	track_undorestore(t, u);
+	orig = track_undosnap(t, &norig);
+	track_diff(orig, norig, mod, nmod, &pos, &nrm, &nins);
+
+	track_undosave(t, u);
+	if (nrm == 0 && nins == 0) {
+		xfree(orig);
+		xfree(mod);
+		return;
+	}
+
+	/*
+	 * if the eot event differs, only its delta changed
+	 */
+	if (pos + nrm == norig) {
+		nrm--;
+		nins--;
+	}
+	se = t->first;
+	for (i = 0; i < pos; i++)
+		se = se->next;
+
+	/*
+	 * overwrite common events, keeping their old values packed
+	 */
+	n = nrm < nins ? nrm : nins;
+	if (n > 0) {
+		u->setpos = se;
+		u->nset = n;
+		u->setlen = track_undopack(NULL, orig + pos, n);
+		u->setbuf = xmalloc(u->setlen, "track_data");
+		track_undopack(u->setbuf, orig + pos, n);
+		u->size += u->setlen;
+		for (i = 0; i < n; i++) {
+			se->delta = mod[pos + i].delta;
+			se->ev = mod[pos + i].ev;
+			se = se->next;
+		}
+	}
+	xfree(orig);
+
+	/*
+	 * remove extra events, keeping them in the log
+	 */
+	if (nrm > n) {
+		first = last = se;
+		delta = se->delta;
+		for (i = n + 1; i < nrm; i++) {
+			last = last->next;
+			delta += last->delta;
+		}
+		se = last->next;
+		se->delta += delta;
+		*first->prev = se;
+		se->prev = first->prev;
+		track_logop(u, TRACK_OP_RMLIST, delta, first, last);
+		u->size += (nrm - n) * sizeof(struct seqev);
+	}
+
+	/*
+	 * insert extra events, taking their space from the next event
+	 */
+	delta = 0;
+	for (i = n; i < nins; i++)
+		delta += mod[pos + i].delta;
+	track_setdelta(t, se, mod[pos + nins].delta + delta);
+	if (nins > n) {
+		first = last = NULL;
+		for (i = n; i < nins; i++) {
+			next = seqev_new();
+			next->delta = mod[pos + i].delta;
+			next->ev = mod[pos + i].ev;
+			if (last == NULL)
+				first = next;
+			else {
+				last->next = next;
+				next->prev = &last->next;
 			}
-			pos->delta = 0;
-			break;
+			last = next;
 		}
-		se = pos;
-		pos = se->next;
+		se->delta -= delta;
+		first->prev = se->prev;
+		*first->prev = first;
+		last->next = se;
+		se->prev = &last->next;
+		track_logop(u, TRACK_OP_INSLIST, delta, first, last);
+	}
+	xfree(mod);
+	t->gen++;
+}
 
-		/* remove seqev */
-		*se->prev = pos;
-		pos->prev = se->prev;
-		seqev_del(se);
+/*
+ * stop logging changes of the track, return the memory used by the
+ * log. If there are more logged changes than events, as when a
+ * whole track is rewritten, the log is compacted
+ */
+unsigned
+track_undodiff(struct track *t, struct track_data *u)
+{
+	struct seqev *i;
+	unsigned n;
+
+	if (u->nops >= UNDO_MINCOMPACT) {
+		n = 0;
+		for (i = t->first; i != NULL; i = i->next) {
+			if (++n > u->nops)
+				break;
+		}
+		if (n <= u->nops)
+			track_undocompact(t, u);
 	}
+	t->log = NULL;
+	return u->size;
+}
 
-	/* insert events that were removed */
-	e = u->evs;
-	for (n = u->nrm; n > 0; n--) {
-		if (e->ev.cmd == EV_NULL) {
-			if (n != 1) {
-				log_puts("can't insert eot event\n");
-				panic();
+/*
+ * undo all logged changes, in reverse order
+ */
+void
+track_undorestore(struct track *t, struct track_data *u)
+{
+	struct track_op *op;
+	struct seqev *se, *next, *last;
+	struct seqev_data e;
+	unsigned char *p;
+	unsigned i;
+
+	for (op = u->ops + u->nops; op != u->ops; ) {
+		op--;
+		se = op->se;
+		switch (op->type) {
+		case TRACK_OP_INS:
+			next = se->next;
+			next->delta += se->delta;
+			*se->prev = next;
+			next->prev = se->prev;
+			seqev_del(se);
+			break;
+		case TRACK_OP_DEL:
+			next = op->aux;
+			next->delta -= se->delta;
+			se->next = next;
+			se->prev = next->prev;
+			*se->prev = se;
+			next->prev = &se->next;
+			break;
+		case TRACK_OP_DELTA:
+			se->delta = op->delta;
+			break;
+		case TRACK_OP_EV:
+			se->ev = op->aux->ev;
+			seqev_del(op->aux);
+			break;
+		case TRACK_OP_CLEAR:
+			if (se != NULL) {
+				t->first = se;
+				se->prev = &t->first;
+				op->aux->next = &t->eot;
+				t->eot.prev = &op->aux->next;
+			}
+			t->eot.delta = op->delta;
+			break;
+		case TRACK_OP_INSLIST:
+			next = op->aux->next;
+			next->delta += op->delta;
+			*se->prev = next;
+			next->prev = se->prev;
+			for (; se != next; se = last) {
+				last = se->next;
+				seqev_del(se);
 			}
-			t->eot.delta = e->delta;
+			break;
+		case TRACK_OP_RMLIST:
+			next = op->aux->next;
+			next->delta -= op->delta;
+			se->prev = next->prev;
+			*se->prev = se;
+			next->prev = &op->aux->next;
 			break;
 		}
-		se = seqev_new();
-		se->ev = e->ev;
-		se->delta = e->delta;
-		e++;
+	}
+	p = u->setbuf;
+	e.delta = 0;
+	e.ev.cmd = e.ev.dev = e.ev.ch = 0;
+	e.ev.v0 = e.ev.v1 = 0;
+	for (i = 0, se = u->setpos; i < u->nset; i++, se = se->next) {
+		p = track_undounpack(p, &e);
+		se->delta = e.delta;
+		se->ev = e.ev;
+	}
+	if (u->setbuf)
+		xfree(u->setbuf);
+	if (u->ops)
+		xfree(u->ops);
+	track_undosave(t, u);
+	t->log = NULL;
+	t->gen++;
+}
 
-		/* insert seqev */
-		se->next = pos;
-		se->prev = pos->prev;
-		*(se->prev) = se;
-		pos->prev = &se->next;
+/*
+ * free the log and the events it keeps
+ */
+void
+track_undofree(struct track_data *u)
+{
+	struct track_op *op;
+	struct seqev *se, *next;
+
+	for (op = u->ops; op != u->ops + u->nops; op++) {
+		switch (op->type) {
+		case TRACK_OP_DEL:
+			seqev_del(op->se);
+			break;
+		case TRACK_OP_EV:
+			seqev_del(op->aux);
+			break;
+		case TRACK_OP_CLEAR:
+		case TRACK_OP_RMLIST:
+			for (se = op->se; se != NULL; se = next) {
+				next = (se == op->aux) ? NULL : se->next;
+				seqev_del(se);
+			}
+			break;
+		}
 	}
-	xfree(u->evs);
+	if (u->setbuf)
+		xfree(u->setbuf);
+	if (u->ops)
+		xfree(u->ops);
 }
 
 void
@@ -491,7 +818,7 @@ undo_tdel_do(struct song *s, struct songtrk *t, char *func)
 	undo_track_diff(s);
 	u = undo_new(s, UNDO_TDEL, NULL, NULL);
 	u->u.tdel.trk = t;
-	name_remove(&s->trklist, &t->name);
+	namelist_remove(&s->trklist, &t->name);
 	undo_push(s, u);
 }
 
@@ -528,6 +855,7 @@ filtnode_dup(struct filtnode **dloc, struct filtnode **sloc)
 	s = *sloc;
 	while (s != NULL) {
 		d = filtnode_new(&s->es, dloc);
+		d->u = s->u;
 		filtnode_dup(&d->dstlist, &s->dstlist);
 		dloc = &d->next;
 		s = s->next;
@@ -589,7 +917,7 @@ undo_fdel_do(struct song *s, struct songfilt *f, char *func)
 	if (s->curfilt == f)
 		song_setcurfilt(s, NULL);
 
-	name_remove(&s->filtlist, &f->name);
+	namelist_remove(&s->filtlist, &f->name);
 
 	undo_push(s, u);
 }
@@ -641,7 +969,7 @@ undo_cdel_do(struct song *s, struct songchan *c, char *func)
 
 	u = undo_new(s, UNDO_CDEL, NULL, NULL);
 	u->u.cdel.chan = c;
-	name_remove(&s->chanlist, &c->name);
+	namelist_remove(&s->chanlist, &c->name);
 	undo_push(s, u);
 	if (c->filt)
 		undo_fdel_do(s, c->filt, NULL);
@@ -735,7 +1063,7 @@ undo_xdel_do(struct song *s, char *func, struct songsx *sx)
 	undo_push(s, u);
 	while (sx->sx.first)
 		undo_xrm_do(s, NULL, sx, 0);
-	name_remove(&s->sxlist, &sx->name);
+	namelist_remove(&s->sxlist, &sx->name);
 }
 
 struct songsx *
@@ -20,6 +20,7 @@
 #include "track.h"
 #include "sysex.h"
 
+struct name;
 struct songtrk;
 struct songchan;
 struct songfilt;
@@ -53,6 +54,7 @@ struct undo {
 	union {
 		struct undo_setstr {
 			char **ptr, *val;
+			struct namelist *list;	/* hashed list, if a name */
 		} ren;
 		struct undo_setuint {
 			unsigned int *ptr, val;
@@ -93,11 +95,13 @@ struct undo {
 	} u;
 };
 
+struct undo *undo_new(struct song *, int, char *, char *);
 void undo_pop(struct song *);
 void undo_push(struct song *, struct undo *);
 void undo_clear(struct song *, struct undo **);
 void undo_start(struct song *, char *, char *);
 void undo_setstr(struct song *, char *, char **, char *);
+void undo_rename(struct song *, char *, struct namelist *, struct name *, char *);
 void undo_setuint(struct song *, char *, char *, unsigned int *, unsigned int);
 void undo_scale(struct song *, char *, char *, unsigned int, unsigned int);
 
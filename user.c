@@ -21,6 +21,14 @@
  * each function is described in the manual.html file
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "utils.h"
 #include "defs.h"
 #include "node.h"
@@ -40,15 +48,25 @@
 #include "builtin.h"
 #include "smf.h"
 #include "saveload.h"
+#include "pool.h"
+#include "str.h"
+#include "ev.h"
+#include "vm.h"
 
 struct song *usong;
 unsigned user_flag_batch = 0;
 unsigned user_flag_verb = 0;
+char *user_batch_script = NULL;		/* script to run on each file */
+char **user_batch_files;		/* files to process, see main.c */
+unsigned user_batch_nfiles = 0;
+unsigned user_batch_njobs = 1;		/* number of worker processes */
+unsigned user_batch_child = 0;		/* true in worker processes */
 
 void
 exec_cb(struct exec *e, struct node *root)
 {
 	struct data *data;
+	unsigned long nnew;
 
 	if (root == NULL) {
 		log_puts("syntax error\n");
@@ -58,7 +76,16 @@ exec_cb(struct exec *e, struct node *root)
 		log_puts("exitting, skiped\n");
 		return;
 	}
-	e->result = node_exec(root, e, &data);
+	/*
+	 * the token ending a statement may complete other ones (ex. the
+	 * new-line after an "if" without "else"), don't let them clear
+	 * the error before the batch loop sees it
+	 */
+	if (e->result == RESULT_ERR && user_flag_batch)
+		return;
+	pool_overflow = 0;
+	nnew = data_nnew;
+	e->result = vm_exec(e, root, &data);
 	if (data != NULL) {
 		if (data->type != DATA_NIL) {
 			data_print(data);
@@ -66,6 +93,12 @@ exec_cb(struct exec *e, struct node *root)
 		}
 		data_delete(data);
 	}
+	if (data_debug) {
+		log_puts("data: ");
+		log_putu(data_nnew - nnew);
+		log_puts(" allocated\n");
+	}
+	pool_gc();
 }
 
 /*
@@ -79,7 +112,7 @@ exec_runfile(struct exec *exec, char *filename)
 {
 	struct parse parse;
 	struct textin *in;
-	struct name **locals;
+	struct namelist *locals;
 	int c;
 
 	in = textin_new(filename);
@@ -241,15 +274,22 @@ unsigned
 exec_lookupev(struct exec *o, char *name, struct ev *ev, int input)
 {
 	struct var *arg;
-	struct data *d;
-	unsigned dev, ch, num;
 
 	arg = exec_varlookup(o, name);
 	if (!arg) {
 		log_puts("exec_lookupev: no such var\n");
 		panic();
 	}
-	d = arg->data;
+	return data_getev(arg->data, ev, input);
+}
+
+/*
+ * convert a list to an event, see exec_lookupev()
+ */
+unsigned
+data_getev(struct data *d, struct ev *ev, int input)
+{
+	unsigned dev, ch, num;
 
 	if (d->type != DATA_LIST) {
 		cons_err("event spec must be a list");
@@ -335,6 +375,37 @@ exec_lookupev(struct exec *o, char *name, struct ev *ev, int input)
 	return 1;
 }
 
+/*
+ * convert an event to a list, in the format accepted by
+ * exec_lookupev()
+ */
+struct data *
+data_newev(struct ev *ev)
+{
+	struct data *d, **tail;
+
+	d = data_newlist(NULL);
+	tail = &d->val.list;
+	*tail = data_newref(evinfo[ev->cmd].ev);
+	tail = &(*tail)->next;
+	if (evinfo[ev->cmd].flags & EV_HAS_CH) {
+		*tail = data_newlist(data_newlong(ev->dev));
+		(*tail)->val.list->next = data_newlong(ev->ch);
+	} else
+		*tail = data_newlong(ev->dev);
+	tail = &(*tail)->next;
+	if (evinfo[ev->cmd].nparams >= 1) {
+		if (ev->v0 == EV_UNDEF)
+			*tail = data_newnil();
+		else
+			*tail = data_newlong(ev->v0);
+		tail = &(*tail)->next;
+	}
+	if (evinfo[ev->cmd].nparams >= 2)
+		*tail = data_newlong(ev->v1);
+	return d;
+}
+
 /*
  * fill the evspec with the one referenced by var.
  * var is of this form
@@ -608,6 +679,40 @@ exec_lookupval(struct exec *o, char *n, unsigned isfine, unsigned *r)
 	}
 }
 
+/*
+ * lookup a velocity map, ie a list of EV_MAXCOARSE + 1 velocities.
+ * Non-zero velocities can't be mapped to zero, since a note-on with
+ * zero velocity would be a note-off
+ */
+unsigned
+exec_lookupvmap(struct exec *o, char *n, unsigned char *map)
+{
+	struct data *d;
+	unsigned i;
+
+	if (!exec_lookuplist(o, n, &d))
+		return 0;
+	for (i = 0; d != NULL; i++, d = d->next) {
+		if (i > EV_MAXCOARSE) {
+			cons_errss(o->procname, n, "too many velocities");
+			return 0;
+		}
+		if (d->type != DATA_LONG ||
+		    d->val.num < (i > 0 ? 1 : 0) ||
+		    d->val.num > EV_MAXCOARSE) {
+			cons_errss(o->procname, n,
+			    "velocities must be in the 1..127 range");
+			return 0;
+		}
+		map[i] = d->val.num;
+	}
+	if (i <= EV_MAXCOARSE) {
+		cons_errss(o->procname, n, "must have 128 velocities");
+		return 0;
+	}
+	return 1;
+}
+
 /*
  * convert lists to channels, 'data' can be
  * 	- a reference to an existing songchan
@@ -913,7 +1018,7 @@ user_oncompl(void *arg, char *text, int curs, int used, int *rstart, int *rend)
 			end++;
 		}
 
-		for (n = exec->procs; n != NULL; n = n->next)
+		for (n = exec->procs.first; n != NULL; n = n->next)
 			el_compladd(n->str);
 	}
 
@@ -926,17 +1031,181 @@ struct el_ops user_el_ops = {
 	user_oncompl
 };
 
+/*
+ * same as exec_cb(), but make syntax errors fail the batch script
+ */
+void
+user_batchcb(struct exec *e, struct node *root)
+{
+	if (root == NULL) {
+		log_puts("syntax error\n");
+		e->result = RESULT_ERR;
+		return;
+	}
+	exec_cb(e, root);
+}
+
+/*
+ * run the batch script on the given file, starting from an empty
+ * song. The path is stored in the "file" global variable. Stop at the
+ * first statement that fails. Procs and variables created by the
+ * script are deleted afterwards, so they don't exist for the next
+ * file; the ones defined before, including the builtins, are kept
+ */
+unsigned
+user_batchfile(char *script, size_t len, char *path)
+{
+	struct parse p;
+	struct name *procs, *globals, *n;
+	size_t i;
+	unsigned ok;
+
+	song_stop(usong);
+	song_done(usong);
+	evpat_reset();
+	song_init(usong);
+	procs = exec->procs.first;
+	globals = exec->globals.first;
+	exec_newvar(exec, "file", data_newstring(path));
+	exec->result = RESULT_OK;
+	parse_init(&p, exec, user_batchcb);
+	lex_init(&p, user_batch_script, parse_cb, &p);
+	for (i = 0; i <= len; i++) {
+		lex_handle(&p, i < len ? (unsigned char)script[i] : -1);
+		if (exec->result == RESULT_ERR || exec->result == RESULT_EXIT)
+			break;
+	}
+	lex_done(&p);
+	parse_done(&p);
+	ok = (exec->result != RESULT_ERR);
+	if (!ok)
+		cons_errs(path, "batch script failed");
+
+	/*
+	 * new procs and variables are inserted at the head of the lists
+	 */
+	while (exec->globals.first != globals)
+		var_delete(&exec->globals, (struct var *)exec->globals.first);
+	if (exec->procs.first != procs) {
+		while ((n = exec->procs.first) != procs) {
+			namelist_remove(&exec->procs, n);
+			proc_delete((struct proc *)n);
+		}
+		exec->gen++;
+	}
+	return ok;
+}
+
+/*
+ * run the batch script on each file given on the command line, or
+ * read from stdin (one path per line). Pools and builtins are set up
+ * only once. If multiple jobs are requested, worker processes are
+ * forked, each handling a subset of the files
+ */
+unsigned
+user_batch(void)
+{
+	char line[PATH_MAX], **files, **newfiles, *script;
+	unsigned nfiles, maxfiles, njobs, job, i, ok;
+	struct stat sb;
+	size_t len, n;
+	pid_t pid;
+	FILE *f;
+	int status;
+
+	f = fopen(user_batch_script, "r");
+	if (f == NULL) {
+		cons_errs(user_batch_script, "failed to open file");
+		return 0;
+	}
+	if (fstat(fileno(f), &sb) < 0) {
+		cons_errs(user_batch_script, "failed to stat file");
+		fclose(f);
+		return 0;
+	}
+	script = xmalloc(sb.st_size + 1, "batch");
+	len = fread(script, 1, sb.st_size, f);
+	fclose(f);
+
+	if (user_batch_nfiles > 0) {
+		files = user_batch_files;
+		nfiles = user_batch_nfiles;
+	} else {
+		files = NULL;
+		nfiles = maxfiles = 0;
+		while (fgets(line, PATH_MAX, stdin) != NULL) {
+			n = strlen(line);
+			if (n > 0 && line[n - 1] == '\n')
+				line[--n] = '\0';
+			if (n == 0)
+				continue;
+			if (nfiles == maxfiles) {
+				maxfiles = maxfiles ? 2 * maxfiles : 64;
+				newfiles = xmalloc(maxfiles * sizeof(char *),
+				    "batch");
+				if (files) {
+					memcpy(newfiles, files,
+					    nfiles * sizeof(char *));
+					xfree(files);
+				}
+				files = newfiles;
+			}
+			files[nfiles++] = str_new(line);
+		}
+	}
+
+	njobs = user_batch_njobs < nfiles ? user_batch_njobs : nfiles;
+	log_flush();
+	fflush(NULL);
+	for (job = 1; job < njobs; job++) {
+		pid = fork();
+		if (pid < 0) {
+			log_perror("fork");
+			njobs = job;
+			break;
+		}
+		if (pid == 0) {
+			user_batch_child = 1;
+			break;
+		}
+	}
+	if (!user_batch_child)
+		job = 0;
+
+	ok = 1;
+	for (i = job; i < nfiles; i += njobs) {
+		if (!user_batchfile(script, len, files[i]))
+			ok = 0;
+	}
+	if (!user_batch_child) {
+		while (wait(&status) > 0) {
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				ok = 0;
+		}
+	}
+
+	if (files != user_batch_files) {
+		for (i = 0; i < nfiles; i++)
+			str_delete(files[i]);
+		if (files)
+			xfree(files);
+	}
+	xfree(script);
+	return ok;
+}
+
 unsigned
 user_mainloop(void)
 {
 	cons_init(&user_el_ops, NULL);
 	textio_init();
 	evctl_init();
-	seqev_pool_init(DEFAULT_MAXNSEQEVS);
-	state_pool_init(DEFAULT_MAXNSTATES);
-	chunk_pool_init(DEFAULT_MAXNCHUNKS);
-	sysex_pool_init(DEFAULT_MAXNSYSEXS);
-	seqptr_pool_init(DEFAULT_MAXNSEQPTRS);
+	seqev_pool_init(DEFAULT_NSEQEVS);
+	state_pool_init(DEFAULT_NSTATES);
+	chunk_pool_init(DEFAULT_NCHUNKS);
+	sysex_pool_init(DEFAULT_NSYSEXS);
+	seqptr_pool_init(DEFAULT_NSEQPTRS);
+	data_pool_init(DEFAULT_NDATAS);
 
 	/*
 	 * create the project (ie the song) and
@@ -1069,6 +1338,9 @@ user_mainloop(void)
 			name_newarg("beat",
 			name_newarg("tic",
 			name_newarg("event", NULL)))));
+	exec_newbuiltin(exec, "tgetevs", blt_tgetevs, NULL);
+	exec_newbuiltin(exec, "taddevs", blt_taddevs,
+			name_newarg("evlist", NULL));
 	exec_newbuiltin(exec, "tsetf", blt_tsetf,
 			name_newarg("filtname", NULL));
 	exec_newbuiltin(exec, "tgetf", blt_tgetf, NULL);
@@ -1090,9 +1362,15 @@ user_mainloop(void)
 			name_newarg("halftones", NULL));
 	exec_newbuiltin(exec, "tvcurve", blt_tvcurve,
 			name_newarg("weight", NULL));
+	exec_newbuiltin(exec, "tvmap", blt_tvmap,
+			name_newarg("map", NULL));
 	exec_newbuiltin(exec, "tevmap", blt_tevmap,
 			name_newarg("from",
 			name_newarg("to", NULL)));
+	exec_newbuiltin(exec, "tbatch", blt_tbatch,
+			name_newarg("tracklist",
+			name_newarg("func",
+			name_newarg("...", NULL))));
 	exec_newbuiltin(exec, "tclist", blt_tclist, NULL);
 	exec_newbuiltin(exec, "tinfo", blt_tinfo, NULL);
 	exec_newbuiltin(exec, "tdump", blt_tdump, NULL);
@@ -1157,6 +1435,9 @@ user_mainloop(void)
 	exec_newbuiltin(exec, "fvcurve", blt_fvcurve,
 			name_newarg("evspec",
 			name_newarg("weight", NULL)));
+	exec_newbuiltin(exec, "fvmap", blt_fvmap,
+			name_newarg("evspec",
+			name_newarg("map", NULL)));
 	exec_newbuiltin(exec, "fchgin", blt_fchgin,
 			name_newarg("from",
 			name_newarg("to", NULL)));
@@ -1229,6 +1510,17 @@ user_mainloop(void)
 	exec_newbuiltin(exec, "doev", blt_doev,
 			name_newarg("devnum",
 			name_newarg("flags", NULL)));
+	exec_newbuiltin(exec, "dflush", blt_dflush,
+			name_newarg("devnum",
+			name_newarg("policy", NULL)));
+	exec_newbuiltin(exec, "timer", blt_timer,
+			name_newarg("mode", NULL));
+	exec_newbuiltin(exec, "timerinfo", blt_timerinfo, NULL);
+	exec_newbuiltin(exec, "poolinfo", blt_poolinfo, NULL);
+	exec_newbuiltin(exec, "rtout", blt_rtout,
+			name_newarg("onoff", NULL));
+	exec_newbuiltin(exec, "lookahead", blt_lookahead,
+			name_newarg("msec", NULL));
 
 	/*
 	 * run the user startup script: $HOME/.midishrc or /etc/midishrc
@@ -1239,25 +1531,30 @@ user_mainloop(void)
 			cons_err("Warning, no MIDI devices configured.");
 	}
 
-	/*
-	 * create the parser and start parsing standard input
-	 */
-	parse_init(&parse, exec, exec_cb);
-	lex_init(&parse, "stdin", parse_cb, &parse);
+	if (user_batch_script) {
+		exitcode = user_batch();
+	} else {
+		/*
+		 * create the parser and start parsing standard input
+		 */
+		parse_init(&parse, exec, exec_cb);
+		lex_init(&parse, "stdin", parse_cb, &parse);
 
-	cons_ready();
-	cons_putpos(usong->curpos, 0, 0);
+		cons_ready();
+		cons_putpos(usong->curpos, 0, 0);
 
-	done = 0;
-	while (!done && mux_mdep_wait(1))
-		; /* nothing */
+		done = 0;
+		while (!done && mux_mdep_wait(1))
+			; /* nothing */
 
-	lex_done(&parse);
-	parse_done(&parse);
+		lex_done(&parse);
+		parse_done(&parse);
+	}
 	exec_delete(exec);
 	song_delete(usong);
 	usong = NULL;
 	mididev_listdone();
+	data_pool_done();
 	seqptr_pool_done();
 	sysex_pool_done();
 	chunk_pool_done();
@@ -32,8 +32,15 @@ struct sysex;
 extern struct song *usong;
 extern unsigned user_flag_batch;
 extern unsigned user_flag_verb;
+extern char *user_batch_script;
+extern char **user_batch_files;
+extern unsigned user_batch_nfiles;
+extern unsigned user_batch_njobs;
+extern unsigned user_batch_child;
 
 unsigned user_mainloop(void);
+unsigned user_batchfile(char *, size_t, char *);
+unsigned user_batch(void);
 void user_printstr(char *);
 void user_printlong(long);
 void user_error(char *);
@@ -60,6 +67,7 @@ unsigned exec_lookupev(struct exec *, char *, struct ev *, int);
 unsigned exec_lookupevspec(struct exec *, char *, struct evspec *, int);
 unsigned exec_lookupctl(struct exec *, char *, unsigned *);
 unsigned exec_lookupval(struct exec *, char *, unsigned, unsigned *);
+unsigned exec_lookupvmap(struct exec *, char *, unsigned char *);
 
 
 void data_print(struct data *);
@@ -70,6 +78,8 @@ unsigned data_matchsysex(struct data *, struct sysex *, unsigned *);
 unsigned data_list2ctl(struct data *, unsigned *);
 unsigned data_getctlset(struct data *, unsigned *);
 unsigned data_getxev(struct data *, unsigned *);
+unsigned data_getev(struct data *, struct ev *, int);
+struct data *data_newev(struct ev *);
 unsigned data_getctl(struct data *, unsigned *);
 
 /* track functions */
@@ -18,8 +18,13 @@
  * This allows traces to be collected during time sensitive operations without
  * disturbing them. The buffer can be flushed on standard error later, when
  * slow syscalls are no longer disruptive, e.g. at the end of the poll() loop.
+ *
+ * Each thread has its own buffer. When worker threads are running
+ * (log_mt is set), buffers are flushed with a lock held, so lines
+ * stored by different threads are not mixed.
  */
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,9 +46,11 @@
 		log_buf[log_used++] = (c);	\
 } while (0)
 
-char log_buf[LOG_BUFSZ];	/* buffer where traces are stored */
-unsigned int log_used = 0;	/* bytes used in the buffer */
+__thread char log_buf[LOG_BUFSZ];	/* buffer where traces are stored */
+__thread unsigned int log_used = 0;	/* bytes used in the buffer */
 unsigned int log_sync = 1;	/* if true, flush after each '\n' */
+unsigned int log_mt = 0;	/* if true, lock the tty to flush */
+pthread_mutex_t log_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * write the log buffer on stderr
@@ -53,7 +60,12 @@ log_flush(void)
 {
 	if (log_used == 0)
 		return;
-	tty_write(log_buf, log_used);
+	if (log_mt) {
+		pthread_mutex_lock(&log_mtx);
+		tty_write(log_buf, log_used);
+		pthread_mutex_unlock(&log_mtx);
+	} else
+		tty_write(log_buf, log_used);
 	log_used = 0;
 }
 
@@ -42,5 +42,6 @@ void xfree(void *);
 #endif
 
 extern unsigned log_sync;
+extern unsigned log_mt;
 
 #endif /* UTILS_H */
@@ -0,0 +1,1358 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * this module compiles the trees built by the parser (see node.c)
+ * into a flat list of instructions and runs them on a stack machine.
+ *
+ * Local variables of procs are resolved at compile time to slots in
+ * the stack frame, integers are kept unboxed on the stack and calls
+ * cache the proc they resolve to. The tree interpreter (node_exec) is
+ * still used for proc definitions and as fallback when the nesting
+ * limit (EXEC_MAXDEPTH) could be reached, so errors and their
+ * messages are the same as with the tree interpreter.
+ */
+
+#include <string.h>
+#include "utils.h"
+#include "str.h"
+#include "data.h"
+#include "node.h"
+#include "exec.h"
+#include "cons.h"
+#include "vm.h"
+#include "pool.h"
+
+/*
+ * instructions, operands follow the opcode
+ */
+enum VM_OP {
+	VM_END,		/* end of code, return the value of the statement */
+	VM_NUM,		/* cst: push the given integer constant */
+	VM_CST,		/* cst: push a copy of the given constant */
+	VM_LOAD,	/* slot: push a copy of the local variable */
+	VM_GET,		/* cst: push a copy of the variable by name */
+	VM_STORE,	/* slot: pop value into the local variable */
+	VM_SET,		/* cst: pop value into the variable by name */
+	VM_LIST,	/* n: pop n values, push a list of them */
+	VM_RANGE,	/* pop max, min, push the min:max range */
+	VM_EQ, VM_NEQ, VM_LE, VM_LT, VM_GE, VM_GT,
+	VM_AND, VM_OR,
+	VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_MOD,
+	VM_LSHIFT, VM_RSHIFT, VM_BITAND, VM_BITOR, VM_BITXOR,
+	VM_NOT, VM_NEG, VM_BITNOT,
+	VM_PROC,	/* call: lookup the proc and push it */
+	VM_ARG,		/* call, n: check that n args are not too many */
+	VM_CALL,	/* call: pop args and proc, push return value */
+	VM_CALLS,	/* call: same as VM_CALL, but return on exit */
+	VM_POP,		/* drop the value on top of the stack */
+	VM_SETSV,	/* pop the value of the current statement */
+	VM_CLRSV,	/* the value of the current statement is nil */
+	VM_JZ,		/* addr: pop value and jump if false */
+	VM_JMP,		/* addr: jump */
+	VM_FORLOAD,	/* slot: start a 'for' loop on a local variable */
+	VM_FORGET,	/* cst: start a 'for' loop on a variable by name */
+	VM_NEXT,	/* addr: set variable to next item, jump if none */
+	VM_RET,		/* pop value and return it */
+	VM_EXIT,	/* return and stop the interpreter */
+	VM_NOPS
+};
+
+struct vmop {
+	char *name;
+	unsigned nargs;
+} vm_optab[VM_NOPS] = {
+	{"end", 0},
+	{"num", 1}, {"cst", 1}, {"load", 1}, {"get", 1},
+	{"store", 1}, {"set", 1}, {"list", 1}, {"range", 0},
+	{"eq", 0}, {"neq", 0}, {"le", 0}, {"lt", 0}, {"ge", 0}, {"gt", 0},
+	{"and", 0}, {"or", 0},
+	{"add", 0}, {"sub", 0}, {"mul", 0}, {"div", 0}, {"mod", 0},
+	{"lshift", 0}, {"rshift", 0}, {"bitand", 0}, {"bitor", 0},
+	{"bitxor", 0},
+	{"not", 0}, {"neg", 0}, {"bitnot", 0},
+	{"proc", 1}, {"arg", 2}, {"call", 1}, {"calls", 1},
+	{"pop", 0}, {"setsv", 0}, {"clrsv", 0},
+	{"jz", 1}, {"jmp", 1},
+	{"forload", 1}, {"forget", 1}, {"next", 1},
+	{"ret", 0}, {"exit", 0}
+};
+
+/*
+ * binary operators, in the same order as VM_EQ...VM_BITXOR
+ */
+struct node_vmt *vm_binvmt[] = {
+	&node_vmt_eq, &node_vmt_neq, &node_vmt_le, &node_vmt_lt,
+	&node_vmt_ge, &node_vmt_gt, &node_vmt_and, &node_vmt_or,
+	&node_vmt_add, &node_vmt_sub, &node_vmt_mul, &node_vmt_div,
+	&node_vmt_mod, &node_vmt_lshift, &node_vmt_rshift,
+	&node_vmt_bitand, &node_vmt_bitor, &node_vmt_bitxor, NULL
+};
+
+unsigned (*vm_binfunc[])(struct data *, struct data *) = {
+	data_eq, data_neq, data_le, data_lt,
+	data_ge, data_gt, data_and, data_or,
+	data_add, data_sub, data_mul, data_div,
+	data_mod, data_lshift, data_rshift,
+	data_bitand, data_bitor, data_bitxor
+};
+
+/*
+ * the stack shared by all running code, frames are allocated on top
+ * of each other
+ */
+struct vmval *vm_stack = NULL;
+unsigned vm_stacklen = 0, vm_sp = 0;
+
+/*
+ * if bit 0 is set, log compiled code; if bit 1 is set, don't
+ * use compiled code, run the tree interpreter instead
+ */
+unsigned vm_debug = 0;
+
+/*
+ * free the value of the given stack entry
+ */
+void
+vm_clear(struct vmval *v)
+{
+	if (v->type == VMVAL_DATA)
+		data_delete(v->data);
+	v->type = VMVAL_NONE;
+}
+
+/*
+ * set the given stack entry to a copy of the given data, if it's
+ * an immediate value (integer, range or nil) and return 1. Return 0
+ * otherwise
+ */
+unsigned
+vm_setimm(struct vmval *v, struct data *d)
+{
+	switch (d->type) {
+	case DATA_LONG:
+		v->type = VMVAL_LONG;
+		v->num = d->val.num;
+		return 1;
+	case DATA_RANGE:
+		v->type = VMVAL_RANGE;
+		v->min = d->val.range.min;
+		v->max = d->val.range.max;
+		return 1;
+	case DATA_NIL:
+		v->type = VMVAL_NIL;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * set the given stack entry to the given data, which is owned by
+ * the stack entry from now on. Immediate values are unboxed
+ */
+void
+vm_setdata(struct vmval *v, struct data *d)
+{
+	if (vm_setimm(v, d)) {
+		data_delete(d);
+	} else {
+		v->type = VMVAL_DATA;
+		v->data = d;
+	}
+}
+
+/*
+ * set the given stack entry to a copy of the given data
+ */
+void
+vm_setcopy(struct vmval *v, struct data *d)
+{
+	if (!vm_setimm(v, d)) {
+		v->type = VMVAL_DATA;
+		v->data = data_newnil();
+		data_assign(v->data, d);
+	}
+}
+
+/*
+ * store the value of the given stack entry in the given data
+ * structure, and clear the entry
+ */
+void
+vm_getdata(struct vmval *v, struct data *d)
+{
+	switch (v->type) {
+	case VMVAL_LONG:
+		data_clear(d);
+		d->type = DATA_LONG;
+		d->val.num = v->num;
+		break;
+	case VMVAL_RANGE:
+		data_clear(d);
+		d->type = DATA_RANGE;
+		d->val.range.min = v->min;
+		d->val.range.max = v->max;
+		break;
+	case VMVAL_DATA:
+		/*
+		 * move the value, without copying it
+		 */
+		data_clear(d);
+		d->type = v->data->type;
+		d->val = v->data->val;
+		v->data->type = DATA_NIL;
+		data_delete(v->data);
+		break;
+	default:
+		data_clear(d);
+	}
+	v->type = VMVAL_NONE;
+}
+
+/*
+ * return the value of the given stack entry as a data structure
+ * owned by the caller, and clear the entry
+ */
+struct data *
+vm_takedata(struct vmval *v)
+{
+	struct data *d;
+
+	if (v->type == VMVAL_DATA) {
+		d = v->data;
+		v->type = VMVAL_NONE;
+	} else {
+		d = data_newnil();
+		vm_getdata(v, d);
+	}
+	return d;
+}
+
+/*
+ * make sure the given stack entry holds a data structure
+ */
+struct data *
+vm_box(struct vmval *v)
+{
+	if (v->type != VMVAL_DATA) {
+		v->data = vm_takedata(v);
+		v->type = VMVAL_DATA;
+	}
+	return v->data;
+}
+
+/*
+ * evaluate the given stack entry as a boolean, see data_eval()
+ */
+unsigned
+vm_eval(struct vmval *v)
+{
+	switch (v->type) {
+	case VMVAL_LONG:
+		return v->num != 0;
+	case VMVAL_RANGE:
+		return 1;
+	case VMVAL_DATA:
+		return data_eval(v->data);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * create an empty code structure
+ */
+struct vmcode *
+vm_new(void)
+{
+	struct vmcode *c;
+
+	c = xmalloc(sizeof(struct vmcode), "vmcode");
+	c->ops = NULL;
+	c->nops = c->maxops = 0;
+	c->csts = NULL;
+	c->ncsts = c->maxcsts = 0;
+	c->calls = NULL;
+	c->ncalls = c->maxcalls = 0;
+	c->slots = NULL;
+	c->nslots = c->maxslots = 0;
+	c->nargs = 0;
+	c->proc = 0;
+	c->depth = 0;
+	c->nstack = c->maxstack = 0;
+	c->nrun = 0;
+	c->dead = 0;
+	return c;
+}
+
+void
+vm_delete(struct vmcode *c)
+{
+	unsigned i;
+
+	for (i = 0; i < c->ncsts; i++)
+		data_delete(c->csts[i]);
+	for (i = 0; i < c->ncalls; i++)
+		str_delete(c->calls[i].name);
+	for (i = 0; i < c->nslots; i++)
+		str_delete(c->slots[i]);
+	if (c->ops)
+		xfree(c->ops);
+	if (c->csts)
+		xfree(c->csts);
+	if (c->calls)
+		xfree(c->calls);
+	if (c->slots)
+		xfree(c->slots);
+	xfree(c);
+}
+
+/*
+ * delete the given code, or if it's running, delete it when it
+ * returns (ex. a proc redefined by a script it runs)
+ */
+void
+vm_release(struct vmcode *c)
+{
+	if (c->nrun > 0)
+		c->dead = 1;
+	else
+		vm_delete(c);
+}
+
+/*
+ * append a word to the code, return its address
+ */
+unsigned
+vm_emit(struct vmcode *c, unsigned w)
+{
+	unsigned *ops;
+
+	if (c->nops == c->maxops) {
+		c->maxops = c->maxops > 0 ? 2 * c->maxops : 32;
+		ops = xmalloc(c->maxops * sizeof(unsigned), "vmops");
+		if (c->ops) {
+			memcpy(ops, c->ops, c->nops * sizeof(unsigned));
+			xfree(c->ops);
+		}
+		c->ops = ops;
+	}
+	c->ops[c->nops] = w;
+	return c->nops++;
+}
+
+/*
+ * account for values pushed (or popped if negative) on the stack
+ */
+void
+vm_push(struct vmcode *c, int n)
+{
+	c->nstack += n;
+	if (c->maxstack < c->nstack)
+		c->maxstack = c->nstack;
+}
+
+/*
+ * add a copy of the given data to the constants, return its index
+ */
+unsigned
+vm_addcst(struct vmcode *c, struct data *d)
+{
+	struct data **csts;
+
+	if (c->ncsts == c->maxcsts) {
+		c->maxcsts = c->maxcsts > 0 ? 2 * c->maxcsts : 8;
+		csts = xmalloc(c->maxcsts * sizeof(struct data *), "vmcsts");
+		if (c->csts) {
+			memcpy(csts, c->csts, c->ncsts * sizeof(struct data *));
+			xfree(c->csts);
+		}
+		c->csts = csts;
+	}
+	c->csts[c->ncsts] = data_newnil();
+	data_assign(c->csts[c->ncsts], d);
+	return c->ncsts++;
+}
+
+/*
+ * add a call site for the given call node, return its index
+ */
+unsigned
+vm_addcall(struct vmcode *c, struct node *o, unsigned depth)
+{
+	struct vmcall *calls, *k;
+	struct node *a;
+
+	if (c->ncalls == c->maxcalls) {
+		c->maxcalls = c->maxcalls > 0 ? 2 * c->maxcalls : 8;
+		calls = xmalloc(c->maxcalls * sizeof(struct vmcall), "vmcalls");
+		if (c->calls) {
+			memcpy(calls, c->calls,
+			    c->ncalls * sizeof(struct vmcall));
+			xfree(c->calls);
+		}
+		c->calls = calls;
+	}
+	k = c->calls + c->ncalls;
+	k->name = str_new(o->data->val.ref);
+	k->argc = 0;
+	for (a = o->list; a != NULL; a = a->next)
+		k->argc++;
+	k->depth = depth;
+	k->gen = 0;
+	k->proc = NULL;
+	k->nfixed = k->hasva = 0;
+	return c->ncalls++;
+}
+
+/*
+ * return the slot of the local variable with the given name, or -1
+ */
+int
+vm_slot(struct vmcode *c, char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < c->nslots; i++) {
+		if (str_eq(c->slots[i], name))
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * add a local variable, if not already there
+ */
+void
+vm_addslot(struct vmcode *c, char *name)
+{
+	char **slots;
+
+	if (vm_slot(c, name) >= 0)
+		return;
+	if (c->nslots == c->maxslots) {
+		c->maxslots = c->maxslots > 0 ? 2 * c->maxslots : 8;
+		slots = xmalloc(c->maxslots * sizeof(char *), "vmslots");
+		if (c->slots) {
+			memcpy(slots, c->slots, c->nslots * sizeof(char *));
+			xfree(c->slots);
+		}
+		c->slots = slots;
+	}
+	c->slots[c->nslots++] = str_new(name);
+}
+
+/*
+ * find all variables a proc body may create (with 'let' and 'for')
+ * and allocate slots for them
+ */
+void
+vm_scan(struct vmcode *c, struct node *o)
+{
+	struct node *i;
+
+	if (o->vmt == &node_vmt_assign || o->vmt == &node_vmt_for)
+		vm_addslot(c, o->data->val.ref);
+	for (i = o->list; i != NULL; i = i->next)
+		vm_scan(c, i);
+}
+
+/*
+ * update the depth of the deepest node
+ */
+void
+vm_depth(struct vmcode *c, unsigned depth)
+{
+	if (c->depth < depth)
+		c->depth = depth;
+}
+
+unsigned vm_compexpr(struct vmcode *, struct node *, unsigned);
+
+/*
+ * compile a call node, the proc is called with 'op'
+ */
+unsigned
+vm_compcall(struct vmcode *c, struct node *o, unsigned depth, unsigned op)
+{
+	struct node *a;
+	unsigned k, n;
+
+	/*
+	 * the proc body runs one level below the call node
+	 */
+	vm_depth(c, depth + 1);
+	k = vm_addcall(c, o, depth);
+	vm_emit(c, VM_PROC);
+	vm_emit(c, k);
+	vm_push(c, 1);
+	for (a = o->list, n = 1; a != NULL; a = a->next, n++) {
+		if (!vm_compexpr(c, a, depth + 1))
+			return 0;
+		if (a->next != NULL) {
+			vm_emit(c, VM_ARG);
+			vm_emit(c, k);
+			vm_emit(c, n);
+		}
+	}
+	vm_emit(c, op);
+	vm_emit(c, k);
+	vm_push(c, -(int)c->calls[k].argc);
+	return 1;
+}
+
+/*
+ * compile an expression, leaving its value on the stack
+ */
+unsigned
+vm_compexpr(struct vmcode *c, struct node *o, unsigned depth)
+{
+	struct node *a;
+	unsigned i, n;
+	int s;
+
+	vm_depth(c, depth);
+	if (o->vmt == &node_vmt_cst) {
+		vm_emit(c, o->data->type == DATA_LONG ? VM_NUM : VM_CST);
+		vm_emit(c, vm_addcst(c, o->data));
+		vm_push(c, 1);
+	} else if (o->vmt == &node_vmt_var) {
+		s = c->proc ? vm_slot(c, o->data->val.ref) : -1;
+		if (s >= 0) {
+			vm_emit(c, VM_LOAD);
+			vm_emit(c, s);
+		} else {
+			vm_emit(c, VM_GET);
+			vm_emit(c, vm_addcst(c, o->data));
+		}
+		vm_push(c, 1);
+	} else if (o->vmt == &node_vmt_call) {
+		return vm_compcall(c, o, depth, VM_CALL);
+	} else if (o->vmt == &node_vmt_list) {
+		n = 0;
+		for (a = o->list; a != NULL; a = a->next) {
+			if (!vm_compexpr(c, a, depth + 1))
+				return 0;
+			n++;
+		}
+		vm_emit(c, VM_LIST);
+		vm_emit(c, n);
+		vm_push(c, 1 - (int)n);
+	} else if (o->vmt == &node_vmt_range) {
+		if (!vm_compexpr(c, o->list, depth + 1) ||
+		    !vm_compexpr(c, o->list->next, depth + 1))
+			return 0;
+		vm_emit(c, VM_RANGE);
+		vm_push(c, -1);
+	} else if (o->vmt == &node_vmt_not ||
+	    o->vmt == &node_vmt_neg ||
+	    o->vmt == &node_vmt_bitnot) {
+		if (!vm_compexpr(c, o->list, depth + 1))
+			return 0;
+		if (o->vmt == &node_vmt_not)
+			vm_emit(c, VM_NOT);
+		else if (o->vmt == &node_vmt_neg)
+			vm_emit(c, VM_NEG);
+		else
+			vm_emit(c, VM_BITNOT);
+	} else {
+		for (i = 0; vm_binvmt[i] != NULL; i++) {
+			if (o->vmt == vm_binvmt[i])
+				break;
+		}
+		if (vm_binvmt[i] == NULL)
+			return 0;
+		if (!vm_compexpr(c, o->list, depth + 1) ||
+		    !vm_compexpr(c, o->list->next, depth + 1))
+			return 0;
+		vm_emit(c, VM_EQ + i);
+		vm_push(c, -1);
+	}
+	return 1;
+}
+
+/*
+ * compile a statement. If 'tail' is set, the statement is the last
+ * one of the proc (or of the top-level statement), so its value is
+ * the return value; it's stored in the 'sv' register
+ */
+unsigned
+vm_compstmt(struct vmcode *c, struct node *o, unsigned depth, unsigned tail)
+{
+	struct node *i;
+	unsigned jz, jmp, loop;
+	int s;
+
+	vm_depth(c, depth);
+	if (o->vmt == &node_vmt_call) {
+		if (!vm_compcall(c, o, depth, VM_CALLS))
+			return 0;
+		vm_emit(c, tail ? VM_SETSV : VM_POP);
+		vm_push(c, -1);
+	} else if (o->vmt == &node_vmt_slist) {
+		if (o->list == NULL && tail)
+			vm_emit(c, VM_CLRSV);
+		for (i = o->list; i != NULL; i = i->next) {
+			if (!vm_compstmt(c, i, depth + 1,
+				tail && i->next == NULL))
+				return 0;
+		}
+	} else if (o->vmt == &node_vmt_assign) {
+		if (!vm_compexpr(c, o->list, depth + 1))
+			return 0;
+		s = c->proc ? vm_slot(c, o->data->val.ref) : -1;
+		if (s >= 0) {
+			vm_emit(c, VM_STORE);
+			vm_emit(c, s);
+		} else {
+			vm_emit(c, VM_SET);
+			vm_emit(c, vm_addcst(c, o->data));
+		}
+		vm_push(c, -1);
+		if (tail)
+			vm_emit(c, VM_CLRSV);
+	} else if (o->vmt == &node_vmt_if) {
+		if (!vm_compexpr(c, o->list, depth + 1))
+			return 0;
+		vm_emit(c, VM_JZ);
+		jz = vm_emit(c, 0);
+		vm_push(c, -1);
+		if (!vm_compstmt(c, o->list->next, depth + 1, tail))
+			return 0;
+		if (o->list->next->next != NULL || tail) {
+			vm_emit(c, VM_JMP);
+			jmp = vm_emit(c, 0);
+			c->ops[jz] = c->nops;
+			if (o->list->next->next != NULL) {
+				if (!vm_compstmt(c, o->list->next->next,
+					depth + 1, tail))
+					return 0;
+			} else
+				vm_emit(c, VM_CLRSV);
+			c->ops[jmp] = c->nops;
+		} else
+			c->ops[jz] = c->nops;
+	} else if (o->vmt == &node_vmt_for) {
+		if (!vm_compexpr(c, o->list, depth + 1))
+			return 0;
+		s = c->proc ? vm_slot(c, o->data->val.ref) : -1;
+		if (s >= 0) {
+			vm_emit(c, VM_FORLOAD);
+			vm_emit(c, s);
+		} else {
+			vm_emit(c, VM_FORGET);
+			vm_emit(c, vm_addcst(c, o->data));
+		}
+		vm_push(c, 1);
+		if (tail)
+			vm_emit(c, VM_CLRSV);
+		loop = vm_emit(c, VM_NEXT);
+		jz = vm_emit(c, 0);
+		if (!vm_compstmt(c, o->list->next, depth + 1, tail))
+			return 0;
+		vm_emit(c, VM_JMP);
+		vm_emit(c, loop);
+		c->ops[jz] = c->nops;
+		vm_push(c, -2);
+	} else if (o->vmt == &node_vmt_return) {
+		if (o->list == NULL || !vm_compexpr(c, o->list, depth + 1))
+			return 0;
+		vm_emit(c, VM_RET);
+		vm_push(c, -1);
+	} else if (o->vmt == &node_vmt_exit) {
+		vm_emit(c, VM_EXIT);
+	} else if (o->vmt == &node_vmt_nop) {
+		if (tail)
+			vm_emit(c, VM_CLRSV);
+	} else
+		return 0;
+	return 1;
+}
+
+/*
+ * compile the given tree. If 'p' is not NULL, the tree is the body
+ * of the given proc and its variables are allocated slots. Return
+ * NULL if the tree contains nodes that can't be compiled
+ */
+struct vmcode *
+vm_compile(struct node *o, struct proc *p)
+{
+	struct vmcode *c;
+	struct name *a;
+
+	c = vm_new();
+	if (p != NULL) {
+		c->proc = 1;
+		for (a = p->args; a != NULL; a = a->next)
+			vm_addslot(c, a->str);
+		c->nargs = c->nslots;
+		vm_scan(c, o);
+	}
+	if (!vm_compstmt(c, o, 0, 1)) {
+		vm_delete(c);
+		return NULL;
+	}
+	vm_emit(c, VM_END);
+	if (vm_debug & 1) {
+		if (p != NULL) {
+			log_puts(p->name.str);
+			log_puts(":\n");
+		}
+		vm_log(c);
+	}
+	return c;
+}
+
+/*
+ * dump the given code on stderr, one instruction per line
+ */
+void
+vm_log(struct vmcode *c)
+{
+	unsigned pc, op, i;
+
+	log_puts("slots:");
+	for (i = 0; i < c->nslots; i++) {
+		log_puts(" ");
+		log_puts(c->slots[i]);
+	}
+	log_puts(", depth ");
+	log_putu(c->depth);
+	log_puts(", stack ");
+	log_putu(c->maxstack);
+	log_puts("\n");
+	for (pc = 0; pc < c->nops; pc += vm_optab[op].nargs + 1) {
+		op = c->ops[pc];
+		log_putu(pc);
+		log_puts("\t");
+		log_puts(vm_optab[op].name);
+		for (i = 0; i < vm_optab[op].nargs; i++) {
+			log_puts(" ");
+			log_putu(c->ops[pc + 1 + i]);
+		}
+		switch (op) {
+		case VM_NUM:
+		case VM_CST:
+		case VM_GET:
+		case VM_SET:
+		case VM_FORGET:
+			log_puts("\t");
+			data_log(c->csts[c->ops[pc + 1]]);
+			break;
+		case VM_LOAD:
+		case VM_STORE:
+		case VM_FORLOAD:
+			log_puts("\t");
+			log_puts(c->slots[c->ops[pc + 1]]);
+			break;
+		case VM_PROC:
+		case VM_CALL:
+		case VM_CALLS:
+			log_puts("\t");
+			log_puts(c->calls[c->ops[pc + 1]].name);
+			break;
+		}
+		log_puts("\n");
+	}
+}
+
+/*
+ * make sure the stack has room for 'n' entries
+ */
+void
+vm_grow(unsigned n)
+{
+	struct vmval *stack;
+
+	if (n <= vm_stacklen)
+		return;
+	vm_stacklen = n > 2 * vm_stacklen ? n : 2 * vm_stacklen;
+	stack = xmalloc(vm_stacklen * sizeof(struct vmval), "vmstack");
+	if (vm_stack) {
+		memcpy(stack, vm_stack, vm_sp * sizeof(struct vmval));
+		xfree(vm_stack);
+	}
+	vm_stack = stack;
+}
+
+/*
+ * find the proc to call, and its number of arguments
+ */
+struct proc *
+vm_lookup(struct exec *x, struct vmcall *k)
+{
+	struct proc *p;
+	struct name *a;
+
+	if (k->proc != NULL && k->gen == x->gen)
+		return k->proc;
+	p = exec_proclookup(x, k->name);
+	if (p == NULL)
+		return NULL;
+	k->nfixed = k->hasva = 0;
+	for (a = p->args; a != NULL; a = a->next) {
+		if (str_eq(a->str, "...")) {
+			k->hasva = 1;
+			break;
+		}
+		k->nfixed++;
+	}
+	k->proc = p;
+	k->gen = x->gen;
+	return p;
+}
+
+/*
+ * move the arguments on the stack into a list of variables, as
+ * builtins and the tree interpreter expect them
+ */
+void
+vm_mklocals(struct proc *p, struct vmval *argv, unsigned argc,
+    struct namelist *locals)
+{
+	struct name *a;
+	struct var *valist;
+	unsigned i;
+
+	valist = NULL;
+	i = 0;
+	for (a = p->args; a != NULL; a = a->next) {
+		if (str_eq(a->str, "...")) {
+			valist = var_new(locals, "...", data_newlist(NULL));
+			break;
+		}
+		var_new(locals, a->str, vm_takedata(argv + i++));
+	}
+	while (i < argc)
+		data_listadd(valist->data, vm_takedata(argv + i++));
+}
+
+unsigned vm_run(struct exec *, struct vmcode *, unsigned, unsigned,
+    struct vmval *);
+
+/*
+ * call the proc of the given call site: the proc is at stack entry
+ * 'argi - 1' and the arguments follow it. The return value is
+ * stored in 'r'. 'depth' is the depth of the calling code
+ */
+unsigned
+vm_call(struct exec *x, struct vmcall *k, unsigned depth, unsigned argi,
+    struct vmval *r)
+{
+	struct proc *p;
+	struct namelist *oldlocals, newlocals;
+	struct data *res;
+	char *procname_save;
+	unsigned result, depth_save, sp_save, i;
+
+	p = vm_stack[argi - 1].ptr;
+	if (k->nfixed > k->argc) {
+		cons_errs(k->name, "to few arguments");
+		return RESULT_ERR;
+	}
+	namelist_init(&newlocals, 0);
+	oldlocals = x->locals;
+	procname_save = x->procname;
+	depth_save = x->depth;
+	sp_save = vm_sp;
+	vm_sp = argi + k->argc;
+	if (p->code->vmt != &node_vmt_builtin && p->vm == NULL && !p->novm) {
+		p->vm = vm_compile(p->code, p);
+		if (p->vm == NULL) {
+			/* don't retry on each call */
+			p->novm = 1;
+			if (vm_debug & 1) {
+				log_puts(p->name.str);
+				log_puts(": not compiled\n");
+			}
+		}
+	}
+	if (p->code->vmt == &node_vmt_builtin) {
+		vm_mklocals(p, vm_stack + argi, k->argc, &newlocals);
+		x->locals = &newlocals;
+		x->procname = p->name.str;
+		x->depth = depth + k->depth + 2;
+		res = NULL;
+		if (!((unsigned (*)(struct exec *, struct data **))
+			p->code->data->val.user)(x, &res)) {
+			if (res)
+				data_delete(res);
+			result = RESULT_ERR;
+		} else if (pool_overflow) {
+			cons_errs(x->procname, "memory limit reached");
+			if (res)
+				data_delete(res);
+			result = RESULT_ERR;
+		} else {
+			vm_setdata(r, res ? res : data_newnil());
+			result = RESULT_OK;
+		}
+	} else if (p->vm == NULL ||
+	    depth + k->depth + 1 + p->vm->depth >= EXEC_MAXDEPTH) {
+		/*
+		 * the nesting limit may be reached, use the tree
+		 * interpreter to fail at the same place
+		 */
+		vm_mklocals(p, vm_stack + argi, k->argc, &newlocals);
+		x->locals = &newlocals;
+		x->procname = p->name.str;
+		x->depth = depth + k->depth + 1;
+		result = node_exec(p->code, x, &res);
+		if (result != RESULT_ERR) {
+			vm_setdata(r, res ? res : data_newnil());
+			if (result != RESULT_EXIT)
+				result = RESULT_OK;
+		}
+	} else {
+		if (k->hasva) {
+			vm_grow(argi + k->nfixed + 1);
+			res = data_newlist(NULL);
+			for (i = k->nfixed; i < k->argc; i++) {
+				data_listadd(res,
+				    vm_takedata(vm_stack + argi + i));
+			}
+			vm_setdata(vm_stack + argi + k->nfixed, res);
+		}
+		x->locals = &newlocals;
+		x->procname = p->name.str;
+		result = vm_run(x, p->vm, depth + k->depth + 1, argi, r);
+		if (result != RESULT_ERR) {
+			if (r->type == VMVAL_NONE)
+				r->type = VMVAL_NIL;
+			if (result != RESULT_EXIT)
+				result = RESULT_OK;
+		}
+	}
+	x->locals = oldlocals;
+	x->procname = procname_save;
+	x->depth = depth_save;
+	vm_sp = sp_save;
+	var_empty(&newlocals);
+	return result;
+}
+
+/*
+ * box both operands, apply the given binary operator and store the
+ * result in the first one
+ */
+unsigned
+vm_binop(struct vmval *op1, struct vmval *op2,
+    unsigned (*func)(struct data *, struct data *))
+{
+	unsigned ok;
+
+	ok = func(vm_box(op1), vm_box(op2));
+	vm_clear(op2);
+	if (!ok)
+		return 0;
+	vm_setdata(op1, op1->data);
+	return 1;
+}
+
+/*
+ * run the given code. The frame starts at stack entry 'fpi' where
+ * the arguments are already stored, they are freed on return. The
+ * value returned by the code is stored in 'r'. 'depth' is the depth
+ * the tree interpreter would be at when running the code
+ */
+unsigned
+vm_run(struct exec *x, struct vmcode *c, unsigned depth, unsigned fpi,
+    struct vmval *r)
+{
+	struct vmval *fp, *sp, *v, sv, ret;
+	struct vmcall *k;
+	struct proc *p;
+	struct var *var;
+	struct data *d, *e, **tail;
+	unsigned *pc, op, result, spi, sp_save, n;
+	long a, b;
+
+	sp_save = vm_sp;
+	vm_sp = fpi + c->nargs;
+	vm_grow(fpi + c->nslots + c->maxstack);
+	fp = vm_stack + fpi;
+	for (v = fp + c->nargs; v < fp + c->nslots; v++)
+		v->type = VMVAL_NONE;
+	sp = fp + c->nslots;
+	sv.type = VMVAL_NONE;
+	r->type = VMVAL_NONE;
+	c->nrun++;
+	pc = c->ops;
+	for (;;) {
+		switch ((op = *pc++)) {
+		case VM_END:
+			*r = sv;
+			sv.type = VMVAL_NONE;
+			result = RESULT_OK;
+			goto done;
+		case VM_NUM:
+			sp->type = VMVAL_LONG;
+			sp->num = c->csts[*pc++]->val.num;
+			sp++;
+			break;
+		case VM_CST:
+			vm_setcopy(sp++, c->csts[*pc++]);
+			break;
+		case VM_LOAD:
+			v = fp + *pc;
+			if (v->type == VMVAL_DATA) {
+				sp->type = VMVAL_DATA;
+				sp->data = data_newnil();
+				data_assign(sp->data, v->data);
+			} else if (v->type != VMVAL_NONE) {
+				*sp = *v;
+			} else {
+				var = exec_varlookup(x, c->slots[*pc]);
+				if (var == NULL) {
+					cons_errss(x->procname, c->slots[*pc],
+					    "no such variable");
+					goto err;
+				}
+				vm_setcopy(sp, var->data);
+			}
+			pc++;
+			sp++;
+			break;
+		case VM_GET:
+			d = c->csts[*pc++];
+			var = exec_varlookup(x, d->val.ref);
+			if (var == NULL) {
+				cons_errss(x->procname, d->val.ref,
+				    "no such variable");
+				goto err;
+			}
+			vm_setcopy(sp++, var->data);
+			break;
+		case VM_STORE:
+			v = fp + *pc;
+			sp--;
+			if (v->type == VMVAL_NONE &&
+			    (var = exec_varlookup(x, c->slots[*pc])) != NULL) {
+				vm_getdata(sp, var->data);
+			} else {
+				vm_clear(v);
+				*v = *sp;
+			}
+			pc++;
+			break;
+		case VM_SET:
+			d = c->csts[*pc++];
+			sp--;
+			var = exec_varlookup(x, d->val.ref);
+			if (var == NULL) {
+				var_new(x->locals, d->val.ref, vm_takedata(sp));
+			} else
+				vm_getdata(sp, var->data);
+			break;
+		case VM_LIST:
+			n = *pc++;
+			d = data_newlist(NULL);
+			tail = &d->val.list;
+			for (v = sp - n; v < sp; v++) {
+				e = vm_takedata(v);
+				e->next = NULL;
+				*tail = e;
+				tail = &e->next;
+			}
+			sp -= n;
+			sp->type = VMVAL_DATA;
+			sp->data = d;
+			sp++;
+			break;
+		case VM_RANGE:
+			if (sp[-2].type != VMVAL_LONG ||
+			    sp[-1].type != VMVAL_LONG) {
+				cons_err("cannot create a range with non integers");
+				goto err;
+			}
+			if (sp[-2].num > sp[-1].num) {
+				cons_err("max > min, cant create a valid range");
+				goto err;
+			}
+			sp--;
+			sp[-1].type = VMVAL_RANGE;
+			sp[-1].min = sp[-1].num;
+			sp[-1].max = sp->num;
+			break;
+		case VM_EQ:
+		case VM_NEQ:
+		case VM_LE:
+		case VM_LT:
+		case VM_GE:
+		case VM_GT:
+		case VM_AND:
+		case VM_OR:
+		case VM_ADD:
+		case VM_SUB:
+		case VM_MUL:
+		case VM_DIV:
+		case VM_MOD:
+		case VM_LSHIFT:
+		case VM_RSHIFT:
+		case VM_BITAND:
+		case VM_BITOR:
+		case VM_BITXOR:
+			sp--;
+			if (sp[-1].type != VMVAL_LONG ||
+			    sp->type != VMVAL_LONG) {
+				if (!vm_binop(sp - 1, sp,
+					vm_binfunc[op - VM_EQ]))
+					goto err;
+				break;
+			}
+			a = sp[-1].num;
+			b = sp->num;
+			switch (op) {
+			case VM_EQ:
+				a = a == b;
+				break;
+			case VM_NEQ:
+				a = a != b;
+				break;
+			case VM_LE:
+				a = a <= b;
+				break;
+			case VM_LT:
+				a = a < b;
+				break;
+			case VM_GE:
+				a = a >= b;
+				break;
+			case VM_GT:
+				a = a > b;
+				break;
+			case VM_AND:
+				a = a != 0 && b != 0;
+				break;
+			case VM_OR:
+				a = a != 0 || b != 0;
+				break;
+			case VM_ADD:
+				a += b;
+				break;
+			case VM_SUB:
+				a -= b;
+				break;
+			case VM_MUL:
+				a *= b;
+				break;
+			case VM_DIV:
+			case VM_MOD:
+				if (b == 0) {
+					cons_err("division by zero");
+					goto err;
+				}
+				if (op == VM_DIV)
+					a /= b;
+				else
+					a %= b;
+				break;
+			case VM_LSHIFT:
+				a <<= b;
+				break;
+			case VM_RSHIFT:
+				a >>= b;
+				break;
+			case VM_BITAND:
+				a &= b;
+				break;
+			case VM_BITOR:
+				a |= b;
+				break;
+			case VM_BITXOR:
+				a ^= b;
+				break;
+			}
+			sp[-1].num = a;
+			break;
+		case VM_NOT:
+			n = vm_eval(sp - 1);
+			vm_clear(sp - 1);
+			sp[-1].type = VMVAL_LONG;
+			sp[-1].num = !n;
+			break;
+		case VM_NEG:
+			if (sp[-1].type == VMVAL_LONG)
+				sp[-1].num = -sp[-1].num;
+			else if (!data_neg(vm_box(sp - 1)))
+				goto err;
+			break;
+		case VM_BITNOT:
+			if (sp[-1].type == VMVAL_LONG)
+				sp[-1].num = ~sp[-1].num;
+			else if (!data_bitnot(vm_box(sp - 1)))
+				goto err;
+			break;
+		case VM_PROC:
+			k = c->calls + *pc++;
+			p = vm_lookup(x, k);
+			if (p == NULL) {
+				cons_errs(k->name, "no such proc");
+				goto err;
+			}
+			if (!k->hasva && k->nfixed == 0 && k->argc > 0) {
+				cons_errs(k->name, "to many arguments");
+				goto err;
+			}
+			sp->type = VMVAL_PROC;
+			sp->ptr = p;
+			sp++;
+			break;
+		case VM_ARG:
+			k = c->calls + pc[0];
+			n = pc[1];
+			pc += 2;
+			if (!k->hasva && k->nfixed == n) {
+				cons_errs(k->name, "to many arguments");
+				goto err;
+			}
+			break;
+		case VM_CALL:
+		case VM_CALLS:
+			k = c->calls + *pc++;
+			spi = sp - vm_stack - k->argc;
+			vm_sp = sp - vm_stack;
+			result = vm_call(x, k, depth, spi, &ret);
+			fp = vm_stack + fpi;
+			if (result == RESULT_ERR) {
+				sp = vm_stack + spi + k->argc;
+				goto err;
+			}
+			sp = vm_stack + spi - 1;
+			if (result == RESULT_EXIT && op == VM_CALLS) {
+				*r = ret;
+				goto done;
+			}
+			*sp++ = ret;
+			break;
+		case VM_POP:
+			vm_clear(--sp);
+			break;
+		case VM_SETSV:
+			vm_clear(&sv);
+			sv = *--sp;
+			break;
+		case VM_CLRSV:
+			vm_clear(&sv);
+			break;
+		case VM_JZ:
+			sp--;
+			n = vm_eval(sp);
+			vm_clear(sp);
+			if (!n)
+				pc = c->ops + *pc;
+			else
+				pc++;
+			break;
+		case VM_JMP:
+			pc = c->ops + *pc;
+			break;
+		case VM_FORLOAD:
+		case VM_FORGET:
+			if (sp[-1].type != VMVAL_DATA ||
+			    sp[-1].data->type != DATA_LIST) {
+				cons_errs(x->procname,
+				    "argument to 'for' must be a list");
+				goto err;
+			}
+			var = NULL;
+			n = 0;
+			if (op == VM_FORLOAD) {
+				n = *pc++;
+				if (fp[n].type == VMVAL_NONE) {
+					var = exec_varlookup(x, c->slots[n]);
+					if (var == NULL)
+						fp[n].type = VMVAL_NIL;
+				}
+			} else {
+				d = c->csts[*pc++];
+				var = exec_varlookup(x, d->val.ref);
+				if (var == NULL) {
+					var = var_new(x->locals, d->val.ref,
+					    data_newnil());
+				}
+			}
+			sp->type = VMVAL_ITER;
+			sp->data = sp[-1].data->val.list;
+			sp->ptr = var;
+			sp->num = n;
+			sp++;
+			break;
+		case VM_NEXT:
+			v = sp - 1;
+			e = v->data;
+			if (e == NULL) {
+				sp -= 2;
+				vm_clear(sp);
+				pc = c->ops + *pc;
+				break;
+			}
+			v->data = e->next;
+			if (v->ptr != NULL) {
+				data_assign(((struct var *)v->ptr)->data, e);
+			} else {
+				vm_clear(fp + v->num);
+				vm_setcopy(fp + v->num, e);
+			}
+			pc++;
+			break;
+		case VM_RET:
+			*r = *--sp;
+			result = RESULT_RETURN;
+			goto done;
+		case VM_EXIT:
+			result = RESULT_EXIT;
+			goto done;
+		default:
+			log_puts("vm_run: bad opcode\n");
+			panic();
+		}
+	}
+err:
+	result = RESULT_ERR;
+done:
+	vm_clear(&sv);
+	while (sp > fp)
+		vm_clear(--sp);
+	c->nrun--;
+	if (c->dead && c->nrun == 0)
+		vm_delete(c);
+	vm_sp = sp_save;
+	return result;
+}
+
+/*
+ * run a top-level statement, same as node_exec()
+ */
+unsigned
+vm_exec(struct exec *x, struct node *o, struct data **r)
+{
+	struct vmcode *c;
+	struct vmval v;
+	unsigned result;
+
+	c = (vm_debug & 2) ? NULL : vm_compile(o, NULL);
+	if (c == NULL || x->depth + c->depth >= EXEC_MAXDEPTH) {
+		if (c)
+			vm_delete(c);
+		return node_exec(o, x, r);
+	}
+	result = vm_run(x, c, x->depth, vm_sp, &v);
+	vm_delete(c);
+	*r = (v.type == VMVAL_NONE) ? NULL : vm_takedata(&v);
+	return result;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2003-2010 Alexandre Ratchov <alex@caoua.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef MIDISH_VM_H
+#define MIDISH_VM_H
+
+struct data;
+struct node;
+struct exec;
+struct proc;
+
+/*
+ * a value on the stack of the virtual machine. Integers and ranges
+ * are kept unboxed, other values are data structures owned by the
+ * stack entry
+ */
+struct vmval {
+#define VMVAL_NONE	0	/* no value, unset local variable */
+#define VMVAL_NIL	1	/* nil */
+#define VMVAL_LONG	2	/* integer in 'num' */
+#define VMVAL_DATA	3	/* data structure in 'data' */
+#define VMVAL_PROC	4	/* proc being called, in 'ptr' */
+#define VMVAL_ITER	5	/* current item of a 'for' loop */
+#define VMVAL_RANGE	6	/* range in 'min' and 'max' */
+	unsigned type;
+	long num;		/* integer, or slot of the loop variable */
+	unsigned min, max;	/* range */
+	struct data *data;	/* boxed value, or current loop item */
+	void *ptr;		/* proc, or variable of the loop */
+};
+
+/*
+ * a call site: the proc is looked up once and cached until the list
+ * of procs changes
+ */
+struct vmcall {
+	char *name;		/* name of the proc to call */
+	unsigned argc;		/* number of arguments passed */
+	unsigned depth;		/* depth of the call node, for EXEC_MAXDEPTH */
+	unsigned gen;		/* exec->gen when the proc was looked up */
+	struct proc *proc;	/* cached proc, NULL if not looked up */
+	unsigned nfixed;	/* number of proc args excluding "..." */
+	unsigned hasva;		/* true if the proc takes "..." */
+};
+
+/*
+ * compiled code of a proc body or of a top-level statement
+ */
+struct vmcode {
+	unsigned *ops;		/* instructions and their operands */
+	unsigned nops, maxops;
+	struct data **csts;	/* constants and variable names */
+	unsigned ncsts, maxcsts;
+	struct vmcall *calls;	/* call sites */
+	unsigned ncalls, maxcalls;
+	char **slots;		/* names of local variables */
+	unsigned nslots, maxslots;
+	unsigned nargs;		/* slots used by arguments */
+	unsigned proc;		/* true for proc bodies */
+	unsigned depth;		/* depth of the deepest node */
+	unsigned nstack;	/* current stack usage, while compiling */
+	unsigned maxstack;	/* max stack usage */
+	unsigned nrun;		/* number of running instances */
+	unsigned dead;		/* delete when last instance returns */
+};
+
+extern unsigned vm_debug;
+
+struct vmcode *vm_compile(struct node *, struct proc *);
+void vm_delete(struct vmcode *);
+void vm_release(struct vmcode *);
+void vm_log(struct vmcode *);
+unsigned vm_exec(struct exec *, struct node *, struct data **);
+
+#endif /* MIDISH_VM_H */